@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    template <typename T>
+    inline void DoNotOptimize(T const& value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    inline void ClobberMemory()
+    {
+        asm volatile("" : : : "memory");
+    }
+
+    struct Options
+    {
+        double minTimeMs = 200.0;   // total measuring time per benchmark
+        unsigned samples = 20;      // number of timed samples, percentiles are computed over them
+    };
+
+    // One benchmark run. A benchmark either hands a body to Run(), which calibrates
+    // the batch size and times `samples` batches, or measures itself and calls Record().
+    class State
+    {
+    public:
+        explicit State(const Options& options) : options(options)
+        {}
+
+        template <typename F>
+        void Run(F&& body)
+        {
+            // calibrate the batch so that one sample lasts minTime / samples
+            auto target = options.minTimeMs * 1e6 / options.samples;
+            uint64_t batch = 1;
+            for (;;)
+            {
+                auto ns = TimeBatch(body, batch);
+                if (ns >= target || batch >= (1ull << 40))
+                    break;
+
+                batch = ns < target / 100 ? batch * 10 : batch * 2;
+            }
+
+            for (unsigned i = 0; i < options.samples; ++i)
+                Record(batch, TimeBatch(body, batch));
+        }
+
+        // Adds one sample of `iterations` operations that took `nanoseconds` in total
+        void Record(uint64_t iterations, double nanoseconds)
+        {
+            totalIterations += iterations;
+            totalNanoseconds += nanoseconds;
+            samples.push_back(nanoseconds / (double)iterations);
+        }
+
+        // Bytes processed by one operation, reported as bytes_per_second
+        void SetBytesPerOp(uint64_t bytes)
+        {
+            bytesPerOp = bytes;
+        }
+
+        // Benchmark specific metric, reported as is
+        void Counter(std::string name, double value)
+        {
+            counters.emplace_back(std::move(name), value);
+        }
+
+        // The benchmark cannot run here (no AES-NI, a file system of /tmp without holes...)
+        void Skip(std::string reason)
+        {
+            skipped = std::move(reason);
+        }
+
+        // A correctness check of the benchmark failed: kbench reports it and exits with an error
+        void Fail(std::string reason)
+        {
+            failed = std::move(reason);
+        }
+
+        [[nodiscard]] auto Failed() const -> bool
+        {
+            return !failed.empty();
+        }
+
+        [[nodiscard]] auto GetOptions() const -> const Options&
+        {
+            return options;
+        }
+
+    private:
+        template <typename F>
+        static auto TimeBatch(F& body, uint64_t batch) -> double
+        {
+            auto start = Clock::now();
+            for (uint64_t i = 0; i < batch; ++i)
+                body();
+
+            return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        }
+
+        friend class Runner;
+
+        const Options& options;
+        uint64_t totalIterations = 0;
+        double totalNanoseconds = 0;
+        uint64_t bytesPerOp = 0;
+        std::vector<double> samples;
+        std::vector<std::pair<std::string, double>> counters;
+        std::string skipped;
+        std::string failed;
+    };
+
+    // A correctness check returns what is wrong, or null
+    using Check = const char* (*)();
+
+    // Runs the checks of a benchmark before it is measured, the first failure fails the benchmark
+    inline auto Verify(State& state, std::initializer_list<Check> checks) -> bool
+    {
+        for (auto check : checks)
+        {
+            if (const char* error = check())
+            {
+                state.Fail(error);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    using Function = void (*)(State&);
+
+    struct Benchmark
+    {
+        const char* name;
+        Function function;
+    };
+
+    inline auto Registry() -> std::vector<Benchmark>&
+    {
+        static std::vector<Benchmark> benchmarks;
+        return benchmarks;
+    }
+
+    struct Registration
+    {
+        Registration(const char* name, Function function)
+        {
+            Registry().push_back({ name, function });
+        }
+    };
+}
+
+#define BENCHMARK(Function, Name) \
+    static void Function(bench::State&); \
+    static bench::Registration Function##Registration(Name, Function); \
+    static void Function(bench::State& state)
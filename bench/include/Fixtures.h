@@ -0,0 +1,72 @@
+#pragma once
+
+#include "kl.h"
+
+#include <cstdlib>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Fixtures shared by the benchmarks
+namespace bench
+{
+    // A UNICODE_STRING over its own copy of the text, as the driver gets names
+    struct Name
+    {
+        std::wstring Text;
+        UNICODE_STRING String;
+
+        explicit Name(std::wstring text) : Text(std::move(text))
+        {
+            String.Buffer = Text.data();
+            String.Length = (USHORT)(Text.size() * sizeof(WCHAR));
+            String.MaximumLength = String.Length;
+        }
+
+        Name(const Name& other) : Name(other.Text)
+        {}
+
+        auto operator=(const Name&) -> Name& = delete;
+    };
+
+    // A file under /tmp, removed with the fixture; Fd is -1 when it cannot be created
+    struct TempFile
+    {
+        std::string Path;
+        int Fd;
+
+        explicit TempFile(const char* prefix) : Path(std::string("/tmp/kbench-") + prefix + "-XXXXXX"), Fd(mkstemp(Path.data()))
+        {}
+
+        TempFile(const TempFile&) = delete;
+        auto operator=(const TempFile&) -> TempFile& = delete;
+
+        ~TempFile()
+        {
+            if (Fd >= 0)
+            {
+                close(Fd);
+                unlink(Path.c_str());
+            }
+        }
+
+        // Bytes allocated on disk, a sparse file does not count its holes
+        [[nodiscard]] auto DiskBytes() const -> ULONGLONG
+        {
+            struct stat info;
+            return fstat(Fd, &info) == 0 ? (ULONGLONG)info.st_blocks * 512 : 0;
+        }
+
+        // Extents of the file once written back, FIEMAP_FLAG_SYNC flushes it first
+        [[nodiscard]] auto Extents() const -> long
+        {
+            struct fiemap map = {};
+            map.fm_length = FIEMAP_MAX_OFFSET;
+            map.fm_flags = FIEMAP_FLAG_SYNC;
+            return ioctl(Fd, FS_IOC_FIEMAP, &map) == 0 ? (long)map.fm_mapped_extents : -1;
+        }
+    };
+}
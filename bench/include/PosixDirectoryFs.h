@@ -0,0 +1,110 @@
+#pragma once
+
+#include "DirectoryWalker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Driver path (`\tmp\tree\file`, ASCII names) to a POSIX one
+inline auto PosixPath(PCUNICODE_STRING path) -> std::string
+{
+    std::string result;
+    for (size_t i = 0; i < path->Length / sizeof(WCHAR); ++i)
+        result += path->Buffer[i] == L'\\' ? '/' : (char)path->Buffer[i];
+    return result;
+}
+
+// 100ns units, as the LastWriteTime of a directory entry
+inline auto FileTime(const timespec& time) -> LONGLONG
+{
+    return (LONGLONG)time.tv_sec * 10000000 + time.tv_nsec / 100;
+}
+
+// Fs policy of the walker (DirectoryWalker.h) over POSIX directories. A directory is read whole
+// when opened and enumerated as NTFS does it: "." and "..", then the names in case insensitive
+// order; symbolic links stand for the reparse points, they are not reported.
+struct PosixDirectoryFs
+{
+    struct Entry
+    {
+        std::wstring Name;
+        bool Directory;
+        ULONGLONG Size;
+        LONGLONG LastWriteTime;
+    };
+
+    struct Listing
+    {
+        std::vector<Entry> Entries;
+        size_t Next = 0;
+    };
+
+    using Directory = Listing*;
+
+    ULONG Opened = 0;
+
+    NTSTATUS Open(PCUNICODE_STRING path, Directory* directory)
+    {
+        auto fd = open(PosixPath(path).c_str(), O_RDONLY | O_DIRECTORY);
+        auto handle = fd >= 0 ? fdopendir(fd) : nullptr;
+        if (!handle)
+        {
+            if (fd >= 0)
+                close(fd);
+            return STATUS_OBJECT_PATH_NOT_FOUND;
+        }
+
+        auto listing = new Listing;
+        std::vector<Entry> names;
+        while (auto entry = readdir(handle))
+        {
+            struct stat info;
+            if (fstatat(fd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0 || S_ISLNK(info.st_mode))
+                continue;
+
+            std::wstring name(entry->d_name, entry->d_name + strlen(entry->d_name));
+            Entry item{ name, S_ISDIR(info.st_mode), (ULONGLONG)info.st_size, FileTime(info.st_mtim) };
+            if (name == L"." || name == L"..")
+                listing->Entries.push_back(item);
+            else
+                names.push_back(item);
+        }
+
+        closedir(handle);
+        std::sort(listing->Entries.begin(), listing->Entries.end(), [](const Entry& a, const Entry& b) { return a.Name.size() < b.Name.size(); });
+        std::sort(names.begin(), names.end(), [](const Entry& a, const Entry& b) {
+            return std::lexicographical_compare(a.Name.begin(), a.Name.end(), b.Name.begin(), b.Name.end(),
+                [](WCHAR x, WCHAR y) { return RtlUpcaseUnicodeChar(x) < RtlUpcaseUnicodeChar(y); });
+        });
+        listing->Entries.insert(listing->Entries.end(), names.begin(), names.end());
+        *directory = listing;
+        ++Opened;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Read(Directory directory, DirectoryEntry* entry)
+    {
+        if (directory->Next == directory->Entries.size())
+            return STATUS_NO_MORE_FILES;
+
+        auto& item = directory->Entries[directory->Next++];
+        entry->Name.Buffer = item.Name.data();
+        entry->Name.Length = (USHORT)(item.Name.size() * sizeof(WCHAR));
+        entry->Name.MaximumLength = entry->Name.Length;
+        entry->Directory = item.Directory;
+        entry->Size = item.Size;
+        entry->LastWriteTime = item.LastWriteTime;
+        return STATUS_SUCCESS;
+    }
+
+    void Close(Directory directory)
+    {
+        delete directory;
+    }
+};
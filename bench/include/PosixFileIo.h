@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CopyEngine.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Io policy of the copy engine (CopyEngine.h) over POSIX file descriptors.
+// Allocated ranges come from SEEK_DATA / SEEK_HOLE, and a Linux file is sparse by
+// default: skipping the writes of a hole is enough to keep it. The allocation of the
+// target is reserved with fallocate, the FileAllocationInformation of the driver.
+struct PosixFileIo
+{
+    int Source;
+    int Target;
+
+    NTSTATUS QueryRanges(ULONGLONG offset, ULONGLONG length, FileRange* ranges, ULONG capacity, ULONG* count, bool* more)
+    {
+        *count = 0;
+        *more = false;
+        auto end = offset + length;
+        auto position = (off_t)offset;
+        while ((ULONGLONG)position < end)
+        {
+            auto data = lseek(Source, position, SEEK_DATA);
+            if (data < 0)
+            {
+                // ENXIO: no data after position
+                if (errno == ENXIO)
+                    return STATUS_SUCCESS;
+
+                if (errno != EINVAL)
+                    return STATUS_UNSUCCESSFUL;
+
+                // no SEEK_DATA support, everything is allocated
+                ranges[0] = { offset, length };
+                *count = 1;
+                return STATUS_SUCCESS;
+            }
+
+            if ((ULONGLONG)data >= end)
+                return STATUS_SUCCESS;
+
+            if (*count == capacity)
+            {
+                *more = true;
+                return STATUS_SUCCESS;
+            }
+
+            auto hole = lseek(Source, data, SEEK_HOLE);
+            if (hole < 0)
+                return STATUS_UNSUCCESSFUL;
+
+            ranges[(*count)++] = { (ULONGLONG)data, (ULONGLONG)(hole - data) };
+            position = hole;
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Read(ULONGLONG offset, UCHAR* buffer, ULONG size, ULONG* bytes)
+    {
+        auto read = pread(Source, buffer, size, (off_t)offset);
+        *bytes = read > 0 ? (ULONG)read : 0;
+        return read < 0 ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+    }
+
+    NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size)
+    {
+        auto written = pwrite(Target, buffer, size, (off_t)offset);
+        return written == (ssize_t)size ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+    }
+
+    NTSTATUS SetSparse()
+    {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS SetEndOfFile(ULONGLONG size)
+    {
+        return ftruncate(Target, (off_t)size) == 0 ? STATUS_SUCCESS : STATUS_UNSUCCESSFUL;
+    }
+
+    NTSTATUS Reserve(ULONGLONG size)
+    {
+        // mode 0 allocates unwritten extents and moves the end of file
+        if (fallocate(Target, 0, 0, (off_t)size) == 0)
+            return STATUS_SUCCESS;
+
+        return errno == EOPNOTSUPP ? STATUS_NOT_SUPPORTED : errno == ENOSPC ? STATUS_DISK_FULL : STATUS_UNSUCCESSFUL;
+    }
+};
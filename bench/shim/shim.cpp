@@ -0,0 +1,836 @@
+#include "fltKernel.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+// Futex helpers
+//
+
+static void FutexWait(volatile LONG* address, LONG expected)
+{
+    syscall(SYS_futex, (LONG*)address, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static void FutexWake(volatile LONG* address, int count)
+{
+    syscall(SYS_futex, (LONG*)address, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+static auto CompareExchange(volatile LONG* address, LONG expected, LONG desired) -> LONG
+{
+    __atomic_compare_exchange_n(address, &expected, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+// Three-state futex mutex: 0 free, 1 owned, 2 owned with (possible) waiters.
+static void FutexLock(volatile LONG* state)
+{
+    auto c = CompareExchange(state, 0, 1);
+    if (c == 0)
+        return;
+
+    if (c != 2)
+        c = __atomic_exchange_n(state, 2, __ATOMIC_ACQUIRE);
+
+    while (c != 0)
+    {
+        FutexWait(state, 2);
+        c = __atomic_exchange_n(state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static auto FutexTryLock(volatile LONG* state) -> bool
+{
+    return CompareExchange(state, 0, 1) == 0;
+}
+
+static void FutexUnlock(volatile LONG* state)
+{
+    if (__atomic_fetch_sub(state, 1, __ATOMIC_RELEASE) != 1)
+    {
+        __atomic_store_n(state, 0, __ATOMIC_RELEASE);
+        FutexWake(state, 1);
+    }
+}
+
+static auto CurrentThreadId() -> LONG
+{
+    static thread_local LONG tid = (LONG)syscall(SYS_gettid);
+    return tid;
+}
+
+//
+// Strings
+//
+
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString)
+{
+    auto length = SourceString ? wcslen(SourceString) * sizeof(WCHAR) : 0;
+    DestinationString->Length = (USHORT)length;
+    DestinationString->MaximumLength = (USHORT)(SourceString ? length + sizeof(WCHAR) : 0);
+    DestinationString->Buffer = const_cast<PWCH>(SourceString);
+}
+
+VOID RtlCopyUnicodeString(PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString)
+{
+    if (!SourceString)
+    {
+        DestinationString->Length = 0;
+        return;
+    }
+
+    auto length = std::min(DestinationString->MaximumLength, SourceString->Length);
+    RtlMoveMemory(DestinationString->Buffer, SourceString->Buffer, length);
+    DestinationString->Length = length;
+    if (length + sizeof(WCHAR) <= DestinationString->MaximumLength)
+        DestinationString->Buffer[length / sizeof(WCHAR)] = L'\0';
+}
+
+NTSTATUS RtlAppendUnicodeToString(PUNICODE_STRING Destination, PCWSTR Source)
+{
+    auto length = wcslen(Source) * sizeof(WCHAR);
+    if (Destination->Length + length > Destination->MaximumLength)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlMoveMemory((UCHAR*)Destination->Buffer + Destination->Length, Source, length);
+    Destination->Length += (USHORT)length;
+    if (Destination->Length + sizeof(WCHAR) <= Destination->MaximumLength)
+        Destination->Buffer[Destination->Length / sizeof(WCHAR)] = L'\0';
+
+    return STATUS_SUCCESS;
+}
+
+WCHAR RtlUpcaseUnicodeChar(WCHAR SourceCharacter)
+{
+    return (WCHAR)towupper(SourceCharacter);
+}
+
+BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive)
+{
+    if (String1->Length != String2->Length)
+        return FALSE;
+
+    for (USHORT i = 0; i < String1->Length / sizeof(WCHAR); ++i)
+    {
+        auto a = String1->Buffer[i];
+        auto b = String2->Buffer[i];
+        if (a != b && (!CaseInSensitive || RtlUpcaseUnicodeChar(a) != RtlUpcaseUnicodeChar(b)))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+LONG RtlCompareUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive)
+{
+    auto length1 = String1->Length / sizeof(WCHAR);
+    auto length2 = String2->Length / sizeof(WCHAR);
+    for (size_t i = 0; i < length1 && i < length2; ++i)
+    {
+        auto a = String1->Buffer[i];
+        auto b = String2->Buffer[i];
+        if (CaseInSensitive)
+        {
+            a = RtlUpcaseUnicodeChar(a);
+            b = RtlUpcaseUnicodeChar(b);
+        }
+
+        if (a != b)
+            return (LONG)a - (LONG)b;
+    }
+
+    return (LONG)length1 - (LONG)length2;
+}
+
+int wcsncpy_s(WCHAR* dest, size_t destsz, const WCHAR* src, size_t count)
+{
+    if (!dest || destsz == 0)
+        return 22; // EINVAL
+
+    size_t i = 0;
+    for (; i < count && src[i] != L'\0'; ++i)
+    {
+        if (i + 1 >= destsz)
+        {
+            dest[0] = L'\0';
+            return 34; // ERANGE
+        }
+
+        dest[i] = src[i];
+    }
+
+    dest[i] = L'\0';
+    return 0;
+}
+
+WCHAR* _wcslwr(WCHAR* str)
+{
+    for (auto p = str; *p; ++p)
+        *p = (WCHAR)towlower(*p);
+
+    return str;
+}
+
+//
+// Processors and time
+//
+
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber)
+{
+    auto cpu = sched_getcpu();
+    if (cpu < 0)
+        cpu = 0;
+
+    if (ProcNumber)
+    {
+        ProcNumber->Group = (USHORT)(cpu / 64);
+        ProcNumber->Number = (UCHAR)(cpu % 64);
+        ProcNumber->Reserved = 0;
+    }
+
+    return (ULONG)cpu;
+}
+
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber)
+{
+    UNREFERENCED_PARAMETER(GroupNumber);
+    auto count = sysconf(_SC_NPROCESSORS_CONF);
+    return count > 0 ? (ULONG)count : 1;
+}
+
+ULONGLONG KeQueryInterruptTime()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONGLONG)now.tv_sec * 10000000ull + (ULONGLONG)now.tv_nsec / 100;
+}
+
+ULONGLONG KeQueryInterruptTimePrecise(PULONGLONG QpcTimeStamp)
+{
+    auto time = KeQueryInterruptTime();
+    *QpcTimeStamp = time;
+    return time;
+}
+
+//
+// Pool
+//
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+    return aligned_alloc(MEMORY_ALLOCATION_ALIGNMENT, (NumberOfBytes + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~(SIZE_T)(MEMORY_ALLOCATION_ALIGNMENT - 1));
+}
+
+VOID ExFreePool(PVOID P)
+{
+    free(P);
+}
+
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(Tag);
+    free(P);
+}
+
+//
+// IRQL
+//
+
+static thread_local KIRQL g_irql = PASSIVE_LEVEL;
+static thread_local LONG g_criticalRegion = 0;
+
+KIRQL KeGetCurrentIrql()
+{
+    return g_irql;
+}
+
+VOID KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql)
+{
+    *OldIrql = g_irql;
+    g_irql = NewIrql;
+}
+
+VOID KeLowerIrql(KIRQL NewIrql)
+{
+    g_irql = NewIrql;
+}
+
+VOID KeEnterCriticalRegion()
+{
+    ++g_criticalRegion;
+}
+
+VOID KeLeaveCriticalRegion()
+{
+    --g_criticalRegion;
+}
+
+//
+// Mutex objects
+//
+
+VOID KeInitializeMutex(PRKMUTEX Mutex, ULONG Level)
+{
+    UNREFERENCED_PARAMETER(Level);
+    Mutex->Header.Type = MutantObject;
+    Mutex->Header.SignalState = 1;
+    Mutex->State = 0;
+    Mutex->Owner = 0;
+    Mutex->Recursion = 0;
+}
+
+LONG KeReleaseMutex(PRKMUTEX Mutex, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Wait);
+    if (--Mutex->Recursion > 0)
+        return 0;
+
+    __atomic_store_n(&Mutex->Owner, 0, __ATOMIC_RELAXED);
+    FutexUnlock(&Mutex->State);
+    return 0;
+}
+
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State)
+{
+    Event->Header.Type = Type == NotificationEvent ? EventNotificationObject : EventSynchronizationObject;
+    Event->Header.SignalState = State ? 1 : 0;
+}
+
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Increment);
+    UNREFERENCED_PARAMETER(Wait);
+    auto previous = __atomic_exchange_n(&Event->Header.SignalState, 1, __ATOMIC_RELEASE);
+    FutexWake(&Event->Header.SignalState, Event->Header.Type == EventNotificationObject ? INT32_MAX : 1);
+    return previous;
+}
+
+VOID KeClearEvent(PRKEVENT Event)
+{
+    __atomic_store_n(&Event->Header.SignalState, 0, __ATOMIC_RELAXED);
+}
+
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout)
+{
+    UNREFERENCED_PARAMETER(WaitReason);
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+    UNREFERENCED_PARAMETER(Timeout);
+
+    auto header = (DISPATCHER_HEADER*)Object;
+    if (header->Type == EventNotificationObject || header->Type == EventSynchronizationObject)
+    {
+        for (;;)
+        {
+            // a synchronization event is reset by the waiter it releases
+            auto state = __atomic_load_n(&header->SignalState, __ATOMIC_ACQUIRE);
+            if (state != 0 && (header->Type == EventNotificationObject || CompareExchange(&header->SignalState, state, 0) == state))
+                return STATUS_SUCCESS;
+
+            if (state == 0)
+                FutexWait(&header->SignalState, 0);
+        }
+    }
+
+    if (header->Type != MutantObject)
+        return STATUS_INVALID_PARAMETER;
+
+    auto mutex = (PRKMUTEX)Object;
+    auto self = CurrentThreadId();
+    if (__atomic_load_n(&mutex->Owner, __ATOMIC_RELAXED) == self)
+    {
+        ++mutex->Recursion;
+        return STATUS_SUCCESS;
+    }
+
+    FutexLock(&mutex->State);
+    __atomic_store_n(&mutex->Owner, self, __ATOMIC_RELAXED);
+    mutex->Recursion = 1;
+    return STATUS_SUCCESS;
+}
+
+//
+// Fast and guarded mutexes
+//
+
+VOID ExInitializeFastMutex(PFAST_MUTEX FastMutex)
+{
+    FastMutex->State = 0;
+    FastMutex->OldIrql = PASSIVE_LEVEL;
+}
+
+VOID ExAcquireFastMutex(PFAST_MUTEX FastMutex)
+{
+    KIRQL oldIrql;
+    KeRaiseIrql(APC_LEVEL, &oldIrql);
+    FutexLock(&FastMutex->State);
+    FastMutex->OldIrql = oldIrql;
+}
+
+BOOLEAN ExTryToAcquireFastMutex(PFAST_MUTEX FastMutex)
+{
+    KIRQL oldIrql;
+    KeRaiseIrql(APC_LEVEL, &oldIrql);
+    if (!FutexTryLock(&FastMutex->State))
+    {
+        KeLowerIrql(oldIrql);
+        return FALSE;
+    }
+
+    FastMutex->OldIrql = oldIrql;
+    return TRUE;
+}
+
+VOID ExReleaseFastMutex(PFAST_MUTEX FastMutex)
+{
+    auto oldIrql = FastMutex->OldIrql;
+    FutexUnlock(&FastMutex->State);
+    KeLowerIrql(oldIrql);
+}
+
+VOID KeInitializeGuardedMutex(PKGUARDED_MUTEX Mutex)
+{
+    ExInitializeFastMutex(Mutex);
+}
+
+VOID KeAcquireGuardedMutex(PKGUARDED_MUTEX Mutex)
+{
+    KeEnterCriticalRegion();
+    FutexLock(&Mutex->State);
+}
+
+BOOLEAN KeTryToAcquireGuardedMutex(PKGUARDED_MUTEX Mutex)
+{
+    KeEnterCriticalRegion();
+    if (FutexTryLock(&Mutex->State))
+        return TRUE;
+
+    KeLeaveCriticalRegion();
+    return FALSE;
+}
+
+VOID KeReleaseGuardedMutex(PKGUARDED_MUTEX Mutex)
+{
+    FutexUnlock(&Mutex->State);
+    KeLeaveCriticalRegion();
+}
+
+//
+// Spin locks
+//
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock)
+{
+    *SpinLock = 0;
+}
+
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    while (__atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE) != 0)
+    {
+        while (__atomic_load_n(SpinLock, __ATOMIC_RELAXED) != 0)
+            __builtin_ia32_pause();
+    }
+}
+
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock)
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql)
+{
+    // the previous IRQL is only written once the lock is owned
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+    *OldIrql = oldIrql;
+}
+
+VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql)
+{
+    KeReleaseSpinLockFromDpcLevel(SpinLock);
+    KeLowerIrql(NewIrql);
+}
+
+VOID KeAcquireInStackQueuedSpinLock(PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KIRQL oldIrql;
+    KeAcquireSpinLock(SpinLock, &oldIrql);
+    LockHandle->Lock = SpinLock;
+    LockHandle->OldIrql = oldIrql;
+}
+
+VOID KeReleaseInStackQueuedSpinLock(PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KeReleaseSpinLock(LockHandle->Lock, LockHandle->OldIrql);
+}
+
+VOID KeAcquireInStackQueuedSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KeAcquireSpinLockAtDpcLevel(SpinLock);
+    LockHandle->Lock = SpinLock;
+}
+
+VOID KeReleaseInStackQueuedSpinLockFromDpcLevel(PKLOCK_QUEUE_HANDLE LockHandle)
+{
+    KeReleaseSpinLockFromDpcLevel(LockHandle->Lock);
+}
+
+//
+// Push locks: a futex reader/writer word. Readers take the lock whenever no writer owns it, waiters
+// of both kinds set PushLockWaiters and sleep on the word, the release that frees it wakes them all.
+//
+
+static constexpr LONG PushLockExclusive = 0x40000000;
+static constexpr LONG PushLockWaiters = (LONG)0x80000000;
+
+// Sleeps until the word changes, unless it already did
+static void PushLockWait(PEX_PUSH_LOCK PushLock, LONG state)
+{
+    if ((state & PushLockWaiters) || CompareExchange(&PushLock->State, state, state | PushLockWaiters) == state)
+        FutexWait(&PushLock->State, state | PushLockWaiters);
+}
+
+VOID ExInitializePushLock(PEX_PUSH_LOCK PushLock)
+{
+    PushLock->State = 0;
+}
+
+VOID ExAcquirePushLockExclusiveEx(PEX_PUSH_LOCK PushLock, ULONG Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+    for (;;)
+    {
+        // the waiters bit is kept, the release wakes the others
+        auto state = __atomic_load_n(&PushLock->State, __ATOMIC_RELAXED);
+        if ((state & ~PushLockWaiters) == 0)
+        {
+            if (CompareExchange(&PushLock->State, state, state | PushLockExclusive) == state)
+                return;
+
+            continue;
+        }
+
+        PushLockWait(PushLock, state);
+    }
+}
+
+VOID ExAcquirePushLockSharedEx(PEX_PUSH_LOCK PushLock, ULONG Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+    for (;;)
+    {
+        auto state = __atomic_load_n(&PushLock->State, __ATOMIC_RELAXED);
+        if (!(state & PushLockExclusive))
+        {
+            if (CompareExchange(&PushLock->State, state, state + 1) == state)
+                return;
+
+            continue;
+        }
+
+        PushLockWait(PushLock, state);
+    }
+}
+
+VOID ExReleasePushLockExclusiveEx(PEX_PUSH_LOCK PushLock, ULONG Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+    if (__atomic_exchange_n(&PushLock->State, 0, __ATOMIC_RELEASE) & PushLockWaiters)
+        FutexWake(&PushLock->State, INT32_MAX);
+}
+
+VOID ExReleasePushLockSharedEx(PEX_PUSH_LOCK PushLock, ULONG Flags)
+{
+    UNREFERENCED_PARAMETER(Flags);
+    // only writers wait on a lock owned shared
+    if (__atomic_sub_fetch(&PushLock->State, 1, __ATOMIC_RELEASE) == PushLockWaiters
+        && CompareExchange(&PushLock->State, PushLockWaiters, 0) == PushLockWaiters)
+        FutexWake(&PushLock->State, INT32_MAX);
+}
+
+//
+// Reader/writer spin locks: an exclusive acquirer sets the high bit, which stops new readers,
+// then spins until the readers already in leave
+//
+
+static constexpr LONG SpinLockExclusive = (LONG)0x80000000;
+
+VOID ExAcquireSpinLockExclusiveAtDpcLevel(PEX_SPIN_LOCK SpinLock)
+{
+    for (;;)
+    {
+        auto state = __atomic_load_n(SpinLock, __ATOMIC_RELAXED);
+        if (!(state & SpinLockExclusive) && CompareExchange(SpinLock, state, state | SpinLockExclusive) == state)
+            break;
+
+        __builtin_ia32_pause();
+    }
+
+    while (__atomic_load_n(SpinLock, __ATOMIC_ACQUIRE) != SpinLockExclusive)
+        __builtin_ia32_pause();
+}
+
+VOID ExReleaseSpinLockExclusiveFromDpcLevel(PEX_SPIN_LOCK SpinLock)
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+VOID ExAcquireSpinLockSharedAtDpcLevel(PEX_SPIN_LOCK SpinLock)
+{
+    for (;;)
+    {
+        auto state = __atomic_load_n(SpinLock, __ATOMIC_RELAXED);
+        if (!(state & SpinLockExclusive) && CompareExchange(SpinLock, state, state + 1) == state)
+            return;
+
+        __builtin_ia32_pause();
+    }
+}
+
+VOID ExReleaseSpinLockSharedFromDpcLevel(PEX_SPIN_LOCK SpinLock)
+{
+    __atomic_sub_fetch(SpinLock, 1, __ATOMIC_RELEASE);
+}
+
+KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK SpinLock)
+{
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    ExAcquireSpinLockExclusiveAtDpcLevel(SpinLock);
+    return oldIrql;
+}
+
+VOID ExReleaseSpinLockExclusive(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql)
+{
+    ExReleaseSpinLockExclusiveFromDpcLevel(SpinLock);
+    KeLowerIrql(OldIrql);
+}
+
+KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK SpinLock)
+{
+    KIRQL oldIrql;
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+    ExAcquireSpinLockSharedAtDpcLevel(SpinLock);
+    return oldIrql;
+}
+
+VOID ExReleaseSpinLockShared(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql)
+{
+    ExReleaseSpinLockSharedFromDpcLevel(SpinLock);
+    KeLowerIrql(OldIrql);
+}
+
+//
+// Rundown protection: the references count in steps of 2, the waiter sets the low bit, which stops
+// new references, and sleeps on the word until the last reference is released
+//
+
+VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    RunRef->Count = 0;
+}
+
+VOID ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    __atomic_store_n(&RunRef->Count, 0, __ATOMIC_RELEASE);
+}
+
+BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    for (;;)
+    {
+        auto count = __atomic_load_n(&RunRef->Count, __ATOMIC_RELAXED);
+        if (count & 1)
+            return FALSE;
+
+        if (CompareExchange(&RunRef->Count, count, count + 2) == count)
+            return TRUE;
+    }
+}
+
+VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef)
+{
+    if (__atomic_sub_fetch(&RunRef->Count, 2, __ATOMIC_RELEASE) == 1)
+        FutexWake(&RunRef->Count, INT32_MAX);
+}
+
+VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef)
+{
+    auto count = __atomic_or_fetch(&RunRef->Count, 1, __ATOMIC_SEQ_CST);
+    while (count != 1)
+    {
+        FutexWait(&RunRef->Count, count);
+        count = __atomic_load_n(&RunRef->Count, __ATOMIC_ACQUIRE);
+    }
+}
+
+//
+// Executive resources
+//
+
+NTSTATUS ExInitializeResourceLite(PERESOURCE Resource)
+{
+    Resource->State = 0;
+    Resource->Waiters = 0;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS ExReinitializeResourceLite(PERESOURCE Resource)
+{
+    return ExInitializeResourceLite(Resource);
+}
+
+NTSTATUS ExDeleteResourceLite(PERESOURCE Resource)
+{
+    UNREFERENCED_PARAMETER(Resource);
+    return STATUS_SUCCESS;
+}
+
+static auto AcquireResource(PERESOURCE Resource, BOOLEAN Wait, bool exclusive) -> BOOLEAN
+{
+    for (;;)
+    {
+        auto state = __atomic_load_n(&Resource->State, __ATOMIC_RELAXED);
+        auto available = exclusive ? state == 0 : state >= 0;
+        if (available)
+        {
+            if (CompareExchange(&Resource->State, state, exclusive ? -1 : state + 1) == state)
+                return TRUE;
+
+            continue;
+        }
+
+        if (!Wait)
+            return FALSE;
+
+        __atomic_fetch_add(&Resource->Waiters, 1, __ATOMIC_RELAXED);
+        FutexWait(&Resource->State, state);
+        __atomic_fetch_sub(&Resource->Waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+BOOLEAN ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+    return AcquireResource(Resource, Wait, true);
+}
+
+BOOLEAN ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait)
+{
+    return AcquireResource(Resource, Wait, false);
+}
+
+VOID ExReleaseResourceLite(PERESOURCE Resource)
+{
+    LONG state;
+    if (__atomic_load_n(&Resource->State, __ATOMIC_RELAXED) < 0)
+        state = 0, __atomic_store_n(&Resource->State, 0, __ATOMIC_RELEASE);
+    else
+        state = __atomic_sub_fetch(&Resource->State, 1, __ATOMIC_RELEASE);
+
+    if (state == 0 && __atomic_load_n(&Resource->Waiters, __ATOMIC_SEQ_CST) > 0)
+        FutexWake(&Resource->State, INT32_MAX);
+}
+
+//
+// File name information
+//
+
+static void SetSubString(PUNICODE_STRING out, PUNICODE_STRING name, size_t begin, size_t end)
+{
+    out->Buffer = name->Buffer + begin;
+    out->Length = (USHORT)((end - begin) * sizeof(WCHAR));
+    out->MaximumLength = out->Length;
+}
+
+NTSTATUS FltGetFileNameInformation(PFLT_CALLBACK_DATA CallbackData, FLT_FILE_NAME_OPTIONS NameOptions, PFLT_FILE_NAME_INFORMATION* FileNameInformation)
+{
+    *FileNameInformation = nullptr;
+    const auto& source = CallbackData->ShimFileName;
+    if (!source.Buffer || source.Length == 0)
+        return STATUS_OBJECT_NAME_INVALID;
+
+    // a single allocation holds the structure and its copy of the name, as the filter manager does
+    auto info = (PFLT_FILE_NAME_INFORMATION)ExAllocatePoolWithTag(PagedPool, sizeof(FLT_FILE_NAME_INFORMATION) + source.Length, 'nFlF');
+    if (!info)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(info, sizeof(*info));
+    info->Size = sizeof(*info);
+    info->Format = NameOptions & 0xff;
+    info->Name.Buffer = (PWCH)(info + 1);
+    info->Name.Length = source.Length;
+    info->Name.MaximumLength = source.Length;
+    RtlCopyMemory(info->Name.Buffer, source.Buffer, source.Length);
+    *FileNameInformation = info;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FltParseFileNameInformation(PFLT_FILE_NAME_INFORMATION FileNameInformation)
+{
+    // \Device\HarddiskVolume1\ParentDir\FinalComponent.Extension:Stream
+    auto name = &FileNameInformation->Name;
+    auto buffer = name->Buffer;
+    size_t length = name->Length / sizeof(WCHAR);
+    if (length < 2 || buffer[0] != L'\\')
+        return STATUS_OBJECT_NAME_INVALID;
+
+    // the volume is the first two components
+    size_t volumeEnd = 1;
+    for (int separators = 0; volumeEnd < length; ++volumeEnd)
+    {
+        if (buffer[volumeEnd] == L'\\' && ++separators == 2)
+            break;
+    }
+
+    size_t lastSeparator = volumeEnd;
+    for (auto i = volumeEnd; i < length; ++i)
+    {
+        if (buffer[i] == L'\\')
+            lastSeparator = i;
+    }
+
+    size_t streamBegin = length;
+    for (auto i = lastSeparator + 1; i < length; ++i)
+    {
+        if (buffer[i] == L':')
+        {
+            streamBegin = i;
+            break;
+        }
+    }
+
+    size_t extensionBegin = streamBegin;
+    for (auto i = streamBegin; i > lastSeparator + 1; --i)
+    {
+        if (buffer[i - 1] == L'.')
+        {
+            extensionBegin = i;
+            break;
+        }
+    }
+
+    SetSubString(&FileNameInformation->Volume, name, 0, volumeEnd);
+    SetSubString(&FileNameInformation->Share, name, 0, 0);
+    SetSubString(&FileNameInformation->ParentDir, name, volumeEnd, std::min(lastSeparator + 1, length));
+    SetSubString(&FileNameInformation->FinalComponent, name, std::min(lastSeparator + 1, length), length);
+    SetSubString(&FileNameInformation->Extension, name, extensionBegin, streamBegin);
+    SetSubString(&FileNameInformation->Stream, name, streamBegin, length);
+    FileNameInformation->NamesParsed = FLTFL_FILE_NAME_PARSED_FINAL_COMPONENT | FLTFL_FILE_NAME_PARSED_EXTENSION | FLTFL_FILE_NAME_PARSED_STREAM | FLTFL_FILE_NAME_PARSED_PARENT_DIR;
+    return STATUS_SUCCESS;
+}
+
+VOID FltReleaseFileNameInformation(PFLT_FILE_NAME_INFORMATION FileNameInformation)
+{
+    ExFreePool(FileNameInformation);
+}
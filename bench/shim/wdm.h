@@ -0,0 +1,383 @@
+#pragma once
+
+// User-mode stand-in for the subset of <wdm.h> used by klib and kapp.
+// Only what the driver actually touches is provided, with the same names and
+// calling conventions, so the library sources compile unchanged on Linux.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+#include <type_traits>
+
+// SAL and driver annotations are documentation only in user mode
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
+#define _Outptr_
+#define _In_reads_bytes_(size)
+#define _Out_writes_bytes_(size)
+#define _Out_writes_bytes_to_(size, count)
+#define _Inout_updates_bytes_(size)
+#define _Success_(expr)
+#define _IRQL_requires_(irql)
+#define _IRQL_requires_max_(irql)
+#define _IRQL_requires_min_(irql)
+#define _IRQL_raises_(irql)
+#define _IRQL_saves_global_(kind, param)
+#define _IRQL_restores_global_(kind, param)
+#define _Acquires_lock_(lock)
+#define _Releases_lock_(lock)
+#define _Acquires_exclusive_lock_(lock)
+#define _Releases_exclusive_lock_(lock)
+#define _Acquires_shared_lock_(lock)
+#define _Releases_shared_lock_(lock)
+#define _Requires_lock_held_(lock)
+#define _Must_inspect_result_
+
+#define __forceinline inline __attribute__((always_inline))
+#define UNREFERENCED_PARAMETER(P) (void)(P)
+#define PAGED_CODE()
+#define NT_ASSERT(expr) ((void)0)
+#define NT_VERIFY(expr) ((void)(expr))
+#define FLT_ASSERT(expr) ((void)0)
+
+#define EXTERN_C extern "C"
+#define EXTERN_C_START extern "C" {
+#define EXTERN_C_END }
+
+typedef void VOID;
+typedef void* PVOID;
+typedef char CHAR;
+typedef unsigned char UCHAR;
+typedef UCHAR* PUCHAR;
+typedef int16_t SHORT;
+typedef uint16_t USHORT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef ULONG* PULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG, *PULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef ULONG_PTR SIZE_T;
+typedef UCHAR BOOLEAN;
+typedef LONG NTSTATUS;
+typedef wchar_t WCHAR;
+typedef WCHAR* PWCH;
+typedef WCHAR* PWSTR;
+typedef const WCHAR* PCWSTR;
+typedef PVOID HANDLE;
+typedef ULONG ACCESS_MASK;
+typedef UCHAR KIRQL;
+typedef KIRQL* PKIRQL;
+
+#define TRUE 1
+#define FALSE 0
+#define CONST const
+
+#define STATUS_SUCCESS ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING ((NTSTATUS)0x00000103L)
+#define STATUS_NO_MORE_FILES ((NTSTATUS)0x80000006L)
+#define STATUS_END_OF_FILE ((NTSTATUS)0xC0000011L)
+#define STATUS_UNSUCCESSFUL ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_MEMORY ((NTSTATUS)0xC0000017L)
+#define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009AL)
+#define STATUS_OBJECT_NAME_INVALID ((NTSTATUS)0xC0000033L)
+#define STATUS_OBJECT_NAME_NOT_FOUND ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_PATH_NOT_FOUND ((NTSTATUS)0xC000003AL)
+#define STATUS_ACCESS_DENIED ((NTSTATUS)0xC0000022L)
+#define STATUS_SHARING_VIOLATION ((NTSTATUS)0xC0000043L)
+#define STATUS_NOT_FOUND ((NTSTATUS)0xC0000225L)
+#define STATUS_NOT_SUPPORTED ((NTSTATUS)0xC00000BBL)
+#define STATUS_DISK_FULL ((NTSTATUS)0xC000007FL)
+#define STATUS_BUFFER_TOO_SMALL ((NTSTATUS)0xC0000023L)
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+#define PASSIVE_LEVEL 0
+#define APC_LEVEL 1
+#define DISPATCH_LEVEL 2
+
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define RTL_CONSTANT_STRING(s) { sizeof(s) - sizeof((s)[0]), sizeof(s), const_cast<PWCH>(s) }
+
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length) memmove((Destination), (Source), (Length))
+#define RtlFillMemory(Destination, Length, Fill) memset((Destination), (Fill), (Length))
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+
+inline PVOID RtlSecureZeroMemory(PVOID Destination, SIZE_T Length)
+{
+    auto p = (volatile char*)Destination;
+    while (Length--)
+        *p++ = 0;
+    return Destination;
+}
+
+VOID RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+VOID RtlCopyUnicodeString(PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString);
+NTSTATUS RtlAppendUnicodeToString(PUNICODE_STRING Destination, PCWSTR Source);
+WCHAR RtlUpcaseUnicodeChar(WCHAR SourceCharacter);
+BOOLEAN RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+LONG RtlCompareUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+
+//
+// File access rights and create parameters
+//
+
+#define FILE_READ_DATA 0x0001
+#define FILE_WRITE_DATA 0x0002
+#define FILE_APPEND_DATA 0x0004
+#define DELETE 0x00010000
+
+#define FILE_SUPERSEDE 0x00000000
+#define FILE_OPEN 0x00000001
+#define FILE_CREATE 0x00000002
+#define FILE_OPEN_IF 0x00000003
+#define FILE_OVERWRITE 0x00000004
+#define FILE_OVERWRITE_IF 0x00000005
+
+#define FILE_DIRECTORY_FILE 0x00000001
+#define FILE_NON_DIRECTORY_FILE 0x00000040
+#define FILE_DELETE_ON_CLOSE 0x00001000
+
+// MSVC CRT extensions used by the driver
+int wcsncpy_s(WCHAR* dest, size_t destsz, const WCHAR* src, size_t count);
+WCHAR* _wcslwr(WCHAR* str);
+
+#define DEFINE_ENUM_FLAG_OPERATORS(ENUMTYPE) \
+    constexpr ENUMTYPE operator | (ENUMTYPE a, ENUMTYPE b) { return ENUMTYPE(std::underlying_type_t<ENUMTYPE>(a) | std::underlying_type_t<ENUMTYPE>(b)); } \
+    constexpr ENUMTYPE operator & (ENUMTYPE a, ENUMTYPE b) { return ENUMTYPE(std::underlying_type_t<ENUMTYPE>(a) & std::underlying_type_t<ENUMTYPE>(b)); } \
+    constexpr ENUMTYPE operator ^ (ENUMTYPE a, ENUMTYPE b) { return ENUMTYPE(std::underlying_type_t<ENUMTYPE>(a) ^ std::underlying_type_t<ENUMTYPE>(b)); } \
+    constexpr ENUMTYPE operator ~ (ENUMTYPE a) { return ENUMTYPE(~std::underlying_type_t<ENUMTYPE>(a)); } \
+    constexpr ENUMTYPE& operator |= (ENUMTYPE& a, ENUMTYPE b) { return a = a | b; } \
+    constexpr ENUMTYPE& operator &= (ENUMTYPE& a, ENUMTYPE b) { return a = a & b; }
+
+//
+// Interlocked operations and processors
+//
+
+#define ALL_PROCESSOR_GROUPS 0xffff
+
+typedef struct _PROCESSOR_NUMBER {
+    USHORT Group;
+    UCHAR Number;
+    UCHAR Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+inline LONG InterlockedIncrement(volatile LONG* Addend) { return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedDecrement(volatile LONG* Addend) { return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchange(volatile LONG* Target, LONG Value) { return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd(volatile LONG* Addend, LONG Value) { return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange(volatile LONG* Destination, LONG Exchange, LONG Comparand)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG* Addend) { return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedDecrement64(volatile LONGLONG* Addend) { return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* Addend, LONGLONG Value) { return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* Target, LONGLONG Value) { return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* Destination, LONGLONG Exchange, LONGLONG Comparand)
+{
+    __atomic_compare_exchange_n(Destination, &Comparand, Exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return Comparand;
+}
+inline LONGLONG ReadNoFence64(volatile const LONGLONG* Source) { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline LONG ReadAcquire(volatile const LONG* Source) { return __atomic_load_n(Source, __ATOMIC_ACQUIRE); }
+inline LONG ReadNoFence(volatile const LONG* Source) { return __atomic_load_n(Source, __ATOMIC_RELAXED); }
+inline void WriteRelease(volatile LONG* Destination, LONG Value) { __atomic_store_n(Destination, Value, __ATOMIC_RELEASE); }
+inline void WriteRelease16(volatile SHORT* Destination, SHORT Value) { __atomic_store_n(Destination, Value, __ATOMIC_RELEASE); }
+#define YieldProcessor() __builtin_ia32_pause()
+#define MemoryBarrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+ULONG KeGetCurrentProcessorNumberEx(PPROCESSOR_NUMBER ProcNumber);
+ULONG KeQueryActiveProcessorCountEx(USHORT GroupNumber);
+
+// 100ns units since an arbitrary point in time, like the kernel interrupt time
+ULONGLONG KeQueryInterruptTime();
+// The same clock read from the performance counter, precise to the 100ns
+ULONGLONG KeQueryInterruptTimePrecise(PULONGLONG QpcTimeStamp);
+
+//
+// Pool
+//
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    NonPagedPoolNx = 512,
+    PagedPool = 1,
+} POOL_TYPE;
+
+PVOID ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID ExFreePool(PVOID P);
+VOID ExFreePoolWithTag(PVOID P, ULONG Tag);
+
+//
+// IRQL and critical regions (tracked per thread)
+//
+
+KIRQL KeGetCurrentIrql();
+VOID KeRaiseIrql(KIRQL NewIrql, PKIRQL OldIrql);
+VOID KeLowerIrql(KIRQL NewIrql);
+VOID KeEnterCriticalRegion();
+VOID KeLeaveCriticalRegion();
+
+//
+// Dispatcher objects
+//
+
+typedef enum _KOBJECTS {
+    EventNotificationObject = 0,
+    EventSynchronizationObject = 1,
+    MutantObject = 2,
+} KOBJECTS;
+
+typedef enum _KWAIT_REASON { Executive = 0 } KWAIT_REASON;
+typedef enum _MODE { KernelMode = 0, UserMode = 1 } MODE, KPROCESSOR_MODE;
+
+typedef struct _DISPATCHER_HEADER {
+    UCHAR Type;
+    volatile LONG SignalState;
+} DISPATCHER_HEADER;
+
+typedef struct _KMUTEX {
+    DISPATCHER_HEADER Header;
+    volatile LONG State;    // futex word: 0 free, 1 owned, 2 owned with waiters
+    volatile LONG Owner;    // owning thread id, the kernel mutex is recursive
+    LONG Recursion;
+} KMUTEX, *PKMUTEX, *PRKMUTEX;
+
+typedef enum _EVENT_TYPE { NotificationEvent = 0, SynchronizationEvent = 1 } EVENT_TYPE;
+typedef LONG KPRIORITY;
+#define IO_NO_INCREMENT 0
+
+typedef struct _KEVENT {
+    DISPATCHER_HEADER Header;   // SignalState is the futex word
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+VOID KeInitializeMutex(PRKMUTEX Mutex, ULONG Level);
+LONG KeReleaseMutex(PRKMUTEX Mutex, BOOLEAN Wait);
+VOID KeInitializeEvent(PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State);
+LONG KeSetEvent(PRKEVENT Event, KPRIORITY Increment, BOOLEAN Wait);
+VOID KeClearEvent(PRKEVENT Event);
+// Mutexes and events, the timeout is ignored
+NTSTATUS KeWaitForSingleObject(PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout);
+
+//
+// Fast and guarded mutexes
+//
+
+typedef struct _FAST_MUTEX {
+    volatile LONG State;
+    KIRQL OldIrql;
+} FAST_MUTEX, *PFAST_MUTEX, KGUARDED_MUTEX, *PKGUARDED_MUTEX;
+
+VOID ExInitializeFastMutex(PFAST_MUTEX FastMutex);
+VOID ExAcquireFastMutex(PFAST_MUTEX FastMutex);
+BOOLEAN ExTryToAcquireFastMutex(PFAST_MUTEX FastMutex);
+VOID ExReleaseFastMutex(PFAST_MUTEX FastMutex);
+
+VOID KeInitializeGuardedMutex(PKGUARDED_MUTEX Mutex);
+VOID KeAcquireGuardedMutex(PKGUARDED_MUTEX Mutex);
+BOOLEAN KeTryToAcquireGuardedMutex(PKGUARDED_MUTEX Mutex);
+VOID KeReleaseGuardedMutex(PKGUARDED_MUTEX Mutex);
+
+//
+// Spin locks
+//
+
+typedef ULONG_PTR KSPIN_LOCK;
+typedef KSPIN_LOCK* PKSPIN_LOCK;
+
+typedef struct _KLOCK_QUEUE_HANDLE {
+    PKSPIN_LOCK Lock;
+    KIRQL OldIrql;
+} KLOCK_QUEUE_HANDLE, *PKLOCK_QUEUE_HANDLE;
+
+VOID KeInitializeSpinLock(PKSPIN_LOCK SpinLock);
+VOID KeAcquireSpinLock(PKSPIN_LOCK SpinLock, PKIRQL OldIrql);
+VOID KeReleaseSpinLock(PKSPIN_LOCK SpinLock, KIRQL NewIrql);
+VOID KeAcquireSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock);
+VOID KeReleaseSpinLockFromDpcLevel(PKSPIN_LOCK SpinLock);
+VOID KeAcquireInStackQueuedSpinLock(PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeReleaseInStackQueuedSpinLock(PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeAcquireInStackQueuedSpinLockAtDpcLevel(PKSPIN_LOCK SpinLock, PKLOCK_QUEUE_HANDLE LockHandle);
+VOID KeReleaseInStackQueuedSpinLockFromDpcLevel(PKLOCK_QUEUE_HANDLE LockHandle);
+
+//
+// Push locks and reader/writer spin locks
+//
+
+typedef struct _EX_PUSH_LOCK {
+    volatile LONG State;    // shared owners in the low bits, PushLockExclusive and PushLockWaiters above
+} EX_PUSH_LOCK, *PEX_PUSH_LOCK;
+
+#define EX_DEFAULT_PUSH_LOCK_FLAGS 0
+
+VOID ExInitializePushLock(PEX_PUSH_LOCK PushLock);
+VOID ExAcquirePushLockExclusiveEx(PEX_PUSH_LOCK PushLock, ULONG Flags);
+VOID ExAcquirePushLockSharedEx(PEX_PUSH_LOCK PushLock, ULONG Flags);
+VOID ExReleasePushLockExclusiveEx(PEX_PUSH_LOCK PushLock, ULONG Flags);
+VOID ExReleasePushLockSharedEx(PEX_PUSH_LOCK PushLock, ULONG Flags);
+
+typedef volatile LONG EX_SPIN_LOCK, *PEX_SPIN_LOCK;
+
+KIRQL ExAcquireSpinLockExclusive(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockExclusive(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql);
+KIRQL ExAcquireSpinLockShared(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockShared(PEX_SPIN_LOCK SpinLock, KIRQL OldIrql);
+VOID ExAcquireSpinLockExclusiveAtDpcLevel(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockExclusiveFromDpcLevel(PEX_SPIN_LOCK SpinLock);
+VOID ExAcquireSpinLockSharedAtDpcLevel(PEX_SPIN_LOCK SpinLock);
+VOID ExReleaseSpinLockSharedFromDpcLevel(PEX_SPIN_LOCK SpinLock);
+
+//
+// Rundown protection
+//
+
+typedef struct _EX_RUNDOWN_REF {
+    volatile LONG Count;    // twice the references, the low bit set once the rundown started
+} EX_RUNDOWN_REF, *PEX_RUNDOWN_REF;
+
+VOID ExInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExReInitializeRundownProtection(PEX_RUNDOWN_REF RunRef);
+BOOLEAN ExAcquireRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExReleaseRundownProtection(PEX_RUNDOWN_REF RunRef);
+VOID ExWaitForRundownProtectionRelease(PEX_RUNDOWN_REF RunRef);
+
+//
+// Executive resources
+//
+
+typedef struct _ERESOURCE {
+    volatile LONG State;    // -1 exclusive, 0 free, > 0 number of shared owners
+    volatile LONG Waiters;
+} ERESOURCE, *PERESOURCE;
+
+NTSTATUS ExInitializeResourceLite(PERESOURCE Resource);
+NTSTATUS ExReinitializeResourceLite(PERESOURCE Resource);
+NTSTATUS ExDeleteResourceLite(PERESOURCE Resource);
+BOOLEAN ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait);
+BOOLEAN ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait);
+VOID ExReleaseResourceLite(PERESOURCE Resource);
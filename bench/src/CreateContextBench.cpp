@@ -0,0 +1,344 @@
+#include "Bench.h"
+#include "CreateContext.h"
+#include "Pool.h"
+#include "Tags.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// scripts/load/desktop.trace replayed through the file context set up of main.cpp, eager and lazy.
+// The name queries, directory checks and name copies are the real ones, over the shim; the filter
+// manager contexts are pool blocks. Both modes must back up the same files at the same writes.
+namespace
+{
+    struct Op
+    {
+        enum Kind { Open, Write, Map, Close } Kind;
+        unsigned Handle;
+        size_t Path;                    // index in Trace::Paths, for opens
+    };
+
+    struct Trace
+    {
+        std::vector<std::wstring> Paths;
+        std::vector<Op> Ops;
+    };
+
+    auto LoadTrace(Trace& trace) -> bool
+    {
+        std::string path = std::string(KBENCH_SOURCE_DIR) + "/scripts/load/desktop.trace";
+        auto file = fopen(path.c_str(), "r");
+        if (!file)
+            return false;
+
+        std::unordered_map<std::string, size_t> paths;
+        char line[1024];
+        while (fgets(line, sizeof(line), file))
+        {
+            char kind[16];
+            char name[sizeof(line)] = "";
+            unsigned handle = 0;
+            if (line[0] == '#' || sscanf(line, "%15s %u %1023s", kind, &handle, name) < 2)
+                continue;
+
+            std::string op = kind;
+            if (op == "open")
+            {
+                auto [it, added] = paths.emplace(name, trace.Paths.size());
+                if (added)
+                    trace.Paths.emplace_back(it->first.begin(), it->first.end());
+                trace.Ops.push_back({ Op::Open, handle, it->second });
+            }
+            else if (op == "write" || op == "map" || op == "close")
+                trace.Ops.push_back({ op == "write" ? Op::Write : op == "map" ? Op::Map : Op::Close, handle, 0 });
+        }
+
+        fclose(file);
+        return !trace.Ops.empty();
+    }
+
+    // FileContext of main.h, without its lock: the replay has a single thread
+    struct Context
+    {
+        UNICODE_STRING FileName;
+        BOOLEAN Written;
+        BOOLEAN BackedUp;
+        BOOLEAN Pending;
+    };
+
+    // What PostCreateOperation, PreWriteOperation, PreAcquireForSectionOperation and PostCleanupOperation do
+    class Replay
+    {
+        bool lazy;
+        std::vector<FLT_CALLBACK_DATA> data;                // per path, stands for the create or write of a handle
+        std::unordered_map<size_t, Context*> contexts;      // file contexts, per path
+        std::unordered_map<unsigned, size_t> handles;
+
+        static void Cleanup(Context* context)
+        {
+            if (context->Pending)
+                InterlockedIncrement64(&g_creates.Avoided);
+            if (context->FileName.Buffer)
+                g_pool.Free(context->FileName.Buffer, CONTEXT_NAME_TAG);
+            g_pool.Free(context, DRIVER_CONTEXT_TAG);
+        }
+
+    public:
+        // ResolveFileContext: a failed name query keeps the context pending
+        static void Resolve(FLT_CALLBACK_DATA* data, Context* context)
+        {
+            if (!context->Pending)
+                return;
+
+            UNICODE_STRING name;
+            auto status = ResolveFileName(data, &name);
+            if (!NT_SUCCESS(status) && status != STATUS_NOT_FOUND)
+                return;
+
+            context->Pending = FALSE;
+            InterlockedIncrement64(&g_creates.Resolved);
+            if (NT_SUCCESS(status))
+                context->FileName = name;
+            else
+                context->Written = TRUE;
+        }
+
+        std::vector<std::pair<size_t, size_t>> Backups;    // op index and path of each backup
+
+        // The name queries of the path at index failing fail
+        Replay(const Trace& trace, bool lazy, size_t failing) : lazy(lazy), data(trace.Paths.size())
+        {
+            for (size_t i = 0; i < trace.Paths.size(); ++i)
+            {
+                if (i == failing)
+                    continue;
+
+                auto& name = data[i].ShimFileName;
+                name.Buffer = const_cast<WCHAR*>(trace.Paths[i].data());
+                name.Length = (USHORT)(trace.Paths[i].size() * sizeof(WCHAR));
+                name.MaximumLength = name.Length;
+            }
+        }
+
+        ~Replay()
+        {
+            for (auto& [path, context] : contexts)
+                Cleanup(context);
+        }
+
+        auto Run(const Trace& trace) -> bool
+        {
+            for (size_t i = 0; i < trace.Ops.size(); ++i)
+            {
+                const auto& op = trace.Ops[i];
+                if (op.Kind == Op::Open)
+                {
+                    handles[op.Handle] = op.Path;
+                    InterlockedIncrement64(&g_creates.Opens);
+                    UNICODE_STRING name = {};
+                    auto pending = lazy;
+                    if (!lazy)
+                    {
+                        auto status = ResolveFileName(&data[op.Path], &name);
+                        if (status == STATUS_NOT_FOUND)
+                            continue;
+                        pending = !NT_SUCCESS(status);
+                    }
+
+                    auto context = (Context*)g_pool.Allocate(PoolSubsystem::Create, PagedPool, sizeof(Context), DRIVER_CONTEXT_TAG);
+                    if (!context)
+                        return false;
+
+                    context->FileName = name;
+                    context->Written = FALSE;
+                    context->BackedUp = FALSE;
+                    context->Pending = pending;
+                    if (pending)
+                        InterlockedIncrement64(&g_creates.Deferred);
+
+                    // FLT_SET_CONTEXT_KEEP_IF_EXISTS
+                    if (!contexts.emplace(op.Path, context).second)
+                        Cleanup(context);
+                    continue;
+                }
+
+                auto handle = handles.find(op.Handle);
+                if (handle == handles.end())
+                    return false;
+
+                auto path = handle->second;
+                auto found = contexts.find(path);
+                if (op.Kind == Op::Close)
+                {
+                    // PostCleanupOperation deletes the context of the file
+                    handles.erase(handle);
+                    if (found != contexts.end())
+                    {
+                        Cleanup(found->second);
+                        contexts.erase(found);
+                    }
+                    continue;
+                }
+
+                if (found == contexts.end())
+                    continue;
+
+                auto context = found->second;
+                // a write to a file still pending goes through unbacked
+                Resolve(&data[path], context);
+                if (op.Kind == Op::Write && !context->Pending && !context->Written)
+                {
+                    Backups.emplace_back(i, path);
+                    context->BackedUp = TRUE;
+                    context->Written = TRUE;
+                }
+            }
+
+            return true;
+        }
+    };
+
+    auto ReplayTrace(const Trace& trace, bool lazy, std::vector<std::pair<size_t, size_t>>* backups, size_t failing = SIZE_MAX) -> bool
+    {
+        Replay replay(trace, lazy, failing);
+        auto ok = replay.Run(trace);
+        if (backups)
+            *backups = std::move(replay.Backups);
+        return ok;
+    }
+
+    // A failed name query leaves the context pending, the next one resolves it; a file that is not
+    // protected is resolved as written
+    auto CheckRetry() -> const char*
+    {
+        std::wstring protectedPath = L"\\Device\\HarddiskVolume3\\Users\\alice\\Documents\\private\\notes.txt";
+        std::wstring otherPath = L"\\Device\\HarddiskVolume3\\Users\\alice\\Documents\\notes.txt";
+        auto outstanding = g_pool.Outstanding();
+        auto counters = g_creates;
+        FLT_CALLBACK_DATA data = {};
+        Context context = { {}, FALSE, FALSE, TRUE };
+        Replay::Resolve(&data, &context);
+        if (!context.Pending || context.Written || g_creates.Resolved != counters.Resolved)
+            return "a failed name query resolves the context";
+
+        data.ShimFileName.Buffer = protectedPath.data();
+        data.ShimFileName.Length = data.ShimFileName.MaximumLength = (USHORT)(protectedPath.size() * sizeof(WCHAR));
+        Replay::Resolve(&data, &context);
+        if (context.Pending || context.Written || !context.FileName.Buffer || g_creates.Resolved != counters.Resolved + 1)
+            return "the retried name query does not resolve the context";
+        g_pool.Free(context.FileName.Buffer, CONTEXT_NAME_TAG);
+
+        context = { {}, FALSE, FALSE, TRUE };
+        data.ShimFileName.Buffer = otherPath.data();
+        data.ShimFileName.Length = data.ShimFileName.MaximumLength = (USHORT)(otherPath.size() * sizeof(WCHAR));
+        Replay::Resolve(&data, &context);
+        g_creates = counters;
+        if (context.Pending || !context.Written || context.FileName.Buffer)
+            return "a file that is not protected is not resolved as written";
+        return g_pool.Outstanding() == outstanding ? nullptr : "a name is not freed";
+    }
+
+    void RunReplay(bench::State& state, bool lazy)
+    {
+        Trace trace;
+        if (!LoadTrace(trace))
+        {
+            state.Skip("cannot read scripts/load/desktop.trace");
+            return;
+        }
+
+        if (!bench::Verify(state, { CheckRetry }))
+            return;
+
+        // the same backups, and every context and name freed
+        std::vector<std::pair<size_t, size_t>> eager;
+        std::vector<std::pair<size_t, size_t>> deferred;
+        auto outstanding = g_pool.Outstanding();
+        g_creates = {};
+        if (!ReplayTrace(trace, false, &eager) || !ReplayTrace(trace, true, &deferred))
+        {
+            state.Fail("the trace does not replay");
+            return;
+        }
+
+        if (eager.empty() || eager != deferred)
+        {
+            state.Fail("the lazy mode does not make the same backups");
+            return;
+        }
+
+        // a file whose name queries fail keeps a pending context in both modes, and its writes make
+        // no backup; the other files are backed up as before
+        auto failing = eager.front().second;
+        auto expected = eager;
+        std::erase_if(expected, [&](const auto& backup) { return backup.second == failing; });
+        for (auto mode : { false, true })
+        {
+            if (!ReplayTrace(trace, mode, &deferred, failing))
+            {
+                state.Fail("the trace does not replay");
+                return;
+            }
+
+            if (deferred != expected)
+            {
+                state.Fail("a write to a pending context makes a backup");
+                return;
+            }
+        }
+
+        if (g_pool.Outstanding() != outstanding)
+        {
+            state.Fail("a context or a name is not freed");
+            return;
+        }
+
+        g_creates = {};
+        if (!ReplayTrace(trace, lazy, nullptr))
+        {
+            state.Fail("the trace does not replay");
+            return;
+        }
+
+        auto counters = g_creates;
+        if (lazy && (counters.Deferred != counters.Opens || counters.Resolved + counters.Avoided != counters.Deferred
+            || counters.NameQueries != counters.Resolved))
+        {
+            state.Fail("the lazy counters do not add up");
+            return;
+        }
+
+        if (!lazy && (counters.NameQueries != counters.Opens || counters.Deferred != 0))
+        {
+            state.Fail("the eager counters do not add up");
+            return;
+        }
+
+        auto ok = true;
+        state.Run([&] { ok &= ReplayTrace(trace, lazy, nullptr); });
+        if (!ok)
+        {
+            state.Fail("the trace does not replay");
+            return;
+        }
+
+        state.Counter("ops", (double)trace.Ops.size());
+        state.Counter("opens", (double)counters.Opens);
+        state.Counter("backups", (double)eager.size());
+        state.Counter("name_queries", (double)counters.NameQueries);
+        state.Counter("avoided", (double)counters.Avoided);
+    }
+}
+
+BENCHMARK(CreateReplayEager, "create/replay/eager")
+{
+    RunReplay(state, false);
+}
+
+BENCHMARK(CreateReplayLazy, "create/replay/lazy")
+{
+    RunReplay(state, true);
+}
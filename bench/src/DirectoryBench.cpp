@@ -0,0 +1,43 @@
+#include "Bench.h"
+#include "Directory.h"
+
+#include <string>
+
+static void IsValidDirectoryBench(bench::State& state, std::wstring directory, bool expected)
+{
+    UNICODE_STRING name;
+    name.Buffer = directory.data();
+    name.Length = (USHORT)(directory.size() * sizeof(WCHAR));
+    name.MaximumLength = name.Length;
+    if (IsValidDirectory(&name) != expected)
+    {
+        state.Fail("unexpected classification");
+        return;
+    }
+
+    state.Run([&] { bench::DoNotOptimize(IsValidDirectory(&name)); });
+}
+
+BENCHMARK(IsValidDirectoryHit, "directory/is_valid/hit")
+{
+    IsValidDirectoryBench(state, L"\\Users\\alice\\Documents\\Secret\\", true);
+}
+
+BENCHMARK(IsValidDirectoryMiss, "directory/is_valid/miss")
+{
+    IsValidDirectoryBench(state, L"\\Users\\alice\\AppData\\Local\\Microsoft\\Windows\\INetCache\\", false);
+}
+
+// Deep paths copy and lowercase up to the 1 KiB limit before searching
+BENCHMARK(IsValidDirectoryDeep, "directory/is_valid/deep")
+{
+    std::wstring directory;
+    while ((directory.size() + 16) * sizeof(WCHAR) < 1024)
+        directory += L"\\Component";
+    IsValidDirectoryBench(state, directory + L"\\private\\", true);
+}
+
+BENCHMARK(IsValidDirectoryTooLong, "directory/is_valid/too_long")
+{
+    IsValidDirectoryBench(state, std::wstring(600, L'a') + L"\\secret\\", false);
+}
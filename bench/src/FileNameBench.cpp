@@ -0,0 +1,33 @@
+#include "Bench.h"
+#include "kl.h"
+
+#include <string>
+
+static void ParseBench(bench::State& state, std::wstring path)
+{
+    FLT_CALLBACK_DATA data = {};
+    data.ShimFileName.Buffer = path.data();
+    data.ShimFileName.Length = (USHORT)(path.size() * sizeof(WCHAR));
+    data.ShimFileName.MaximumLength = data.ShimFileName.Length;
+
+    state.Run([&] {
+        auto fileNameInfo = kl::FilterFileNameInformation(&data);
+        if (fileNameInfo && NT_SUCCESS(fileNameInfo.Parse()))
+            bench::DoNotOptimize(fileNameInfo->ParentDir.Length);
+    });
+}
+
+BENCHMARK(FileNameShort, "filename/parse/short")
+{
+    ParseBench(state, L"\\Device\\HarddiskVolume3\\secret\\file.txt");
+}
+
+BENCHMARK(FileNameDeep, "filename/parse/deep")
+{
+    ParseBench(state, L"\\Device\\HarddiskVolume3\\Users\\alice\\Documents\\Projects\\2022\\Quarterly\\Reports\\private\\Budget review (final).xlsx");
+}
+
+BENCHMARK(FileNameStream, "filename/parse/stream")
+{
+    ParseBench(state, L"\\Device\\HarddiskVolume3\\secret\\file.txt:Zone.Identifier:$DATA");
+}
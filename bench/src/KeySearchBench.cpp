@@ -0,0 +1,181 @@
+#include "Bench.h"
+#include "KeySearch.h"
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    auto ReadFile(const char* name) -> std::vector<uint8_t>
+    {
+        std::ifstream stream(std::string(KBENCH_SOURCE_DIR) + "/scripts/secret/" + name, std::ios::binary);
+        return { std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+    }
+
+    auto AllSignatures() -> std::vector<const Signature*>
+    {
+        std::vector<const Signature*> signatures;
+        for (const auto& signature : BuiltinSignatures())
+            signatures.push_back(&signature);
+        return signatures;
+    }
+
+    // First bytes of a file of each format, the rest is noise
+    auto Plaintext(const std::string& format, std::mt19937& random) -> std::vector<uint8_t>
+    {
+        using namespace std::string_literals;
+        std::string head;
+        if (format == "zip")
+            head = "PK\x03\x04\x14\x00\x08\x00\x08\x00"s;
+        else if (format == "ooxml")
+            head = "PK\x03\x04\x14\x00\x06\x00\x08\x00\x00\x00\x21\x00\x62\xee\x9d\x68\x5e\x01\x00\x00\x90\x04\x00\x00\x13\x00\x08\x02[Content_Types].xml"s;
+        else if (format == "pdf")
+            head = "%PDF-1.7\n%\xe2\xe3\xcf\xd3\n"s;
+        else if (format == "pe")
+            head = "MZ\x90\x00\x03\x00\x00\x00\x04\x00\x00\x00\xff\xff\x00\x00"s;
+        else if (format == "utf16")
+        {
+            head = "\xff\xfe";
+            for (auto c : std::string("Quarterly results, draft 3. Do not forward.\r\n"))
+                head += { c, '\0' };
+        }
+        else
+            head = "# Inventory\n\nItem, quantity, price\nKeyboard, 12, 24.90\nScreen, 4, 189.00\n";
+
+        std::vector<uint8_t> data(head.begin(), head.end());
+        while (data.size() < 4096)
+            data.push_back((uint8_t)random());
+        return data;
+    }
+
+    auto Encrypt(std::vector<uint8_t> data, uint32_t key) -> std::vector<uint8_t>
+    {
+        return DecodeBackup(data.data(), data.size(), key);
+    }
+
+    // The key of the challenge file, and the original text
+    auto CheckLockFile() -> const char*
+    {
+        auto backup = ReadFile("file.txt.lock");
+        if (backup.empty())
+            return "cannot read scripts/secret/file.txt.lock";
+
+        KeySearch search(backup.data(), backup.size(), AllSignatures());
+        KeySearchOptions options;
+        options.All = true;
+        auto result = search.Run(options);
+        if (result.Matches.size() != 1 || result.Matches[0].Key != 0x2efacd02 || result.Matches[0].Format->Name != "utf16")
+            return "the key of file.txt.lock is not found";
+        if (DecodeBackup(backup.data(), backup.size(), result.Matches[0].Key) != ReadFile("original.txt"))
+            return "file.txt.lock does not decode to original.txt";
+        return nullptr;
+    }
+
+    // Each format gives back the key of random backups
+    auto CheckFormats() -> const char*
+    {
+        std::mt19937 random(1);
+        for (const auto& signature : BuiltinSignatures())
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                auto key = (uint32_t)random();
+                auto backup = Encrypt(Plaintext(signature.Name, random), key);
+                KeySearch search(backup.data(), backup.size(), { &signature });
+                KeySearchOptions options;
+                options.All = true;
+                auto result = search.Run(options);
+                auto found = false;
+                for (const auto& match : result.Matches)
+                    found |= match.Key == key;
+                if (!found || result.Tested != 1ull << 32 || search.Test(key) != &signature)
+                    return "a format does not give the key back";
+
+                // the formats pinning the 4 key bytes give it alone
+                if (signature.Name != "utf8" && result.Matches.size() != 1)
+                    return "a format gives more than one key";
+            }
+        }
+
+        return nullptr;
+    }
+
+    // The engines find the same keys, on bounds that are not block aligned
+    auto CheckEngines() -> const char*
+    {
+        std::mt19937 random(2);
+        auto backup = Encrypt(Plaintext("utf8", random), 0x12345678);
+        KeySearch search(backup.data(), backup.size(), AllSignatures());
+        std::vector<std::vector<KeySearchResult::Match>> results;
+        for (auto engine : { KeySearchOptions::Engine::Scalar, KeySearchOptions::Engine::Sse2, KeySearchOptions::Engine::Avx2 })
+        {
+            KeySearchOptions options;
+            options.First = 0x12300071;
+            options.Last = 0x12400093;
+            options.All = true;
+            options.Vector = engine;
+            results.push_back(search.Run(options).Matches);
+        }
+
+        for (const auto& matches : results)
+        {
+            if (matches.size() != results[0].size())
+                return "the engines disagree";
+            for (size_t i = 0; i < matches.size(); ++i)
+            {
+                if (matches[i].Key != results[0][i].Key || matches[i].Format != results[0][i].Format
+                    || matches[i].Key < 0x12300071 || matches[i].Key >= 0x12400093)
+                    return "the engines disagree";
+            }
+        }
+
+        return results[0].empty() ? "the engines find nothing" : nullptr;
+    }
+
+    // The whole key space against every signature, no early exit
+    void RunSearch(bench::State& state, KeySearchOptions::Engine engine)
+    {
+        auto backup = ReadFile("file.txt.lock");
+        KeySearch search(backup.data(), backup.size(), AllSignatures());
+        KeySearchOptions options;
+        options.All = true;
+        options.Threads = 1;
+        options.Vector = engine;
+        KeySearchResult result;
+        state.Run([&] { result = search.Run(options); });
+        state.Counter("keys_per_second", result.Tested / result.Seconds);
+        state.Counter("matches", (double)result.Matches.size());
+    }
+}
+
+BENCHMARK(KeySearchAvx2, "keysearch/full/avx2")
+{
+    if (!bench::Verify(state, { CheckLockFile, CheckFormats, CheckEngines }))
+        return;
+
+    RunSearch(state, KeySearchOptions::Engine::Avx2);
+}
+
+BENCHMARK(KeySearchSse2, "keysearch/full/sse2")
+{
+    RunSearch(state, KeySearchOptions::Engine::Sse2);
+}
+
+BENCHMARK(KeySearchScalar, "keysearch/full/scalar")
+{
+    RunSearch(state, KeySearchOptions::Engine::Scalar);
+}
+
+// Time to the key of the challenge file with the defaults: every processor, early exit
+BENCHMARK(KeySearchLockFile, "keysearch/lock_file")
+{
+    auto backup = ReadFile("file.txt.lock");
+    KeySearch search(backup.data(), backup.size(), AllSignatures());
+    KeySearchResult result;
+    state.Run([&] { result = search.Run({}); });
+    state.Counter("keys_tested", (double)result.Tested);
+    state.Counter("threads", result.Threads);
+}
@@ -0,0 +1,318 @@
+#include "Bench.h"
+#include "kl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// The locks are their kernel object, aligned: no vtable pointer, so no indirect call to reach Lock and Unlock
+template <typename T, typename Object>
+constexpr bool Devirtualized = !std::is_polymorphic_v<T>
+    && sizeof(T) == (sizeof(Object) + MEMORY_ALLOCATION_ALIGNMENT - 1) / MEMORY_ALLOCATION_ALIGNMENT * MEMORY_ALLOCATION_ALIGNMENT;
+
+static_assert(Devirtualized<kl::Mutex, KMUTEX>);
+static_assert(Devirtualized<kl::FastMutex, FAST_MUTEX>);
+static_assert(Devirtualized<kl::GuardedMutex, KGUARDED_MUTEX>);
+static_assert(Devirtualized<kl::ExecutiveResource, ERESOURCE>);
+static_assert(Devirtualized<kl::PushLock, EX_PUSH_LOCK>);
+static_assert(!std::is_polymorphic_v<kl::SpinLock> && !std::is_polymorphic_v<kl::QueuedSpinLock>);
+static_assert(!std::is_polymorphic_v<kl::SharedSpinLock>);
+static_assert(std::is_trivially_destructible_v<kl::FastMutex> && !std::is_trivially_destructible_v<kl::ExecutiveResource>);
+
+// A queued spin lock is only taken by a guard, with its queue entry on the stack
+template <typename T>
+concept Lockable = requires(T& lock)
+{
+    lock.Lock();
+    lock.Unlock();
+    lock.LockAtDpc();
+    lock.UnlockFromDpc();
+};
+
+static_assert(Lockable<kl::SpinLock> && !Lockable<kl::QueuedSpinLock>);
+
+namespace
+{
+    // The former lock interface, a virtual call for each operation
+    class ILock
+    {
+    public:
+        virtual void Init() = 0;
+        virtual void Lock() = 0;
+        virtual void Unlock() = 0;
+    };
+
+    template <typename T>
+    class VirtualLock final : public ILock
+    {
+        T lock;
+
+    public:
+        void Init() override { lock.Init(); }
+        void Lock() override { lock.Lock(); }
+        void Unlock() override { lock.Unlock(); }
+    };
+}
+
+template <typename T>
+static void UncontendedBench(bench::State& state)
+{
+    T lock;
+    lock.Init();
+    state.Run([&] {
+        lock.Lock();
+        bench::ClobberMemory();
+        lock.Unlock();
+    });
+}
+
+// Every thread increments a shared counter under the lock
+template <typename T>
+static void ContendedBench(bench::State& state)
+{
+    constexpr uint64_t perThread = 100000;
+    auto threads = std::clamp(std::thread::hardware_concurrency(), 2u, 4u);
+    T lock;
+    lock.Init();
+    uint64_t counter = 0;
+
+    auto start = bench::Clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&] {
+            for (uint64_t i = 0; i < perThread; ++i)
+            {
+                kl::ExclusiveGuard guard(lock);
+                ++counter;
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench::Clock::now() - start).count();
+    if (counter != perThread * threads)
+    {
+        state.Fail("lost updates");
+        return;
+    }
+
+    state.Record(counter, ns);
+    state.Counter("threads", threads);
+}
+
+BENCHMARK(MutexUncontended, "lock/mutex/uncontended") { UncontendedBench<kl::Mutex>(state); }
+BENCHMARK(FastMutexUncontended, "lock/fast_mutex/uncontended") { UncontendedBench<kl::FastMutex>(state); }
+BENCHMARK(GuardedMutexUncontended, "lock/guarded_mutex/uncontended") { UncontendedBench<kl::GuardedMutex>(state); }
+BENCHMARK(SpinLockUncontended, "lock/spin_lock/uncontended") { UncontendedBench<kl::SpinLock>(state); }
+BENCHMARK(ExecutiveResourceUncontended, "lock/executive_resource/uncontended") { UncontendedBench<kl::ExecutiveResource>(state); }
+
+// Scoped guards, the previous IRQL or the queue handle on the stack
+template <typename T>
+static void GuardBench(bench::State& state)
+{
+    T lock;
+    lock.Init();
+    state.Run([&] {
+        kl::ExclusiveGuard guard(lock);
+        bench::ClobberMemory();
+    });
+}
+
+BENCHMARK(FastMutexGuard, "lock/fast_mutex/guard") { GuardBench<kl::FastMutex>(state); }
+BENCHMARK(SpinLockGuard, "lock/spin_lock/guard") { GuardBench<kl::SpinLock>(state); }
+BENCHMARK(QueuedSpinLockGuard, "lock/queued_spin_lock/guard") { GuardBench<kl::QueuedSpinLock>(state); }
+
+// Baseline: the same locks called through the interface they used to derive from. The object is
+// laundered so that the compiler cannot devirtualize the calls.
+template <typename T>
+static void VirtualBench(bench::State& state)
+{
+    VirtualLock<T> object;
+    ILock* lock = &object;
+    asm volatile("" : "+r"(lock));
+    lock->Init();
+    state.Run([&] {
+        lock->Lock();
+        bench::ClobberMemory();
+        lock->Unlock();
+    });
+}
+
+BENCHMARK(FastMutexVirtual, "lock/fast_mutex/virtual") { VirtualBench<kl::FastMutex>(state); }
+BENCHMARK(SpinLockVirtual, "lock/spin_lock/virtual") { VirtualBench<kl::SpinLock>(state); }
+
+BENCHMARK(ExecutiveResourceSharedUncontended, "lock/executive_resource/shared_uncontended")
+{
+    kl::ExecutiveResource lock;
+    lock.Init();
+    state.Run([&] {
+        kl::SharedGuard guard(lock);
+        bench::ClobberMemory();
+    });
+}
+
+BENCHMARK(MutexContended, "lock/mutex/contended") { ContendedBench<kl::Mutex>(state); }
+BENCHMARK(FastMutexContended, "lock/fast_mutex/contended") { ContendedBench<kl::FastMutex>(state); }
+BENCHMARK(GuardedMutexContended, "lock/guarded_mutex/contended") { ContendedBench<kl::GuardedMutex>(state); }
+BENCHMARK(SpinLockContended, "lock/spin_lock/contended") { ContendedBench<kl::SpinLock>(state); }
+BENCHMARK(QueuedSpinLockContended, "lock/queued_spin_lock/contended") { ContendedBench<kl::QueuedSpinLock>(state); }
+BENCHMARK(ExecutiveResourceContended, "lock/executive_resource/contended") { ContendedBench<kl::ExecutiveResource>(state); }
+
+BENCHMARK(PushLockUncontended, "lock/push_lock/uncontended") { UncontendedBench<kl::PushLock>(state); }
+BENCHMARK(SharedSpinLockUncontended, "lock/shared_spin_lock/uncontended") { UncontendedBench<kl::SharedSpinLock>(state); }
+BENCHMARK(PushLockContended, "lock/push_lock/contended") { ContendedBench<kl::PushLock>(state); }
+BENCHMARK(SharedSpinLockContended, "lock/shared_spin_lock/contended") { ContendedBench<kl::SharedSpinLock>(state); }
+
+// Read-mostly table: a lookup reads a few lines of it, an update rewrites all of it
+struct ReadTable
+{
+    static constexpr unsigned Entries = 64;
+    ULONGLONG entries[Entries] = {};
+
+    [[nodiscard]] auto Read(unsigned start) const -> ULONGLONG
+    {
+        ULONGLONG sum = 0;
+        for (unsigned i = 0; i < 8; ++i)
+            sum += entries[(start + i * 8) % Entries];
+        return sum;
+    }
+
+    // Every entry holds the same value between updates
+    [[nodiscard]] auto Consistent() const -> bool
+    {
+        for (auto entry : entries)
+        {
+            if (entry != entries[0])
+                return false;
+        }
+
+        return true;
+    }
+
+    void Update()
+    {
+        for (auto& entry : entries)
+            ++entry;
+    }
+};
+
+// Shared when the lock has a shared mode, exclusive otherwise
+template <typename T, typename F>
+static void Read(T& lock, F&& body)
+{
+    if constexpr (kl::SharedLockPolicy<typename T::Policy>)
+    {
+        kl::SharedGuard guard(lock);
+        body();
+    }
+    else
+    {
+        kl::ExclusiveGuard guard(lock);
+        body();
+    }
+}
+
+// Readers never see a half updated table, and the updates are not lost
+template <typename T>
+static auto CheckExclusion() -> bool
+{
+    constexpr unsigned Readers = 3;
+    constexpr unsigned Updates = 2000;
+    T lock;
+    lock.Init();
+    ReadTable table;
+    std::atomic<bool> torn = false;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < Readers; ++t)
+    {
+        workers.emplace_back([&] {
+            for (unsigned i = 0; i < Updates * 4; ++i)
+                Read(lock, [&] { torn = torn || !table.Consistent(); });
+        });
+    }
+
+    workers.emplace_back([&] {
+        for (unsigned i = 0; i < Updates; ++i)
+        {
+            kl::ExclusiveGuard guard(lock);
+            table.Update();
+        }
+    });
+
+    for (auto& worker : workers)
+        worker.join();
+    return !torn && table.entries[0] == Updates && table.Consistent();
+}
+
+// Every thread does the same number of lookups under the lock, ns_per_op is the wall time of one
+// lookup over all of them: it falls with the thread count as long as the readers scale.
+template <typename T>
+static void ReaderBench(bench::State& state, unsigned threads)
+{
+    if (threads == 1 && !CheckExclusion<T>())
+    {
+        state.Fail("a reader saw a partial update");
+        return;
+    }
+
+    constexpr uint64_t perThread = 1 << 16;
+    T lock;
+    lock.Init();
+    ReadTable table;
+    table.Update();
+    std::atomic<unsigned> ready = 0;
+    std::atomic<bool> go = false;
+    std::atomic<ULONGLONG> checksum = 0;
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            ++ready;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            ULONGLONG sum = 0;
+            for (uint64_t i = 0; i < perThread; ++i)
+                Read(lock, [&] { sum += table.Read((unsigned)i + t); });
+            checksum += sum;
+        });
+    }
+
+    while (ready < threads)
+        std::this_thread::yield();
+
+    auto start = bench::Clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers)
+        worker.join();
+
+    auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench::Clock::now() - start).count();
+    if (checksum != perThread * threads * 8)
+    {
+        state.Fail("lost reads");
+        return;
+    }
+
+    state.Record(perThread * threads, ns);
+    state.Counter("threads", threads);
+    state.Counter("reads_per_second", perThread * threads / ns * 1e9);
+}
+
+#define READER_BENCHMARKS(Function, Name, T) \
+    BENCHMARK(Function##Readers1, Name "/readers/1") { ReaderBench<T>(state, 1); } \
+    BENCHMARK(Function##Readers2, Name "/readers/2") { ReaderBench<T>(state, 2); } \
+    BENCHMARK(Function##Readers4, Name "/readers/4") { ReaderBench<T>(state, 4); } \
+    BENCHMARK(Function##Readers8, Name "/readers/8") { ReaderBench<T>(state, 8); } \
+    BENCHMARK(Function##Readers16, Name "/readers/16") { ReaderBench<T>(state, 16); } \
+    BENCHMARK(Function##Readers32, Name "/readers/32") { ReaderBench<T>(state, 32); } \
+    BENCHMARK(Function##Readers64, Name "/readers/64") { ReaderBench<T>(state, 64); }
+
+READER_BENCHMARKS(PushLock, "lock/push_lock", kl::PushLock)
+READER_BENCHMARKS(SharedSpinLock, "lock/shared_spin_lock", kl::SharedSpinLock)
+READER_BENCHMARKS(ExecutiveResource, "lock/executive_resource", kl::ExecutiveResource)
+READER_BENCHMARKS(FastMutex, "lock/fast_mutex", kl::FastMutex)
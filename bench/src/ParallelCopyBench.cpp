@@ -0,0 +1,205 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "ParallelCopy.h"
+#include "PosixFileIo.h"
+#include "Transform.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+// A 64 MiB dense file copied into its reserved backup by 1 to 32 workers. The helpers are
+// threads here, the copy helper threads of the volume in the driver; pread and pwrite take
+// concurrent calls as FltReadFile and FltWriteFile do at explicit offsets.
+static constexpr ULONGLONG FileSize = 64ull << 20;
+static constexpr ULONGLONG MinPiece = 1ull << 20;
+static constexpr ULONG BufferSize = 64 * 1024;
+
+namespace
+{
+    // Every write past Fail fails
+    struct FailingFileIo : PosixFileIo
+    {
+        ULONGLONG Fail;
+
+        NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size)
+        {
+            return offset >= Fail ? STATUS_DISK_FULL : PosixFileIo::Write(offset, buffer, size);
+        }
+    };
+
+    auto MakeSource(const bench::TempFile& source) -> bool
+    {
+        std::vector<UCHAR> data(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            for (size_t i = 0; i < data.size(); ++i)
+                data[i] = (UCHAR)((offset + i) * 131 >> 3);
+            if (pwrite(source.Fd, data.data(), data.size(), (off_t)offset) != (ssize_t)data.size())
+                return false;
+        }
+
+        return true;
+    }
+
+    // What CopyFileParallel (main.cpp) does, with a thread per helper
+    template <typename Io>
+    auto Copy(Io& io, const CopyPlan& plan, std::vector<std::vector<UCHAR>>& buffers, CopyStatistics& statistics) -> NTSTATUS
+    {
+        ParallelCopy<Io, XorTransform> copy(io, XorTransform{}, FileSize, plan);
+        std::vector<std::thread> helpers;
+        for (ULONG i = 1; i < plan.Workers; ++i)
+        {
+            copy.Enter();
+            helpers.emplace_back([&copy, &buffer = buffers[i]] { copy.Help(buffer.data(), BufferSize); });
+        }
+
+        auto status = copy.Join(buffers[0].data(), BufferSize, statistics);
+        for (auto& helper : helpers)
+            helper.join();
+        return status;
+    }
+
+    // What CopyFileParallel does when the helper threads are all busy: the helpers never run, the
+    // caller copies every piece and withdraws them
+    template <typename Io>
+    auto CopyWithdrawn(Io& io, const CopyPlan& plan, std::vector<UCHAR>& buffer, CopyStatistics& statistics) -> NTSTATUS
+    {
+        ParallelCopy<Io, XorTransform> copy(io, XorTransform{}, FileSize, plan);
+        for (ULONG i = 1; i < plan.Workers; ++i)
+            copy.Enter();
+        return copy.Join(buffer.data(), BufferSize, statistics, [&]() -> ULONG { return plan.Workers - 1; });
+    }
+
+    // The pieces cover the file once, aligned on the buffer, and a small file is not split
+    auto CheckPlans() -> const char*
+    {
+        const ULONGLONG sizes[] = { 0, 1, MinPiece, 2 * MinPiece - 1, 2 * MinPiece, 5 * MinPiece + 7, FileSize, 1ull << 40 };
+        for (auto size : sizes)
+        {
+            for (ULONG workers : { 1u, 2u, 3u, 8u, 32u })
+            {
+                auto plan = SplitFile(size, workers, MinPiece, BufferSize);
+                if (plan.Workers < 1 || plan.Workers > workers || (plan.Workers > 1 && plan.Workers > plan.Pieces))
+                    return "a plan has the wrong worker count";
+                if (size < 2 * MinPiece && plan.Workers != 1)
+                    return "a small file is split";
+                if (plan.Workers > 1 && (plan.PieceSize % BufferSize != 0 || plan.PieceSize < MinPiece))
+                    return "a piece is not aligned";
+                if (size && (plan.Pieces * plan.PieceSize < size || (plan.Pieces - 1) * plan.PieceSize >= size))
+                    return "the pieces do not cover the file";
+            }
+        }
+
+        return nullptr;
+    }
+
+    auto CheckBackup(const bench::TempFile& target) -> bool
+    {
+        std::vector<UCHAR> data(BufferSize);
+        std::vector<UCHAR> expected(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            if (pread(target.Fd, data.data(), data.size(), (off_t)offset) != (ssize_t)data.size())
+                return false;
+            for (size_t i = 0; i < expected.size(); ++i)
+                expected[i] = (UCHAR)((offset + i) * 131 >> 3);
+            XorTransform{}.Apply(expected.data(), BufferSize, offset);
+            if (data != expected)
+                return false;
+        }
+
+        struct stat info;
+        return fstat(target.Fd, &info) == 0 && (ULONGLONG)info.st_size == FileSize;
+    }
+
+    void RunCopy(bench::State& state, ULONG workers)
+    {
+        if (!bench::Verify(state, { CheckPlans }))
+            return;
+
+        bench::TempFile source("parallel");
+        bench::TempFile target("parallel");
+        if (source.Fd < 0 || target.Fd < 0 || !MakeSource(source))
+        {
+            state.Skip("cannot create the files in /tmp");
+            return;
+        }
+
+        PosixFileIo io = { source.Fd, target.Fd };
+        TargetLayout layout;
+        if (PrepareTarget(io, FileSize, false, 0, false, &layout) != STATUS_SUCCESS || layout != TargetLayout::Reserved)
+        {
+            state.Skip("cannot reserve the backup in /tmp");
+            return;
+        }
+
+        auto plan = SplitFile(FileSize, workers, MinPiece, BufferSize);
+        std::vector<std::vector<UCHAR>> buffers(plan.Workers, std::vector<UCHAR>(BufferSize));
+        CopyStatistics statistics;
+
+        // a failed write stops the copy, every worker is done when Join returns
+        FailingFileIo failing = { io, FileSize / 2 };
+        if (Copy(failing, plan, buffers, statistics) != STATUS_DISK_FULL)
+        {
+            state.Fail("a failed write is not returned");
+            return;
+        }
+
+        if (Copy(io, plan, buffers, statistics) != STATUS_SUCCESS || statistics.BytesRead != FileSize || statistics.BytesWritten != FileSize
+            || FinishTarget(io, FileSize, layout, statistics) != STATUS_SUCCESS || !CheckBackup(target))
+        {
+            state.Fail("the backup is not the transformed source");
+            return;
+        }
+
+        // withdrawn helpers are not waited for, the caller copies the whole file
+        if (CopyWithdrawn(io, plan, buffers[0], statistics) != STATUS_SUCCESS || statistics.BytesWritten != FileSize || !CheckBackup(target))
+        {
+            state.Fail("a copy with withdrawn helpers is not complete");
+            return;
+        }
+
+        auto ok = true;
+        state.Run([&] { ok &= Copy(io, plan, buffers, statistics) == STATUS_SUCCESS; });
+        if (!ok)
+        {
+            state.Fail("a copy failed");
+            return;
+        }
+
+        state.SetBytesPerOp(FileSize);
+        state.Counter("workers", plan.Workers);
+        state.Counter("pieces", plan.Pieces);
+    }
+}
+
+BENCHMARK(ParallelCopy1, "copy/parallel/1")
+{
+    RunCopy(state, 1);
+}
+
+BENCHMARK(ParallelCopy2, "copy/parallel/2")
+{
+    RunCopy(state, 2);
+}
+
+BENCHMARK(ParallelCopy4, "copy/parallel/4")
+{
+    RunCopy(state, 4);
+}
+
+BENCHMARK(ParallelCopy8, "copy/parallel/8")
+{
+    RunCopy(state, 8);
+}
+
+BENCHMARK(ParallelCopy16, "copy/parallel/16")
+{
+    RunCopy(state, 16);
+}
+
+BENCHMARK(ParallelCopy32, "copy/parallel/32")
+{
+    RunCopy(state, 32);
+}
@@ -0,0 +1,173 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "Directory.h"
+#include "Pool.h"
+#include "ProcessTable.h"
+#include "Protocol.h"
+#include "Session.h"
+#include "Shadow.h"
+#include "kl.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Allocation sizes used by the driver: the HandleFile copy buffer, a file name
+// buffer and the IsValidDirectory lowercase copy
+static void AllocFreeBench(bench::State& state, SIZE_T size)
+{
+    state.Run([&] {
+        auto p = ExAllocatePoolWithTag(PagedPool, size, KERNEL_LIB_TAG);
+        bench::DoNotOptimize(p);
+        ExFreePool(p);
+    });
+}
+
+BENCHMARK(PoolAllocFree7, "pool/alloc_free/7")
+{
+    AllocFreeBench(state, 7);
+}
+
+BENCHMARK(PoolAllocFree128, "pool/alloc_free/128")
+{
+    AllocFreeBench(state, 128);
+}
+
+BENCHMARK(PoolAllocFree1026, "pool/alloc_free/1026")
+{
+    AllocFreeBench(state, 1024 + sizeof(WCHAR));
+}
+
+namespace
+{
+    auto Counters(PoolAccounting& pool, PoolSubsystem subsystem) -> KappPoolCounters
+    {
+        KappPoolReport report;
+        pool.Snapshot(&report, false);
+        return report.Counters[(ULONG)subsystem];
+    }
+
+    // Current, peak and totals of a subsystem, peaks restart on request, threads leave nothing behind
+    auto CheckAccounting() -> const char*
+    {
+        auto pool = std::make_unique<PoolAccounting>();
+        auto a = pool->Allocate(PoolSubsystem::Copy, PagedPool, 100, 'tbkF');
+        auto b = pool->Allocate(PoolSubsystem::Copy, NonPagedPoolNx, 28, 'tbkF');
+        if (!a || !b || (ULONG_PTR)a % MEMORY_ALLOCATION_ALIGNMENT != 0 || (ULONG_PTR)b % MEMORY_ALLOCATION_ALIGNMENT != 0)
+            return "an accounted block is not aligned";
+
+        auto counters = Counters(*pool, PoolSubsystem::Copy);
+        if (counters.Bytes != 128 || counters.Blocks != 2 || counters.PeakBytes != 128 || counters.TotalBlocks != 2)
+            return "the blocks are not accounted";
+        if (Counters(*pool, PoolSubsystem::Session).TotalBlocks != 0)
+            return "a block is accounted to another subsystem";
+
+        pool->Free(a, 'tbkF');
+        pool->Charge(PoolSubsystem::Copy, 10);
+        counters = Counters(*pool, PoolSubsystem::Copy);
+        if (counters.Bytes != 38 || counters.Blocks != 2 || counters.PeakBytes != 128 || counters.TotalBytes != 138 || counters.TotalBlocks != 3)
+            return "a free is not accounted";
+
+        KappPoolReport report;
+        pool->Snapshot(&report, true);
+        if (report.Subsystems != KappPoolSubsystems || report.Counters[(ULONG)PoolSubsystem::Copy].PeakBytes != 128)
+            return "the snapshot before the reset lost the peak";
+
+        pool->Free(b, 'tbkF');
+        pool->Release(PoolSubsystem::Copy, 10);
+        counters = Counters(*pool, PoolSubsystem::Copy);
+        if (counters.Bytes != 0 || counters.PeakBytes != 38 || counters.PeakBlocks != 2 || pool->Outstanding() != 0)
+            return "the peak does not restart from the current value";
+
+        // each thread holds at most Held blocks at a time
+        constexpr unsigned Threads = 4, Rounds = 200, Held = 16;
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < Threads; ++t)
+        {
+            threads.emplace_back([&pool] {
+                PVOID blocks[Held];
+                for (unsigned round = 0; round < Rounds; ++round)
+                {
+                    for (auto& block : blocks)
+                        block = pool->Allocate(PoolSubsystem::Port, PagedPool, 64, 'tobF');
+                    for (auto block : blocks)
+                    {
+                        if (block)
+                            pool->Free(block, 'tobF');
+                    }
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+        counters = Counters(*pool, PoolSubsystem::Port);
+        if (counters.Blocks != 0 || counters.Bytes != 0 || counters.TotalBlocks != Threads * Rounds * Held
+            || counters.PeakBlocks < Held || counters.PeakBlocks > Threads * Held || counters.PeakBytes != counters.PeakBlocks * 64)
+            return "concurrent blocks are not accounted";
+
+        return nullptr;
+    }
+
+    // The portable subsystems of the driver, through their life cycle: every block goes back
+    auto CheckLeaks() -> const char*
+    {
+        auto outstanding = g_pool.Outstanding();
+        auto sessionPeak = Counters(g_pool, PoolSubsystem::Session).PeakBytes;
+
+        auto sessions = std::make_unique<SessionTable>();
+        sessions->Init(0, 20000000, 2500000);
+        for (int i = 0; i < 100; ++i)
+        {
+            bench::Name name(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\file" + std::to_wstring(i) + L".docx");
+            if (sessions->Touch(&name.String, (ULONGLONG)i) != STATUS_SUCCESS)
+                return "a session is not created";
+        }
+
+        bench::Name removed(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\file7.docx");
+        if (!sessions->Remove(&removed.String) || sessions->Expire(30000000) != 99)
+            return "the sessions do not expire";
+
+        bench::Name kept(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\kept.docx");
+        if (sessions->Touch(&kept.String, 30000000) != STATUS_SUCCESS)
+            return "a session is not created";
+        sessions->Clear();
+
+        auto shadow = std::make_unique<ShadowTable>();
+        for (int i = 0; i < 50; ++i)
+        {
+            bench::Name name(L"\\Device\\HarddiskVolume3\\Data\\" + std::to_wstring(i % 10) + L"\\file.txt");
+            if (shadow->Record(&name.String, true, 1, 1) != STATUS_SUCCESS)
+                return "a shadow directory is not recorded";
+        }
+        shadow->Clear();
+
+        ExclusionList exclusions;
+        const WCHAR images[] = L"\\??\\C:\\Agent\\backup.exe\0\\??\\C:\\Agent\\indexer.exe\0";
+        if (exclusions.Init(images, sizeof(images)) != STATUS_SUCCESS)
+            return "the exclusions are not read";
+        exclusions.Clear();
+
+        bench::Name directory(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\");
+        if (!IsValidDirectory(&directory.String))
+            return "a protected directory is not recognized";
+
+        if (g_pool.Outstanding() != outstanding)
+            return "a block leaks";
+        return Counters(g_pool, PoolSubsystem::Session).PeakBytes > sessionPeak ? nullptr : "the session peak is not raised";
+    }
+}
+
+// Accounted allocations of the same size, the header and five interlocked updates on each side
+BENCHMARK(PoolAccounted128, "pool/accounted/128")
+{
+    if (!bench::Verify(state, { CheckAccounting, CheckLeaks }))
+        return;
+
+    state.Run([&] {
+        auto p = g_pool.Allocate(PoolSubsystem::Port, PagedPool, 128, 'tobF');
+        bench::DoNotOptimize(p);
+        g_pool.Free(p, 'tobF');
+    });
+}
@@ -0,0 +1,175 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "PosixFileIo.h"
+#include "Transform.h"
+
+#include <vector>
+
+// Two 32 MiB backups written at the same time, flushed every 2 MiB: the file system allocates
+// the dirty ranges of both files at each flush, as the lazy writer does for concurrent backups
+static constexpr ULONGLONG FileSize = 32ull << 20;
+static constexpr ULONGLONG FlushSize = 2ull << 20;
+static constexpr ULONG BufferSize = 64 * 1024;
+static constexpr unsigned Copies = 5;
+
+namespace
+{
+    // The copy of a second backup runs along: each write of the first one is mirrored into it
+    struct ConcurrentFileIo : PosixFileIo
+    {
+        int Other = -1;
+        bool Reservable = true;
+        ULONGLONG Dirty = 0;
+
+        NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size)
+        {
+            auto status = PosixFileIo::Write(offset, buffer, size);
+            if (!NT_SUCCESS(status) || pwrite(Other, buffer, size, (off_t)offset) != (ssize_t)size)
+                return STATUS_UNSUCCESSFUL;
+
+            Dirty += size;
+            if (Dirty >= FlushSize)
+            {
+                Dirty = 0;
+                if (fdatasync(Target) != 0 || fdatasync(Other) != 0)
+                    return STATUS_UNSUCCESSFUL;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        NTSTATUS SetEndOfFile(ULONGLONG size)
+        {
+            auto status = PosixFileIo::SetEndOfFile(size);
+            return NT_SUCCESS(status) && ftruncate(Other, (off_t)size) == 0 ? status : STATUS_UNSUCCESSFUL;
+        }
+
+        // A file system without allocation size support, the writes extend the backups
+        NTSTATUS Reserve(ULONGLONG size)
+        {
+            if (!Reservable)
+                return STATUS_NOT_SUPPORTED;
+
+            auto status = PosixFileIo::Reserve(size);
+            return NT_SUCCESS(status) && fallocate(Other, 0, 0, (off_t)size) == 0 ? status : STATUS_NOT_SUPPORTED;
+        }
+    };
+
+    auto MakeSource(const bench::TempFile& source) -> bool
+    {
+        std::vector<UCHAR> data(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            for (size_t i = 0; i < data.size(); ++i)
+                data[i] = (UCHAR)((offset + i) * 131 >> 3);
+            if (pwrite(source.Fd, data.data(), data.size(), (off_t)offset) != (ssize_t)data.size())
+                return false;
+        }
+
+        return fsync(source.Fd) == 0;
+    }
+
+    // The backup transforms back to the source
+    auto CheckBackup(int source, int target) -> bool
+    {
+        struct stat info;
+        if (fstat(target, &info) != 0 || (ULONGLONG)info.st_size != FileSize)
+            return false;
+
+        std::vector<UCHAR> expected(BufferSize);
+        std::vector<UCHAR> actual(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            if (pread(source, expected.data(), BufferSize, (off_t)offset) != BufferSize
+                || pread(target, actual.data(), BufferSize, (off_t)offset) != BufferSize)
+                return false;
+
+            XorTransform{}.Apply(actual.data(), BufferSize, offset);
+            if (expected != actual)
+                return false;
+        }
+
+        return true;
+    }
+
+    // One backup of a dense source, as HandleFile does it. A new target has no size: it is never reused.
+    auto Copy(ConcurrentFileIo& io, bool reuse, UCHAR* buffer, TargetLayout* layout) -> bool
+    {
+        CopyStatistics statistics;
+        io.Dirty = 0;
+        return PrepareTarget(io, FileSize, false, reuse ? FileSize : 0, false, layout) == STATUS_SUCCESS
+            && CopyFileRanges(io, FileSize, XorTransform{}, buffer, BufferSize, statistics) == STATUS_SUCCESS
+            && FinishTarget(io, FileSize, *layout, statistics) == STATUS_SUCCESS
+            && fdatasync(io.Target) == 0 && fdatasync(io.Other) == 0;
+    }
+
+    void RunCopy(bench::State& state, TargetLayout expected)
+    {
+        bench::TempFile source("prealloc");
+        bench::TempFile target("prealloc");
+        bench::TempFile other("prealloc");
+        if (source.Fd < 0 || target.Fd < 0 || other.Fd < 0 || !MakeSource(source))
+        {
+            state.Skip("cannot create the files in /tmp");
+            return;
+        }
+
+        ConcurrentFileIo io;
+        io.Source = source.Fd;
+        io.Target = target.Fd;
+        io.Other = other.Fd;
+        io.Reservable = expected != TargetLayout::Extended;
+        auto reuse = expected == TargetLayout::Reused;
+        std::vector<UCHAR> buffer(BufferSize);
+
+        // a reused target was reserved by the backup before
+        TargetLayout layout;
+        if (reuse && !Copy(io, false, buffer.data(), &layout))
+        {
+            state.Fail("cannot write the first backup");
+            return;
+        }
+
+        for (unsigned i = 0; i < Copies; ++i)
+        {
+            auto start = bench::Clock::now();
+            auto copied = Copy(io, reuse, buffer.data(), &layout);
+            auto ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench::Clock::now() - start).count();
+            if (!copied || !CheckBackup(source.Fd, target.Fd))
+            {
+                state.Fail("the backup does not transform back to the source");
+                return;
+            }
+
+            if (layout != expected)
+            {
+                state.Skip("the file system of /tmp cannot reserve the allocation");
+                return;
+            }
+
+            state.Record(1, ns);
+        }
+
+        state.SetBytesPerOp(FileSize);
+        state.Counter("target_extents", (double)target.Extents());
+        state.Counter("source_extents", (double)source.Extents());
+    }
+}
+
+// Before: the target is truncated and each write extends it
+BENCHMARK(TargetExtend, "copy/target/extend")
+{
+    RunCopy(state, TargetLayout::Extended);
+}
+
+// The allocation of the whole backup is reserved before the first write
+BENCHMARK(TargetReserve, "copy/target/reserve")
+{
+    RunCopy(state, TargetLayout::Reserved);
+}
+
+// A backup of the same size is overwritten in place, its extents are kept
+BENCHMARK(TargetReuse, "copy/target/reuse")
+{
+    RunCopy(state, TargetLayout::Reused);
+}
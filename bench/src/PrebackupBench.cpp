@@ -0,0 +1,432 @@
+#include "Bench.h"
+#include "PosixDirectoryFs.h"
+#include "PosixFileIo.h"
+#include "Prebackup.h"
+#include "Transform.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <ftw.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr ULONG BufferSize = 64 * 1024;
+
+    // Backup policy over POSIX files, as HandleFile does it in prebackup mode: `.lock` next to the
+    // source, current when it has the size and the modification time of the source, and a record
+    // of the transform mode and key of the driver
+    struct PosixBackup
+    {
+        std::vector<UCHAR> Buffer = std::vector<UCHAR>(BufferSize);
+        std::map<std::string, ULONG> Refreshed;     // backups created or refreshed, by source
+        std::map<std::string, BackupRecord> Records;    // the KAPP.BACKUP attributes, by source
+        std::set<std::string> Writing;              // sources open by a writer, HasFileContext
+        TransformMode Mode = TransformMode::Xor;
+        ULONGLONG KeyId = 1;
+
+        NTSTATUS Refresh(PCUNICODE_STRING path, const DirectoryEntry&, ULONGLONG* copied)
+        {
+            *copied = 0;
+            auto source = PosixPath(path);
+            if (Writing.count(source))
+                return STATUS_SHARING_VIOLATION;
+
+            auto sourceFd = open(source.c_str(), O_RDONLY);
+            if (sourceFd < 0)
+                return STATUS_OBJECT_NAME_NOT_FOUND;
+
+            auto status = STATUS_SUCCESS;
+            struct stat sourceInfo;
+            struct stat targetInfo;
+            auto targetFd = -1;
+            if (fstat(sourceFd, &sourceInfo) != 0)
+                status = STATUS_UNSUCCESSFUL;
+            else if (sourceInfo.st_size > 0 && (targetFd = open((source + ".lock").c_str(), O_RDWR | O_CREAT, 0600)) < 0)
+                status = STATUS_ACCESS_DENIED;
+
+            auto& record = Records[source];
+            if (targetFd >= 0 && fstat(targetFd, &targetInfo) == 0
+                && !IsBackupCurrent(sourceInfo.st_size, FileTime(sourceInfo.st_mtim), targetInfo.st_size, FileTime(targetInfo.st_mtim), record, Mode, KeyId))
+            {
+                PosixFileIo io{ sourceFd, targetFd };
+                CopyStatistics statistics;
+                auto size = (ULONGLONG)sourceInfo.st_size;
+                timespec times[2] = { { 0, UTIME_OMIT }, sourceInfo.st_mtim };
+                if (ftruncate(targetFd, 0) != 0
+                    || CopyFileRanges(io, size, XorTransform{}, Buffer.data(), BufferSize, statistics) != STATUS_SUCCESS
+                    || ftruncate(targetFd, (off_t)size) != 0
+                    || futimens(targetFd, times) != 0)
+                {
+                    status = STATUS_UNSUCCESSFUL;
+                }
+                else
+                {
+                    record = { BackupRecord::CurrentVersion, Mode, KeyId, {} };
+                    *copied = size;
+                    ++Refreshed[source];
+                }
+            }
+
+            if (targetFd >= 0)
+                close(targetFd);
+            close(sourceFd);
+            return status;
+        }
+    };
+
+    using Scan = PrebackupScan<PosixDirectoryFs, PosixBackup>;
+
+    // Synthetic home directory: protected files among many that are not, an existing backup,
+    // a symbolic link loop and a tree deeper than the walker goes
+    struct Tree
+    {
+        char Root[40] = "/tmp/kbench-prebackup-XXXXXX";
+        bool Created = mkdtemp(Root) != nullptr;
+        std::wstring WindowsRoot;
+        ULONG Files = 0;        // files the scan walks
+        ULONG Protected = 0;    // files under a protected directory, backups excluded
+        ULONGLONG Bytes = 0;    // bytes of the protected files
+
+        Tree()
+        {
+            for (auto c = Root; *c; ++c)
+                WindowsRoot += *c == '/' ? L'\\' : (WCHAR)*c;
+
+            Created = Created
+                && Make("public", 96, 2048, false)
+                && Make("Documents/Secret", 48, 48 * 1024, true)
+                && Make("docs/private", 24, 16 * 1024, true)
+                && Make("docs/private/drafts", 16, 8 * 1024, true)
+                && Make("docs/notes", 32, 1024, false)
+                && Make("secret", 8, 32 * 1024, true)
+                && symlink(".", Path("docs/loop").c_str()) == 0;
+
+            // an existing backup is walked but never backed up itself
+            Created = Created && Write(Path("secret/old.txt.lock"), 1024);
+            ++Files;
+
+            // beyond MaxDepth: walked down to it, then skipped
+            std::string deep = "deep";
+            for (ULONG i = 0; Created && i < DirectoryWalker<PosixDirectoryFs>::MaxDepth + 4; ++i, deep += "/d")
+                Created = mkdir(Path(deep).c_str(), 0700) == 0;
+        }
+
+        ~Tree()
+        {
+            nftw(Root, [](const char* path, const struct stat*, int, FTW*) { return remove(path); }, 16, FTW_DEPTH | FTW_PHYS);
+        }
+
+        [[nodiscard]] auto Path(const std::string& relative) const -> std::string
+        {
+            return std::string(Root) + "/" + relative;
+        }
+
+        static auto Write(const std::string& path, size_t size) -> bool
+        {
+            std::vector<UCHAR> data(size);
+            for (size_t i = 0; i < size; ++i)
+                data[i] = (UCHAR)(i * 13 + path.size());
+
+            auto fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            auto ok = fd >= 0 && write(fd, data.data(), size) == (ssize_t)size;
+            if (fd >= 0)
+                close(fd);
+            return ok;
+        }
+
+        auto Make(const std::string& directory, ULONG count, size_t size, bool protect) -> bool
+        {
+            std::string path;
+            for (size_t end = 0; end != std::string::npos;)
+            {
+                end = directory.find('/', end + 1);
+                path = Path(directory.substr(0, end));
+                if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+                    return false;
+            }
+
+            for (ULONG i = 0; i < count; ++i)
+            {
+                // mixed case names, the enumeration order is case insensitive
+                auto name = path + "/" + (i % 3 == 0 ? "File" : "file") + std::to_string(i) + ".txt";
+                if (!Write(name, size + i))
+                    return false;
+
+                ++Files;
+                Protected += protect;
+                Bytes += protect ? size + i : 0;
+            }
+
+            return true;
+        }
+
+        [[nodiscard]] auto Name() -> UNICODE_STRING
+        {
+            UNICODE_STRING name;
+            name.Buffer = WindowsRoot.data();
+            name.Length = (USHORT)(WindowsRoot.size() * sizeof(WCHAR));
+            name.MaximumLength = name.Length;
+            return name;
+        }
+
+        // Removes the backups made by the scan
+        void Reset(const PosixBackup& backup) const
+        {
+            for (auto& [source, count] : backup.Refreshed)
+                unlink((source + ".lock").c_str());
+        }
+    };
+
+    // Runs a scan to its end on a simulated clock, returns the time it waited
+    auto RunScan(Scan& scan, ULONGLONG now = 0) -> ULONGLONG
+    {
+        auto start = now;
+        for (;;)
+        {
+            ULONGLONG wait = 0;
+            if (scan.Run(now, &wait) != STATUS_PENDING)
+                return now - start;
+            now += wait;
+        }
+    }
+
+    // The backups transform back to their sources
+    auto CheckBackups(const PosixBackup& backup) -> bool
+    {
+        for (auto& [source, count] : backup.Refreshed)
+        {
+            auto sourceFd = open(source.c_str(), O_RDONLY);
+            auto targetFd = open((source + ".lock").c_str(), O_RDONLY);
+            std::vector<UCHAR> expected(BufferSize);
+            std::vector<UCHAR> actual(BufferSize);
+            auto ok = sourceFd >= 0 && targetFd >= 0;
+            for (off_t offset = 0; ok; offset += BufferSize)
+            {
+                auto read = pread(sourceFd, expected.data(), BufferSize, offset);
+                ok = read >= 0 && pread(targetFd, actual.data(), BufferSize, offset) == read;
+                if (read <= 0)
+                    break;
+
+                XorTransform{}.Apply(actual.data(), (ULONG)read, (ULONGLONG)offset);
+                ok = ok && std::equal(expected.begin(), expected.begin() + read, actual.begin());
+            }
+
+            if (sourceFd >= 0)
+                close(sourceFd);
+            if (targetFd >= 0)
+                close(targetFd);
+            if (!ok)
+                return false;
+        }
+
+        return true;
+    }
+
+    auto Touch(const std::string& path, time_t seconds) -> bool
+    {
+        timespec times[2] = { { 0, UTIME_OMIT }, { seconds, 0 } };
+        return Tree::Write(path, 4096) && utimensat(AT_FDCWD, path.c_str(), times, 0) == 0;
+    }
+
+    auto CheckScans(Tree& tree) -> const char*
+    {
+        auto root = tree.Name();
+        PosixDirectoryFs fs;
+        PosixBackup backup;
+        auto scan = std::make_unique<Scan>();
+
+        // the initial scan backs up the protected files, and only them
+        if (scan->Start(&fs, &backup, &root, nullptr, 0, 0) != STATUS_SUCCESS)
+            return "cannot start the scan";
+        RunScan(*scan);
+        auto& statistics = scan->Statistics();
+        if (statistics.Files != tree.Files || statistics.Protected != tree.Protected || statistics.BackedUp != tree.Protected
+            || statistics.BytesCopied != tree.Bytes || statistics.Failed != 0 || backup.Refreshed.size() != tree.Protected
+            || scan->Skipped() != 1)
+            return "the initial scan does not back up the protected files";
+        if (!CheckBackups(backup))
+            return "a backup does not transform back to its source";
+
+        // nothing changed, every backup is current
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        if (statistics.Current != tree.Protected || statistics.BackedUp != 0)
+            return "the second scan copies current backups";
+
+        // backups made with another key, as after the XOR key of a new load, or another mode are
+        // made again, then current with the new ones
+        for (auto change : { 0, 1 })
+        {
+            if (change == 0)
+                ++backup.KeyId;
+            else
+                backup.Mode = TransformMode::Aes128Ctr;
+            (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+            RunScan(*scan);
+            if (statistics.BackedUp != tree.Protected || statistics.Current != 0)
+                return "a backup of another key or mode is current";
+        }
+
+        backup.Mode = TransformMode::Xor;
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        if (statistics.Current != tree.Protected || statistics.BackedUp != 0)
+            return "the backups of the new key are not current";
+        for (auto& [source, count] : backup.Refreshed)
+            count = 1;
+
+        // a modified file, and only it, is backed up again
+        auto modified = tree.Path("docs/private/drafts/file5.txt");
+        if (!Touch(modified, 1700000000))
+            return "cannot modify a file";
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        if (statistics.BackedUp != 1 || backup.Refreshed[modified] != 2)
+            return "the modified file is not backed up again";
+
+        // a file open by a writer is left to its first write, then backed up by the next scan
+        if (!Touch(modified, 1700000100))
+            return "cannot modify a file";
+        backup.Writing.insert(modified);
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        if (statistics.Busy != 1 || statistics.Failed != 0 || statistics.BackedUp != 0)
+            return "a file open by a writer is not left to it";
+        backup.Writing.clear();
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        if (statistics.Busy != 0 || statistics.BackedUp != 1 || backup.Refreshed[modified] != 3)
+            return "a file no longer written is not backed up";
+
+        // a scan cancelled after a slice resumes after its bookmark: each file is handled once
+        tree.Reset(backup);
+        backup.Refreshed.clear();
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        ULONGLONG wait = 0;
+        if (scan->Run(0, &wait) != STATUS_PENDING)
+            return "the scan does not stop between slices";
+        std::wstring bookmark(scan->Bookmark()->Buffer, scan->Bookmark()->Length / sizeof(WCHAR));
+        auto first = statistics;
+        scan->Stop();
+
+        UNICODE_STRING resume;
+        resume.Buffer = bookmark.data();
+        resume.Length = (USHORT)(bookmark.size() * sizeof(WCHAR));
+        resume.MaximumLength = resume.Length;
+        (void)scan->Start(&fs, &backup, &root, &resume, 0, 0);
+        RunScan(*scan);
+        // (the backups made before the bookmark are walked too, the ones sorting after it)
+        if (first.Protected + statistics.Protected != tree.Protected || first.BackedUp + statistics.BackedUp != tree.Protected
+            || backup.Refreshed.size() != tree.Protected)
+            return "the resumed scan misses or repeats files";
+        for (auto& [source, count] : backup.Refreshed)
+        {
+            if (count != 1)
+                return "the resumed scan backs a file up twice";
+        }
+
+        // the rate limit spreads the copies: the waits add up to the cost past the initial burst,
+        // short of the debt left by the last file
+        constexpr ULONGLONG Rate = 1 << 20;
+        tree.Reset(backup);
+        (void)scan->Start(&fs, &backup, &root, nullptr, Rate, 0);
+        auto elapsed = RunScan(*scan);
+        auto cost = statistics.Protected * Scan::FileCost + statistics.BytesCopied;
+        auto expected = (cost - Rate) * 10000000 / Rate;
+        auto slack = (64 * 1024 + Scan::FileCost) * 10000000 / Rate;
+        if (elapsed > expected + 1000 || elapsed + slack < expected)
+            return "the rate limit does not pace the scan";
+
+        tree.Reset(backup);
+        return nullptr;
+    }
+
+    // Full scans, timed one by one. `initial` removes the backups before each scan, untimed.
+    void RunScans(bench::State& state, bool initial)
+    {
+        Tree tree;
+        if (!tree.Created)
+        {
+            state.Skip("cannot create the tree in /tmp");
+            return;
+        }
+
+        if (initial)
+        {
+            if (auto error = CheckScans(tree))
+            {
+                state.Fail(error);
+                return;
+            }
+        }
+
+        auto root = tree.Name();
+        PosixDirectoryFs fs;
+        PosixBackup backup;
+        auto scan = std::make_unique<Scan>();
+        (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+        RunScan(*scan);
+        for (unsigned i = 0; i < state.GetOptions().samples; ++i)
+        {
+            if (initial)
+                tree.Reset(backup);
+
+            auto start = bench::Clock::now();
+            (void)scan->Start(&fs, &backup, &root, nullptr, 0, 0);
+            RunScan(*scan);
+            state.Record(1, (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench::Clock::now() - start).count());
+        }
+
+        auto& statistics = scan->Statistics();
+        state.Counter("files", statistics.Files);
+        state.Counter("backed_up", statistics.BackedUp);
+        state.Counter("current", statistics.Current);
+        state.Counter("bytes_copied", (double)statistics.BytesCopied);
+        tree.Reset(backup);
+    }
+}
+
+// Every protected file is copied: the work taken off the first writes
+BENCHMARK(PrebackupScanInitial, "prebackup/scan/initial")
+{
+    RunScans(state, true);
+}
+
+// The steady state: the walk and one freshness check per protected file
+BENCHMARK(PrebackupScanCurrent, "prebackup/scan/current")
+{
+    RunScans(state, false);
+}
+
+// The walk alone
+BENCHMARK(PrebackupWalk, "prebackup/walk")
+{
+    Tree tree;
+    if (!tree.Created)
+    {
+        state.Skip("cannot create the tree in /tmp");
+        return;
+    }
+
+    auto root = tree.Name();
+    PosixDirectoryFs fs;
+    auto walker = std::make_unique<DirectoryWalker<PosixDirectoryFs>>();
+    ULONG files = 0;
+    state.Run([&] {
+        (void)walker->Start(&fs, &root, nullptr);
+        DirectoryEntry entry;
+        for (files = 0; walker->Next(&entry) == STATUS_SUCCESS; ++files)
+            bench::DoNotOptimize(entry);
+    });
+
+    if (files != tree.Files)
+        state.Fail("the walk misses files");
+    state.Counter("files", files);
+}
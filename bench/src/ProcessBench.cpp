@@ -0,0 +1,255 @@
+#include "Bench.h"
+#include "CreateFilter.h"
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    auto Pid(ULONG_PTR value) -> HANDLE
+    {
+        return (HANDLE)(value * 4);
+    }
+
+    // The table lives in pool memory in the driver, Init does all the set up
+    auto MakeTable(ULONG excluded) -> std::unique_ptr<ProcessTable>
+    {
+        auto table = std::make_unique<ProcessTable>();
+        table->Init();
+        for (ULONG i = 1; i <= excluded; ++i)
+            (void)table->Set(Pid(i * 37), ProcessPolicy::Exclude);
+        return table;
+    }
+
+    // Random sets and removes against a reference map, on few process ids to get long clusters
+    auto CheckTable() -> bool
+    {
+        auto table = MakeTable(0);
+        std::unordered_map<ULONG_PTR, ProcessPolicy> reference;
+        std::mt19937 random(42);
+        for (int i = 0; i < 200000; ++i)
+        {
+            auto pid = random() % 1500 + 1;
+            if (random() % 2)
+            {
+                auto status = table->Set(Pid(pid), ProcessPolicy::Exclude);
+                if (status == STATUS_SUCCESS)
+                    reference[pid] = ProcessPolicy::Exclude;
+                else if (status != STATUS_INSUFFICIENT_RESOURCES || table->Count() != 1024 || reference.count(pid))
+                    return false;
+            }
+            else if (table->Remove(Pid(pid)) != (reference.erase(pid) == 1))
+            {
+                return false;
+            }
+
+            if (table->Count() != reference.size())
+                return false;
+        }
+
+        for (ULONG_PTR pid = 1; pid <= 1500; ++pid)
+        {
+            auto expected = reference.count(pid) ? ProcessPolicy::Exclude : ProcessPolicy::Monitor;
+            if (table->Lookup(Pid(pid)) != expected)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Lookups running along with a writer never see a policy the process does not have
+    auto CheckConcurrentLookups(ULONG& misses) -> bool
+    {
+        auto table = MakeTable(0);
+        for (ULONG_PTR pid = 1; pid <= 256; ++pid)
+            (void)table->Set(Pid(pid * 2), ProcessPolicy::Exclude);
+
+        std::atomic<bool> stop{ false };
+        std::thread writer([&] {
+            std::mt19937 random(7);
+            while (!stop)
+            {
+                auto pid = (random() % 256) * 2 + 1;    // odd: churned
+                (void)table->Set(Pid(pid), ProcessPolicy::Exclude);
+                table->Remove(Pid(pid));
+            }
+        });
+
+        auto ok = true;
+        misses = 0;
+        for (int round = 0; round < 2000 && ok; ++round)
+        {
+            for (ULONG_PTR pid = 1; pid <= 256; ++pid)
+            {
+                // a stable entry can be missed while a removal moves it, never reported for an absent process
+                misses += table->Lookup(Pid(pid * 2)) != ProcessPolicy::Exclude;
+                ok = ok && table->Lookup(Pid(pid * 2 + 1024)) == ProcessPolicy::Monitor;
+            }
+        }
+
+        stop = true;
+        writer.join();
+        return ok;
+    }
+
+    auto Match(const ExclusionList& list, std::wstring image) -> bool
+    {
+        UNICODE_STRING name;
+        name.Buffer = image.data();
+        name.Length = (USHORT)(image.size() * sizeof(WCHAR));
+        name.MaximumLength = name.Length;
+        return list.Match(&name);
+    }
+
+    // REG_MULTI_SZ, as read from the service key
+    const WCHAR Exclusions[] = L"\\??\\C:\\Windows\\System32\\SearchIndexer.exe\0\\??\\C:\\Windows\\System32\\SearchProtocolHost.exe\0"
+        L"\\??\\C:\\ProgramData\\Microsoft\\Windows Defender\\Platform\\MsMpEng.exe\0\\??\\C:\\Program Files\\Agent\\agent.exe\0";
+
+    auto CheckExclusions() -> bool
+    {
+        ExclusionList list;
+        if (list.Init(Exclusions, sizeof(Exclusions)) != STATUS_SUCCESS || list.Empty() || list.Rejected() != 0)
+            return false;
+
+        // the whole image path, a copy of the image elsewhere is filtered
+        auto ok = Match(list, L"\\??\\C:\\Windows\\System32\\searchindexer.EXE")
+            && Match(list, L"\\??\\C:\\Program Files\\Agent\\agent.exe")
+            && !Match(list, L"\\??\\C:\\Users\\alice\\agent.exe")
+            && !Match(list, L"\\??\\C:\\Users\\alice\\SearchIndexer.exe")
+            && !Match(list, L"\\??\\C:\\Windows\\System32\\SearchIndexer.exe.exe");
+        list.Clear();
+
+        // bare names are rejected, the full paths next to them are kept
+        const WCHAR mixed[] = L"SearchIndexer.exe\0\\??\\C:\\Program Files\\Agent\\agent.exe\0MsMpEng.exe\0";
+        ok = ok && list.Init(mixed, sizeof(mixed)) == STATUS_SUCCESS && list.Rejected() == 2
+            && Match(list, L"\\??\\C:\\Program Files\\Agent\\agent.exe")
+            && !Match(list, L"\\??\\C:\\Users\\alice\\SearchIndexer.exe");
+        list.Clear();
+
+        // a value of bare names only leaves the list empty
+        const WCHAR bare[] = L"SearchIndexer.exe\0";
+        ok = ok && list.Init(bare, sizeof(bare)) == STATUS_SUCCESS && list.Empty() && list.Rejected() == 1;
+        list.Clear();
+
+        // an empty value is a single terminator
+        std::wstring empty(1, L'\0');
+        ok = ok && list.Init(empty.data(), sizeof(WCHAR)) == STATUS_SUCCESS && list.Empty();
+        return ok;
+    }
+
+    auto Options(ULONG disposition, ULONG options) -> ULONG
+    {
+        return disposition << 24 | options;
+    }
+
+    auto CheckDecisions() -> bool
+    {
+        auto table = MakeTable(1);
+        auto excluded = Pid(37);
+        auto other = Pid(38);
+        return !NeedsPostCreate(UserMode, FILE_READ_DATA, Options(FILE_OPEN, 0), table.get(), other)
+            && !NeedsPostCreate(KernelMode, FILE_WRITE_DATA, Options(FILE_OPEN, 0), table.get(), other)
+            && !NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_CREATE, 0), table.get(), other)
+            && !NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_OPEN_IF, FILE_DIRECTORY_FILE), table.get(), other)
+            && !NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_OPEN, 0), table.get(), excluded)
+            && NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_OPEN, 0), table.get(), other)
+            && NeedsPostCreate(UserMode, FILE_WRITE_DATA | FILE_READ_DATA, Options(FILE_OVERWRITE_IF, FILE_NON_DIRECTORY_FILE), nullptr, excluded);
+    }
+
+    void RunLookup(bench::State& state, ULONG_PTR first)
+    {
+        auto table = MakeTable(64);
+        ULONG_PTR i = 0;
+        state.Run([&] {
+            bench::DoNotOptimize(table->Lookup(Pid((first + (i++ & 63)) * 37)));
+        });
+    }
+}
+
+BENCHMARK(ProcessLookupHit, "process/lookup/hit")
+{
+    ULONG misses = 0;
+    if (!CheckTable() || !CheckConcurrentLookups(misses))
+    {
+        state.Fail("process table does not match the reference map");
+        return;
+    }
+
+    RunLookup(state, 1);
+    state.Counter("concurrent_misses", misses);
+}
+
+BENCHMARK(ProcessLookupMiss, "process/lookup/miss")
+{
+    RunLookup(state, 1000);
+}
+
+// The notify routines of an excluded process: start and exit
+BENCHMARK(ProcessSetRemove, "process/set_remove")
+{
+    auto table = MakeTable(64);
+    ULONG_PTR i = 0;
+    state.Run([&] {
+        auto pid = Pid(100000 + (i++ & 1023));
+        (void)table->Set(pid, ProcessPolicy::Exclude);
+        table->Remove(pid);
+    });
+}
+
+BENCHMARK(ProcessExclusionsMatch, "process/exclusions/match")
+{
+    if (!CheckExclusions())
+    {
+        state.Fail("unexpected exclusion match");
+        return;
+    }
+
+    ExclusionList list;
+    (void)list.Init(Exclusions, sizeof(Exclusions));
+    std::wstring image = L"\\??\\C:\\Program Files\\Microsoft Office\\root\\Office16\\WINWORD.EXE";
+    UNICODE_STRING name;
+    name.Buffer = image.data();
+    name.Length = (USHORT)(image.size() * sizeof(WCHAR));
+    name.MaximumLength = name.Length;
+    state.Run([&] { bench::DoNotOptimize(list.Match(&name)); });
+    list.Clear();
+}
+
+// Read only opens, most of the creates, rejected without a post-operation callback
+BENCHMARK(PreCreateReadOnly, "precreate/decide/read_only")
+{
+    if (!CheckDecisions())
+    {
+        state.Fail("unexpected pre-create decision");
+        return;
+    }
+
+    auto table = MakeTable(64);
+    ULONG_PTR i = 0;
+    state.Run([&] {
+        bench::DoNotOptimize(NeedsPostCreate(UserMode, FILE_READ_DATA, Options(FILE_OPEN, 0), table.get(), Pid(i++ & 1023)));
+    });
+}
+
+BENCHMARK(PreCreateExcluded, "precreate/decide/write_excluded")
+{
+    auto table = MakeTable(64);
+    ULONG_PTR i = 0;
+    state.Run([&] {
+        bench::DoNotOptimize(NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_OPEN, 0), table.get(), Pid((1 + (i++ & 63)) * 37)));
+    });
+}
+
+BENCHMARK(PreCreateMonitored, "precreate/decide/write_monitored")
+{
+    auto table = MakeTable(64);
+    ULONG_PTR i = 0;
+    state.Run([&] {
+        bench::DoNotOptimize(NeedsPostCreate(UserMode, FILE_WRITE_DATA, Options(FILE_OPEN, 0), table.get(), Pid((1000 + (i++ & 63)) * 37)));
+    });
+}
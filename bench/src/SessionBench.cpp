@@ -0,0 +1,182 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "Session.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Simulated time, in KeQueryInterruptTime units
+static constexpr ULONGLONG Millisecond = 10000;
+static constexpr ULONGLONG Window = 2000 * Millisecond;
+static constexpr ULONGLONG Tick = 250 * Millisecond;
+
+namespace
+{
+    auto MakeNames(size_t count) -> std::vector<bench::Name>
+    {
+        std::vector<bench::Name> names;
+        names.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            names.emplace_back(L"\\Device\\HarddiskVolume3\\Users\\alice\\secret\\file" + std::to_wstring(i) + L".docx");
+        return names;
+    }
+
+    // The table lives in pool memory in the driver, Init does all the set up
+    auto MakeTable(ULONGLONG now) -> std::unique_ptr<SessionTable>
+    {
+        auto table = std::make_unique<SessionTable>();
+        table->Init(now, Window, Tick);
+        return table;
+    }
+
+    // Session life cycle against a simulated clock
+    auto CheckLifeCycle() -> bool
+    {
+        auto table = MakeTable(0);
+        bench::Name name(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\report.docx");
+        bench::Name upper(L"\\DEVICE\\HARDDISKVOLUME3\\USERS\\ALICE\\SECRET\\REPORT.DOCX");
+
+        auto ok = table->Touch(&name.String, 0) == STATUS_SUCCESS
+            && table->Find(&upper.String, 1000 * Millisecond)           // names are case insensitive
+            && !table->Find(&name.String, Window)                       // expired, even before the wheel ran
+            && table->Touch(&name.String, 1500 * Millisecond) == STATUS_SUCCESS  // extended to 3.5s
+            && table->Find(&name.String, 3000 * Millisecond)
+            && table->Count() == 1
+            && table->Expire(3400 * Millisecond) == 0
+            && table->Expire(3750 * Millisecond) == 1
+            && table->Count() == 0
+            && !table->Find(&name.String, 3750 * Millisecond);
+
+        // rename or delete
+        ok = ok && table->Touch(&name.String, 4000 * Millisecond) == STATUS_SUCCESS
+            && table->Remove(&upper.String)
+            && !table->Find(&name.String, 4000 * Millisecond)
+            && table->Count() == 0
+            && table->Expire(10000 * Millisecond) == 0;
+
+        // a name longer than the keys kept on the stack, its key is in pool memory
+        bench::Name longName(L"\\Device\\HarddiskVolume3\\" + std::wstring(300, L'a') + L".docx");
+        bench::Name longUpper(L"\\DEVICE\\HARDDISKVOLUME3\\" + std::wstring(300, L'A') + L".DOCX");
+        ok = ok && table->Touch(&longName.String, 11000 * Millisecond) == STATUS_SUCCESS
+            && table->Find(&longUpper.String, 11000 * Millisecond)
+            && table->Remove(&longUpper.String)
+            && table->Count() == 0;
+
+        // sessions due several revolutions of the wheel later stay scheduled
+        auto names = MakeNames(1000);
+        for (size_t i = 0; i < names.size(); ++i)
+            ok = ok && table->Touch(&names[i].String, 20000 * Millisecond + i * 97 * Millisecond) == STATUS_SUCCESS;
+
+        ULONG expired = 0;
+        for (ULONGLONG now = 20000 * Millisecond; now < 200000 * Millisecond; now += 333 * Millisecond)
+        {
+            expired += table->Expire(now);
+            for (size_t i = 0; i < names.size(); ++i)
+            {
+                // a session is reclaimed once expired, and no earlier than that
+                auto expires = 20000 * Millisecond + i * 97 * Millisecond + Window;
+                if (table->Find(&names[i].String, now) != (now < expires))
+                    return false;
+            }
+        }
+
+        ok = ok && expired == names.size() && table->Count() == 0;
+
+        // a long idle period is a single pass over the wheel
+        ok = ok && table->Touch(&name.String, 0) == STATUS_SUCCESS
+            && table->Expire(3600 * 1000 * Millisecond) == 1;
+        table->Clear();
+        return ok;
+    }
+
+    // Editor pattern: open, write, close every `period` for `duration`.
+    // Returns the number of full backups, the first write of an open without a live session.
+    auto SimulateSaves(ULONGLONG period, ULONGLONG duration, bool sessions) -> ULONG
+    {
+        auto table = MakeTable(0);
+        bench::Name name(L"\\Device\\HarddiskVolume3\\Users\\alice\\secret\\main.cpp");
+        ULONG backups = 0;
+        for (ULONGLONG now = 0; now < duration; now += period)
+        {
+            table->Expire(now);
+            if (!sessions || !table->Find(&name.String, now))
+                ++backups;
+
+            if (sessions)
+                (void)table->Touch(&name.String, now + period / 2);
+        }
+
+        table->Clear();
+        return backups;
+    }
+}
+
+BENCHMARK(SessionFindHit, "session/find/hit")
+{
+    if (!CheckLifeCycle())
+    {
+        state.Fail("session life cycle does not match the simulated clock");
+        return;
+    }
+
+    auto names = MakeNames(4096);
+    auto table = MakeTable(0);
+    for (auto& name : names)
+        (void)table->Touch(&name.String, 0);
+
+    size_t i = 0;
+    state.Run([&] {
+        bench::DoNotOptimize(table->Find(&names[i++ & 4095].String, Millisecond));
+    });
+
+    // 100ms save cycles for 10s, a 2s window
+    auto without = SimulateSaves(100 * Millisecond, 10000 * Millisecond, false);
+    auto with = SimulateSaves(100 * Millisecond, 10000 * Millisecond, true);
+    state.Counter("backups_without_sessions", without);
+    state.Counter("backups_with_sessions", with);
+    table->Clear();
+}
+
+BENCHMARK(SessionFindMiss, "session/find/miss")
+{
+    auto names = MakeNames(4096);
+    auto table = MakeTable(0);
+    for (size_t i = 0; i < names.size(); i += 2)
+        (void)table->Touch(&names[i].String, 0);
+
+    size_t i = 1;
+    state.Run([&] {
+        bench::DoNotOptimize(table->Find(&names[i & 4095].String, Millisecond));
+        i += 2;
+    });
+    table->Clear();
+}
+
+BENCHMARK(SessionTouch, "session/touch/existing")
+{
+    auto names = MakeNames(4096);
+    auto table = MakeTable(0);
+    ULONGLONG now = 0;
+    size_t i = 0;
+    state.Run([&] {
+        (void)table->Touch(&names[i++ & 4095].String, now);
+        now += 1000;
+    });
+    table->Clear();
+}
+
+// Create a session, let it expire: allocation, wheel insertion and reclaim
+BENCHMARK(SessionChurn, "session/churn")
+{
+    auto names = MakeNames(256);
+    auto table = MakeTable(0);
+    ULONGLONG now = 0;
+    size_t i = 0;
+    state.Run([&] {
+        (void)table->Touch(&names[i++ & 255].String, now);
+        now += Millisecond;
+        table->Expire(now);
+    });
+    table->Clear();
+}
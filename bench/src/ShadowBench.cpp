@@ -0,0 +1,248 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "PosixFileIo.h"
+#include "Protocol.h"
+#include "Shadow.h"
+#include "Transform.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+static constexpr ULONGLONG FileSize = 4ull << 20;
+static constexpr ULONG BufferSize = 64 * 1024;
+
+namespace
+{
+    struct Directory
+    {
+        std::wstring Name;
+        KappShadowDirectory Record;
+    };
+
+    // The records of a snapshot, as uapp reads them
+    auto Parse(const std::vector<UCHAR>& buffer, ULONG written, KappShadowReport* report) -> std::vector<Directory>
+    {
+        std::vector<Directory> directories;
+        *report = *(const KappShadowReport*)buffer.data();
+        size_t offset = sizeof(KappShadowReport);
+        for (uint32_t i = 0; i < report->Records && offset + sizeof(KappShadowDirectory) <= written; ++i)
+        {
+            auto record = (const KappShadowDirectory*)(buffer.data() + offset);
+            if (record->Size % 8 != 0 || record->Size < sizeof(KappShadowDirectory) + record->NameLength || offset + record->Size > written)
+                break;
+
+            auto name = (const WCHAR*)(record + 1);
+            directories.push_back({ std::wstring(name, record->NameLength / sizeof(WCHAR)), *record });
+            offset += record->Size;
+        }
+
+        return directories;
+    }
+
+    auto Snapshot(const ShadowTable& table, std::vector<UCHAR>& buffer, KappShadowReport* report) -> std::vector<Directory>
+    {
+        ULONG written = 0;
+        if (table.Snapshot(buffer.data(), (ULONG)buffer.size(), &written) != STATUS_SUCCESS)
+            written = 0;
+        RtlZeroMemory(report, sizeof(*report));
+        return written != 0 ? Parse(buffer, written, report) : std::vector<Directory>();
+    }
+
+    auto Record(ShadowTable& table, const wchar_t* fileName, bool copied, ULONGLONG bytes, ULONGLONG latency) -> bool
+    {
+        bench::Name name(fileName);
+        return table.Record(&name.String, copied, bytes, latency) == STATUS_SUCCESS;
+    }
+
+    // Files are summed per directory, case insensitively; the snapshot holds whole records
+    auto CheckTable() -> const char*
+    {
+        auto table = std::make_unique<ShadowTable>();
+        if (!Record(*table, L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\a.docx", true, 100, 10)
+            || !Record(*table, L"\\Device\\HarddiskVolume3\\USERS\\ALICE\\SECRET\\b.docx", true, 50, 30)
+            || !Record(*table, L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\c.docx", false, 0, 5)
+            || !Record(*table, L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\Old\\d.docx", true, 7, 1))
+            return "a file is not recorded";
+
+        std::vector<UCHAR> buffer(64 * 1024);
+        KappShadowReport report;
+        auto directories = Snapshot(*table, buffer, &report);
+        if (report.Directories != 2 || report.Records != 2 || directories.size() != 2 || report.Dropped != 0)
+            return "the files are not summed per directory";
+
+        for (const auto& directory : directories)
+        {
+            auto& record = directory.Record;
+            if (directory.Name == L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\Old")
+            {
+                if (record.Files != 1 || record.Current != 0 || record.Bytes != 7)
+                    return "the sub directory has the wrong totals";
+            }
+            else if (directory.Name != L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret" || record.Files != 2 || record.Current != 1 || record.Bytes != 150
+                || record.Latency != 45 || record.LatencyMax != 30)
+                return "the directory has the wrong totals";
+        }
+
+        // a buffer for one record gets one
+        ULONG written = 0;
+        auto size = (ULONG)(sizeof(KappShadowReport) + directories[0].Record.Size);
+        if (table->Snapshot(buffer.data(), size, &written) != STATUS_SUCCESS || written != size
+            || Parse(buffer, written, &report).size() != 1 || report.Records != 1 || report.Directories != 2)
+            return "a short snapshot is not cut between records";
+        if (table->Snapshot(buffer.data(), sizeof(KappShadowReport) - 1, &written) != STATUS_BUFFER_TOO_SMALL)
+            return "a snapshot without room for the report succeeds";
+
+        // past MaxDirectories the files are dropped
+        for (ULONG i = 2; i < ShadowTable::MaxDirectories + 3; ++i)
+        {
+            auto fileName = L"\\Device\\HarddiskVolume3\\Data\\" + std::to_wstring(i) + L"\\file.txt";
+            auto recorded = Record(*table, fileName.c_str(), true, 1, 1);
+            if (recorded != (i < ShadowTable::MaxDirectories))
+                return "the table does not stop at MaxDirectories";
+        }
+
+        directories = Snapshot(*table, buffer, &report);
+        if (report.Directories != ShadowTable::MaxDirectories || report.Dropped != 3)
+            return "the dropped files are not counted";
+
+        table->Clear();
+        directories = Snapshot(*table, buffer, &report);
+        return directories.empty() && report.Directories == 0 && report.Records == 0 && report.Dropped == 0 ? nullptr : "Clear keeps directories";
+    }
+
+    auto MakeSource(const bench::TempFile& source) -> bool
+    {
+        std::vector<UCHAR> data(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            for (size_t i = 0; i < data.size(); ++i)
+                data[i] = (UCHAR)((offset + i) * 131 >> 3);
+            if (pwrite(source.Fd, data.data(), data.size(), (off_t)offset) != (ssize_t)data.size())
+                return false;
+        }
+
+        return true;
+    }
+
+    // The copy of CopyFileData (main.cpp), against an Io
+    template <typename Io>
+    auto Copy(Io& io, UCHAR* buffer) -> NTSTATUS
+    {
+        TargetLayout layout;
+        CopyStatistics statistics;
+        auto status = PrepareTarget(io, FileSize, false, 0, false, &layout);
+        if (NT_SUCCESS(status))
+            status = CopyFileRanges(io, FileSize, XorTransform{}, buffer, BufferSize, statistics);
+        if (NT_SUCCESS(status))
+            status = FinishTarget(io, FileSize, layout, statistics);
+        return status;
+    }
+
+    // What HandleFile does with the file in each mode, then accounts it
+    void RunFile(bench::State& state, ShadowMode mode)
+    {
+        bench::TempFile source("shadow");
+        bench::TempFile target("shadow");
+        if (source.Fd < 0 || target.Fd < 0 || !MakeSource(source))
+        {
+            state.Skip("cannot create the files in /tmp");
+            return;
+        }
+
+        // the target of the shadow copy is a closed descriptor: any write to it fails
+        PosixFileIo inner = { source.Fd, mode == ShadowMode::Off ? target.Fd : -1 };
+        std::vector<UCHAR> buffer(BufferSize);
+        auto table = std::make_unique<ShadowTable>();
+        bench::Name name(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\report.docx");
+        ShadowIo<PosixFileIo> io = { &inner };
+        if (mode == ShadowMode::Read && (Copy(io, buffer.data()) != STATUS_SUCCESS || io.Written != FileSize))
+        {
+            state.Fail("the shadow copy does not read the whole source");
+            return;
+        }
+
+        auto ok = true;
+        state.Run([&] {
+            auto start = KeQueryInterruptTime();
+            ULONGLONG bytes = 0;
+            if (mode == ShadowMode::Off)
+            {
+                ok &= Copy(inner, buffer.data()) == STATUS_SUCCESS;
+                bytes = FileSize;
+            }
+            else if (mode == ShadowMode::Read)
+            {
+                io.Written = 0;
+                ok &= Copy(io, buffer.data()) == STATUS_SUCCESS;
+                bytes = io.Written;
+            }
+            else
+            {
+                struct stat info;
+                ok &= fstat(source.Fd, &info) == 0;
+                bytes = (ULONGLONG)info.st_size;
+            }
+
+            ok &= table->Record(&name.String, true, bytes, KeQueryInterruptTime() - start) == STATUS_SUCCESS;
+        });
+
+        struct stat info;
+        if (!ok || fstat(target.Fd, &info) != 0 || (mode == ShadowMode::Off) != (info.st_size != 0))
+        {
+            state.Fail("a shadow copy wrote to the target");
+            return;
+        }
+
+        if (mode != ShadowMode::Estimate)
+            state.SetBytesPerOp(FileSize);
+    }
+}
+
+BENCHMARK(ShadowRecordHit, "shadow/record/hit")
+{
+    if (!bench::Verify(state, { CheckTable }))
+        return;
+
+    // a write to a file of a known directory: shared lock, interlocked adds
+    auto table = std::make_unique<ShadowTable>();
+    bench::Name name(L"\\Device\\HarddiskVolume3\\Users\\alice\\Secret\\report.docx");
+    ULONGLONG latency = 0;
+    state.Run([&] { (void)table->Record(&name.String, true, 4096, ++latency); });
+}
+
+BENCHMARK(ShadowRecordNew, "shadow/record/new")
+{
+    // first file of a directory: allocation and exclusive insert, the table is cleared when full
+    auto table = std::make_unique<ShadowTable>();
+    std::vector<bench::Name> names;
+    for (ULONG i = 0; i < ShadowTable::MaxDirectories; ++i)
+        names.emplace_back(L"\\Device\\HarddiskVolume3\\Data\\" + std::to_wstring(i) + L"\\file.txt");
+
+    size_t next = 0;
+    state.Run([&] {
+        if (next == names.size())
+        {
+            table->Clear();
+            next = 0;
+        }
+
+        (void)table->Record(&names[next++].String, true, 4096, 1);
+    });
+}
+
+// The same file in each mode: the backup, the shadow read of the source and the estimate
+BENCHMARK(ShadowFileOff, "shadow/file/off")
+{
+    RunFile(state, ShadowMode::Off);
+}
+
+BENCHMARK(ShadowFileRead, "shadow/file/read")
+{
+    RunFile(state, ShadowMode::Read);
+}
+
+BENCHMARK(ShadowFileEstimate, "shadow/file/estimate")
+{
+    RunFile(state, ShadowMode::Estimate);
+}
@@ -0,0 +1,129 @@
+#include "Bench.h"
+#include "Fixtures.h"
+#include "PosixFileIo.h"
+#include "Transform.h"
+
+#include <cstdlib>
+#include <vector>
+
+// 64 MiB file with 1 MiB of data every 8 MiB, a VM disk or a database file
+static constexpr ULONGLONG FileSize = 64ull << 20;
+static constexpr ULONGLONG Stride = 8ull << 20;
+static constexpr ULONGLONG DataSize = 1ull << 20;
+static constexpr ULONG BufferSize = 64 * 1024;
+
+namespace
+{
+    // What the engine sees on a file system without sparse support
+    struct DenseFileIo : PosixFileIo
+    {
+        NTSTATUS QueryRanges(ULONGLONG offset, ULONGLONG length, FileRange* ranges, ULONG, ULONG* count, bool* more)
+        {
+            ranges[0] = { offset, length };
+            *count = 1;
+            *more = false;
+            return STATUS_SUCCESS;
+        }
+    };
+
+    auto MakeSource(bench::TempFile& source) -> bool
+    {
+        std::vector<UCHAR> data(DataSize);
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = (UCHAR)(i * 31 + 7);
+
+        if (source.Fd < 0 || ftruncate(source.Fd, (off_t)FileSize) != 0)
+            return false;
+
+        for (ULONGLONG offset = 0; offset < FileSize; offset += Stride)
+        {
+            if (pwrite(source.Fd, data.data(), data.size(), (off_t)offset) != (ssize_t)data.size())
+                return false;
+        }
+
+        return fsync(source.Fd) == 0;
+    }
+
+    // One backup, as HandleFile does it: prepare the target of a sparse source, copy, then set the end of file
+    template <typename Io>
+    auto Copy(Io& io, UCHAR* buffer, CopyStatistics& statistics) -> bool
+    {
+        TargetLayout layout;
+        return PrepareTarget(io, FileSize, true, FileSize, false, &layout) == STATUS_SUCCESS
+            && CopyFileRanges(io, FileSize, XorTransform{}, buffer, BufferSize, statistics) == STATUS_SUCCESS
+            && FinishTarget(io, FileSize, layout, statistics) == STATUS_SUCCESS;
+    }
+
+    // The backup transforms back to the source, holes included
+    auto CheckBackup(int source, int target, bool sparse) -> bool
+    {
+        std::vector<UCHAR> expected(BufferSize);
+        std::vector<UCHAR> actual(BufferSize);
+        for (ULONGLONG offset = 0; offset < FileSize; offset += BufferSize)
+        {
+            if (pread(source, expected.data(), BufferSize, (off_t)offset) != BufferSize
+                || pread(target, actual.data(), BufferSize, (off_t)offset) != BufferSize)
+                return false;
+
+            // the holes of a sparse backup are not transformed, they read as zeroes
+            if (!sparse || offset % Stride < DataSize)
+                XorTransform{}.Apply(actual.data(), BufferSize, offset);
+            if (expected != actual)
+                return false;
+        }
+
+        return true;
+    }
+
+    template <typename Io>
+    void RunCopy(bench::State& state)
+    {
+        bench::TempFile source("sparse");
+        bench::TempFile target("sparse");
+        if (!MakeSource(source) || target.Fd < 0)
+        {
+            state.Skip("cannot create the source file in /tmp");
+            return;
+        }
+
+        if (source.DiskBytes() >= FileSize)
+        {
+            state.Skip("the file system of /tmp does not keep holes");
+            return;
+        }
+
+        Io io;
+        io.Source = source.Fd;
+        io.Target = target.Fd;
+        std::vector<UCHAR> buffer(BufferSize);
+        CopyStatistics statistics = {};
+        if (!Copy(io, buffer.data(), statistics) || !CheckBackup(source.Fd, target.Fd, statistics.Sparse))
+        {
+            state.Fail("the backup does not transform back to the source");
+            return;
+        }
+
+        state.Run([&] {
+            bench::DoNotOptimize(Copy(io, buffer.data(), statistics));
+        });
+
+        fsync(target.Fd);
+        state.SetBytesPerOp(FileSize);
+        state.Counter("bytes_read", (double)statistics.BytesRead);
+        state.Counter("bytes_skipped", (double)statistics.BytesSkipped);
+        state.Counter("source_disk_bytes", (double)source.DiskBytes());
+        state.Counter("target_disk_bytes", (double)target.DiskBytes());
+    }
+}
+
+// Allocated ranges only, holes stay holes in the backup
+BENCHMARK(CopySparseRanges, "copy/sparse/ranges")
+{
+    RunCopy<PosixFileIo>(state);
+}
+
+// The copy loop before: every byte of the file is read, transformed and written
+BENCHMARK(CopySparseDense, "copy/sparse/dense")
+{
+    RunCopy<DenseFileIo>(state);
+}
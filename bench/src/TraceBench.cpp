@@ -0,0 +1,123 @@
+#include "Bench.h"
+#include "Trace.h"
+#include "TraceCategories.h"
+#include "TraceDecoder.h"
+
+#include <string>
+#include <vector>
+
+using namespace kl::trace;
+
+namespace
+{
+    constexpr ULONG BytesPerCpu = 1024 * 1024;
+    constexpr ULONG DrainSize = 4 * 1024 * 1024;
+
+    // Runs `body` with the default session started, draining it every `batch` records
+    // so that the cost measured is the one of appending, not of dropping
+    template <typename Body>
+    void RunTrace(bench::State& state, Body&& body)
+    {
+        if (Default().Start(BytesPerCpu) != STATUS_SUCCESS)
+        {
+            state.Skip("cannot start the trace session");
+            return;
+        }
+
+        std::vector<UCHAR> output(DrainSize);
+        ULONG written = 0;
+        ULONG count = 0;
+        state.Run([&] {
+            body();
+            if (++count % 4096 == 0)
+                (void)Default().Drain(output.data(), DrainSize, &written);
+        });
+
+        Default().Stop();
+    }
+}
+
+BENCHMARK(TraceWriteNoArgs, "trace/write/no_args")
+{
+    RunTrace(state, [] {
+        LOG_INFO(TraceDriver, "DriverEntry completed\n");
+    });
+}
+
+BENCHMARK(TraceWriteInts, "trace/write/3_ints")
+{
+    ULONG chunk = 0;
+    RunTrace(state, [&] {
+        ++chunk;
+        LOG_INFO(TraceCopy, "chunk %u offset %llu status 0x%08x\n", chunk, (ULONGLONG)chunk * 7, (NTSTATUS)0);
+    });
+}
+
+BENCHMARK(TraceWriteUnicodeString, "trace/write/unicode_string")
+{
+    wchar_t path[] = L"\\Device\\HarddiskVolume3\\Users\\user\\Documents\\report.docx";
+    UNICODE_STRING name = { (USHORT)(wcslen(path) * sizeof(WCHAR)), (USHORT)sizeof(path), path };
+    RunTrace(state, [&] {
+        LOG_INFO(TraceCreate, "PreCreate %wZ\n", &name);
+    });
+}
+
+// A site above KL_TRACE_LEVEL is discarded at compile time, this measures an empty loop
+BENCHMARK(TraceWriteDisabled, "trace/write/compiled_out")
+{
+    ULONG chunk = 0;
+    RunTrace(state, [&] {
+        ++chunk;
+        LOG_VERBOSE(TraceCopy, "chunk %u\n", chunk);
+        bench::DoNotOptimize(chunk);
+    });
+}
+
+// Decoding cost per record, and a round trip check of the encoding
+BENCHMARK(TraceDecode, "trace/decode")
+{
+    constexpr ULONG Records = 10000;
+    wchar_t path[] = L"\\Device\\HarddiskVolume3\\Users\\user\\file.txt";
+    UNICODE_STRING name = { (USHORT)(wcslen(path) * sizeof(WCHAR)), (USHORT)sizeof(path), path };
+
+    // both halves must hold every record
+    if (Default().Start(DrainSize * 2) != STATUS_SUCCESS)
+    {
+        state.Skip("cannot start the trace session");
+        return;
+    }
+
+    for (ULONG i = 0; i < Records; ++i)
+        LOG_INFO(TraceWrite, "write %wZ chunk %u status %d\n", &name, i, -1);
+
+    std::vector<UCHAR> output(DrainSize);
+    ULONG written = 0;
+    auto status = Default().Drain(output.data(), DrainSize, &written);
+    Default().Stop();
+    if (status != STATUS_SUCCESS)
+    {
+        state.Fail("drain failed");
+        return;
+    }
+
+    TraceDecoder decoder;
+    decoder.AddFormat("write %wZ chunk %u status %d\n");
+
+    std::vector<TraceDecoder::Event> events;
+    std::string error;
+    if (!decoder.Parse(output.data(), written, events, error) || events.size() != Records || decoder.Dropped() != 0
+        || decoder.Format(events.back()) != "write \\Device\\HarddiskVolume3\\Users\\user\\file.txt chunk 9999 status -1\n")
+    {
+        state.Fail("decoded records do not match the records written");
+        return;
+    }
+
+    size_t length = 0;
+    state.Run([&] {
+        for (const auto& event : events)
+            length += decoder.Format(event).size();
+        bench::DoNotOptimize(length);
+    });
+
+    state.Counter("records_per_op", Records);
+}
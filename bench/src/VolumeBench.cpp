@@ -0,0 +1,259 @@
+#include "Bench.h"
+#include "Volume.h"
+
+#include <atomic>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+// Backups on two volumes at once: an NVMe disk and a USB stick, with 4 writers each making their
+// first write to new files. The devices are simulated by sleeping for the copy time of a backup
+// on one of their channels. With one queue for the machine the slow backups of the stick hold the
+// slots the NVMe writers wait for; with a queue per volume (Volume.h) they only hold each other.
+static constexpr ULONG BackupSize = 256 * 1024;
+static constexpr ULONG Writers = 4;
+
+namespace
+{
+    struct Device
+    {
+        const char* Name;
+        double BytesPerUs;
+        std::counting_semaphore<16> Channels;
+        ULONG Backups;                          // per writer
+
+        Device(const char* name, double mbPerSecond, ptrdiff_t channels, ULONG backups)
+            : Name(name), BytesPerUs(mbPerSecond), Channels(channels), Backups(backups)
+        {}
+
+        void Copy(ULONG bytes)
+        {
+            Channels.acquire();
+            std::this_thread::sleep_for(std::chrono::microseconds((long long)(bytes / BytesPerUs)));
+            Channels.release();
+        }
+    };
+
+    auto Percentile(std::vector<double>& values, double p) -> double
+    {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, (size_t)(p * (double)values.size()))];
+    }
+
+    auto CheckTuning() -> const char*
+    {
+        for (ULONG sector : { 0u, 512u, 520u, 4096u, 65536u })
+        {
+            for (int kind = 0; kind < 3; ++kind)
+            {
+                VolumeDevice device;
+                device.SectorSize = sector;
+                device.Removable = kind == 0;
+                device.SeekPenalty = kind == 1;
+                auto tuning = TuneVolume(device, 8);
+                if (tuning.SectorSize < 512 || tuning.BlockSize % tuning.SectorSize != 0 || tuning.BlockSize < 256 * 1024)
+                    return "the block is not a multiple of the sector";
+                if (device.Removable && (tuning.Budget != 1 || tuning.CopyWorkers != 1))
+                    return "a removable disk copies more than one file";
+                if (device.SeekPenalty && tuning.CopyWorkers != 1)
+                    return "a rotational disk copies in parallel pieces";
+                if (kind == 2 && (tuning.Budget < 2 || tuning.CopyWorkers != 8))
+                    return "a solid state disk is not used in parallel";
+            }
+        }
+
+        return TuneVolume(VolumeDevice{ 512, false, false }, 0).CopyWorkers == 1 ? nullptr : "no copy worker";
+    }
+
+    // No more than the budget copy at once, and every backup is accounted
+    auto CheckBudget() -> const char*
+    {
+        BackupQueue queue;
+        queue.Init(2);
+        std::atomic<ULONG> active = 0;
+        std::atomic<ULONG> peak = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; ++i)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 10; ++j)
+                {
+                    BackupQueue::Waiter waiter;
+                    queue.Enter(waiter);
+                    auto now = ++active;
+                    for (auto seen = peak.load(); seen < now && !peak.compare_exchange_weak(seen, now);)
+                    {
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    --active;
+                    queue.Leave(j % 5 != 0, 100);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        auto statistics = queue.Statistics();
+        if (peak > 2)
+            return "the budget is exceeded";
+        if (statistics.Backups != 80 || statistics.Failed != 16 || statistics.Bytes != 8000 || queue.Active() != 0)
+            return "the backups are not accounted";
+        if (statistics.Queued && (statistics.DepthMax == 0 || statistics.DepthMax > 6))
+            return "the queue depth is wrong";
+        return nullptr;
+    }
+
+    // Starts a writer that queues behind the slot taken by the caller, once it is on the queue
+    void StartWaiter(BackupQueue& queue, std::vector<std::thread>& threads, std::mutex& lock, std::vector<int>& order, int id)
+    {
+        auto queued = queue.Statistics().Queued;
+        threads.emplace_back([&queue, &lock, &order, id] {
+            BackupQueue::Waiter waiter;
+            queue.Enter(waiter);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                order.push_back(id);
+            }
+            queue.Leave(true, 0);
+        });
+
+        while (queue.Statistics().Queued == queued)
+            std::this_thread::yield();
+    }
+
+    // The slots are handed over in arrival order, and a closed queue releases its waiters
+    auto CheckOrder() -> const char*
+    {
+        for (auto close : { false, true })
+        {
+            BackupQueue queue;
+            queue.Init(1);
+            BackupQueue::Waiter first;
+            queue.Enter(first);
+
+            std::mutex lock;
+            std::vector<int> order;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < 5; ++i)
+                StartWaiter(queue, threads, lock, order, i);
+
+            if (close)
+                queue.Close();
+            else
+                queue.Leave(true, 0);
+            for (auto& thread : threads)
+                thread.join();
+
+            if (order.size() != 5)
+                return "a waiter is not released";
+            if (!close)
+            {
+                for (int i = 0; i < 5; ++i)
+                {
+                    if (order[i] != i)
+                        return "the slots are not handed over in order";
+                }
+            }
+            else
+            {
+                // the first slot is still held, later writers do not wait
+                BackupQueue::Waiter late;
+                queue.Enter(late);
+                queue.Leave(true, 0);
+                queue.Leave(true, 0);
+            }
+
+            auto statistics = queue.Statistics();
+            if (queue.Active() != 0 || statistics.Queued != 5 || statistics.DepthMax != 5)
+                return "the slots are not given back";
+        }
+
+        return nullptr;
+    }
+
+    // Makes the backups of both devices, each volume through the queue Route gives it
+    template <typename Route>
+    auto Simulate(Device& nvme, Device& usb, Route route, std::vector<double>& nvmeLatency, std::vector<double>& usbLatency) -> uint64_t
+    {
+        std::mutex lock;
+        std::vector<std::thread> threads;
+        for (auto* device : { &nvme, &usb })
+        {
+            auto& latency = device == &nvme ? nvmeLatency : usbLatency;
+            for (ULONG i = 0; i < Writers; ++i)
+            {
+                threads.emplace_back([&, device] {
+                    auto& queue = route(*device);
+                    std::vector<double> local;
+                    for (ULONG j = 0; j < device->Backups; ++j)
+                    {
+                        auto start = bench::Clock::now();
+                        BackupQueue::Waiter waiter;
+                        queue.Enter(waiter);
+                        device->Copy(BackupSize);
+                        queue.Leave(true, BackupSize);
+                        local.push_back(std::chrono::duration<double, std::micro>(bench::Clock::now() - start).count());
+                    }
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    latency.insert(latency.end(), local.begin(), local.end());
+                });
+            }
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+        return (uint64_t)Writers * (nvme.Backups + usb.Backups);
+    }
+
+    void RunSimulation(bench::State& state, bool perVolume)
+    {
+        if (!bench::Verify(state, { CheckTuning, CheckBudget, CheckOrder }))
+            return;
+
+        // 2000 MB/s over 4 queues, 25 MB/s over 1
+        Device nvme("nvme", 2000, 4, 60);
+        Device usb("usb", 25, 1, 3);
+        auto nvmeTuning = TuneVolume(VolumeDevice{ 512, false, false }, 8);
+        auto usbTuning = TuneVolume(VolumeDevice{ 512, true, true }, 8);
+
+        std::vector<double> nvmeLatency;
+        std::vector<double> usbLatency;
+        for (int sample = 0; sample < 3; ++sample)
+        {
+            BackupQueue shared;
+            shared.Init(4);
+            BackupQueue nvmeQueue;
+            nvmeQueue.Init(nvmeTuning.Budget);
+            BackupQueue usbQueue;
+            usbQueue.Init(usbTuning.Budget);
+
+            auto start = bench::Clock::now();
+            auto backups = Simulate(nvme, usb, [&](Device& device) -> BackupQueue& {
+                if (!perVolume)
+                    return shared;
+                return &device == &nvme ? nvmeQueue : usbQueue;
+            }, nvmeLatency, usbLatency);
+            state.Record(backups, std::chrono::duration<double, std::nano>(bench::Clock::now() - start).count());
+        }
+
+        state.SetBytesPerOp(BackupSize);
+        state.Counter("nvme_p50_us", Percentile(nvmeLatency, 0.5));
+        state.Counter("nvme_p99_us", Percentile(nvmeLatency, 0.99));
+        state.Counter("usb_p99_us", Percentile(usbLatency, 0.99));
+    }
+}
+
+BENCHMARK(VolumeSimShared, "volume/sim/shared")
+{
+    RunSimulation(state, false);
+}
+
+BENCHMARK(VolumeSimVolume, "volume/sim/volume")
+{
+    RunSimulation(state, true);
+}
@@ -0,0 +1,109 @@
+#include "Bench.h"
+#include "Workload.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+    auto CheckParse() -> const char*
+    {
+        WorkloadSpec spec;
+        std::string error;
+        auto text = "# comment\n threads = 8 \nsizes = 4K:1 2M:3\nmix = rewrite:1 append:2 # trailing\nwrite_size=512\nthink_ms = 0.5\n";
+        if (!ParseWorkload(text, spec, error) || spec.Threads != 8 || spec.Sizes.size() != 2 || spec.Sizes[1].Value != 2u << 20
+            || spec.Sizes[1].Weight != 3 || spec.Mix.size() != 2 || spec.Mix[0].Value != WorkloadSpec::Rewrite
+            || spec.WriteSize != 512 || spec.ThinkMs != 0.5 || spec.Files != WorkloadSpec().Files)
+            return "a spec is not parsed";
+
+        for (auto bad : { "threads = 0\n", "mix = delete:1\n", "sizes = 4X:1\n", "colour = red\n", "sizes = 4K:0\n" })
+        {
+            if (ParseWorkload(bad, spec, error))
+                return "a bad spec is accepted";
+        }
+
+        // the bundled specs parse
+        for (auto name : { "documents.load", "logs.load" })
+        {
+            std::string path = std::string(KBENCH_SOURCE_DIR) + "/scripts/load/" + name;
+            auto file = fopen(path.c_str(), "r");
+            std::string content;
+            for (int c; file && (c = fgetc(file)) != EOF;)
+                content += (char)c;
+            if (file)
+                fclose(file);
+            if (content.empty() || !ParseWorkload(content, spec, error))
+                return "a spec of scripts/load does not parse";
+        }
+
+        return nullptr;
+    }
+
+    // Percentiles of the histogram against the exact ones, within a bucket
+    auto CheckHistogram() -> const char*
+    {
+        std::mt19937_64 random(3);
+        std::lognormal_distribution<double> latency(10, 1.5);
+        std::vector<uint64_t> samples;
+        LatencyHistogram first;
+        LatencyHistogram second;
+        for (int i = 0; i < 100000; ++i)
+        {
+            auto ns = (uint64_t)latency(random);
+            samples.push_back(ns);
+            (i % 2 ? first : second).Record(ns);
+        }
+
+        first.Merge(second);
+        std::sort(samples.begin(), samples.end());
+        for (auto q : { 0.5, 0.99, 0.999, 1.0 })
+        {
+            auto exact = samples[(size_t)std::ceil(q * (double)samples.size()) - 1];
+            auto estimate = first.Percentile(q);
+            if (estimate < exact || (double)estimate > (double)exact * 1.04 + 1)
+                return "a percentile is off by more than a bucket";
+        }
+
+        return first.Count() == samples.size() && first.Max() == samples.back() && LatencyHistogram().Percentile(0.99) == 0
+            ? nullptr : "the histogram loses samples";
+    }
+}
+
+// A short run of the generator on /tmp, the Linux baseline of the driver runs
+BENCHMARK(WorkloadMixed, "load/mixed/16")
+{
+    if (!bench::Verify(state, { CheckParse, CheckHistogram }))
+        return;
+
+    WorkloadSpec spec;
+    spec.Threads = 16;
+    spec.Files = 128;
+    spec.Duration = state.GetOptions().minTimeMs / 1000;
+    spec.Sizes = { { 4096, 50 }, { 256 * 1024, 50 } };
+    spec.ThinkMs = 0.2;
+    auto root = "/tmp/kbench-load-" + std::to_string(getpid());
+    WorkloadResult result;
+    std::string message;
+    if (!RunWorkload(spec, root, false, result, message) || result.Sessions == 0 || result.Errors != 0 || result.Created != 0)
+    {
+        state.Fail(message.empty() ? "the run has errors" : message);
+        return;
+    }
+
+    if (access(root.c_str(), F_OK) == 0)
+    {
+        state.Fail("the files are left behind");
+        return;
+    }
+
+    state.Record(result.Writes, result.Seconds * 1e9);
+    state.SetBytesPerOp(spec.WriteSize);
+    state.Counter("write_p50_ns", (double)result.Write.Percentile(0.50));
+    state.Counter("write_p99_ns", (double)result.Write.Percentile(0.99));
+    state.Counter("write_p999_ns", (double)result.Write.Percentile(0.999));
+    state.Counter("first_write_p99_ns", (double)result.FirstWrite.Percentile(0.99));
+    state.Counter("open_p99_ns", (double)result.Open.Percentile(0.99));
+    state.Counter("sessions_per_second", result.Sessions / result.Seconds);
+}
@@ -0,0 +1,171 @@
+#include "Bench.h"
+#include "kl.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+namespace bench
+{
+    class Runner
+    {
+        const Options& options;
+        FILE* out;
+        bool first = true;
+
+    public:
+        unsigned failures = 0;
+
+        Runner(const Options& options, FILE* out) : options(options), out(out)
+        {}
+
+        void Begin()
+        {
+            char date[32];
+            auto now = std::time(nullptr);
+            std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+            auto version = kl::getVersion();
+            std::string klVersion;
+            for (USHORT i = 0; i < version->Length / sizeof(WCHAR); ++i)
+                klVersion += (char)version->Buffer[i];
+
+            fprintf(out, "{\n  \"context\": {\n");
+            fprintf(out, "    \"date\": \"%s\",\n", date);
+            fprintf(out, "    \"klib_version\": \"%s\",\n", klVersion.c_str());
+            fprintf(out, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+            fprintf(out, "    \"compiler\": \"%s\",\n", __VERSION__);
+#ifdef NDEBUG
+            fprintf(out, "    \"build_type\": \"release\",\n");
+#else
+            fprintf(out, "    \"build_type\": \"debug\",\n");
+#endif
+            fprintf(out, "    \"min_time_ms\": %.0f,\n", options.minTimeMs);
+            fprintf(out, "    \"samples\": %u\n", options.samples);
+            fprintf(out, "  },\n  \"benchmarks\": [");
+        }
+
+        void Run(const Benchmark& benchmark)
+        {
+            State state(options);
+            benchmark.function(state);
+
+            fprintf(out, "%s\n    {\"name\": \"%s\"", first ? "" : ",", benchmark.name);
+            first = false;
+            if (state.Failed())
+            {
+                fprintf(out, ", \"failed\": \"%s\"}", state.failed.c_str());
+                fprintf(stderr, "%s: FAILED: %s\n", benchmark.name, state.failed.c_str());
+                ++failures;
+                return;
+            }
+
+            if (!state.skipped.empty() || state.samples.empty())
+            {
+                fprintf(out, ", \"skipped\": \"%s\"}", state.skipped.empty() ? "no samples" : state.skipped.c_str());
+                return;
+            }
+
+            auto sorted = state.samples;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](double p) {
+                auto index = (size_t)std::ceil(p * (double)sorted.size()) - 1;
+                return sorted[std::min(index, sorted.size() - 1)];
+            };
+
+            auto nsPerOp = state.totalNanoseconds / (double)state.totalIterations;
+            fprintf(out, ", \"iterations\": %llu", (unsigned long long)state.totalIterations);
+            fprintf(out, ", \"ns_per_op\": %.3f", nsPerOp);
+            fprintf(out, ", \"min_ns\": %.3f, \"p50_ns\": %.3f, \"p99_ns\": %.3f", sorted.front(), percentile(0.50), percentile(0.99));
+            fprintf(out, ", \"ops_per_second\": %.1f", 1e9 / nsPerOp);
+            if (state.bytesPerOp)
+                fprintf(out, ", \"bytes_per_second\": %.1f", (double)state.bytesPerOp * 1e9 / nsPerOp);
+
+            if (!state.counters.empty())
+            {
+                fprintf(out, ", \"counters\": {");
+                for (size_t i = 0; i < state.counters.size(); ++i)
+                    fprintf(out, "%s\"%s\": %.6g", i ? ", " : "", state.counters[i].first.c_str(), state.counters[i].second);
+                fprintf(out, "}");
+            }
+
+            fprintf(out, "}");
+            fflush(out);
+        }
+
+        void End()
+        {
+            fprintf(out, "\n  ]\n}\n");
+        }
+    };
+}
+
+static void Usage(const char* self)
+{
+    fprintf(stderr,
+        "usage: %s [--filter=<substring>] [--min-time=<ms>] [--samples=<n>] [--out=<file>] [--list]\n"
+        "Runs the klib/kapp microbenchmarks and writes the results as JSON.\n"
+        "Exits with 1 when a correctness check of a benchmark fails.\n", self);
+}
+
+int main(int argc, char** argv)
+{
+    bench::Options options;
+    const char* filter = nullptr;
+    const char* path = nullptr;
+    bool list = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        auto arg = argv[i];
+        if (!strncmp(arg, "--filter=", 9))
+            filter = arg + 9;
+        else if (!strncmp(arg, "--min-time=", 11))
+            options.minTimeMs = atof(arg + 11);
+        else if (!strncmp(arg, "--samples=", 10))
+            options.samples = (unsigned)std::max(1, atoi(arg + 10));
+        else if (!strncmp(arg, "--out=", 6))
+            path = arg + 6;
+        else if (!strcmp(arg, "--list"))
+            list = true;
+        else
+        {
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+
+    auto benchmarks = bench::Registry();
+    std::sort(benchmarks.begin(), benchmarks.end(), [](const auto& a, const auto& b) { return strcmp(a.name, b.name) < 0; });
+    if (list)
+    {
+        for (const auto& benchmark : benchmarks)
+            puts(benchmark.name);
+
+        return 0;
+    }
+
+    auto out = path ? fopen(path, "w") : stdout;
+    if (!out)
+    {
+        perror(path);
+        return 1;
+    }
+
+    bench::Runner runner(options, out);
+    runner.Begin();
+    for (const auto& benchmark : benchmarks)
+    {
+        if (!filter || strstr(benchmark.name, filter))
+            runner.Run(benchmark);
+    }
+
+    runner.End();
+    if (path)
+        fclose(out);
+
+    // a failed check is a regression, a skip is not
+    return runner.failures ? 1 : 0;
+}
@@ -28,6 +28,4 @@ CheckLastExitCode
 cmake --build build/x64 --target clangformat
 CheckLastExitCode
 
-# Test
-#.\build\x86\ulib\test\Debug\ulib_test.exe
-.\build\x64\ulib\test\Debug\ulib_test.exe
\ No newline at end of file
+# Benchmarks (bench/) are user-mode only and built on Linux, see README.md
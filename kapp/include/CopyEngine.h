@@ -0,0 +1,201 @@
+#pragma once
+
+#include "kl.h"
+#include "TraceCategories.h"
+
+// Backup copy engine.
+//
+// Copies the allocated ranges of a source file to a target through a transform (see
+// Transform.h). Holes are neither read nor written: the target is made sparse before the
+// first write past a hole, so holes of the source stay holes in the backup. A restore
+// transforms the allocated ranges of the backup back and leaves its holes as zeroes.
+//
+// The file system is reached through an Io policy, resolved at compile time like the transform:
+//
+//   // Up to `capacity` allocated ranges of [offset, offset + length), in order. `more` is set
+//   // when the ranges did not fit. A file system without sparse support reports one range.
+//   NTSTATUS QueryRanges(ULONGLONG offset, ULONGLONG length, FileRange* ranges, ULONG capacity, ULONG* count, bool* more);
+//   NTSTATUS Read(ULONGLONG offset, UCHAR* buffer, ULONG size, ULONG* bytes);
+//   NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size);
+//   NTSTATUS SetSparse();   // target
+//   NTSTATUS SetEndOfFile(ULONGLONG size);   // target
+//   // Target: allocates [0, size) in one request, as few extents as the file system can, and
+//   // sets the end of file to size. The copy then writes below the end of file, never extends it.
+//   NTSTATUS Reserve(ULONGLONG size);
+//
+// The driver uses KernelFileIo (main.cpp), the benchmarks a POSIX implementation.
+
+struct FileRange
+{
+    ULONGLONG Offset;
+    ULONGLONG Length;
+};
+
+struct CopyStatistics
+{
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+    ULONGLONG BytesSkipped;     // holes
+    ULONG Ranges;
+    bool Sparse;                // the target was made sparse
+};
+
+// Copies [range.Offset, range.Offset + range.Length) in bufferSize pieces
+template <typename Io, typename Transform>
+NTSTATUS CopyRange(Io& io, const FileRange& range, const Transform& transform, UCHAR* buffer, ULONG bufferSize, CopyStatistics& statistics)
+{
+    auto offset = range.Offset;
+    auto end = range.Offset + range.Length;
+    while (offset < end)
+    {
+        auto remaining = end - offset;
+        auto size = remaining < bufferSize ? (ULONG)remaining : bufferSize;
+        ULONG bytes = 0;
+        auto status = io.Read(offset, buffer, size, &bytes);
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "CopyRange: cannot read source chunk (0x%08x)", status);
+            return status;
+        }
+
+        // the file shrank under us, the end of file is set by the caller
+        if (bytes == 0)
+            break;
+
+        statistics.BytesRead += bytes;
+        transform.Apply(buffer, bytes, offset);
+        status = io.Write(offset, buffer, bytes);
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "CopyRange: cannot write target chunk (0x%08x)", status);
+            return status;
+        }
+
+        statistics.BytesWritten += bytes;
+        offset += bytes;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+// Copies the allocated ranges of the first fileSize bytes of the source
+template <typename Io, typename Transform>
+NTSTATUS CopyFileRanges(Io& io, ULONGLONG fileSize, const Transform& transform, UCHAR* buffer, ULONG bufferSize, CopyStatistics& statistics)
+{
+    constexpr ULONG BatchSize = 16;
+    FileRange ranges[BatchSize];
+    RtlZeroMemory(&statistics, sizeof(statistics));
+
+    ULONGLONG offset = 0;   // everything before has been copied or skipped
+    while (offset < fileSize)
+    {
+        ULONG count = 0;
+        bool more = false;
+        auto status = io.QueryRanges(offset, fileSize - offset, ranges, BatchSize, &count, &more);
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "CopyFileRanges: cannot query allocated ranges (0x%08x)", status);
+            return status;
+        }
+
+        for (ULONG i = 0; i < count; ++i)
+        {
+            // clip to the part not copied yet, the first range can start before offset
+            auto start = ranges[i].Offset > offset ? ranges[i].Offset : offset;
+            auto end = ranges[i].Offset + ranges[i].Length;
+            if (end > fileSize)
+                end = fileSize;
+            if (start >= end)
+                continue;
+
+            if (start > offset && !statistics.Sparse)
+            {
+                // writing past a hole of a non sparse file would allocate and zero it
+                status = io.SetSparse();
+                if (!NT_SUCCESS(status))
+                {
+                    LOG_ERROR(TraceCopy, "CopyFileRanges: cannot make the target sparse (0x%08x)", status);
+                    return status;
+                }
+
+                statistics.Sparse = true;
+            }
+
+            statistics.BytesSkipped += start - offset;
+            status = CopyRange(io, FileRange{ start, end - start }, transform, buffer, bufferSize, statistics);
+            if (!NT_SUCCESS(status))
+                return status;
+
+            ++statistics.Ranges;
+            offset = end;
+        }
+
+        if (!more || count == 0)
+            break;
+    }
+
+    // trailing hole, the caller sets the end of file
+    if (offset < fileSize)
+        statistics.BytesSkipped += fileSize - offset;
+
+    return STATUS_SUCCESS;
+}
+
+// How PrepareTarget laid the target out
+enum class TargetLayout
+{
+    Reused,         // same size and dense: overwritten in place, the allocation is kept
+    Reserved,       // truncated, then allocated up front for the whole file
+    Extended,       // truncated, the writes extend it: the source is sparse, or the reservation failed
+};
+
+// Makes the target ready for a backup of fileSize bytes. A target of that size is overwritten in
+// place when both files are dense: every byte of it is written again. Otherwise it starts over,
+// ranges of the previous backup must not survive as data of the new one, and a dense source gets
+// its allocation reserved so that the backup is not grown one write at a time.
+template <typename Io>
+NTSTATUS PrepareTarget(Io& io, ULONGLONG fileSize, bool sourceSparse, ULONGLONG targetSize, bool targetSparse, TargetLayout* layout)
+{
+    if (!sourceSparse && !targetSparse && targetSize == fileSize)
+    {
+        *layout = TargetLayout::Reused;
+        return STATUS_SUCCESS;
+    }
+
+    auto status = io.SetEndOfFile(0);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_ERROR(TraceCopy, "PrepareTarget: cannot truncate the target (0x%08x)", status);
+        return status;
+    }
+
+    *layout = TargetLayout::Extended;
+    if (sourceSparse)
+        return STATUS_SUCCESS;
+
+    status = io.Reserve(fileSize);
+    if (!NT_SUCCESS(status))
+    {
+        // not every file system takes an allocation size, the copy still works without
+        LOG_WARNING(TraceCopy, "PrepareTarget: cannot reserve %llu bytes (0x%08x)", fileSize, status);
+        return STATUS_SUCCESS;
+    }
+
+    *layout = TargetLayout::Reserved;
+    return STATUS_SUCCESS;
+}
+
+// Sets the end of file of the target once the ranges are copied. A source that shrank during the
+// copy leaves a tail of the previous backup in a reused target: it is cut, and reads as zeroes.
+template <typename Io>
+NTSTATUS FinishTarget(Io& io, ULONGLONG fileSize, TargetLayout layout, const CopyStatistics& statistics)
+{
+    if (layout == TargetLayout::Reused && statistics.BytesRead < fileSize)
+    {
+        auto status = io.SetEndOfFile(statistics.BytesRead);
+        if (!NT_SUCCESS(status))
+            return status;
+    }
+
+    return io.SetEndOfFile(fileSize);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "kl.h"
+
+// File context set up.
+//
+// PostCreateOperation gives a file context to the user mode opens for writing of a protected
+// file. Finding out whether the file is protected takes a normalized name query, the directory
+// check and a copy of the name, and most of these opens (Office, the shell, sync clients) never
+// write. With the LazyCreate service value the create only sets a context marked Pending, with
+// no name: ResolveFileName runs on the first PreWriteOperation instead, or when a writable
+// section is created for the file, before any of its paging writes, which the filter does not
+// see. A pending context freed unresolved is a name query avoided. KappCommandCreateQuery reads
+// the counters (Protocol.h). A name query that fails, eager or lazy, leaves the context
+// pending: the next write or section makes it again.
+
+struct CreateCounters
+{
+    volatile LONGLONG Opens;        // creates for writing classified by PostCreateOperation
+    volatile LONGLONG NameQueries;  // made by ResolveFileName
+    volatile LONGLONG Deferred;     // contexts set pending
+    volatile LONGLONG Resolved;     // pending contexts resolved by a write or a section
+    volatile LONGLONG Avoided;      // pending contexts freed without a name query
+};
+
+extern CreateCounters g_creates;
+
+// The normalized name of the default data stream of a protected file, in a buffer allocated with
+// CONTEXT_NAME_TAG; STATUS_NOT_FOUND for a file that is not backed up, the status of the name query
+// or of the allocation when it failed: the file may be protected, the query is made again
+[[nodiscard]] NTSTATUS ResolveFileName(_In_ PFLT_CALLBACK_DATA Data, _Out_ PUNICODE_STRING Name);
+
+struct KappCreateReport;
+
+// Each counter is read once, a snapshot taken under load is not a single instant
+void SnapshotCreates(_Out_ KappCreateReport* report);
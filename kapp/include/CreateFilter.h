@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ProcessTable.h"
+
+// Pre-create fast path.
+//
+// Whether a create can lead to a backup, so that PostCreateOperation is worth calling.
+// Everything here is known before the request reaches the file system: most creates are
+// rejected without a post-operation callback or a name query.
+[[nodiscard]] inline auto NeedsPostCreate(KPROCESSOR_MODE requestorMode, ACCESS_MASK desiredAccess, ULONG options,
+    _In_opt_ const ProcessTable* processes, _In_ HANDLE processId) -> bool
+{
+    // kernel callers and opens that cannot modify the data
+    if (requestorMode == KernelMode || (desiredAccess & FILE_WRITE_DATA) == 0)
+        return false;
+
+    // FILE_CREATE fails on an existing file, a new file has nothing to back up
+    auto disposition = options >> 24;
+    if (disposition == FILE_CREATE || (options & FILE_DIRECTORY_FILE) != 0)
+        return false;
+
+    // the table is only allocated when processes are excluded, and usually empty
+    return !processes || processes->Count() == 0 || processes->Lookup(processId) != ProcessPolicy::Exclude;
+}
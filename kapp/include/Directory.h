@@ -0,0 +1,6 @@
+#pragma once
+
+#include "kl.h"
+
+// Whether files under the given parent directory are protected (\secret\ or \private\, case insensitive).
+bool IsValidDirectory(_In_ PUNICODE_STRING directory);
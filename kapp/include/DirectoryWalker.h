@@ -0,0 +1,234 @@
+#pragma once
+
+#include "kl.h"
+
+// Resumable depth first walk of a directory tree.
+//
+// The walker is a state machine: Next returns one file at a time and keeps the open directories
+// between calls, so that a caller can pause for as long as it likes. A walk can also restart
+// after the last file handled by a previous one (its bookmark), provided the file system
+// enumerates directories in RtlCompareUnicodeString case insensitive order, as NTFS does.
+//
+// Directories are reached through an Fs policy, resolved at compile time:
+//
+//   typename Fs::Directory;     // an open directory
+//   NTSTATUS Open(PCUNICODE_STRING path, Directory* directory);
+//   // STATUS_NO_MORE_FILES at the end. Entry names stay valid until the next Read of the
+//   // directory. Reparse points are not reported, so that the walk cannot loop.
+//   NTSTATUS Read(Directory directory, DirectoryEntry* entry);
+//   void Close(Directory directory);
+//
+// The driver uses KernelDirectoryFs (main.cpp), the benchmarks a POSIX implementation.
+
+struct DirectoryEntry
+{
+    UNICODE_STRING Name;
+    bool Directory;
+    ULONGLONG Size;
+    LONGLONG LastWriteTime;     // 100ns units
+};
+
+template <typename Fs>
+class DirectoryWalker final
+{
+public:
+    static constexpr ULONG MaxDepth = 32;
+    static constexpr USHORT MaxPath = 1024;     // characters
+
+private:
+    struct Level
+    {
+        typename Fs::Directory Directory;
+        USHORT Length;      // bytes of the path of the directory, separator included
+    };
+
+    Fs* fs;
+    Level levels[MaxDepth];
+    ULONG depth;            // open directories
+    ULONG skipped;          // directories not walked: too deep, too long or not readable
+    WCHAR path[MaxPath];
+    UNICODE_STRING current; // path of the last file returned
+    WCHAR bookmark[MaxPath];
+    USHORT bookmarkLength;  // characters, the bookmark relative to the root
+    bool resuming;          // skipping the entries up to the bookmark
+
+    // Component `index` of the bookmark, relative to the root
+    auto BookmarkComponent(ULONG index, bool* last) const -> UNICODE_STRING
+    {
+        USHORT start = 0;
+        for (; index > 0 && start < bookmarkLength; ++start)
+        {
+            if (bookmark[start] == L'\\')
+                --index;
+        }
+
+        auto end = start;
+        while (end < bookmarkLength && bookmark[end] != L'\\')
+            ++end;
+
+        *last = end == bookmarkLength;
+        UNICODE_STRING component;
+        component.Buffer = const_cast<WCHAR*>(bookmark) + start;
+        component.Length = (USHORT)((end - start) * sizeof(WCHAR));
+        component.MaximumLength = component.Length;
+        return component;
+    }
+
+    auto Push(USHORT length) -> NTSTATUS
+    {
+        // the directory path, without its separator
+        UNICODE_STRING directory;
+        directory.Buffer = path;
+        directory.Length = (USHORT)(length - sizeof(WCHAR));
+        directory.MaximumLength = directory.Length;
+        auto status = fs->Open(&directory, &levels[depth].Directory);
+        if (!NT_SUCCESS(status))
+            return status;
+
+        levels[depth++].Length = length;
+        return STATUS_SUCCESS;
+    }
+
+    void Pop()
+    {
+        fs->Close(levels[--depth].Directory);
+        // whatever is left in the parent comes after the bookmark
+        resuming = false;
+    }
+
+public:
+    // The walker lives in pool memory that is not constructed, Start does all the set up.
+    // `resumeAfter` is the bookmark of a previous walk of the same root, or null.
+    auto Start(_In_ Fs* fileSystem, _In_ PCUNICODE_STRING root, _In_opt_ PCUNICODE_STRING resumeAfter) -> NTSTATUS
+    {
+        fs = fileSystem;
+        depth = 0;
+        skipped = 0;
+        current.Buffer = path;
+        current.Length = 0;
+        current.MaximumLength = sizeof(path);
+        bookmarkLength = 0;
+        resuming = false;
+
+        auto rootLength = root->Length / sizeof(WCHAR);
+        while (rootLength > 0 && root->Buffer[rootLength - 1] == L'\\')
+            --rootLength;
+        if (rootLength == 0 || rootLength + 2 > MaxPath)
+            return STATUS_OBJECT_NAME_INVALID;
+
+        RtlCopyMemory(path, root->Buffer, rootLength * sizeof(WCHAR));
+        path[rootLength] = L'\\';
+
+        // a bookmark of another root is ignored
+        if (resumeAfter && resumeAfter->Length / sizeof(WCHAR) > rootLength + 1)
+        {
+            UNICODE_STRING prefix;
+            prefix.Buffer = resumeAfter->Buffer;
+            prefix.Length = (USHORT)((rootLength + 1) * sizeof(WCHAR));
+            prefix.MaximumLength = prefix.Length;
+            UNICODE_STRING rootPath;
+            rootPath.Buffer = path;
+            rootPath.Length = prefix.Length;
+            rootPath.MaximumLength = prefix.Length;
+            if (RtlEqualUnicodeString(&prefix, &rootPath, TRUE))
+            {
+                bookmarkLength = (USHORT)(resumeAfter->Length / sizeof(WCHAR) - rootLength - 1);
+                if (bookmarkLength > MaxPath)
+                    bookmarkLength = 0;
+                RtlCopyMemory(bookmark, resumeAfter->Buffer + rootLength + 1, bookmarkLength * sizeof(WCHAR));
+                resuming = bookmarkLength > 0;
+            }
+        }
+
+        return Push((USHORT)((rootLength + 1) * sizeof(WCHAR)));
+    }
+
+    // The next file, its path is Path(). STATUS_NO_MORE_FILES when the walk is over.
+    auto Next(_Out_ DirectoryEntry* entry) -> NTSTATUS
+    {
+        while (depth > 0)
+        {
+            auto& level = levels[depth - 1];
+            auto status = fs->Read(level.Directory, entry);
+            if (status == STATUS_NO_MORE_FILES)
+            {
+                Pop();
+                continue;
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                ++skipped;
+                Pop();
+                continue;
+            }
+
+            auto name = entry->Name.Length / sizeof(WCHAR);
+            if ((name == 1 && entry->Name.Buffer[0] == L'.') || (name == 2 && entry->Name.Buffer[0] == L'.' && entry->Name.Buffer[1] == L'.'))
+                continue;
+
+            if (resuming)
+            {
+                bool last = false;
+                auto component = BookmarkComponent(depth - 1, &last);
+                auto order = RtlCompareUnicodeString(&entry->Name, &component, TRUE);
+                if (order < 0)
+                    continue;
+
+                if (order == 0 && last)
+                {
+                    // the bookmark itself has been handled
+                    resuming = false;
+                    continue;
+                }
+
+                // past the bookmark, or a directory on its path that is still resuming
+                if (order > 0 || !entry->Directory)
+                    resuming = false;
+            }
+
+            auto length = level.Length + entry->Name.Length;
+            if (length + sizeof(WCHAR) > sizeof(path))
+            {
+                ++skipped;
+                continue;
+            }
+
+            RtlCopyMemory((UCHAR*)path + level.Length, entry->Name.Buffer, entry->Name.Length);
+            if (entry->Directory)
+            {
+                path[length / sizeof(WCHAR)] = L'\\';
+                if (depth == MaxDepth || !NT_SUCCESS(Push((USHORT)(length + sizeof(WCHAR)))))
+                {
+                    ++skipped;
+                    resuming = false;
+                }
+
+                continue;
+            }
+
+            current.Length = (USHORT)length;
+            return STATUS_SUCCESS;
+        }
+
+        return STATUS_NO_MORE_FILES;
+    }
+
+    // Path of the last file returned, the bookmark to resume after it
+    [[nodiscard]] auto Path() const -> PCUNICODE_STRING
+    {
+        return &current;
+    }
+
+    [[nodiscard]] auto Skipped() const -> ULONG
+    {
+        return skipped;
+    }
+
+    // Closes the open directories, the walk cannot continue
+    void Stop()
+    {
+        while (depth > 0)
+            Pop();
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CopyEngine.h"
+
+// Intra-file parallel copy of a large dense file.
+//
+// The transforms depend on the absolute offset of a byte only, so disjoint pieces of a file are
+// transformed independently. SplitFile cuts [0, fileSize) into pieces; the caller and the helpers
+// it queues claim them in order with an interlocked counter and copy each one through CopyRange.
+// The caller copies too: the backup completes even when no helper gets to run, and Join only
+// waits for the helpers that did, the caller withdraws the others. After a failure the workers
+// stop at their next piece.
+//
+// The Io must take concurrent Read and Write calls at distinct offsets, and the target must not
+// be extended by them: PrepareTarget reserved its allocation or it is reused. FinishTarget runs
+// after Join. Sparse sources and extended targets are copied by CopyFileRanges.
+
+struct CopyPlan
+{
+    ULONGLONG PieceSize;
+    ULONG Pieces;
+    ULONG Workers;      // the caller included
+};
+
+// Pieces are multiples of alignment and at least minPiece long, up to PiecesPerWorker per worker
+// so that a worker held up on a piece does not hold the copy back. One worker for a small file.
+[[nodiscard]] inline auto SplitFile(ULONGLONG fileSize, ULONG maxWorkers, ULONGLONG minPiece, ULONG alignment) -> CopyPlan
+{
+    constexpr ULONG PiecesPerWorker = 4;
+    CopyPlan plan = { fileSize, fileSize ? 1u : 0u, 1 };
+    if (maxWorkers <= 1 || fileSize < 2 * minPiece)
+        return plan;
+
+    auto pieceSize = fileSize / ((ULONGLONG)maxWorkers * PiecesPerWorker);
+    if (pieceSize < minPiece)
+        pieceSize = minPiece;
+    pieceSize = (pieceSize + alignment - 1) / alignment * alignment;
+
+    plan.PieceSize = pieceSize;
+    plan.Pieces = (ULONG)((fileSize + pieceSize - 1) / pieceSize);
+    plan.Workers = plan.Pieces < maxWorkers ? plan.Pieces : maxWorkers;
+    return plan;
+}
+
+template <typename Io, typename Transform>
+class ParallelCopy final
+{
+    Io& io;
+    const Transform& transform;
+    ULONGLONG fileSize;
+    CopyPlan plan;
+    volatile LONG next = 0;             // first piece not claimed
+    volatile LONG active = 1;           // workers not done, the caller included
+    volatile LONG status = STATUS_SUCCESS;
+    volatile LONGLONG bytesRead = 0;
+    volatile LONGLONG bytesWritten = 0;
+    KEVENT done;                        // active dropped to zero
+
+    void Work(UCHAR* buffer, ULONG bufferSize)
+    {
+        while (ReadNoFence(&status) == STATUS_SUCCESS)
+        {
+            auto piece = (ULONG)InterlockedIncrement(&next) - 1;
+            if (piece >= plan.Pieces)
+                break;
+
+            auto offset = piece * plan.PieceSize;
+            auto length = fileSize - offset < plan.PieceSize ? fileSize - offset : plan.PieceSize;
+            CopyStatistics statistics = {};
+            auto result = CopyRange(io, FileRange{ offset, length }, transform, buffer, bufferSize, statistics);
+            InterlockedExchangeAdd64(&bytesRead, (LONGLONG)statistics.BytesRead);
+            InterlockedExchangeAdd64(&bytesWritten, (LONGLONG)statistics.BytesWritten);
+            if (!NT_SUCCESS(result))
+                InterlockedCompareExchange(&status, result, STATUS_SUCCESS);
+        }
+    }
+
+public:
+    ParallelCopy(Io& io, const Transform& transform, ULONGLONG fileSize, const CopyPlan& plan)
+        : io(io), transform(transform), fileSize(fileSize), plan(plan)
+    {
+        KeInitializeEvent(&done, NotificationEvent, FALSE);
+    }
+
+    ParallelCopy(const ParallelCopy&) = delete;
+    ParallelCopy& operator=(const ParallelCopy&) = delete;
+
+    [[nodiscard]] auto Plan() const -> const CopyPlan&
+    {
+        return plan;
+    }
+
+    // Before a helper is queued
+    void Enter()
+    {
+        InterlockedIncrement(&active);
+    }
+
+    // A helper that entered and could not run (no buffer, not queued)
+    void Leave()
+    {
+        if (InterlockedDecrement(&active) == 0)
+            KeSetEvent(&done, IO_NO_INCREMENT, FALSE);
+    }
+
+    // Body of a helper: copies pieces until none is left, then leaves. The copy may be gone
+    // once it returns.
+    void Help(UCHAR* buffer, ULONG bufferSize)
+    {
+        Work(buffer, bufferSize);
+        Leave();
+    }
+
+    // The caller copies pieces, then waits for the helpers. The first failure of a worker.
+    [[nodiscard]] auto Join(UCHAR* buffer, ULONG bufferSize, CopyStatistics& statistics) -> NTSTATUS
+    {
+        return Join(buffer, bufferSize, statistics, []() -> ULONG { return 0; });
+    }
+
+    // Join, for helpers that may still be queued once the caller is done with the pieces: withdraw
+    // takes them back from the queue, and returns how many it took, which leave without running.
+    template <typename Withdraw>
+    [[nodiscard]] auto Join(UCHAR* buffer, ULONG bufferSize, CopyStatistics& statistics, Withdraw withdraw) -> NTSTATUS
+    {
+        Work(buffer, bufferSize);
+        for (ULONG withdrawn = withdraw(); withdrawn > 0; --withdrawn)
+            Leave();
+        Leave();
+        KeWaitForSingleObject(&done, Executive, KernelMode, FALSE, nullptr);
+
+        RtlZeroMemory(&statistics, sizeof(statistics));
+        statistics.BytesRead = (ULONGLONG)bytesRead;
+        statistics.BytesWritten = (ULONGLONG)bytesWritten;
+        statistics.Ranges = plan.Pieces;
+        return status;
+    }
+};
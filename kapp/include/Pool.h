@@ -0,0 +1,85 @@
+#pragma once
+
+#include "kl.h"
+
+// Pool usage of the driver, per subsystem.
+//
+// The allocations of kapp go through g_pool.Allocate and g_pool.Free, with the tag of their site
+// (Tags.h) for poolmon and the subsystem they are accounted to. A header before the block keeps
+// its size and subsystem, so Free takes the block and its tag as ExFreePoolWithTag does. The
+// contexts allocated by the filter manager are accounted with Charge and Release. The counters
+// are interlocked, any IRQL the pool type allows: current and peak bytes and blocks, and the
+// totals since the driver loaded. KappCommandPoolQuery reads them (Protocol.h).
+
+enum class PoolSubsystem : ULONG
+{
+    Create,         // file contexts, their names, directory checks
+    Copy,           // copy buffers and backup names of HandleFile
+    Session,
+    Process,
+    Prebackup,      // workers, directory scans, bookmarks, roots
+    Shadow,
+    Port,           // replies to uapp
+    Volume,         // instance contexts
+    Count
+};
+
+// Raises *target to value
+inline void InterlockedMax64(volatile LONGLONG* target, LONGLONG value)
+{
+    auto current = ReadNoFence64(target);
+    while (current < value)
+    {
+        auto previous = InterlockedCompareExchange64(target, value, current);
+        if (previous == current)
+            break;
+        current = previous;
+    }
+}
+
+struct PoolCounters
+{
+    volatile LONGLONG Bytes;
+    volatile LONGLONG PeakBytes;
+    volatile LONGLONG TotalBytes;
+    volatile LONGLONG Blocks;
+    volatile LONGLONG PeakBlocks;
+    volatile LONGLONG TotalBlocks;
+};
+
+struct KappPoolReport;
+
+class PoolAccounting final
+{
+    struct ALIGN Header
+    {
+        SIZE_T Size;
+        ULONG Tag;
+        PoolSubsystem Subsystem;
+    };
+
+    static_assert(sizeof(Header) == MEMORY_ALLOCATION_ALIGNMENT, "the blocks keep the pool alignment");
+
+    PoolCounters counters[(ULONG)PoolSubsystem::Count] = {};
+
+public:
+    // Null when the pool is exhausted, as ExAllocatePoolWithTag
+    [[nodiscard]] auto Allocate(PoolSubsystem subsystem, POOL_TYPE type, SIZE_T size, ULONG tag) -> PVOID;
+    void Free(_In_ PVOID block, ULONG tag);
+
+    void Charge(PoolSubsystem subsystem, SIZE_T size);
+    void Release(PoolSubsystem subsystem, SIZE_T size);
+
+    [[nodiscard]] auto Counters(PoolSubsystem subsystem) const -> const PoolCounters&
+    {
+        return counters[(ULONG)subsystem];
+    }
+
+    // The counters of every subsystem; the peaks restart from the current values with resetPeaks
+    void Snapshot(_Out_ KappPoolReport* report, bool resetPeaks);
+
+    // Blocks not freed, logged on unload
+    [[nodiscard]] auto Outstanding() const -> LONGLONG;
+};
+
+extern PoolAccounting g_pool;
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <fltKernel.h>
+
+// Communication port used by uapp to query the driver
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS PortCreate(_In_ PFLT_FILTER Filter);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID PortClose();
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "kl.h"
+#include "Directory.h"
+#include "DirectoryWalker.h"
+#include "Transform.h"
+
+// Background pre-backup.
+//
+// The first write to a protected file waits for HandleFile to copy it. When the PrebackupRoots
+// service value lists directories, each volume instance walks them at low priority and creates
+// or refreshes the `.lock` backups ahead of time; the first write then finds the backup current
+// and only deletes the source. A backup is current when it has the size and the last write time
+// of its source (HandleFile stamps the backup with the last write time of the source), and its
+// record the transform mode and key of the driver.
+//
+// The scan is a state machine driven by the caller: Run handles files until the rate limit or
+// the end of a slice, and the caller waits as told before calling it again, or cancels it.
+//
+// Backups are made through a Backup policy, resolved at compile time like the Fs policy of the walker:
+//
+//   // Creates or refreshes the backup of the file unless it is current.
+//   // `copied` receives the bytes copied, 0 when the backup was current.
+//   // STATUS_SHARING_VIOLATION when a writer has the file open: its first write makes the backup.
+//   NTSTATUS Refresh(PCUNICODE_STRING path, const DirectoryEntry& entry, ULONGLONG* copied);
+
+struct PrebackupStatistics
+{
+    ULONG Files;            // files walked
+    ULONG Protected;        // files under a protected directory
+    ULONG Current;          // backups found current
+    ULONG BackedUp;         // backups created or refreshed
+    ULONG Busy;             // files open by a writer, left to its first write
+    ULONG Failed;
+    ULONGLONG BytesCopied;
+};
+
+// Backups, and the files the scan ignores
+[[nodiscard]] inline auto IsBackupName(_In_ PCUNICODE_STRING name) -> bool
+{
+    static const WCHAR suffix[] = L".lock";
+    constexpr USHORT characters = sizeof(suffix) / sizeof(WCHAR) - 1;
+    auto length = name->Length / sizeof(WCHAR);
+    if (length < characters)
+        return false;
+
+    for (USHORT i = 0; i < characters; ++i)
+    {
+        if (RtlUpcaseUnicodeChar(name->Buffer[length - characters + i]) != RtlUpcaseUnicodeChar(suffix[i]))
+            return false;
+    }
+
+    return true;
+}
+
+// Whether the backup of a file with the given size and last write time is current. A backup made
+// with another transform or key cannot be restored with the current one, nor one without a record
+// (zeroed): it is made again.
+[[nodiscard]] inline auto IsBackupCurrent(ULONGLONG sourceSize, LONGLONG sourceWriteTime, ULONGLONG backupSize, LONGLONG backupWriteTime,
+    const BackupRecord& backup, TransformMode mode, ULONGLONG keyId) -> bool
+{
+    return sourceSize == backupSize && sourceWriteTime == backupWriteTime
+        && backup.Version == BackupRecord::CurrentVersion && backup.Mode == mode && backup.KeyId == keyId;
+}
+
+template <typename Fs, typename Backup>
+class PrebackupScan final
+{
+public:
+    static constexpr ULONG SliceFiles = 64;         // files per Run call, between cancellation checks
+    static constexpr ULONGLONG FileCost = 4096;     // rate limit tokens (bytes) of the opens and queries of a protected file
+
+private:
+    DirectoryWalker<Fs> walker;
+    Backup* backup;
+    kl::TokenBucket bucket;
+    PrebackupStatistics statistics;
+    bool running;
+
+    void Handle(const DirectoryEntry& entry, ULONGLONG now)
+    {
+        ++statistics.Files;
+        auto path = walker.Path();
+        if (IsBackupName(path))
+            return;
+
+        // parent directory, separator included, as IsValidDirectory expects it
+        UNICODE_STRING parent = *path;
+        while (parent.Length > 0 && parent.Buffer[parent.Length / sizeof(WCHAR) - 1] != L'\\')
+            parent.Length -= sizeof(WCHAR);
+        if (!IsValidDirectory(&parent))
+            return;
+
+        ++statistics.Protected;
+        ULONGLONG copied = 0;
+        auto status = backup->Refresh(path, entry, &copied);
+        if (status == STATUS_SHARING_VIOLATION)
+            ++statistics.Busy;
+        else if (!NT_SUCCESS(status))
+            ++statistics.Failed;
+        else if (copied == 0)
+            ++statistics.Current;
+        else
+            ++statistics.BackedUp;
+
+        statistics.BytesCopied += copied;
+        bucket.Consume(FileCost + copied, now);
+    }
+
+public:
+    // The scan lives in pool memory that is not constructed, Start does all the set up.
+    // `resumeAfter` is the Bookmark of a cancelled scan of the same root, or null.
+    // `bytesPerSecond` limits the bytes copied, plus FileCost per protected file; 0 for no limit.
+    auto Start(_In_ Fs* fs, _In_ Backup* backupPolicy, _In_ PCUNICODE_STRING root, _In_opt_ PCUNICODE_STRING resumeAfter,
+        ULONGLONG bytesPerSecond, ULONGLONG now) -> NTSTATUS
+    {
+        backup = backupPolicy;
+        RtlZeroMemory(&statistics, sizeof(statistics));
+        // a burst of a second worth of I/O
+        bucket.Init(bytesPerSecond, bytesPerSecond, now);
+        auto status = walker.Start(fs, root, resumeAfter);
+        running = NT_SUCCESS(status);
+        return status;
+    }
+
+    // Handles files until the rate limit, the end of a slice or the end of the tree.
+    // STATUS_SUCCESS when the scan is over; STATUS_PENDING when it must be called again after `wait` (100ns).
+    auto Run(ULONGLONG now, _Out_ ULONGLONG* wait) -> NTSTATUS
+    {
+        *wait = 0;
+        for (ULONG i = 0; running && i < SliceFiles; ++i)
+        {
+            *wait = bucket.Delay(now);
+            if (*wait > 0)
+                return STATUS_PENDING;
+
+            DirectoryEntry entry;
+            auto status = walker.Next(&entry);
+            if (status == STATUS_NO_MORE_FILES)
+            {
+                running = false;
+                break;
+            }
+
+            Handle(entry, now);
+        }
+
+        return running ? STATUS_PENDING : STATUS_SUCCESS;
+    }
+
+    // Cancels the scan, Bookmark tells where to resume it
+    void Stop()
+    {
+        walker.Stop();
+        running = false;
+    }
+
+    // Last file handled
+    [[nodiscard]] auto Bookmark() const -> PCUNICODE_STRING
+    {
+        return walker.Path();
+    }
+
+    [[nodiscard]] auto Statistics() const -> const PrebackupStatistics&
+    {
+        return statistics;
+    }
+
+    [[nodiscard]] auto Skipped() const -> ULONG
+    {
+        return walker.Skipped();
+    }
+};
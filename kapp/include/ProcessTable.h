@@ -0,0 +1,96 @@
+#pragma once
+
+#include "kl.h"
+
+// Per process create policy.
+//
+// PreCreateOperation looks the requesting process up on every create, so lookups take no lock:
+// a slot is a single 64 bits word holding the process id and its policy, written atomically.
+// Only processes with a policy other than Monitor have a slot; the process notify routine adds
+// them when they start and removes them when they exit. Writers are serialized by a spin lock.
+//
+// Open addressing with linear probing and backward shift deletion, so there are no tombstones
+// and a miss stops at the first empty slot. A lookup racing with a removal can miss an entry
+// being moved, which reads as Monitor, the safe answer. Callable at IRQL <= DISPATCH_LEVEL.
+
+enum class ProcessPolicy : UCHAR
+{
+    Monitor = 0,    // creates go through PostCreateOperation, the default
+    Exclude = 1,    // trusted process (backup agent, indexer, antivirus), its creates are not filtered
+};
+
+class ProcessTable final
+{
+    static constexpr ULONG SlotBits = 10;
+    static constexpr ULONG Slots = 1u << SlotBits;
+    static constexpr LONGLONG Empty = 0;    // process id 0 is the idle process, never notified
+
+    kl::SpinLock lock;                  // writers
+    volatile LONGLONG slots[Slots];     // process id << 8 | policy
+    volatile LONG count;
+
+    static auto Key(HANDLE processId) -> ULONGLONG
+    {
+        return (ULONGLONG)(ULONG_PTR)processId;
+    }
+
+    static auto Start(ULONGLONG key) -> ULONG
+    {
+        // process ids are multiples of 4, Fibonacci hashing spreads them over the slots
+        return (ULONG)(((key >> 2) * 0x9e3779b97f4a7c15ull) >> (64 - SlotBits));
+    }
+
+    // Slot of the process or of the empty slot ending its probe sequence, Slots when the table is full
+    auto Find(ULONGLONG key) const -> ULONG;
+
+public:
+    // The table lives in pool memory that is not constructed, like the filter contexts
+    void Init();
+
+    // Sets the policy of a process, Monitor removes it.
+    // STATUS_INSUFFICIENT_RESOURCES when the table is full: the process is monitored.
+    [[nodiscard]] auto Set(_In_ HANDLE processId, ProcessPolicy policy) -> NTSTATUS;
+
+    // Forgets the process, if it has a slot
+    auto Remove(_In_ HANDLE processId) -> bool;
+
+    // Monitor for processes without a slot
+    [[nodiscard]] auto Lookup(_In_ HANDLE processId) const -> ProcessPolicy;
+
+    // Read without synchronization, a hint for callers that want to skip the lookup on an empty table
+    [[nodiscard]] auto Count() const -> ULONG
+    {
+        return (ULONG)count;
+    }
+};
+
+// Image paths of the excluded processes, from a REG_MULTI_SZ value. An entry matches the whole
+// image path as the process notify routine gets it ("\??\C:\Program Files\Agent\agent.exe"),
+// case insensitively. A bare file name would exclude any program a user copies under that name
+// to a directory they can write, so entries without a backslash are rejected.
+class ExclusionList final
+{
+    WCHAR* names = nullptr;     // pool copy of the accepted entries, null when there is none
+    ULONG length = 0;           // in characters
+    ULONG rejected = 0;         // entries without a backslash
+
+public:
+    // Copies the full paths of the value, replacing the previous list
+    [[nodiscard]] auto Init(_In_reads_bytes_(size) const WCHAR* multiSz, ULONG size) -> NTSTATUS;
+
+    void Clear();
+
+    [[nodiscard]] auto Empty() const -> bool
+    {
+        return names == nullptr;
+    }
+
+    // Entries of the last Init that were not full paths
+    [[nodiscard]] auto Rejected() const -> ULONG
+    {
+        return rejected;
+    }
+
+    // Whether a process started from this image is excluded
+    [[nodiscard]] auto Match(_In_ PCUNICODE_STRING imageFileName) const -> bool;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+// Messages exchanged with uapp over the filter communication port (no kernel includes).
+
+#include <stdint.h>
+
+#define KAPP_PORT_NAME L"\\KappPort"
+
+enum KappCommand : uint32_t
+{
+    // Output: the trace records written since the last drain, as kl::trace::ChunkHeader + records
+    KappCommandTraceDrain = 1,
+    // Input: KappShadowSetMessage, selects the shadow mode and optionally resets its statistics
+    KappCommandShadowSet = 2,
+    // Output: KappShadowReport followed by its KappShadowDirectory records
+    KappCommandShadowQuery = 3,
+    // Input: KappPoolQueryMessage, output: KappPoolReport
+    KappCommandPoolQuery = 4,
+    // Output: KappCreateReport
+    KappCommandCreateQuery = 5,
+};
+
+struct KappMessage
+{
+    KappCommand Command;
+    uint32_t Reserved;
+};
+
+// Shadow mode: the backups are decided, measured and accounted per directory, nothing is written
+enum KappShadowMode : uint32_t
+{
+    KappShadowOff = 0,
+    KappShadowEstimate = 1,     // the size of the source stands for the bytes copied
+    KappShadowRead = 2,         // the source is read as the copy would read it
+};
+
+struct KappShadowSetMessage
+{
+    KappMessage Header;
+    uint32_t Mode;              // KappShadowMode
+    uint32_t Reset;             // non zero to clear the statistics
+};
+
+struct KappShadowReport
+{
+    uint32_t Mode;
+    uint32_t Directories;       // in the table
+    uint32_t Records;           // in this reply, fewer than Directories when the buffer is too small
+    uint32_t Reserved;
+    uint64_t Dropped;           // files of directories the table had no room for
+};
+
+// Followed by the UTF-16 name of the directory, the next record starts at the next multiple of 8
+struct KappShadowDirectory
+{
+    uint64_t Files;             // backups that would have been made
+    uint64_t Current;           // files whose backup was current, nothing would have been copied
+    uint64_t Bytes;             // that would have been copied
+    uint64_t Latency;           // added to the first writes, in 100 ns
+    uint64_t LatencyMax;
+    uint32_t Size;              // of the record, name and padding included
+    uint16_t NameLength;        // in bytes
+    uint16_t Reserved;
+};
+
+// Pool usage of the driver per subsystem, in this order
+enum KappPoolSubsystem : uint32_t
+{
+    KappPoolCreate = 0,         // file contexts, their names, directory checks
+    KappPoolCopy = 1,           // copy buffers and backup names
+    KappPoolSession = 2,
+    KappPoolProcess = 3,
+    KappPoolPrebackup = 4,
+    KappPoolShadow = 5,
+    KappPoolPort = 6,
+    KappPoolVolume = 7,         // instance contexts
+    KappPoolSubsystems = 8,
+};
+
+struct KappPoolQueryMessage
+{
+    KappMessage Header;
+    uint32_t ResetPeaks;        // non zero to restart the peaks from the current values after the reply
+    uint32_t Reserved;
+};
+
+struct KappPoolCounters
+{
+    uint64_t Bytes;             // allocated now
+    uint64_t PeakBytes;
+    uint64_t TotalBytes;        // since the driver loaded
+    uint64_t Blocks;
+    uint64_t PeakBlocks;
+    uint64_t TotalBlocks;
+};
+
+struct KappPoolReport
+{
+    uint32_t Subsystems;        // KappPoolSubsystems
+    uint32_t Reserved;
+    KappPoolCounters Counters[KappPoolSubsystems];
+};
+
+// Name queries of the create path since the driver loaded, with the LazyCreate service value
+// most of them are deferred to the first write and avoided
+struct KappCreateReport
+{
+    uint64_t Opens;             // creates for writing classified
+    uint64_t NameQueries;
+    uint64_t Deferred;          // contexts set up without a name
+    uint64_t Resolved;          // deferred ones named by a write or a writable section
+    uint64_t Avoided;           // deferred ones closed without a name query
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "kl.h"
+
+// Backup sessions.
+//
+// Editors and build tools open, write and close the same file many times per second.
+// Once a file has been backed up, its session keeps the backup valid until `window`
+// after its last cleanup: writes from later opens reuse the backup instead of copying
+// the file again. Renaming or deleting the file ends the session.
+//
+// Times are KeQueryInterruptTime values (100ns), passed by the callers so that the
+// table can be driven by a simulated clock.
+//
+// The lock is a spin lock, taken by the timer DPC. Find, Touch and Remove upcase the name
+// of the caller, which may be paged, into a Key before they take it (IRQL <= APC_LEVEL);
+// under the lock only the keys and the sessions are read, both resident, and compared
+// byte for byte. Expire and Clear are callable at IRQL <= DISPATCH_LEVEL.
+class SessionTable final
+{
+    static constexpr ULONG Buckets = 256;
+    static constexpr ULONG WheelSlots = 64;
+    static constexpr USHORT InlineKey = 256;    // characters of a key kept on the stack of the caller
+
+    struct Session
+    {
+        kl::TimerEntry Timer;   // first, the wheel hands it back on expiry
+        Session* Next;          // bucket chain
+        ULONG Hash;
+        ULONGLONG Expires;
+        UNICODE_STRING Name;    // upcased, buffer follows the session
+    };
+
+    // The upcased name of a lookup and its hash. The stack of a running thread is resident,
+    // longer names are copied to non paged pool.
+    struct Key
+    {
+        UNICODE_STRING Name;
+        ULONG Hash;
+        WCHAR Inline[InlineKey];
+
+        Key() : Name{}, Hash(0)
+        {}
+        Key(const Key&) = delete;
+        Key& operator = (const Key&) = delete;
+        ~Key();
+
+        [[nodiscard]] auto Init(_In_ PCUNICODE_STRING name) -> NTSTATUS;
+    };
+
+    kl::SpinLock lock;
+    Session* buckets[Buckets];
+    kl::TimerWheel<WheelSlots> wheel;
+    ULONGLONG window;
+    ULONG count;
+
+    auto Lookup(const Key& key, Session*** link) -> Session*;
+    auto Link(Session* session) -> Session**;
+    void Unlink(Session** link, Session* session);
+
+public:
+    // The table lives in pool memory that is not constructed, like the filter contexts
+    void Init(ULONGLONG now, ULONGLONG window, ULONGLONG tick);
+
+    // Frees every session
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void Clear();
+
+    // Whether the file has a live session at `now`
+    _IRQL_requires_max_(APC_LEVEL)
+    [[nodiscard]] auto Find(_In_ PCUNICODE_STRING name, ULONGLONG now) -> bool;
+
+    // Starts the session of a backed up file, or extends it, until now + window
+    _IRQL_requires_max_(APC_LEVEL)
+    [[nodiscard]] auto Touch(_In_ PCUNICODE_STRING name, ULONGLONG now) -> NTSTATUS;
+
+    // Ends the session of the file, if any
+    _IRQL_requires_max_(APC_LEVEL)
+    auto Remove(_In_ PCUNICODE_STRING name) -> bool;
+
+    // Frees the sessions expired at `now`, returns how many
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    auto Expire(ULONGLONG now) -> ULONG;
+
+    // Read without the lock, a hint for callers that want to skip work on an empty table
+    [[nodiscard]] auto Count() const -> ULONG
+    {
+        return count;
+    }
+};
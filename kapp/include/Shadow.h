@@ -0,0 +1,120 @@
+#pragma once
+
+#include "CopyEngine.h"
+
+// Shadow mode: the cost of the backups, measured without making them.
+//
+// The create and write callbacks run unchanged: a file is classified by PostCreateOperation and
+// its first write decides a backup as usual. HandleFile then only looks at the source and at the
+// current backup; in Read mode it also reads the source through the copy engine, with an Io that
+// discards the writes (ShadowIo). Nothing is written, renamed or deleted. What the backup would
+// have cost, in files, bytes and latency added to the first write, is summed per directory here,
+// for the KappCommandShadowQuery command of the port (Protocol.h).
+
+enum class ShadowMode : ULONG
+{
+    Off = 0,        // backups are made
+    Estimate = 1,   // the size of the source stands for the bytes copied, the source is not read
+    Read = 2,       // the source is read as the copy would read it
+};
+
+// Statistics per directory, the directory of a file being its name up to the last backslash.
+//
+// A write takes the push lock shared to find its directory and adds to it with interlocked
+// operations, so writes to files of known directories do not serialize. A new directory is
+// allocated outside the lock and inserted exclusively. The table holds up to MaxDirectories;
+// the files of the others are only counted as dropped.
+//
+// A zeroed table is empty and Off, the global one needs no Init. Callable at PASSIVE_LEVEL.
+class ShadowTable final
+{
+public:
+    static constexpr ULONG MaxDirectories = 1024;
+
+private:
+    static constexpr ULONG BucketBits = 8;
+    static constexpr ULONG Buckets = 1u << BucketBits;
+
+    struct Directory
+    {
+        Directory* Next;
+        ULONG Hash;
+        volatile LONGLONG Files;
+        volatile LONGLONG Current;
+        volatile LONGLONG Bytes;
+        volatile LONGLONG Latency;
+        volatile LONGLONG LatencyMax;
+        UNICODE_STRING Name;    // points right after the structure
+    };
+
+    mutable kl::PushLock lock;     // Snapshot is const
+    Directory* buckets[Buckets] = {};
+    ULONG count = 0;                // written under the exclusive lock
+    volatile LONGLONG dropped = 0;
+    volatile LONG mode = 0;
+
+    auto Find(PCUNICODE_STRING name, ULONG hash) const -> Directory*;
+
+public:
+    void SetMode(ShadowMode value)
+    {
+        InterlockedExchange(&mode, (LONG)value);
+    }
+
+    [[nodiscard]] auto Mode() const -> ShadowMode
+    {
+        return (ShadowMode)ReadNoFence(&mode);
+    }
+
+    // Accounts one decided backup of fileName: copied is false when the backup was current,
+    // latency is the time HandleFile would have added to the first write, in 100ns.
+    // STATUS_INSUFFICIENT_RESOURCES when the directory could not be added, the file is dropped.
+    auto Record(_In_ PCUNICODE_STRING fileName, bool copied, ULONGLONG bytes, ULONGLONG latency) -> NTSTATUS;
+
+    // Forgets the directories, the mode is kept
+    void Clear();
+
+    // Fills buffer with a KappShadowReport and as many KappShadowDirectory records as fit.
+    // STATUS_BUFFER_TOO_SMALL when not even the report fits.
+    [[nodiscard]] auto Snapshot(_Out_writes_bytes_to_(size, *written) PVOID buffer, ULONG size, _Out_ ULONG* written) const -> NTSTATUS;
+};
+
+// Io policy of the copy engine (CopyEngine.h) in ShadowMode::Read: the source is read through
+// the inner Io, the target is left alone. Written counts the bytes the backup would have had.
+template <typename Io>
+struct ShadowIo
+{
+    Io* Inner;
+    ULONGLONG Written = 0;
+
+    NTSTATUS QueryRanges(ULONGLONG offset, ULONGLONG length, FileRange* ranges, ULONG capacity, ULONG* count, bool* more)
+    {
+        return Inner->QueryRanges(offset, length, ranges, capacity, count, more);
+    }
+
+    NTSTATUS Read(ULONGLONG offset, UCHAR* buffer, ULONG size, ULONG* bytes)
+    {
+        return Inner->Read(offset, buffer, size, bytes);
+    }
+
+    NTSTATUS Write(ULONGLONG, const UCHAR*, ULONG size)
+    {
+        Written += size;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS SetSparse()
+    {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS SetEndOfFile(ULONGLONG)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Reserve(ULONGLONG)
+    {
+        return STATUS_SUCCESS;
+    }
+};
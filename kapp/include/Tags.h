@@ -0,0 +1,42 @@
+#pragma once
+
+// A tag per allocation site, grouped by the Pool.h subsystem they are accounted to.
+// poolmon shows them reversed: 'ncbF' is Fbcn.
+
+// Create
+#define DRIVER_CONTEXT_TAG 'xcbF'       // file contexts, allocated by the filter manager
+#define CONTEXT_NAME_TAG 'ncbF'         // file name of a file context
+#define DIRECTORY_TAG 'dcbF'            // lowercase copy of IsValidDirectory
+
+// Copy
+#define COPY_BUFFER_TAG 'bkbF'          // copy buffer of HandleFile
+#define COPY_HELPER_TAG 'hkbF'          // copy buffer of a parallel copy helper
+#define COPY_POOL_TAG 'pkbF'            // helper threads of a volume
+#define BACKUP_NAME_TAG 'nkbF'          // name of the .lock stream
+
+// Session
+#define SESSION_TAG 'ssbF'              // sessions
+#define SESSION_TABLE_TAG 'tsbF'
+#define SESSION_KEY_TAG 'ksbF'          // upcased name of a long lookup
+
+// Process
+#define PROCESS_TAG 'ppbF'              // names of the excluded images
+#define PROCESS_TABLE_TAG 'tpbF'
+#define PROCESS_VALUE_TAG 'vpbF'        // ExcludedProcesses value, while it is read
+
+// Prebackup
+#define PREBACKUP_TAG 'wbbF'            // workers
+#define PREBACKUP_DIRECTORY_TAG 'dbbF'  // directories open in a scan
+#define PREBACKUP_VALUE_TAG 'vbbF'      // bookmarks and PrebackupRoots, while they are read
+#define PREBACKUP_ROOTS_TAG 'rbbF'      // roots and service key name
+
+// Shadow
+#define SHADOW_TAG 'dhbF'               // directories
+#define SHADOW_NAME_TAG 'nhbF'          // name of the .lock stream looked at
+
+// Port
+#define PORT_TAG 'dobF'                 // trace drains
+#define PORT_SHADOW_TAG 'sobF'          // shadow reports
+
+// Volume
+#define INSTANCE_CONTEXT_TAG 'ivbF'     // instance contexts, allocated by the filter manager
@@ -0,0 +1,33 @@
+#pragma once
+
+// Trace categories of the driver, shared with the decoder in uapp (no kernel includes).
+// Select them at build time with KL_TRACE_CATEGORIES, a mask of (1 << category).
+
+#include <stdint.h>
+
+enum TraceCategory : uint8_t
+{
+    TraceDriver = 0,    // load, unload, key generation
+    TraceInstance = 1,  // volume attach and detach
+    TraceCreate = 2,    // create classification
+    TraceContext = 3,   // file context life cycle
+    TraceWrite = 4,     // write interception
+    TraceCopy = 5,      // backup copy
+    TraceSession = 6,   // backup sessions
+    TraceProcess = 7,   // per process create policy
+    TracePrebackup = 8, // background pre-backup scan
+    TraceShadow = 9,    // shadow mode accounting
+};
+
+inline constexpr const char* TraceCategoryNames[] = {
+    "driver",
+    "instance",
+    "create",
+    "context",
+    "write",
+    "copy",
+    "session",
+    "process",
+    "prebackup",
+    "shadow",
+};
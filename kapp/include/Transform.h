@@ -0,0 +1,73 @@
+#pragma once
+
+#include "kl.h"
+
+extern UCHAR g_key[4];
+
+// Identifies the key of the transform without revealing it: drawn at each load for the XOR key,
+// which is generated at each load, the first 8 bytes of the encryption of a zero block for AES
+extern ULONGLONG g_keyId;
+
+// Transforms applied in place to the data copied to the backup.
+//
+// The copy engine takes the transform as a template parameter and calls
+//     void Apply(UCHAR* buffer, ULONG size, ULONGLONG offset) const
+// from its copy loop, so the call is resolved at compile time and inlined.
+// A transform may only depend on the absolute offset of the data in the file:
+// ranges can be read, transformed and written in any order.
+
+// Selected by the TransformMode value of the service key
+enum class TransformMode : ULONG
+{
+    Xor = 0,
+    Aes128Ctr = 1,
+    Aes256Ctr = 2,
+};
+
+// The original keystream: each byte is xored with g_key[i % 4] and with the 1-based
+// index of the 7 bytes chunk it belongs to, i being its position in the chunk
+struct XorTransform
+{
+    static constexpr ULONG ChunkSize = 7;
+
+    __forceinline void Apply(UCHAR* buffer, ULONG size, ULONGLONG offset) const
+    {
+        auto position = (ULONG)(offset % ChunkSize);
+        auto chunk = (UCHAR)(offset / ChunkSize + 1);
+        for (ULONG i = 0; i < size; ++i)
+        {
+            buffer[i] ^= g_key[position % sizeof(g_key)] ^ chunk;
+            if (++position == ChunkSize)
+            {
+                position = 0;
+                ++chunk;
+            }
+        }
+    }
+};
+
+// AES-CTR, the counter block of file offset 0 is Iv: the Nonce of the backup, then a zero block index
+struct AesCtrTransform
+{
+    const kl::Aes* Cipher;
+    UCHAR Iv[kl::Aes::BlockSize];
+
+    __forceinline void Apply(UCHAR* buffer, ULONG size, ULONGLONG offset) const
+    {
+        Cipher->Ctr(buffer, size, Iv, offset);
+    }
+};
+
+// What a restore needs besides the key, stored by HandleFile in the KAPP.BACKUP extended attribute
+// of the `.lock` file each time it copies the source. Nonce is drawn for each copy: two backups, or
+// two copies of the same file, never share an AES keystream. A backup made with another Mode or
+// KeyId than the driver's is never current (IsBackupCurrent).
+struct BackupRecord
+{
+    static constexpr ULONG CurrentVersion = 1;
+
+    ULONG Version;
+    TransformMode Mode;
+    ULONGLONG KeyId;        // g_keyId of the copy
+    UCHAR Nonce[8];
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "kl.h"
+
+// Per-volume backup scheduling.
+//
+// Each volume the filter attaches to has an instance context (main.h) with the tuning of its
+// device and a BackupQueue. The first write of a file takes a slot of the queue of its volume
+// for the time of the backup; at most Budget backups copy at the same time on a volume and the
+// others wait in arrival order. A slow removable disk then only holds the writers of its own
+// files, while a solid state volume copies several files at once with large blocks. The
+// pre-backup scan has its own thread and rate limit, it does not take slots.
+
+// What the tuning is derived from, the defaults stand for a device that cannot be asked
+struct VolumeDevice
+{
+    ULONG SectorSize = 512;
+    bool SeekPenalty = true;        // rotational
+    bool Removable = false;
+};
+
+struct VolumeTuning
+{
+    ULONG SectorSize;
+    ULONG BlockSize;                // copy buffer of a backup, a multiple of the sector size
+    ULONG Budget;                   // backups copying at the same time
+    ULONG CopyWorkers;              // workers of a parallel copy (ParallelCopy.h), 1 copies serially
+};
+
+// Removable disks copy one file at a time, rotational ones two with large sequential blocks and no
+// parallel pieces, solid state ones up to eight with parallel pieces
+[[nodiscard]] auto TuneVolume(const VolumeDevice& device, ULONG maxCopyWorkers) -> VolumeTuning;
+
+struct VolumeStatistics
+{
+    ULONGLONG Backups;              // through the queue
+    ULONGLONG Failed;
+    ULONGLONG Bytes;                // copied, current backups copy nothing
+    ULONGLONG Queued;               // backups that waited for a slot
+    ULONGLONG WaitTime;             // in 100 ns
+    ULONGLONG WaitMax;
+    ULONG DepthMax;                 // waiters at the same time
+};
+
+class BackupQueue final
+{
+public:
+    // On the stack of a waiting writer
+    struct Waiter
+    {
+        Waiter* Next;
+        KEVENT Ready;
+    };
+
+private:
+    kl::SpinLock lock;
+    Waiter* head;
+    Waiter* tail;
+    ULONG depth;
+    ULONG active;                   // slots taken
+    ULONG budget;
+    bool closed;
+    VolumeStatistics statistics;
+
+public:
+    // The queue lives in an instance context that is not constructed, Init does all the set up
+    void Init(ULONG slots);
+
+    // Waits for a slot; a closed queue does not make writers wait
+    void Enter(Waiter& waiter);
+
+    // Gives the slot to the first waiter, and accounts the backup made with it
+    void Leave(bool succeeded, ULONGLONG bytes);
+
+    // Instance teardown: the waiters are released, they and later writers copy without waiting
+    void Close();
+
+    [[nodiscard]] auto Active() -> ULONG;
+    [[nodiscard]] auto Statistics() -> VolumeStatistics;
+};
@@ -1,9 +1,29 @@
 #pragma once
 #include <fltKernel.h>
 #include "kl.h"
+#include "Tags.h"
+#include "Volume.h"
 
-#define DRIVER_CONTEXT_TAG 'xcbF'
-#define DRIVER_TAG 'bF'
+// Per processor trace buffer size, when tracing is compiled in (KL_TRACE_LEVEL > 0)
+#define TRACE_BUFFER_SIZE (256 * 1024)
+
+// Backup sessions: default window (SessionWindowMs service value, 0 disables) and expiry timer period
+#define SESSION_WINDOW_MS 2000
+#define SESSION_TICK_MS 250
+
+// Copy buffer of a backup on a volume without instance context, the others use the block size of their
+// tuning (Volume.h). The target allocation is reserved up front so the size of the writes does not matter to its layout
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+// Parallel backup of large dense files: default and largest workers (CopyWorkers service value, 1 disables) and
+// piece size, files under two pieces are copied by the writer alone
+#define PARALLEL_COPY_WORKERS 8
+#define PARALLEL_COPY_WORKERS_MAX 64
+#define PARALLEL_COPY_PIECE_SIZE (16 * 1024 * 1024)
+
+// Pre-backup scan: delay after the volume is attached, default rate (PrebackupRateKBps service value, 0 for no limit)
+#define PREBACKUP_DELAY_MS (60 * 1000)
+#define PREBACKUP_RATE_KBPS 4096
 
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
@@ -20,7 +40,12 @@ VOID InstanceTeardownCompleteCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In
 FLT_PREOP_CALLBACK_STATUS PreCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext);
 FLT_POSTOP_CALLBACK_STATUS PostCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ PVOID CompletionContext, _In_ FLT_POST_OPERATION_FLAGS Flags);
 FLT_PREOP_CALLBACK_STATUS PreWriteOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext);
+FLT_PREOP_CALLBACK_STATUS PreSetInformationOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext);
+FLT_PREOP_CALLBACK_STATUS PreAcquireForSectionOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext);
 FLT_POSTOP_CALLBACK_STATUS PostCleanupOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ PVOID CompletionContext, _In_ FLT_POST_OPERATION_FLAGS Flags);
+
+VOID FileContextCleanup(_In_ PFLT_CONTEXT Context, _In_ FLT_CONTEXT_TYPE ContextType);
+VOID InstanceContextCleanup(_In_ PFLT_CONTEXT Context, _In_ FLT_CONTEXT_TYPE ContextType);
 EXTERN_C_END
 
 #ifdef ALLOC_PRAGMA
@@ -35,5 +60,18 @@ EXTERN_C_END
 struct FileContext {
     kl::Mutex Lock;
     UNICODE_STRING FileName;
-    BOOLEAN Written;
+    BOOLEAN Written;    // the first write has been handled
+    BOOLEAN BackedUp;   // the backup is valid, set when HandleFile succeeded or a session was reused
+    BOOLEAN Pending;    // lazy create: no name yet, the first write or writable section resolves it (CreateContext.h)
+};
+
+struct PrebackupWorker;
+struct CopyPool;
+
+// Per volume, set up by InstanceSetupCallback
+struct InstanceContext {
+    VolumeTuning Tuning;
+    BackupQueue Queue;              // first writes of the volume, closed at teardown
+    PrebackupWorker* Prebackup;     // null when no root is scanned on the volume
+    CopyPool* Helpers;              // threads of the parallel copies, null when the volume copies serially
 };
\ No newline at end of file
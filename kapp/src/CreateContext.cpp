@@ -0,0 +1,60 @@
+#include "CreateContext.h"
+#include "Directory.h"
+#include "Pool.h"
+#include "Protocol.h"
+#include "Tags.h"
+#include "TraceCategories.h"
+
+CreateCounters g_creates;
+
+NTSTATUS ResolveFileName(_In_ PFLT_CALLBACK_DATA Data, _Out_ PUNICODE_STRING Name)
+{
+    RtlZeroMemory(Name, sizeof(*Name));
+    InterlockedIncrement64(&g_creates.NameQueries);
+    auto fileNameInfo = kl::FilterFileNameInformation(Data);
+    if (!fileNameInfo)
+    {
+        LOG_ERROR(TraceCreate, "ResolveFileName: no filename info (0x%08x)", fileNameInfo.Status());
+        return fileNameInfo.Status();
+    }
+
+    auto status = fileNameInfo.Parse();
+    if (!NT_SUCCESS(status))
+    {
+        LOG_ERROR(TraceCreate, "ResolveFileName: cannot parse filename info (0x%08x)", status);
+        return status;
+    }
+
+    LOG_VERBOSE(TraceCreate, "ResolveFileName: got %wZ", &fileNameInfo->Name);
+    if (fileNameInfo->Stream.Length > 0) // only the default data stream. Should check ::$DATA
+    {
+        LOG_INFO(TraceCreate, "ResolveFileName: only the default data stream");
+        return STATUS_NOT_FOUND;
+    }
+
+    if (!IsValidDirectory(&fileNameInfo->ParentDir))
+    {
+        LOG_VERBOSE(TraceCreate, "ResolveFileName: invalid parent directory");
+        return STATUS_NOT_FOUND;
+    }
+
+    Name->Buffer = (WCHAR*)g_pool.Allocate(PoolSubsystem::Create, PagedPool, fileNameInfo->Name.Length, CONTEXT_NAME_TAG);
+    if (!Name->Buffer)
+    {
+        LOG_ERROR(TraceContext, "ResolveFileName: failed to allocate file buffer");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Name->MaximumLength = fileNameInfo->Name.Length;
+    RtlCopyUnicodeString(Name, &fileNameInfo->Name);
+    return STATUS_SUCCESS;
+}
+
+void SnapshotCreates(_Out_ KappCreateReport* report)
+{
+    report->Opens = (uint64_t)ReadNoFence64(&g_creates.Opens);
+    report->NameQueries = (uint64_t)ReadNoFence64(&g_creates.NameQueries);
+    report->Deferred = (uint64_t)ReadNoFence64(&g_creates.Deferred);
+    report->Resolved = (uint64_t)ReadNoFence64(&g_creates.Resolved);
+    report->Avoided = (uint64_t)ReadNoFence64(&g_creates.Avoided);
+}
@@ -0,0 +1,29 @@
+#include "Directory.h"
+#include "Pool.h"
+#include "TraceCategories.h"
+#include "Tags.h"
+
+bool IsValidDirectory(_In_ PUNICODE_STRING directory)
+{
+    ULONG maxSize = 1024;
+    if (directory->Length > maxSize)
+    {
+        LOG_WARNING(TraceCreate, "IsValidDirectory: invalid length %u", directory->Length);
+        return false;
+    }
+
+    auto copy = (WCHAR*)g_pool.Allocate(PoolSubsystem::Create, PagedPool, maxSize + sizeof(WCHAR), DIRECTORY_TAG);
+    if (!copy)
+    {
+        LOG_ERROR(TraceCreate, "IsValidDirectory: cannot allocate copy");
+        return false;
+    }
+
+    RtlZeroMemory(copy, maxSize + sizeof(WCHAR));
+    wcsncpy_s(copy, maxSize / sizeof(WCHAR) + 1, directory->Buffer, directory->Length / sizeof(WCHAR));
+    _wcslwr(copy);
+    
+    auto ret = wcsstr(copy, L"\\secret\\") || wcsstr(copy, L"\\private\\");
+    g_pool.Free(copy, DIRECTORY_TAG);
+    return ret;
+}
@@ -0,0 +1,77 @@
+#include "Pool.h"
+#include "Protocol.h"
+
+static_assert((ULONG)PoolSubsystem::Count == KappPoolSubsystems, "the report has a slot per subsystem");
+
+PoolAccounting g_pool;
+
+auto PoolAccounting::Allocate(PoolSubsystem subsystem, POOL_TYPE type, SIZE_T size, ULONG tag) -> PVOID
+{
+    if (size > (SIZE_T)-1 - sizeof(Header))
+        return nullptr;
+
+    auto header = (Header*)ExAllocatePoolWithTag(type, sizeof(Header) + size, tag);
+    if (!header)
+        return nullptr;
+
+    header->Size = size;
+    header->Tag = tag;
+    header->Subsystem = subsystem;
+    Charge(subsystem, size);
+    return header + 1;
+}
+
+void PoolAccounting::Free(_In_ PVOID block, ULONG tag)
+{
+    auto header = (Header*)block - 1;
+    NT_ASSERT(header->Tag == tag);
+    Release(header->Subsystem, header->Size);
+    ExFreePoolWithTag(header, tag);
+}
+
+void PoolAccounting::Charge(PoolSubsystem subsystem, SIZE_T size)
+{
+    auto& counter = counters[(ULONG)subsystem];
+    InterlockedMax64(&counter.PeakBytes, InterlockedExchangeAdd64(&counter.Bytes, (LONGLONG)size) + (LONGLONG)size);
+    InterlockedMax64(&counter.PeakBlocks, InterlockedIncrement64(&counter.Blocks));
+    InterlockedExchangeAdd64(&counter.TotalBytes, (LONGLONG)size);
+    InterlockedIncrement64(&counter.TotalBlocks);
+}
+
+void PoolAccounting::Release(PoolSubsystem subsystem, SIZE_T size)
+{
+    auto& counter = counters[(ULONG)subsystem];
+    InterlockedExchangeAdd64(&counter.Bytes, -(LONGLONG)size);
+    InterlockedDecrement64(&counter.Blocks);
+}
+
+void PoolAccounting::Snapshot(_Out_ KappPoolReport* report, bool resetPeaks)
+{
+    RtlZeroMemory(report, sizeof(*report));
+    report->Subsystems = KappPoolSubsystems;
+    for (ULONG i = 0; i < KappPoolSubsystems; ++i)
+    {
+        // each counter is read once, a snapshot taken under load is not a single instant
+        auto& counter = counters[i];
+        auto& out = report->Counters[i];
+        out.Bytes = (uint64_t)ReadNoFence64(&counter.Bytes);
+        out.PeakBytes = (uint64_t)ReadNoFence64(&counter.PeakBytes);
+        out.TotalBytes = (uint64_t)ReadNoFence64(&counter.TotalBytes);
+        out.Blocks = (uint64_t)ReadNoFence64(&counter.Blocks);
+        out.PeakBlocks = (uint64_t)ReadNoFence64(&counter.PeakBlocks);
+        out.TotalBlocks = (uint64_t)ReadNoFence64(&counter.TotalBlocks);
+        if (resetPeaks)
+        {
+            InterlockedExchange64(&counter.PeakBytes, ReadNoFence64(&counter.Bytes));
+            InterlockedExchange64(&counter.PeakBlocks, ReadNoFence64(&counter.Blocks));
+        }
+    }
+}
+
+auto PoolAccounting::Outstanding() const -> LONGLONG
+{
+    LONGLONG blocks = 0;
+    for (const auto& counter : counters)
+        blocks += ReadNoFence64(&counter.Blocks);
+    return blocks;
+}
@@ -0,0 +1,251 @@
+#include "Port.h"
+#include "CreateContext.h"
+#include "Pool.h"
+#include "Protocol.h"
+#include "Shadow.h"
+#include "Tags.h"
+#include "TraceCategories.h"
+#include "kl.h"
+
+extern ShadowTable g_shadow;
+
+static PFLT_FILTER PortFilter = nullptr;
+static PFLT_PORT ServerPort = nullptr;
+static PFLT_PORT ClientPort = nullptr;
+static volatile LONG DrainBusy = 0;
+
+// Drains and shadow reports are bounded so that a large output buffer cannot exhaust the pool
+static const ULONG MaxDrainSize = 1024 * 1024;
+
+static NTSTATUS TraceDrain(_Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer, _In_ ULONG OutputBufferLength, _Out_ PULONG ReturnOutputBufferLength)
+{
+    *ReturnOutputBufferLength = 0;
+    if (!OutputBuffer || OutputBufferLength == 0)
+        return STATUS_INVALID_PARAMETER;
+
+    // kl::trace::Session::Drain calls must not overlap
+    if (InterlockedCompareExchange(&DrainBusy, 1, 0) != 0)
+        return STATUS_DEVICE_BUSY;
+
+    auto size = min(OutputBufferLength, MaxDrainSize);
+    auto buffer = g_pool.Allocate(PoolSubsystem::Port, PagedPool, size, PORT_TAG);
+    if (!buffer)
+    {
+        InterlockedExchange(&DrainBusy, 0);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    ULONG written = 0;
+    auto status = kl::trace::Default().Drain(buffer, size, &written);
+    InterlockedExchange(&DrainBusy, 0);
+    if (NT_SUCCESS(status))
+    {
+        // the output buffer is a user mode address
+        __try
+        {
+            RtlCopyMemory(OutputBuffer, buffer, written);
+            *ReturnOutputBufferLength = written;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+        }
+    }
+
+    g_pool.Free(buffer, PORT_TAG);
+    return status;
+}
+
+static NTSTATUS ShadowSet(_In_reads_bytes_(InputBufferLength) PVOID InputBuffer, _In_ ULONG InputBufferLength)
+{
+    if (InputBufferLength < sizeof(KappShadowSetMessage))
+        return STATUS_INVALID_PARAMETER;
+
+    KappShadowSetMessage message;
+    __try
+    {
+        message = *(KappShadowSetMessage*)InputBuffer;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    if (message.Mode > (uint32_t)ShadowMode::Read)
+        return STATUS_INVALID_PARAMETER;
+
+    // writes already deciding keep the mode they read
+    g_shadow.SetMode((ShadowMode)message.Mode);
+    if (message.Reset)
+        g_shadow.Clear();
+    LOG_INFO(TraceShadow, "Port: shadow mode %u, reset %u", message.Mode, message.Reset);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ShadowQuery(_Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer, _In_ ULONG OutputBufferLength, _Out_ PULONG ReturnOutputBufferLength)
+{
+    *ReturnOutputBufferLength = 0;
+    if (!OutputBuffer || OutputBufferLength < sizeof(KappShadowReport))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    // the snapshot is taken under the table lock, into pool memory, then copied to the user buffer
+    auto size = min(OutputBufferLength, MaxDrainSize);
+    auto buffer = g_pool.Allocate(PoolSubsystem::Port, PagedPool, size, PORT_SHADOW_TAG);
+    if (!buffer)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ULONG written = 0;
+    auto status = g_shadow.Snapshot(buffer, size, &written);
+    if (NT_SUCCESS(status))
+    {
+        __try
+        {
+            RtlCopyMemory(OutputBuffer, buffer, written);
+            *ReturnOutputBufferLength = written;
+        }
+        __except (EXCEPTION_EXECUTE_HANDLER)
+        {
+            status = GetExceptionCode();
+        }
+    }
+
+    g_pool.Free(buffer, PORT_SHADOW_TAG);
+    return status;
+}
+
+static NTSTATUS PoolQuery(_In_reads_bytes_(InputBufferLength) PVOID InputBuffer, _In_ ULONG InputBufferLength, _Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer, _In_ ULONG OutputBufferLength, _Out_ PULONG ReturnOutputBufferLength)
+{
+    *ReturnOutputBufferLength = 0;
+    if (!OutputBuffer || OutputBufferLength < sizeof(KappPoolReport))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    // a bare KappMessage leaves the peaks alone
+    KappPoolQueryMessage message = {};
+    __try
+    {
+        if (InputBufferLength >= sizeof(message))
+            message = *(KappPoolQueryMessage*)InputBuffer;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    KappPoolReport report;
+    g_pool.Snapshot(&report, message.ResetPeaks != 0);
+    __try
+    {
+        RtlCopyMemory(OutputBuffer, &report, sizeof(report));
+        *ReturnOutputBufferLength = sizeof(report);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS CreateQuery(_Out_writes_bytes_to_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer, _In_ ULONG OutputBufferLength, _Out_ PULONG ReturnOutputBufferLength)
+{
+    *ReturnOutputBufferLength = 0;
+    if (!OutputBuffer || OutputBufferLength < sizeof(KappCreateReport))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    KappCreateReport report;
+    SnapshotCreates(&report);
+    __try
+    {
+        RtlCopyMemory(OutputBuffer, &report, sizeof(report));
+        *ReturnOutputBufferLength = sizeof(report);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS PortConnect(_In_ PFLT_PORT ClientPortHandle, _In_opt_ PVOID ServerPortCookie, _In_reads_bytes_opt_(SizeOfContext) PVOID ConnectionContext, _In_ ULONG SizeOfContext, _Outptr_result_maybenull_ PVOID* ConnectionPortCookie)
+{
+    UNREFERENCED_PARAMETER(ServerPortCookie);
+    UNREFERENCED_PARAMETER(ConnectionContext);
+    UNREFERENCED_PARAMETER(SizeOfContext);
+    *ConnectionPortCookie = nullptr;
+    ClientPort = ClientPortHandle;
+    LOG_INFO(TraceDriver, "Port: client connected");
+    return STATUS_SUCCESS;
+}
+
+static VOID PortDisconnect(_In_opt_ PVOID ConnectionCookie)
+{
+    UNREFERENCED_PARAMETER(ConnectionCookie);
+    FltCloseClientPort(PortFilter, &ClientPort);
+    LOG_INFO(TraceDriver, "Port: client disconnected");
+}
+
+static NTSTATUS PortMessage(_In_opt_ PVOID PortCookie, _In_reads_bytes_opt_(InputBufferLength) PVOID InputBuffer, _In_ ULONG InputBufferLength, _Out_writes_bytes_to_opt_(OutputBufferLength, *ReturnOutputBufferLength) PVOID OutputBuffer, _In_ ULONG OutputBufferLength, _Out_ PULONG ReturnOutputBufferLength)
+{
+    UNREFERENCED_PARAMETER(PortCookie);
+    *ReturnOutputBufferLength = 0;
+    if (!InputBuffer || InputBufferLength < sizeof(KappMessage))
+        return STATUS_INVALID_PARAMETER;
+
+    KappMessage message;
+    __try
+    {
+        message = *(KappMessage*)InputBuffer;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+        return GetExceptionCode();
+    }
+
+    switch (message.Command)
+    {
+    case KappCommandTraceDrain:
+        return TraceDrain(OutputBuffer, OutputBufferLength, ReturnOutputBufferLength);
+    case KappCommandShadowSet:
+        return ShadowSet(InputBuffer, InputBufferLength);
+    case KappCommandShadowQuery:
+        return ShadowQuery(OutputBuffer, OutputBufferLength, ReturnOutputBufferLength);
+    case KappCommandPoolQuery:
+        return PoolQuery(InputBuffer, InputBufferLength, OutputBuffer, OutputBufferLength, ReturnOutputBufferLength);
+    case KappCommandCreateQuery:
+        return CreateQuery(OutputBuffer, OutputBufferLength, ReturnOutputBufferLength);
+    default:
+        LOG_WARNING(TraceDriver, "Port: unknown command %u", (ULONG)message.Command);
+        return STATUS_INVALID_PARAMETER;
+    }
+}
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS PortCreate(_In_ PFLT_FILTER Filter)
+{
+    PSECURITY_DESCRIPTOR sd = nullptr;
+    auto status = FltBuildDefaultSecurityDescriptor(&sd, FLT_PORT_ALL_ACCESS);  // administrators and system only
+    if (!NT_SUCCESS(status))
+        return status;
+
+    UNICODE_STRING name = RTL_CONSTANT_STRING(KAPP_PORT_NAME);
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, sd);
+    PortFilter = Filter;
+    status = FltCreateCommunicationPort(Filter, &ServerPort, &attributes, nullptr, PortConnect, PortDisconnect, PortMessage, 1);
+    FltFreeSecurityDescriptor(sd);
+    if (!NT_SUCCESS(status))
+        LOG_ERROR(TraceDriver, "Port: cannot create communication port (0x%08x)", status);
+
+    return status;
+}
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID PortClose()
+{
+    if (ServerPort)
+    {
+        FltCloseCommunicationPort(ServerPort);
+        ServerPort = nullptr;
+    }
+}
@@ -0,0 +1,168 @@
+#include "ProcessTable.h"
+#include "Pool.h"
+#include "Tags.h"
+
+void ProcessTable::Init()
+{
+    lock.Init();
+    for (auto& slot : slots)
+        slot = Empty;
+    count = 0;
+}
+
+auto ProcessTable::Find(ULONGLONG key) const -> ULONG
+{
+    auto index = Start(key);
+    for (ULONG i = 0; i < Slots; ++i, index = (index + 1) & (Slots - 1))
+    {
+        auto word = (ULONGLONG)ReadNoFence64(&slots[index]);
+        if (word == Empty || word >> 8 == key)
+            return index;
+    }
+
+    return Slots;
+}
+
+[[nodiscard]] auto ProcessTable::Set(_In_ HANDLE processId, ProcessPolicy policy) -> NTSTATUS
+{
+    if (policy == ProcessPolicy::Monitor)
+    {
+        Remove(processId);
+        return STATUS_SUCCESS;
+    }
+
+    auto key = Key(processId);
+    NT_ASSERT(key != 0);
+    kl::ExclusiveGuard guard(lock);
+    auto index = Find(key);
+    if (index == Slots)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (slots[index] == Empty)
+        InterlockedIncrement(&count);
+    // one store, a lookup sees the old word or the new one
+    InterlockedExchange64(&slots[index], (LONGLONG)(key << 8 | (UCHAR)policy));
+    return STATUS_SUCCESS;
+}
+
+auto ProcessTable::Remove(_In_ HANDLE processId) -> bool
+{
+    auto key = Key(processId);
+    kl::ExclusiveGuard guard(lock);
+    auto hole = Find(key);
+    auto found = hole != Slots && slots[hole] != Empty;
+    if (found)
+    {
+        // Backward shift: entries of the cluster that can live in the hole move into it, so that
+        // no probe sequence crosses an empty slot. An entry is copied before its old slot is
+        // reused, lookups meanwhile find it once, twice or, racing with the move, not at all.
+        for (auto next = (hole + 1) & (Slots - 1); slots[next] != Empty; next = (next + 1) & (Slots - 1))
+        {
+            auto start = Start((ULONGLONG)slots[next] >> 8);
+            auto stays = hole <= next ? (hole < start && start <= next) : (hole < start || start <= next);
+            if (stays)
+                continue;
+
+            InterlockedExchange64(&slots[hole], slots[next]);
+            hole = next;
+        }
+
+        InterlockedExchange64(&slots[hole], Empty);
+        InterlockedDecrement(&count);
+    }
+
+    return found;
+}
+
+[[nodiscard]] auto ProcessTable::Lookup(_In_ HANDLE processId) const -> ProcessPolicy
+{
+    auto key = Key(processId);
+    auto index = Start(key);
+    for (ULONG i = 0; i < Slots; ++i, index = (index + 1) & (Slots - 1))
+    {
+        auto word = (ULONGLONG)ReadNoFence64(&slots[index]);
+        if (word == Empty)
+            break;
+
+        if (word >> 8 == key)
+            return (ProcessPolicy)(word & 0xff);
+    }
+
+    return ProcessPolicy::Monitor;
+}
+
+[[nodiscard]] auto ExclusionList::Init(_In_reads_bytes_(size) const WCHAR* multiSz, ULONG size) -> NTSTATUS
+{
+    Clear();
+    auto characters = size / sizeof(WCHAR);
+    // an empty REG_MULTI_SZ is a single terminator
+    while (characters > 0 && multiSz[characters - 1] == L'\0')
+        --characters;
+    if (characters == 0)
+        return STATUS_SUCCESS;
+
+    // checked by the process notify routine, at PASSIVE_LEVEL
+    names = (WCHAR*)g_pool.Allocate(PoolSubsystem::Process, PagedPool, (characters + 1) * sizeof(WCHAR), PROCESS_TAG);
+    if (!names)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    // the accepted entries are packed, each with its terminator
+    for (ULONG start = 0; start < characters;)
+    {
+        auto end = start;
+        auto path = false;
+        while (end < characters && multiSz[end] != L'\0')
+            path |= multiSz[end++] == L'\\';
+
+        if (path)
+        {
+            RtlCopyMemory(names + length, multiSz + start, (end - start) * sizeof(WCHAR));
+            length += end - start;
+            names[length++] = L'\0';
+        }
+        else if (end > start)
+        {
+            ++rejected;
+        }
+
+        start = end + 1;
+    }
+
+    if (length == 0)
+    {
+        g_pool.Free(names, PROCESS_TAG);
+        names = nullptr;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void ExclusionList::Clear()
+{
+    if (names)
+        g_pool.Free(names, PROCESS_TAG);
+    names = nullptr;
+    length = 0;
+    rejected = 0;
+}
+
+[[nodiscard]] auto ExclusionList::Match(_In_ PCUNICODE_STRING imageFileName) const -> bool
+{
+    for (ULONG start = 0; start < length;)
+    {
+        auto end = start;
+        while (end < length && names[end] != L'\0')
+            ++end;
+
+        UNICODE_STRING name;
+        name.Buffer = names + start;
+        name.Length = (USHORT)((end - start) * sizeof(WCHAR));
+        name.MaximumLength = name.Length;
+        if (RtlEqualUnicodeString(&name, imageFileName, TRUE))
+            return true;
+
+        start = end + 1;
+    }
+
+    return false;
+}
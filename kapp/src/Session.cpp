@@ -0,0 +1,219 @@
+#include "Session.h"
+#include "Pool.h"
+#include "Tags.h"
+#include "TraceCategories.h"
+
+SessionTable::Key::~Key()
+{
+    if (Name.Buffer && Name.Buffer != Inline)
+        g_pool.Free(Name.Buffer, SESSION_KEY_TAG);
+}
+
+auto SessionTable::Key::Init(_In_ PCUNICODE_STRING name) -> NTSTATUS
+{
+    Name.Length = name->Length;
+    Name.MaximumLength = name->Length;
+    Name.Buffer = Inline;
+    if (name->Length > sizeof(Inline))
+    {
+        Name.Buffer = (WCHAR*)g_pool.Allocate(PoolSubsystem::Session, NonPagedPoolNx, name->Length, SESSION_KEY_TAG);
+        if (!Name.Buffer)
+            return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // FNV-1a of the upcased name, names are compared case insensitively
+    Hash = 2166136261u;
+    for (USHORT i = 0; i < name->Length / sizeof(WCHAR); ++i)
+    {
+        Name.Buffer[i] = RtlUpcaseUnicodeChar(name->Buffer[i]);
+        Hash ^= (USHORT)Name.Buffer[i];
+        Hash *= 16777619u;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+auto SessionTable::Lookup(const Key& key, Session*** link) -> Session*
+{
+    for (auto current = &buckets[key.Hash % Buckets]; *current; current = &(*current)->Next)
+    {
+        auto session = *current;
+        if (session->Hash == key.Hash && session->Name.Length == key.Name.Length
+            && RtlEqualMemory(session->Name.Buffer, key.Name.Buffer, key.Name.Length))
+        {
+            *link = current;
+            return session;
+        }
+    }
+
+    return nullptr;
+}
+
+auto SessionTable::Link(Session* session) -> Session**
+{
+    auto current = &buckets[session->Hash % Buckets];
+    while (*current != session)
+        current = &(*current)->Next;
+
+    return current;
+}
+
+void SessionTable::Unlink(Session** link, Session* session)
+{
+    *link = session->Next;
+    wheel.Cancel(&session->Timer);
+    --count;
+}
+
+void SessionTable::Init(ULONGLONG now, ULONGLONG sessionWindow, ULONGLONG tick)
+{
+    lock.Init();
+    RtlZeroMemory(buckets, sizeof(buckets));
+    wheel.Init(now, tick);
+    window = sessionWindow;
+    count = 0;
+}
+
+void SessionTable::Clear()
+{
+    kl::ExclusiveGuard guard(lock);
+    for (auto& bucket : buckets)
+    {
+        while (bucket)
+        {
+            auto session = bucket;
+            Unlink(&bucket, session);
+            g_pool.Free(session, SESSION_TAG);
+        }
+    }
+}
+
+[[nodiscard]] auto SessionTable::Find(_In_ PCUNICODE_STRING name, ULONGLONG now) -> bool
+{
+    // without a key the file makes a new backup
+    Key key;
+    if (!NT_SUCCESS(key.Init(name)))
+        return false;
+
+    Session** link = nullptr;
+    kl::ExclusiveGuard guard(lock);
+    auto session = Lookup(key, &link);
+    // an expired session the wheel has not reclaimed yet is as good as gone
+    return session && now < session->Expires;
+}
+
+[[nodiscard]] auto SessionTable::Touch(_In_ PCUNICODE_STRING name, ULONGLONG now) -> NTSTATUS
+{
+    Key key;
+    auto status = key.Init(name);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    Session** link = nullptr;
+    {
+        kl::ExclusiveGuard guard(lock);
+        auto session = Lookup(key, &link);
+        if (session)
+        {
+            session->Expires = now + window;
+            wheel.Reschedule(&session->Timer, session->Expires);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    // Allocate outside of the lock, then insert unless another thread was faster
+    auto created = (Session*)g_pool.Allocate(PoolSubsystem::Session, NonPagedPoolNx, sizeof(Session) + name->Length, SESSION_TAG);
+    if (!created)
+    {
+        LOG_ERROR(TraceSession, "SessionTable::Touch: cannot allocate session");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(created, sizeof(Session));
+    created->Hash = key.Hash;
+    created->Expires = now + window;
+    created->Name.Buffer = (WCHAR*)(created + 1);
+    created->Name.MaximumLength = name->Length;
+    RtlCopyUnicodeString(&created->Name, &key.Name);
+
+    Session* session = nullptr;
+    {
+        kl::ExclusiveGuard guard(lock);
+        session = Lookup(key, &link);
+        if (session)
+        {
+            session->Expires = created->Expires;
+            wheel.Reschedule(&session->Timer, session->Expires);
+        }
+        else
+        {
+            auto& bucket = buckets[key.Hash % Buckets];
+            created->Next = bucket;
+            bucket = created;
+            wheel.Schedule(&created->Timer, created->Expires);
+            ++count;
+        }
+    }
+
+    if (session)
+        g_pool.Free(created, SESSION_TAG);
+
+    return STATUS_SUCCESS;
+}
+
+auto SessionTable::Remove(_In_ PCUNICODE_STRING name) -> bool
+{
+    // a session that cannot be looked up must not outlive the file: they all end
+    Key key;
+    if (!NT_SUCCESS(key.Init(name)))
+    {
+        LOG_WARNING(TraceSession, "SessionTable::Remove: cannot allocate the key, ending every session");
+        Clear();
+        return true;
+    }
+
+    Session** link = nullptr;
+    Session* session = nullptr;
+    {
+        kl::ExclusiveGuard guard(lock);
+        session = Lookup(key, &link);
+        if (session)
+            Unlink(link, session);
+    }
+
+    if (!session)
+        return false;
+
+    LOG_VERBOSE(TraceSession, "SessionTable::Remove: %wZ", &session->Name);
+    g_pool.Free(session, SESSION_TAG);
+    return true;
+}
+
+auto SessionTable::Expire(ULONGLONG now) -> ULONG
+{
+    // Expired sessions are chained through their Next field and freed outside of the lock
+    Session* expired = nullptr;
+    ULONG fired = 0;
+    {
+        kl::ExclusiveGuard guard(lock);
+        fired = wheel.Advance(now, [&](kl::TimerEntry* entry) {
+            // found by address, names are not compared at DISPATCH_LEVEL
+            auto session = (Session*)entry;
+            *Link(session) = session->Next;
+            --count;
+            session->Next = expired;
+            expired = session;
+        });
+    }
+
+    while (expired)
+    {
+        auto session = expired;
+        expired = session->Next;
+        g_pool.Free(session, SESSION_TAG);
+    }
+
+    if (fired)
+        LOG_VERBOSE(TraceSession, "SessionTable::Expire: %u sessions expired", fired);
+    return fired;
+}
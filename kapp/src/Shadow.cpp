@@ -0,0 +1,183 @@
+#include "Shadow.h"
+#include "Pool.h"
+#include "Protocol.h"
+#include "Tags.h"
+
+namespace
+{
+    // Name of the directory of a file, without its final backslash
+    auto DirectoryName(PCUNICODE_STRING fileName) -> UNICODE_STRING
+    {
+        auto characters = fileName->Length / sizeof(WCHAR);
+        auto end = characters;
+        while (end > 0 && fileName->Buffer[end - 1] != L'\\')
+            --end;
+
+        UNICODE_STRING name;
+        name.Buffer = fileName->Buffer;
+        name.Length = (USHORT)((end > 0 ? end - 1 : characters) * sizeof(WCHAR));
+        name.MaximumLength = name.Length;
+        return name;
+    }
+
+    auto Hash(PCUNICODE_STRING name) -> ULONG
+    {
+        // FNV-1a of the upcased name, names are compared case insensitively
+        ULONG hash = 2166136261u;
+        for (USHORT i = 0; i < name->Length / sizeof(WCHAR); ++i)
+        {
+            hash ^= (USHORT)RtlUpcaseUnicodeChar(name->Buffer[i]);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+
+    constexpr auto RecordSize(USHORT nameLength) -> ULONG
+    {
+        return (ULONG)(sizeof(KappShadowDirectory) + nameLength + 7) & ~7u;
+    }
+}
+
+auto ShadowTable::Find(PCUNICODE_STRING name, ULONG hash) const -> Directory*
+{
+    for (auto directory = buckets[hash % Buckets]; directory; directory = directory->Next)
+    {
+        if (directory->Hash == hash && RtlEqualUnicodeString(&directory->Name, name, TRUE))
+            return directory;
+    }
+
+    return nullptr;
+}
+
+auto ShadowTable::Record(_In_ PCUNICODE_STRING fileName, bool copied, ULONGLONG bytes, ULONGLONG latency) -> NTSTATUS
+{
+    auto name = DirectoryName(fileName);
+    auto hash = Hash(&name);
+    auto add = [&](Directory* directory)
+    {
+        InterlockedIncrement64(copied ? &directory->Files : &directory->Current);
+        InterlockedExchangeAdd64(&directory->Bytes, (LONGLONG)bytes);
+        InterlockedExchangeAdd64(&directory->Latency, (LONGLONG)latency);
+        InterlockedMax64(&directory->LatencyMax, (LONGLONG)latency);
+    };
+
+    // the directories are only freed by Clear, under the exclusive lock
+    {
+        kl::SharedGuard guard(lock);
+        auto directory = Find(&name, hash);
+        if (directory)
+        {
+            add(directory);
+            return STATUS_SUCCESS;
+        }
+    }
+
+    // Allocate outside of the lock, then insert unless another thread was faster
+    auto created = (Directory*)g_pool.Allocate(PoolSubsystem::Shadow, PagedPool, sizeof(Directory) + name.Length, SHADOW_TAG);
+    if (!created)
+    {
+        InterlockedIncrement64(&dropped);
+        LOG_ERROR(TraceShadow, "ShadowTable::Record: cannot allocate directory");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(created, sizeof(Directory));
+    created->Hash = hash;
+    created->Name.Buffer = (WCHAR*)(created + 1);
+    created->Name.MaximumLength = name.Length;
+    RtlCopyUnicodeString(&created->Name, &name);
+
+    auto inserted = false;
+    auto full = false;
+    {
+        kl::ExclusiveGuard guard(lock);
+        auto directory = Find(&name, hash);
+        full = !directory && count == MaxDirectories;
+        if (!directory && !full)
+        {
+            auto& bucket = buckets[hash % Buckets];
+            created->Next = bucket;
+            bucket = created;
+            ++count;
+            directory = created;
+            inserted = true;
+        }
+
+        if (directory)
+            add(directory);
+    }
+
+    if (!inserted)
+        g_pool.Free(created, SHADOW_TAG);
+
+    if (full)
+    {
+        InterlockedIncrement64(&dropped);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void ShadowTable::Clear()
+{
+    kl::ExclusiveGuard guard(lock);
+    for (auto& bucket : buckets)
+    {
+        while (bucket)
+        {
+            auto directory = bucket;
+            bucket = directory->Next;
+            g_pool.Free(directory, SHADOW_TAG);
+        }
+    }
+
+    count = 0;
+    InterlockedExchange64(&dropped, 0);
+}
+
+[[nodiscard]] auto ShadowTable::Snapshot(_Out_writes_bytes_to_(size, *written) PVOID buffer, ULONG size, _Out_ ULONG* written) const -> NTSTATUS
+{
+    *written = 0;
+    if (size < sizeof(KappShadowReport))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    auto report = (KappShadowReport*)buffer;
+    RtlZeroMemory(report, sizeof(KappShadowReport));
+    auto offset = (ULONG)sizeof(KappShadowReport);
+
+    kl::SharedGuard guard(lock);
+    report->Mode = (uint32_t)Mode();
+    report->Directories = count;
+    report->Dropped = (uint64_t)ReadNoFence64(&dropped);
+    for (auto directory : buckets)
+    {
+        for (; directory; directory = directory->Next)
+        {
+            auto recordSize = RecordSize(directory->Name.Length);
+            if (size - offset < recordSize)
+            {
+                *written = offset;
+                return STATUS_SUCCESS;
+            }
+
+            auto record = (KappShadowDirectory*)((UCHAR*)buffer + offset);
+            RtlZeroMemory(record, recordSize);
+            record->Files = (uint64_t)ReadNoFence64(&directory->Files);
+            record->Current = (uint64_t)ReadNoFence64(&directory->Current);
+            record->Bytes = (uint64_t)ReadNoFence64(&directory->Bytes);
+            record->Latency = (uint64_t)ReadNoFence64(&directory->Latency);
+            record->LatencyMax = (uint64_t)ReadNoFence64(&directory->LatencyMax);
+            record->Size = recordSize;
+            record->NameLength = directory->Name.Length;
+            RtlCopyMemory(record + 1, directory->Name.Buffer, directory->Name.Length);
+            ++report->Records;
+            offset += recordSize;
+        }
+    }
+
+    *written = offset;
+    return STATUS_SUCCESS;
+}
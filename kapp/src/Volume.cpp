@@ -0,0 +1,123 @@
+#include "Volume.h"
+
+auto TuneVolume(const VolumeDevice& device, ULONG maxCopyWorkers) -> VolumeTuning
+{
+    VolumeTuning tuning;
+    tuning.SectorSize = device.SectorSize >= 512 ? device.SectorSize : 512;
+    ULONG block = 256 * 1024;
+    if (device.Removable)
+    {
+        tuning.Budget = 1;
+        tuning.CopyWorkers = 1;
+    }
+    else if (device.SeekPenalty)
+    {
+        // a head moving between files or pieces costs more than the copy of a block
+        block = 1024 * 1024;
+        tuning.Budget = 2;
+        tuning.CopyWorkers = 1;
+    }
+    else
+    {
+        tuning.Budget = 8;
+        tuning.CopyWorkers = maxCopyWorkers ? maxCopyWorkers : 1;
+    }
+
+    tuning.BlockSize = (block + tuning.SectorSize - 1) / tuning.SectorSize * tuning.SectorSize;
+    return tuning;
+}
+
+void BackupQueue::Init(ULONG slots)
+{
+    lock.Init();
+    head = nullptr;
+    tail = nullptr;
+    depth = 0;
+    active = 0;
+    budget = slots ? slots : 1;
+    closed = false;
+    RtlZeroMemory(&statistics, sizeof(statistics));
+}
+
+void BackupQueue::Enter(Waiter& waiter)
+{
+    {
+        kl::ExclusiveGuard guard(lock);
+        if (closed || (active < budget && !head))
+        {
+            ++active;
+            return;
+        }
+
+        KeInitializeEvent(&waiter.Ready, NotificationEvent, FALSE);
+        waiter.Next = nullptr;
+        if (tail)
+            tail->Next = &waiter;
+        else
+            head = &waiter;
+        tail = &waiter;
+        ++statistics.Queued;
+        if (++depth > statistics.DepthMax)
+            statistics.DepthMax = depth;
+    }
+
+    // Leave or Close hands the slot over, the waiter is off the queue when it is set
+    auto start = KeQueryInterruptTime();
+    KeWaitForSingleObject(&waiter.Ready, Executive, KernelMode, FALSE, nullptr);
+    auto wait = KeQueryInterruptTime() - start;
+
+    kl::ExclusiveGuard guard(lock);
+    statistics.WaitTime += wait;
+    if (wait > statistics.WaitMax)
+        statistics.WaitMax = wait;
+}
+
+void BackupQueue::Leave(bool succeeded, ULONGLONG bytes)
+{
+    kl::ExclusiveGuard guard(lock);
+    ++statistics.Backups;
+    statistics.Bytes += bytes;
+    if (!succeeded)
+        ++statistics.Failed;
+
+    auto next = head;
+    if (!next)
+    {
+        --active;
+        return;
+    }
+
+    head = next->Next;
+    if (!head)
+        tail = nullptr;
+    --depth;
+    KeSetEvent(&next->Ready, IO_NO_INCREMENT, FALSE);
+}
+
+void BackupQueue::Close()
+{
+    kl::ExclusiveGuard guard(lock);
+    closed = true;
+    while (head)
+    {
+        auto next = head;
+        head = next->Next;
+        ++active;
+        KeSetEvent(&next->Ready, IO_NO_INCREMENT, FALSE);
+    }
+
+    tail = nullptr;
+    depth = 0;
+}
+
+auto BackupQueue::Active() -> ULONG
+{
+    kl::ExclusiveGuard guard(lock);
+    return active;
+}
+
+auto BackupQueue::Statistics() -> VolumeStatistics
+{
+    kl::ExclusiveGuard guard(lock);
+    return statistics;
+}
@@ -1,10 +1,44 @@
 #include "main.h"
+#include "CopyEngine.h"
+#include "CreateContext.h"
+#include "CreateFilter.h"
+#include "Directory.h"
+#include "ParallelCopy.h"
+#include "Pool.h"
+#include "Port.h"
+#include "Prebackup.h"
+#include "ProcessTable.h"
+#include "Session.h"
+#include "Shadow.h"
+#include "TraceCategories.h"
+#include "Transform.h"
+
+#include <bcrypt.h>
+#include <ntddstor.h>
 
 UCHAR g_key[4];// = {0xaa, 0xbb, 0xcc, 0xdd };
 static_assert(sizeof(g_key) == sizeof(ULONG));
 
-#define DBGPRINT(x, ...)
-//#define DBGPRINT(msg, ...) DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_ERROR_LEVEL, msg"\n", __VA_ARGS__)
+TransformMode g_transformMode = TransformMode::Xor;
+kl::Aes g_cipher;
+ULONGLONG g_keyId = 0;
+
+ULONG g_sessionWindowMs = SESSION_WINDOW_MS;
+SessionTable* g_sessions = nullptr;     // null when sessions are disabled
+KTIMER g_sessionTimer;
+KDPC g_sessionDpc;
+
+ExclusionList g_exclusions;             // ExcludedProcesses service value
+ProcessTable* g_processes = nullptr;    // null when no process is excluded
+
+UNICODE_STRING g_serviceKey;            // bookmarks of the pre-backup scans live under it
+WCHAR* g_prebackupRoots = nullptr;      // PrebackupRoots service value, null when there is no scan
+ULONG g_prebackupRootsLength = 0;       // characters
+ULONGLONG g_prebackupRate = PREBACKUP_RATE_KBPS * 1024ull;
+ULONG g_copyWorkers = PARALLEL_COPY_WORKERS;     // CopyWorkers service value, at most that many per volume
+BOOLEAN g_lazyCreate = FALSE;           // LazyCreate service value, the names are queried by the first write
+
+ShadowTable g_shadow;                   // ShadowMode service value, uapp switches it at run time
 
 PFLT_FILTER FilterHandle = nullptr;
 
@@ -15,7 +49,7 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {            // The minifilter dr
                                                             // FLTFL_OPERATION_REGISTRATION_SKIP_CACHED_IO: bypass callbacks if it's cached I/O (e.g. Fast I/O)
                                                             // FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO: bypass callbacks for paging I/O (IRP-based operations)
                                                             // FLTFL_OPERATION_REGISTRATION_SKIP_NON_DASD_IO: bypass callbacks for direct access volumes (DAX/DAS)
-        nullptr,                                            // Pre operation
+        (PFLT_PRE_OPERATION_CALLBACK)PreCreateOperation,    // Pre operation
         (PFLT_POST_OPERATION_CALLBACK)PostCreateOperation   // Post operation
     },
     {
@@ -30,6 +64,18 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {            // The minifilter dr
         nullptr,
         (PFLT_POST_OPERATION_CALLBACK)PostCleanupOperation,
     },
+    {
+        IRP_MJ_ACQUIRE_FOR_SECTION_SYNCHRONIZATION,         // writable mappings resolve the pending contexts
+        0,
+        (PFLT_PRE_OPERATION_CALLBACK)PreAcquireForSectionOperation,
+        nullptr,
+    },
+    {
+        IRP_MJ_SET_INFORMATION,                             // renames and deletes end backup sessions
+        FLTFL_OPERATION_REGISTRATION_SKIP_PAGING_IO,
+        (PFLT_PRE_OPERATION_CALLBACK)PreSetInformationOperation,
+        nullptr,
+    },
     { IRP_MJ_OPERATION_END }
 };
 
@@ -37,36 +83,64 @@ const FLT_CONTEXT_REGISTRATION Contexts[] = {
     {
         FLT_FILE_CONTEXT,
         0,
-        nullptr,
+        FileContextCleanup,
         sizeof(FileContext),
         DRIVER_CONTEXT_TAG,
     },
+    {
+        FLT_INSTANCE_CONTEXT,
+        0,
+        InstanceContextCleanup,
+        sizeof(InstanceContext),
+        INSTANCE_CONTEXT_TAG,
+    },
     {FLT_CONTEXT_END}
 };
 
-static bool IsValidDirectory(_In_ PUNICODE_STRING directory)
+FLT_PREOP_CALLBACK_STATUS PreCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext)
 {
-    ULONG maxSize = 1024;
-    if (directory->Length > maxSize)
-    {
-        DBGPRINT("IsValidDirectory: invalid length\n");
-        return false;
-    }
+    UNREFERENCED_PARAMETER(CompletionContext);
+    const auto& params = Data->Iopb->Parameters.Create;
+    // paging files and volume opens are never backed up
+    if (FlagOn(Data->Iopb->OperationFlags, SL_OPEN_PAGING_FILE) || FlagOn(FltObjects->FileObject->Flags, FO_VOLUME_OPEN)
+        || !NeedsPostCreate(Data->RequestorMode, params.SecurityContext->DesiredAccess, params.Options, g_processes, FltGetRequestorProcessIdEx(Data)))
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    return FLT_PREOP_SUCCESS_WITH_CALLBACK;
+}
+
+// Gives its resolved name to a context; a file backed up within the session window keeps its backup
+VOID SetFileName(_Inout_ FileContext* Context, _In_ PUNICODE_STRING Name)
+{
+    Context->FileName = *Name;
+    Context->Written = g_sessions && g_sessions->Find(&Context->FileName, KeQueryInterruptTime());
+    Context->BackedUp = Context->Written;
+    if (Context->Written)
+        LOG_INFO(TraceSession, "SetFileName: reusing the backup of %wZ", &Context->FileName);
+}
+
+// The name query and classification a lazy create deferred, under the lock of the context. A file
+// that is not backed up keeps its context without a name, its writes go straight through; a failed
+// query keeps the context pending for the next write.
+VOID ResolveFileContext(_In_ PFLT_CALLBACK_DATA Data, _Inout_ FileContext* Context)
+{
+    if (!Context->Pending)
+        return;
 
-    auto copy = (WCHAR*)ExAllocatePoolWithTag(PagedPool, maxSize + sizeof(WCHAR), DRIVER_TAG);
-    if (!copy)
+    UNICODE_STRING name;
+    auto status = ResolveFileName(Data, &name);
+    if (!NT_SUCCESS(status) && status != STATUS_NOT_FOUND)
     {
-        DBGPRINT("IsValidDirectory: cannot allocate copy\n");
-        return false;
+        LOG_WARNING(TraceCreate, "ResolveFileContext: the name query failed, retried by the next write (0x%08x)", status);
+        return;
     }
 
-    RtlZeroMemory(copy, maxSize + sizeof(WCHAR));
-    wcsncpy_s(copy, maxSize / sizeof(WCHAR) + 1, directory->Buffer, directory->Length / sizeof(WCHAR));
-    _wcslwr(copy);
-    
-    auto ret = wcsstr(copy, L"\\secret\\") || wcsstr(copy, L"\\private\\");
-    ExFreePool(copy);
-    return ret;
+    Context->Pending = FALSE;
+    InterlockedIncrement64(&g_creates.Resolved);
+    if (NT_SUCCESS(status))
+        SetFileName(Context, &name);
+    else
+        Context->Written = TRUE;
 }
 
 FLT_POSTOP_CALLBACK_STATUS PostCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ PVOID CompletionContext, _In_ FLT_POST_OPERATION_FLAGS Flags)
@@ -77,7 +151,7 @@ FLT_POSTOP_CALLBACK_STATUS PostCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data,
     //UNREFERENCED_PARAMETER(Flags);              // A bitmask of flags that specifies how the post-operation callback is to be performed
     if (Flags & FLTFL_POST_OPERATION_DRAINING || FltObjects->FileObject->DeletePending)
     {
-        //DBGPRINT("PostCreateOperation: the filter instance is being detached or the file is opened for deletion\n");
+        LOG_VERBOSE(TraceCreate, "PostCreateOperation: the filter instance is being detached or the file is opened for deletion");
         return FLT_POSTOP_FINISHED_PROCESSING;
     }
 
@@ -86,65 +160,54 @@ FLT_POSTOP_CALLBACK_STATUS PostCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data,
         || (params.SecurityContext->DesiredAccess & FILE_WRITE_DATA) == 0
         || Data->IoStatus.Information == FILE_DOES_NOT_EXIST)
     {
-        //DBGPRINT("PostCreateOperation: kernel caller or not exists or no write access\n");
-        return FLT_POSTOP_FINISHED_PROCESSING;
-    }
-
-    auto fileNameInfo = kl::FilterFileNameInformation(Data);
-    if (!fileNameInfo)
-    {
-        DBGPRINT("PostCreateOperation: no filename info\n");
-        return FLT_POSTOP_FINISHED_PROCESSING;
-    }
-
-    if (!NT_SUCCESS(fileNameInfo.Parse()))
-    {
-        DBGPRINT("PostCreateOperation: cannot parse filename info\n");
+        LOG_VERBOSE(TraceCreate, "PostCreateOperation: kernel caller or not exists or no write access");
         return FLT_POSTOP_FINISHED_PROCESSING;
     }
 
-    //DBGPRINT("PostCreateOperation:got %wZ\n", fileNameInfo->Name);
-    if (fileNameInfo->Stream.Length > 0) // only the default data stream. Should check ::$DATA
+    InterlockedIncrement64(&g_creates.Opens);
+    UNICODE_STRING name = {};
+    auto pending = g_lazyCreate;
+    if (!pending)
     {
-        DBGPRINT("PostCreateOperation: only the default data stream\n");
-        return FLT_POSTOP_FINISHED_PROCESSING;
-    }
+        auto status = ResolveFileName(Data, &name);
+        if (status == STATUS_NOT_FOUND)
+            return FLT_POSTOP_FINISHED_PROCESSING;
 
-    if (!IsValidDirectory(&fileNameInfo->ParentDir))
-    {
-        //DBGPRINT("PostCreateOperation: invalid parent directory\n");
-        return FLT_POSTOP_FINISHED_PROCESSING;
+        // a failed name query is made again by the first write, as a lazy create does
+        pending = !NT_SUCCESS(status);
     }
 
     FileContext* context = nullptr;
     auto status = FltAllocateContext(FltObjects->Filter, FLT_FILE_CONTEXT, sizeof(*context), PagedPool, (PFLT_CONTEXT*)&context);
     if (!NT_SUCCESS(status))
     {
-        DBGPRINT("Failed to allocate file context (0x%08x)\n", status);
+        LOG_ERROR(TraceContext, "Failed to allocate file context (0x%08x)", status);
+        if (name.Buffer)
+            g_pool.Free(name.Buffer, CONTEXT_NAME_TAG);
         return FLT_POSTOP_FINISHED_PROCESSING;
     }
 
-    context->Written = FALSE;
-    context->FileName.MaximumLength = fileNameInfo->Name.Length;
-    context->FileName.Buffer = (WCHAR*)ExAllocatePoolWithTag(PagedPool, fileNameInfo->Name.Length, DRIVER_TAG);
-    if (!context->FileName.Buffer)
+    // released by FileContextCleanup, which frees the name too
+    g_pool.Charge(PoolSubsystem::Create, sizeof(*context));
+    context->Pending = pending;
+    if (context->Pending)
     {
-        DBGPRINT("PostCreateOperation: no failed to allocate file buffer\n");
-        FltReleaseContext(context);
-        return FLT_POSTOP_FINISHED_PROCESSING;
+        InterlockedIncrement64(&g_creates.Deferred);
+        context->FileName = name;       // empty
+        context->Written = FALSE;
+        context->BackedUp = FALSE;
     }
+    else
+        SetFileName(context, &name);
 
-    // copy file name (this might be done at a later stage but the sooner the better)
-    RtlCopyUnicodeString(&context->FileName, &fileNameInfo->Name);
     // if more than one thread within the client process writes to the file at roughly the same time
     context->Lock.Init();
-    // attach the context to the file object
-    DBGPRINT("Set context for %wZ on FltObjects %p\n", context->FileName, FltObjects);
+    // attach the context to the file object, a pending one has no name yet
+    LOG_INFO(TraceContext, "Set context for %wZ on FltObjects %p", &context->FileName, FltObjects);
     status = FltSetFileContext(FltObjects->Instance, FltObjects->FileObject, FLT_SET_CONTEXT_KEEP_IF_EXISTS, context, nullptr);
     if (!NT_SUCCESS(status))
     {
-        DBGPRINT("Failed to set file context (0x%08x)\n", status);
-        ExFreePool(context->FileName.Buffer);
+        LOG_ERROR(TraceContext, "Failed to set file context (0x%08x)", status);
     }
 
     // decrement ref counter set by FltSetFileContext (refcount == 1 by FltAllocateContext)
@@ -152,296 +215,1613 @@ FLT_POSTOP_CALLBACK_STATUS PostCreateOperation(_Inout_ PFLT_CALLBACK_DATA Data,
     return FLT_POSTOP_FINISHED_PROCESSING;
 }
 
-__forceinline void UpdateBuffer(UCHAR *buffer, ULONG size, ULONG chunk)
+// Last reference to a file context, its name goes with it
+VOID FileContextCleanup(_In_ PFLT_CONTEXT Context, _In_ FLT_CONTEXT_TYPE ContextType)
 {
-    UNREFERENCED_PARAMETER(chunk);
-    for (unsigned i = 0 ; i < size ; ++i)
-    {
-        *(buffer + i) = *(buffer + i) ^ g_key[i % sizeof(g_key)] ^ (UCHAR)chunk;
-        DBGPRINT("%d ", chunk);
-    }
+    UNREFERENCED_PARAMETER(ContextType);
+    auto context = (FileContext*)Context;
+    if (context->Pending)
+        InterlockedIncrement64(&g_creates.Avoided);
+    if (context->FileName.Buffer)
+        g_pool.Free(context->FileName.Buffer, CONTEXT_NAME_TAG);
+    g_pool.Release(PoolSubsystem::Create, sizeof(*context));
 }
 
-NTSTATUS HandleFile(_In_ PUNICODE_STRING FileName, _In_ PCFLT_RELATED_OBJECTS FltObjects)
+// Last reference to an instance context, its pre-backup worker and copy helpers were freed by InstanceTeardownCompleteCallback
+VOID InstanceContextCleanup(_In_ PFLT_CONTEXT Context, _In_ FLT_CONTEXT_TYPE ContextType)
 {
-    HANDLE hTargetFile = nullptr;
-    HANDLE hSourceFile = nullptr;
-    IO_STATUS_BLOCK ioStatus;
-    auto status = STATUS_SUCCESS;
-    void* buffer = nullptr;
-    LARGE_INTEGER fileSize;
+    UNREFERENCED_PARAMETER(Context);
+    UNREFERENCED_PARAMETER(ContextType);
+    g_pool.Release(PoolSubsystem::Volume, sizeof(InstanceContext));
+}
+
+// Io policy of the copy engine (CopyEngine.h) over the handles opened by HandleFile
+struct KernelFileIo
+{
+    HANDLE Source;
+    HANDLE Target;
+
+    NTSTATUS QueryRanges(ULONGLONG offset, ULONGLONG length, FileRange* ranges, ULONG capacity, ULONG* count, bool* more)
+    {
+        static_assert(sizeof(FileRange) == sizeof(FILE_ALLOCATED_RANGE_BUFFER), "FileRange mirrors FILE_ALLOCATED_RANGE_BUFFER");
+        FILE_ALLOCATED_RANGE_BUFFER query;
+        query.FileOffset.QuadPart = (LONGLONG)offset;
+        query.Length.QuadPart = (LONGLONG)length;
+        IO_STATUS_BLOCK ioStatus;
+        auto status = ZwFsControlFile(Source, nullptr, nullptr, nullptr, &ioStatus, FSCTL_QUERY_ALLOCATED_RANGES,
+            &query, sizeof(query), ranges, capacity * sizeof(FileRange));
+        if (status == STATUS_INVALID_DEVICE_REQUEST)
+        {
+            // no sparse file support, everything is allocated
+            ranges[0] = { offset, length };
+            *count = 1;
+            *more = false;
+            return STATUS_SUCCESS;
+        }
+
+        // STATUS_BUFFER_OVERFLOW: the buffer is full of ranges, ask again after the last one
+        *more = status == STATUS_BUFFER_OVERFLOW;
+        if (!NT_SUCCESS(status) && !*more)
+            return status;
+
+        *count = (ULONG)(ioStatus.Information / sizeof(FileRange));
+        return STATUS_SUCCESS;
+    }
 
-    DBGPRINT("HandleFile: handle %wZ\n", FileName);
-    // Return if no data (size == 0)
-    status = FsRtlGetFileSize(FltObjects->FileObject, &fileSize);
-    if (!NT_SUCCESS(status) || fileSize.QuadPart == 0)
+    NTSTATUS Read(ULONGLONG offset, UCHAR* buffer, ULONG size, ULONG* bytes)
     {
-        DBGPRINT("HandleFile: cannot get file size (0x%08x)\n", status);
+        IO_STATUS_BLOCK ioStatus;
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)offset;
+        *bytes = 0;
+        auto status = ZwReadFile(Source, nullptr, nullptr, nullptr, &ioStatus, buffer, size, &position, nullptr);
+        if (status == STATUS_END_OF_FILE)
+            return STATUS_SUCCESS;
+
+        if (NT_SUCCESS(status))
+            *bytes = (ULONG)ioStatus.Information;
         return status;
     }
 
-    do {
-        OBJECT_ATTRIBUTES sourceFileAttr;
-        InitializeObjectAttributes(&sourceFileAttr, FileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
-        // Open the source file (ZwCreateFile would send I/O requests to the top of the file system driver stack)
-        status = FltCreateFile(
-            FltObjects->Filter,                                        // filter object
-            FltObjects->Instance,                                    // filter instance
-            &hSourceFile,                                            // resulting handle
-            FILE_READ_DATA | SYNCHRONIZE,                           // access mask
-            &sourceFileAttr,                                        // object attributes
-            &ioStatus,                                                // resulting status
-            nullptr, FILE_ATTRIBUTE_NORMAL,                         // allocation size, file attributes
-            FILE_SHARE_READ | FILE_SHARE_WRITE,                        // share flags
-            FILE_OPEN,                                                // create disposition
-            FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY,    // create options (sync I/O)
-            nullptr, 0,                                                // extended attributes, EA length
-            IO_IGNORE_SHARE_ACCESS_CHECK                            // flags
-        );
+    NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size)
+    {
+        IO_STATUS_BLOCK ioStatus;
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)offset;
+        return ZwWriteFile(Target, nullptr, nullptr, nullptr, &ioStatus, (PVOID)buffer, size, &position, nullptr);
+    }
+
+    NTSTATUS SetSparse()
+    {
+        IO_STATUS_BLOCK ioStatus;
+        FILE_SET_SPARSE_BUFFER sparse;
+        sparse.SetSparse = TRUE;
+        return ZwFsControlFile(Target, nullptr, nullptr, nullptr, &ioStatus, FSCTL_SET_SPARSE, &sparse, sizeof(sparse), nullptr, 0);
+    }
+
+    NTSTATUS SetEndOfFile(ULONGLONG size)
+    {
+        IO_STATUS_BLOCK ioStatus;
+        FILE_END_OF_FILE_INFORMATION info;
+        info.EndOfFile.QuadPart = (LONGLONG)size;
+        return ZwSetInformationFile(Target, &ioStatus, &info, sizeof(info), FileEndOfFileInformation);
+    }
+
+    NTSTATUS Reserve(ULONGLONG size)
+    {
+        // NTFS looks for free clusters for the whole allocation at once, instead of extending it at each write
+        IO_STATUS_BLOCK ioStatus;
+        FILE_ALLOCATION_INFORMATION allocation;
+        allocation.AllocationSize.QuadPart = (LONGLONG)size;
+        auto status = ZwSetInformationFile(Target, &ioStatus, &allocation, sizeof(allocation), FileAllocationInformation);
         if (!NT_SUCCESS(status))
-        {
-            DBGPRINT("HandleFile: cannot open the source file (0x%08x)\n", status);
-            break;
-        }
+            return status;
 
-        // Open the target file (source ADS)
-        UNICODE_STRING targetFileName;
-        const WCHAR backupStream[] = L".lock";
-        targetFileName.MaximumLength = FileName->Length + sizeof(backupStream);
-        targetFileName.Buffer = (WCHAR*)ExAllocatePoolWithTag(PagedPool, targetFileName.MaximumLength, DRIVER_TAG);
-        if (targetFileName.Buffer == nullptr)
-        {
-            DBGPRINT("HandleFile: cannot allocate target file buffer\n");
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
+        return SetEndOfFile(size);
+    }
+};
 
-        RtlCopyUnicodeString(&targetFileName, FileName);
-        RtlAppendUnicodeToString(&targetFileName, backupStream);
+// Io of the parallel copy. FltReadFile and FltWriteFile at explicit offsets, without updating the
+// byte offset, do not serialize on the file object lock as ZwReadFile does on a synchronous handle.
+struct KernelParallelIo
+{
+    PFLT_INSTANCE Instance;
+    PFILE_OBJECT Source = nullptr;
+    PFILE_OBJECT Target = nullptr;
 
-        OBJECT_ATTRIBUTES targetFileAttr;
-        InitializeObjectAttributes(&targetFileAttr, &targetFileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
-        status = FltCreateFile(
-            FltObjects->Filter,                                        // filter object
-            FltObjects->Instance,                                    // filter instance
-            &hTargetFile,                                            // resulting handle
-            GENERIC_WRITE | SYNCHRONIZE,                            // access mask
-            &targetFileAttr,                                        // object attributes
-            &ioStatus,                                                // resulting status
-            nullptr, FILE_ATTRIBUTE_NORMAL,                         // allocation size, file attributes
-            0,                                                        // share flags
-            FILE_OVERWRITE_IF,                                        // create disposition
-            FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY,    // create options (sync I/O)
-            nullptr, 0,                                                // extended attributes, EA length
-            0 /*IO_IGNORE_SHARE_ACCESS_CHECK*/                        // flags
-        );
-        ExFreePool(targetFileName.Buffer);
+    NTSTATUS Reference(_In_ HANDLE hSourceFile, _In_ HANDLE hTargetFile)
+    {
+        auto status = ObReferenceObjectByHandle(hSourceFile, 0, *IoFileObjectType, KernelMode, (PVOID*)&Source, nullptr);
+        if (NT_SUCCESS(status))
+            status = ObReferenceObjectByHandle(hTargetFile, 0, *IoFileObjectType, KernelMode, (PVOID*)&Target, nullptr);
         if (!NT_SUCCESS(status))
+            Dereference();
+        return status;
+    }
+
+    void Dereference()
+    {
+        if (Source)
+            ObDereferenceObject(Source);
+        if (Target)
+            ObDereferenceObject(Target);
+        Source = nullptr;
+        Target = nullptr;
+    }
+
+    NTSTATUS Read(ULONGLONG offset, UCHAR* buffer, ULONG size, ULONG* bytes)
+    {
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)offset;
+        *bytes = 0;
+        auto status = FltReadFile(Instance, Source, &position, size, buffer, FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET, bytes, nullptr, nullptr);
+        if (status == STATUS_END_OF_FILE)
         {
-            DBGPRINT("HandleFile: cannot open target file (0x%08x)\n", status);
-            break;
+            *bytes = 0;
+            return STATUS_SUCCESS;
         }
 
-        // copy chunks from source to target
-        // allocate buffer for copying purposes
-        ULONG size = 7;
-        buffer = ExAllocatePoolWithTag(PagedPool, size, DRIVER_TAG);
-        if (!buffer)
+        return status;
+    }
+
+    NTSTATUS Write(ULONGLONG offset, const UCHAR* buffer, ULONG size)
+    {
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)offset;
+        ULONG written = 0;
+        return FltWriteFile(Instance, Target, &position, size, (PVOID)buffer, FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET, &written, nullptr, nullptr);
+    }
+};
+
+// A helper of a parallel copy queued on the threads of the volume, in an allocation of CopyFileParallel
+struct CopyJob
+{
+    LIST_ENTRY Link;                // self-linked once a thread took it
+    VOID (*Run)(_In_ PVOID Context);
+    PVOID Context;
+};
+
+// Helper threads of the parallel copies of a volume, CopyWorkers - 1 of them. A helper makes long synchronous
+// piece reads and writes: on the system worker threads it would hold up the delayed work of the system and of
+// the other drivers, as many times over as there are first writes copying.
+struct CopyPool
+{
+    kl::SpinLock Lock;              // guards Pending and Stopping
+    LIST_ENTRY Pending;             // CopyJob, not taken by a thread yet
+    KSEMAPHORE Queued;              // a count per job queued, and per thread to stop
+    BOOLEAN Stopping;
+    ULONG Threads;
+    PKTHREAD Thread[PARALLEL_COPY_WORKERS_MAX];
+
+    void Queue(_Inout_ CopyJob* Job)
+    {
         {
-            DBGPRINT("HandleFile: cannot allocate chunk\n");
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            break;
+            kl::ExclusiveGuard guard(Lock);
+            InsertTailList(&Pending, &Job->Link);
         }
 
-        // loop - read from source, write to target
-        LARGE_INTEGER offset = { 0 };       // read
-        LARGE_INTEGER writeOffset = { 0 };  // write
-        ULONG bytes;
-        auto saveSize = fileSize;
-        ULONG chunk = 1;
-        while (fileSize.QuadPart > 0)
+        KeReleaseSemaphore(&Queued, IO_NO_INCREMENT, 1, FALSE);
+    }
+
+    // Takes back the jobs no thread took yet, returns how many. Their counts only wake a thread for nothing.
+    auto Withdraw(_Inout_updates_(Count) CopyJob* Jobs, ULONG Count) -> ULONG
+    {
+        ULONG withdrawn = 0;
+        kl::ExclusiveGuard guard(Lock);
+        for (ULONG i = 0; i < Count; ++i)
         {
-            status = ZwReadFile(
-                hSourceFile,
-                nullptr,                                        // optional KEVENT
-                nullptr, nullptr,                               // no APC
-                &ioStatus,
-                buffer,
-                (ULONG)min((LONGLONG)size, fileSize.QuadPart),  // number of bytes
-                &offset,                                        // offset
-                nullptr                                         // optional key
-            );
-            if (!NT_SUCCESS(status))
+            if (!IsListEmpty(&Jobs[i].Link))
             {
-                DBGPRINT("HandleFile: cannot read source chunk (0x%08x)\n", status);
-                break;
+                RemoveEntryList(&Jobs[i].Link);
+                InitializeListHead(&Jobs[i].Link);
+                ++withdrawn;
             }
+        }
 
-            bytes = (ULONG)ioStatus.Information;
-            UpdateBuffer((UCHAR*)buffer, bytes, chunk++);
-            // write to target file
-            status = ZwWriteFile(
-                hTargetFile,        // target handle
-                nullptr,            // optional KEVENT
-                nullptr, nullptr,   // APC routine, APC context
-                &ioStatus,          // I/O status result
-                buffer,             // data to write
-                bytes,              // number of bytes to write
-                &writeOffset,       // offset
-                nullptr             // optional key
-            );
-            if (!NT_SUCCESS(status))
+        return withdrawn;
+    }
+};
+
+VOID CopyPoolThread(_In_ PVOID Context)
+{
+    auto pool = (CopyPool*)Context;
+    for (;;)
+    {
+        KeWaitForSingleObject(&pool->Queued, Executive, KernelMode, FALSE, nullptr);
+        CopyJob* job = nullptr;
+        {
+            kl::ExclusiveGuard guard(pool->Lock);
+            if (!IsListEmpty(&pool->Pending))
             {
-                DBGPRINT("HandleFile: cannot write target chunk (0x%08x)\n", status);
-                break;
+                job = CONTAINING_RECORD(RemoveHeadList(&pool->Pending), CopyJob, Link);
+                InitializeListHead(&job->Link);
             }
-
-            // update byte count and offsets
-            offset.QuadPart += bytes;
-            writeOffset.QuadPart += bytes;
-            fileSize.QuadPart -= bytes;
+            else if (pool->Stopping)
+                break;
         }
 
-        // write target file
-        FILE_END_OF_FILE_INFORMATION info;
-        info.EndOfFile = saveSize;
-        NT_VERIFY(NT_SUCCESS(ZwSetInformationFile(hTargetFile, &ioStatus, &info, sizeof(info), FileEndOfFileInformation)));
-
-        // delete source file
-        FILE_DISPOSITION_INFORMATION delete_info;
-        delete_info.DeleteFile = TRUE;
-        NT_VERIFY(NT_SUCCESS(ZwSetInformationFile(hSourceFile, &ioStatus, &delete_info, sizeof(delete_info), FileDispositionInformation)));
-    } while(false);
-
-    if (buffer)
-        ExFreePool(buffer);
-
-    if (hSourceFile)
-        FltClose(hSourceFile);
-
-    if (hTargetFile)
-        FltClose(hTargetFile);
+        // the job may be gone once it ran
+        if (job)
+            job->Run(job->Context);
+    }
 
-    return status;
+    PsTerminateSystemThread(STATUS_SUCCESS);
 }
 
-FLT_PREOP_CALLBACK_STATUS PreWriteOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext)
+// Starts the helper threads of the volume of Context, its copies are serial without them
+VOID CopyPoolStart(_Inout_ InstanceContext* Context)
 {
-    UNREFERENCED_PARAMETER(Data);               // Pointer to the callback data structure for the I/O operation
-    //UNREFERENCED_PARAMETER(FltObjects);       // Pointer to an FLT_RELATED_OBJECTS strcture that contains opaque pointers for the objects related to the current I/O request
-    UNREFERENCED_PARAMETER(CompletionContext);  // Pointer to an optional context in case this callacks returns FLT_PREOP_SUCCESS_WITH_CALLBACK or FLT_PREOP_SYNCHRONIZE
-    FileContext* context = nullptr;
-    //DBGPRINT("Get context on FltObjects %p\n", FltObjects);
-    auto status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
-    if (!NT_SUCCESS(status) || context == nullptr)
+    auto threads = min(Context->Tuning.CopyWorkers, KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS));
+    if (threads <= 1)
+        return;
+
+    // the list and the semaphore are used at DISPATCH_LEVEL
+    auto pool = (CopyPool*)g_pool.Allocate(PoolSubsystem::Copy, NonPagedPoolNx, sizeof(CopyPool), COPY_POOL_TAG);
+    if (!pool)
     {
-        //DBGPRINT("PreWriteOperation: cannot get file context (0x%08x)\n", status);
-        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+        LOG_WARNING(TraceCopy, "CopyPoolStart: no copy helpers, the copies of the volume are serial");
+        return;
     }
 
+    pool->Lock.Init();
+    InitializeListHead(&pool->Pending);
+    KeInitializeSemaphore(&pool->Queued, 0, MAXLONG);
+    pool->Stopping = FALSE;
+    for (pool->Threads = 0; pool->Threads < threads - 1; ++pool->Threads)
     {
-        context->Lock.Lock();
-        DBGPRINT("context filename %wZ", &context->FileName);
-        if (!context->Written)
+        HANDLE thread = nullptr;
+        auto status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, nullptr, nullptr, nullptr, CopyPoolThread, pool);
+        if (!NT_SUCCESS(status))
         {
-            status = HandleFile(&context->FileName, FltObjects);
-            if (!NT_SUCCESS(status))
-            {
-                DBGPRINT("PreWriteOperation: failed to handle file (0x%08x)\n", status);
-            }
-
-            context->Written = TRUE;
+            LOG_WARNING(TraceCopy, "CopyPoolStart: %u copy helpers (0x%08x)", pool->Threads, status);
+            break;
         }
-        context->Lock.Unlock();
+
+        NT_VERIFY(NT_SUCCESS(ObReferenceObjectByHandle(thread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID*)&pool->Thread[pool->Threads], nullptr)));
+        ZwClose(thread);
     }
 
-    FltReleaseContext(context);
-    return FLT_PREOP_SUCCESS_NO_CALLBACK;
-    //return FLT_PREOP_COMPLETE;
+    if (pool->Threads == 0)
+    {
+        g_pool.Free(pool, COPY_POOL_TAG);
+        return;
+    }
+
+    Context->Helpers = pool;
 }
 
-FLT_POSTOP_CALLBACK_STATUS PostCleanupOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ PVOID CompletionContext, _In_ FLT_POST_OPERATION_FLAGS Flags)
+// Once the I/O of the volume is over, no copy is left to help
+VOID CopyPoolStop(_In_ CopyPool* Pool)
 {
-    UNREFERENCED_PARAMETER(Data);               // Pointer to the callback data structure for the I/O operation
-    UNREFERENCED_PARAMETER(FltObjects);         // Pointer to an FLT_RELATED_OBJECTS strcture that contains opaque pointers for the objects related to the current I/O request
-    UNREFERENCED_PARAMETER(CompletionContext);  // A pointer that was returned by the minifilter pre-operation callback.
-    UNREFERENCED_PARAMETER(Flags);              // A bitmask of flags that specifies how the post-operation callback is to be performed
-    FileContext* context = nullptr;
-    auto status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
-    if (!NT_SUCCESS(status) || context == nullptr)
     {
-        // DBGPRINT("PostCleanupOperation: cannot get file context (0x%08x)\n", status);
-        return FLT_POSTOP_FINISHED_PROCESSING;
+        kl::ExclusiveGuard guard(Pool->Lock);
+        Pool->Stopping = TRUE;
     }
 
-    if (context->FileName.Buffer)
-        ExFreePool(context->FileName.Buffer);
+    KeReleaseSemaphore(&Pool->Queued, IO_NO_INCREMENT, (LONG)Pool->Threads, FALSE);
+    for (ULONG i = 0; i < Pool->Threads; ++i)
+    {
+        KeWaitForSingleObject(Pool->Thread[i], Executive, KernelMode, FALSE, nullptr);
+        ObDereferenceObject(Pool->Thread[i]);
+    }
 
-    FltReleaseContext(context);
-    FltDeleteContext(context);
-    return FLT_POSTOP_FINISHED_PROCESSING;
+    g_pool.Free(Pool, COPY_POOL_TAG);
 }
 
-NTSTATUS FilterUnloadCallback(_In_ FLT_FILTER_UNLOAD_FLAGS Flags)
+// Shared by the helpers of CopyFileParallel, which returns once every helper left the copy
+template <typename Transform>
+struct CopyHelperContext
 {
-    /*
-        The filter manager calls the FilterUnloadCallback routine to notify the minifilter driver that the filter manager is about to unload the minifilter driver.
-    */
-    UNREFERENCED_PARAMETER(Flags);              // A bitmask of flags describing the unload request
-    PAGED_CODE();
-    FltUnregisterFilter(FilterHandle);
-    DBGPRINT("Driver unloaded\n");
-    return STATUS_SUCCESS;
+    ParallelCopy<KernelParallelIo, Transform>* Copy;
+    ULONG BufferSize;               // block size of the volume
+};
+
+// A helper of the parallel copy, on a helper thread of the volume
+template <typename Transform>
+VOID CopyHelper(_In_ PVOID Context)
+{
+    auto copy = ((CopyHelperContext<Transform>*)Context)->Copy;
+    auto size = ((CopyHelperContext<Transform>*)Context)->BufferSize;
+    auto buffer = (UCHAR*)g_pool.Allocate(PoolSubsystem::Copy, PagedPool, size, COPY_HELPER_TAG);
+    if (buffer)
+        copy->Help(buffer, size);
+    else
+        copy->Leave();
+
+    // the copy may be gone, only our own allocation is left
+    if (buffer)
+        g_pool.Free(buffer, COPY_HELPER_TAG);
 }
 
-NTSTATUS InstanceSetupCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_SETUP_FLAGS Flags, _In_ DEVICE_TYPE VolumeDeviceType, _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType)
+// Copies the pieces of the plan on the calling thread and up to plan.Workers - 1 helpers of the volume, returns
+// once they are all done. The helpers still queued when the caller is done with the pieces are withdrawn: a busy
+// pool does not hold the copy back.
+template <typename Transform>
+NTSTATUS CopyFileParallel(_In_ CopyPool* Helpers, KernelParallelIo& Io, const Transform& transform, ULONGLONG FileSize, const CopyPlan& Plan,
+    _Inout_updates_bytes_(Size) UCHAR* Buffer, ULONG Size, CopyStatistics& Statistics)
 {
-    /*
-        The filter manager calls this routine on the first operation after a new volume is mounted.
-        The filter manager calls this routine to allow the minifilter driver to respond to an automatic or manual attachment request.
-        If this routine returns an error or warning NTSTATUS code, the minifilter driver instance is not attached to the given volume.
-        Otherwise, the minifilter driver instance is attached to the given volume.
-    */
-    UNREFERENCED_PARAMETER(FltObjects);             // Pointer to an FLT_RELATED_OBJECTS structure that contains opaque pointers for the objects related to the current operation.
-    UNREFERENCED_PARAMETER(Flags);                  // Bitmask of flags that indicate why the instance is being attached
-    UNREFERENCED_PARAMETER(VolumeDeviceType);       // Device type of the file system volume (FILE_DEVICE_CD_ROM_FILE_SYSTEM, FILE_DEVICE_DISK_FILE_SYSTEM, FILE_DEVICE_NETWORK_FILE_SYSTEM)
-    // UNREFERENCED_PARAMETER(VolumeFilesystemType);   // File system type of the volume (FLT_FILESYSTEM_TYPE enum)
-    PAGED_CODE();
+    ParallelCopy<KernelParallelIo, Transform> copy(Io, transform, FileSize, Plan);
+    CopyHelperContext<Transform> helper = { &copy, Size };
+    auto queued = min(Plan.Workers - 1, Helpers->Threads);
+    // the pool walks the jobs at DISPATCH_LEVEL; without them the caller copies alone
+    auto jobs = (CopyJob*)g_pool.Allocate(PoolSubsystem::Copy, NonPagedPoolNx, queued * sizeof(CopyJob), COPY_POOL_TAG);
+    if (!jobs)
+        queued = 0;
 
-    DBGPRINT("VolumeFilesystemType %d. Want %d.\n", VolumeFilesystemType, FLT_FSTYPE_NTFS);
-    if (VolumeFilesystemType != FLT_FSTYPE_NTFS || VolumeDeviceType != FILE_DEVICE_DISK_FILE_SYSTEM)
+    for (ULONG i = 0; i < queued; ++i)
     {
-        DBGPRINT("Not attaching to non-NTFS volume (%d)\n", VolumeFilesystemType); // (13) and (5)
-        return STATUS_FLT_DO_NOT_ATTACH;
+        jobs[i].Run = CopyHelper<Transform>;
+        jobs[i].Context = &helper;
+        copy.Enter();
+        Helpers->Queue(&jobs[i]);
     }
 
-    return STATUS_SUCCESS;
+    auto status = copy.Join(Buffer, Size, Statistics, [&] { return Helpers->Withdraw(jobs, queued); });
+    if (jobs)
+        g_pool.Free(jobs, COPY_POOL_TAG);
+    return status;
 }
 
-
-NTSTATUS InstanceQueryTeardownCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags)
+// Picks the transform once per file, the copy loop itself has no indirect call.
+// Io is KernelFileIo, or ShadowIo in shadow mode. The copy buffer is the block size of the volume and,
+// with Parallel, a large dense file is split between the copy workers of the volume (ParallelCopy.h).
+template <typename Io>
+NTSTATUS CopyFileData(_In_ const BackupRecord* Record, _In_opt_ CopyPool* Helpers, _In_ const VolumeTuning* Tuning, Io& io, _In_opt_ KernelParallelIo* Parallel,
+    _In_ const FILE_NETWORK_OPEN_INFORMATION* Source, _In_ const FILE_NETWORK_OPEN_INFORMATION* Target)
 {
-    /*
-        The filter manager calls this routine to allow the minifilter driver to respond to a manual detach request.
-        Such a request is received when a user-mode application calls FilterDetach or a kernel-mode component calls FltDetachVolume.
-        This routine is not called for automatic or mandatory detach requests, for example, when the minifilter driver is unloaded or a volume is dismounted.
-    */
-    UNREFERENCED_PARAMETER(FltObjects);             // Pointer to an FLT_RELATED_OBJECTS structure that contains opaque pointers for the objects related to the current operation.
-    UNREFERENCED_PARAMETER(Flags);                  // Bitmask of flags that describe why the given isntance query teardown callback routine was called (no flags currently defined)
-    PAGED_CODE();
-    return STATUS_SUCCESS;
-}
+    // allocate buffer for copying purposes
+    ULONG size = Tuning->BlockSize;
+    auto buffer = (UCHAR*)g_pool.Allocate(PoolSubsystem::Copy, PagedPool, size, COPY_BUFFER_TAG);
+    if (!buffer)
+    {
+        LOG_ERROR(TraceCopy, "HandleFile: cannot allocate chunk");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-const FLT_REGISTRATION FilterRegistration = {                               // A driver uses FLT_REGISTRATION to register itself with the filter manager
-    sizeof(FLT_REGISTRATION),                                               // Size
-    FLT_REGISTRATION_VERSION,                                               // Version
+    auto fileSize = Source->EndOfFile;
+    TargetLayout layout;
+    auto status = PrepareTarget(io, (ULONGLONG)fileSize.QuadPart, (Source->FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0,
+        (ULONGLONG)Target->EndOfFile.QuadPart, (Target->FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0, &layout);
+    if (!NT_SUCCESS(status))
+    {
+        g_pool.Free(buffer, COPY_BUFFER_TAG);
+        return status;
+    }
+
+    // the pieces are written in parallel into the reserved target, holes and extensions are serial
+    auto workers = min(Tuning->CopyWorkers, KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS));
+    auto dense = (Source->FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) == 0 && layout != TargetLayout::Extended;
+    auto plan = SplitFile((ULONGLONG)fileSize.QuadPart, Helpers && Parallel && dense ? workers : 1, PARALLEL_COPY_PIECE_SIZE, size);
+    CopyStatistics statistics;
+    auto copy = [&](const auto& transform) {
+        return plan.Workers > 1
+            ? CopyFileParallel(Helpers, *Parallel, transform, (ULONGLONG)fileSize.QuadPart, plan, buffer, size, statistics)
+            : CopyFileRanges(io, (ULONGLONG)fileSize.QuadPart, transform, buffer, size, statistics);
+    };
+
+    if (g_transformMode == TransformMode::Xor)
+    {
+        status = copy(XorTransform{});
+    }
+    else
+    {
+        // Counter blocks are the nonce of the copy (8 bytes) | block index (8 bytes)
+        AesCtrTransform transform = { &g_cipher, {} };
+        RtlCopyMemory(transform.Iv, Record->Nonce, sizeof(Record->Nonce));
+        status = copy(transform);
+    }
+
+    g_pool.Free(buffer, COPY_BUFFER_TAG);
+    if (NT_SUCCESS(status))
+        status = FinishTarget(io, (ULONGLONG)fileSize.QuadPart, layout, statistics);
+    LOG_INFO(TraceCopy, "HandleFile: %llu bytes read, %llu skipped in holes, %u ranges, sparse %d, layout %u, %u workers",
+        statistics.BytesRead, statistics.BytesSkipped, statistics.Ranges, statistics.Sparse, (ULONG)layout, plan.Workers);
+    return status;
+}
+
+// Name of the extended attribute of a backup that holds its BackupRecord (Transform.h)
+static const CHAR BackupRecordName[] = "KAPP.BACKUP";
+
+// The record of a new copy, with a nonce of its own
+NTSTATUS NewBackupRecord(_Out_ BackupRecord* Record)
+{
+    RtlZeroMemory(Record, sizeof(*Record));
+    Record->Version = BackupRecord::CurrentVersion;
+    Record->Mode = g_transformMode;
+    Record->KeyId = g_keyId;
+    return BCryptGenRandom(nullptr, Record->Nonce, sizeof(Record->Nonce), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+}
+
+// Replaces the record of the backup, once its data is written
+NTSTATUS WriteBackupRecord(_In_ HANDLE Target, _In_ const BackupRecord* Record)
+{
+    alignas(ULONG) UCHAR buffer[FIELD_OFFSET(FILE_FULL_EA_INFORMATION, EaName) + sizeof(BackupRecordName) + sizeof(BackupRecord)];
+    auto ea = (PFILE_FULL_EA_INFORMATION)buffer;
+    ea->NextEntryOffset = 0;
+    ea->Flags = 0;
+    ea->EaNameLength = sizeof(BackupRecordName) - 1;
+    ea->EaValueLength = sizeof(BackupRecord);
+    // the value follows the terminating null of the name
+    RtlCopyMemory(ea->EaName, BackupRecordName, sizeof(BackupRecordName));
+    RtlCopyMemory(ea->EaName + sizeof(BackupRecordName), Record, sizeof(*Record));
+    IO_STATUS_BLOCK ioStatus;
+    return ZwSetEaFile(Target, &ioStatus, buffer, sizeof(buffer));
+}
+
+// The record of the backup, zeroed when it has none or it cannot be read
+NTSTATUS ReadBackupRecord(_In_ HANDLE Target, _Out_ BackupRecord* Record)
+{
+    RtlZeroMemory(Record, sizeof(*Record));
+    alignas(ULONG) UCHAR query[FIELD_OFFSET(FILE_GET_EA_INFORMATION, EaName) + sizeof(BackupRecordName)];
+    auto name = (PFILE_GET_EA_INFORMATION)query;
+    name->NextEntryOffset = 0;
+    name->EaNameLength = sizeof(BackupRecordName) - 1;
+    RtlCopyMemory(name->EaName, BackupRecordName, sizeof(BackupRecordName));
+
+    alignas(ULONG) UCHAR buffer[FIELD_OFFSET(FILE_FULL_EA_INFORMATION, EaName) + sizeof(BackupRecordName) + sizeof(BackupRecord)];
+    IO_STATUS_BLOCK ioStatus;
+    auto status = ZwQueryEaFile(Target, &ioStatus, buffer, sizeof(buffer), TRUE, query, sizeof(query), nullptr, TRUE);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    // a missing attribute is returned with no value
+    auto ea = (PFILE_FULL_EA_INFORMATION)buffer;
+    if (ea->EaNameLength != sizeof(BackupRecordName) - 1 || ea->EaValueLength != sizeof(BackupRecord))
+        return STATUS_NO_EAS_ON_FILE;
+
+    RtlCopyMemory(Record, ea->EaName + sizeof(BackupRecordName), sizeof(*Record));
+    return STATUS_SUCCESS;
+}
+
+// Background work yields the disk to the applications
+VOID SetLowIoPriority(_In_ HANDLE File)
+{
+    IO_STATUS_BLOCK ioStatus;
+    FILE_IO_PRIORITY_HINT_INFORMATION hint;
+    hint.PriorityHint = IoPriorityVeryLow;
+    (void)ZwSetInformationFile(File, &ioStatus, &hint, sizeof(hint), FileIoPriorityHintInformation);
+}
+
+// Attributes and record of the current backup of FileName, zeroes when there is none. It is only looked at:
+// opened for its attributes and extended attributes, never created.
+NTSTATUS QueryBackup(_In_ PUNICODE_STRING FileName, _In_ PFLT_FILTER Filter, _In_ PFLT_INSTANCE Instance, _Out_ FILE_NETWORK_OPEN_INFORMATION* Target,
+    _Out_ BackupRecord* Record)
+{
+    RtlZeroMemory(Target, sizeof(*Target));
+    RtlZeroMemory(Record, sizeof(*Record));
+    UNICODE_STRING targetFileName;
+    const WCHAR backupStream[] = L".lock";
+    targetFileName.MaximumLength = FileName->Length + sizeof(backupStream);
+    targetFileName.Buffer = (WCHAR*)g_pool.Allocate(PoolSubsystem::Shadow, PagedPool, targetFileName.MaximumLength, SHADOW_NAME_TAG);
+    if (targetFileName.Buffer == nullptr)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlCopyUnicodeString(&targetFileName, FileName);
+    RtlAppendUnicodeToString(&targetFileName, backupStream);
+
+    HANDLE hTargetFile = nullptr;
+    IO_STATUS_BLOCK ioStatus;
+    OBJECT_ATTRIBUTES targetFileAttr;
+    InitializeObjectAttributes(&targetFileAttr, &targetFileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+    auto status = FltCreateFile(Filter, Instance, &hTargetFile, FILE_READ_ATTRIBUTES | FILE_READ_EA | SYNCHRONIZE, &targetFileAttr, &ioStatus,
+        nullptr, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT, nullptr, 0, 0);
+    g_pool.Free(targetFileName.Buffer, SHADOW_NAME_TAG);
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+        return STATUS_SUCCESS;
+    if (!NT_SUCCESS(status))
+        return status;
+
+    status = ZwQueryInformationFile(hTargetFile, &ioStatus, Target, sizeof(*Target), FileNetworkOpenInformation);
+    if (NT_SUCCESS(status))
+        (void)ReadBackupRecord(hTargetFile, Record);
+    FltClose(hTargetFile);
+    if (!NT_SUCCESS(status))
+        RtlZeroMemory(Target, sizeof(*Target));
+    return status;
+}
+
+// HandleFile in shadow mode: decides the backup of FileName as HandleFile does, then accounts its
+// cost in g_shadow instead of making it. The source is opened, measured and, in ShadowMode::Read,
+// read through the copy engine; the backup is only looked at. Nothing is written, renamed or deleted.
+NTSTATUS ShadowFile(_In_ PUNICODE_STRING FileName, _In_ PFLT_FILTER Filter, _In_ PFLT_INSTANCE Instance, _In_ const VolumeTuning* Tuning, BOOLEAN Prebackup, ShadowMode Mode)
+{
+    ULONGLONG counter;
+    auto start = KeQueryInterruptTimePrecise(&counter);
+    HANDLE hSourceFile = nullptr;
+    IO_STATUS_BLOCK ioStatus;
+    OBJECT_ATTRIBUTES sourceFileAttr;
+    InitializeObjectAttributes(&sourceFileAttr, FileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+    auto status = FltCreateFile(Filter, Instance, &hSourceFile, FILE_READ_DATA | FILE_READ_ATTRIBUTES | SYNCHRONIZE, &sourceFileAttr, &ioStatus,
+        nullptr, FILE_ATTRIBUTE_NORMAL, FILE_SHARE_READ | FILE_SHARE_WRITE | (Prebackup ? FILE_SHARE_DELETE : 0), FILE_OPEN,
+        FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY, nullptr, 0, IO_IGNORE_SHARE_ACCESS_CHECK);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_ERROR(TraceShadow, "ShadowFile: cannot open the source file (0x%08x)", status);
+        return status;
+    }
+
+    if (Prebackup)
+        SetLowIoPriority(hSourceFile);
+
+    FILE_NETWORK_OPEN_INFORMATION source;
+    auto copied = false;
+    ULONGLONG bytes = 0;
+    status = ZwQueryInformationFile(hSourceFile, &ioStatus, &source, sizeof(source), FileNetworkOpenInformation);
+    if (NT_SUCCESS(status) && source.EndOfFile.QuadPart > 0)
+    {
+        // a backup that cannot be looked at is copied over, as HandleFile would
+        FILE_NETWORK_OPEN_INFORMATION target;
+        BackupRecord current;
+        (void)QueryBackup(FileName, Filter, Instance, &target, &current);
+        copied = !IsBackupCurrent(source.EndOfFile.QuadPart, source.LastWriteTime.QuadPart, target.EndOfFile.QuadPart, target.LastWriteTime.QuadPart,
+            current, g_transformMode, g_keyId);
+        bytes = copied ? (ULONGLONG)source.EndOfFile.QuadPart : 0;
+        if (copied && Mode == ShadowMode::Read)
+        {
+            // the nonce is drawn as for a backup, only the writes are discarded
+            BackupRecord record;
+            KernelFileIo inner = { hSourceFile, nullptr };
+            ShadowIo<KernelFileIo> io = { &inner };
+            status = NewBackupRecord(&record);
+            if (NT_SUCCESS(status))
+                status = CopyFileData(&record, nullptr, Tuning, io, nullptr, &source, &target);
+            bytes = io.Written;
+        }
+    }
+
+    FltClose(hSourceFile);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_ERROR(TraceShadow, "ShadowFile: cannot measure %wZ (0x%08x)", FileName, status);
+        return status;
+    }
+
+    auto latency = KeQueryInterruptTimePrecise(&counter) - start;
+    LOG_VERBOSE(TraceShadow, "ShadowFile: %wZ, copied %d, %llu bytes, %llu00 ns", FileName, copied, bytes, latency);
+    return g_shadow.Record(FileName, copied, bytes, latency);
+}
+
+// Whether a writer has the file open: PostCreateOperation gave it a context
+BOOLEAN HasFileContext(_In_ PFLT_INSTANCE Instance, _In_ HANDLE File)
+{
+    PFILE_OBJECT fileObject = nullptr;
+    if (!NT_SUCCESS(ObReferenceObjectByHandle(File, 0, *IoFileObjectType, KernelMode, (PVOID*)&fileObject, nullptr)))
+        return FALSE;
+
+    PFLT_CONTEXT context = nullptr;
+    auto found = NT_SUCCESS(FltGetFileContext(Instance, fileObject, &context));
+    if (found)
+        FltReleaseContext(context);
+    ObDereferenceObject(fileObject);
+    return found;
+}
+
+// Backs FileName up to FileName.lock, unless the backup is current, then deletes the source.
+// The pre-backup scan only creates or refreshes the backup, at low I/O priority, and leaves the files open by a
+// writer to their first write (STATUS_SHARING_VIOLATION). A first write waits for the scan of its file to end
+// (PrebackupFile), both open the backup exclusively.
+NTSTATUS HandleFile(_In_ PUNICODE_STRING FileName, _In_ PFLT_FILTER Filter, _In_ PFLT_INSTANCE Instance, _In_ const VolumeTuning* Tuning, _In_opt_ CopyPool* Helpers,
+    BOOLEAN Prebackup, _Out_opt_ PULONGLONG Copied)
+{
+    HANDLE hTargetFile = nullptr;
+    HANDLE hSourceFile = nullptr;
+    IO_STATUS_BLOCK ioStatus;
+    auto status = STATUS_SUCCESS;
+    LARGE_INTEGER fileSize;
+
+    if (Copied)
+        *Copied = 0;
+
+    auto shadow = g_shadow.Mode();
+    if (shadow != ShadowMode::Off)
+        return ShadowFile(FileName, Filter, Instance, Tuning, Prebackup, shadow);
+
+    LOG_INFO(TraceCopy, "HandleFile: handle %wZ", FileName);
+    do {
+        OBJECT_ATTRIBUTES sourceFileAttr;
+        InitializeObjectAttributes(&sourceFileAttr, FileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+        // Open the source file (ZwCreateFile would send I/O requests to the top of the file system driver stack)
+        status = FltCreateFile(
+            Filter,                                                 // filter object
+            Instance,                                               // filter instance
+            &hSourceFile,                                            // resulting handle
+            FILE_READ_DATA | FILE_READ_ATTRIBUTES | SYNCHRONIZE,    // access mask
+            &sourceFileAttr,                                        // object attributes
+            &ioStatus,                                                // resulting status
+            nullptr, FILE_ATTRIBUTE_NORMAL,                         // allocation size, file attributes
+            FILE_SHARE_READ | FILE_SHARE_WRITE | (Prebackup ? FILE_SHARE_DELETE : 0),  // share flags, the scan must not get in the way
+            FILE_OPEN,                                                // create disposition
+            FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY,    // create options (sync I/O)
+            nullptr, 0,                                                // extended attributes, EA length
+            IO_IGNORE_SHARE_ACCESS_CHECK                            // flags
+        );
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "HandleFile: cannot open the source file (0x%08x)", status);
+            break;
+        }
+
+        if (Prebackup && HasFileContext(Instance, hSourceFile))
+        {
+            LOG_INFO(TraceCopy, "HandleFile: %wZ is open for writing, left to its first write", FileName);
+            status = STATUS_SHARING_VIOLATION;
+            break;
+        }
+
+        if (Prebackup)
+            SetLowIoPriority(hSourceFile);
+
+        FILE_NETWORK_OPEN_INFORMATION source;
+        status = ZwQueryInformationFile(hSourceFile, &ioStatus, &source, sizeof(source), FileNetworkOpenInformation);
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "HandleFile: cannot get file size (0x%08x)", status);
+            break;
+        }
+
+        // no data (size == 0)
+        fileSize = source.EndOfFile;
+        if (fileSize.QuadPart == 0)
+            break;
+
+        // the holes of a sparse source stay holes in the backup, its allocation is not reserved
+        auto sparse = (source.FileAttributes & FILE_ATTRIBUTE_SPARSE_FILE) != 0;
+
+        // Open the target file (source ADS)
+        UNICODE_STRING targetFileName;
+        const WCHAR backupStream[] = L".lock";
+        targetFileName.MaximumLength = FileName->Length + sizeof(backupStream);
+        targetFileName.Buffer = (WCHAR*)g_pool.Allocate(PoolSubsystem::Copy, PagedPool, targetFileName.MaximumLength, BACKUP_NAME_TAG);
+        if (targetFileName.Buffer == nullptr)
+        {
+            LOG_ERROR(TraceCopy, "HandleFile: cannot allocate target file buffer");
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        RtlCopyUnicodeString(&targetFileName, FileName);
+        RtlAppendUnicodeToString(&targetFileName, backupStream);
+
+        OBJECT_ATTRIBUTES targetFileAttr;
+        InitializeObjectAttributes(&targetFileAttr, &targetFileName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+        status = FltCreateFile(
+            Filter,                                                 // filter object
+            Instance,                                               // filter instance
+            &hTargetFile,                                            // resulting handle
+            GENERIC_WRITE | FILE_READ_ATTRIBUTES | FILE_READ_EA | SYNCHRONIZE,  // access mask
+            &targetFileAttr,                                        // object attributes
+            &ioStatus,                                                // resulting status
+            sparse ? nullptr : &fileSize, FILE_ATTRIBUTE_NORMAL,    // allocation size of a new backup, file attributes
+            0,                                                        // share flags
+            FILE_OPEN_IF,                                           // create disposition, a current backup is kept
+            FILE_SYNCHRONOUS_IO_NONALERT | FILE_SEQUENTIAL_ONLY,    // create options (sync I/O)
+            nullptr, 0,                                                // extended attributes, EA length
+            0 /*IO_IGNORE_SHARE_ACCESS_CHECK*/                        // flags
+        );
+
+        g_pool.Free(targetFileName.Buffer, BACKUP_NAME_TAG);
+        if (!NT_SUCCESS(status))
+        {
+            LOG_ERROR(TraceCopy, "HandleFile: cannot open target file (0x%08x)", status);
+            break;
+        }
+
+        if (Prebackup)
+            SetLowIoPriority(hTargetFile);
+
+        // a backup without a record, or from another mode or key, is copied over
+        FILE_NETWORK_OPEN_INFORMATION target;
+        BackupRecord current;
+        status = ZwQueryInformationFile(hTargetFile, &ioStatus, &target, sizeof(target), FileNetworkOpenInformation);
+        (void)ReadBackupRecord(hTargetFile, &current);
+        if (NT_SUCCESS(status) && IsBackupCurrent(fileSize.QuadPart, source.LastWriteTime.QuadPart, target.EndOfFile.QuadPart, target.LastWriteTime.QuadPart,
+            current, g_transformMode, g_keyId))
+        {
+            LOG_INFO(TraceCopy, "HandleFile: the backup of %wZ is current", FileName);
+        }
+        else
+        {
+            // an unknown target is not reused
+            if (!NT_SUCCESS(status))
+                RtlZeroMemory(&target, sizeof(target));
+
+            BackupRecord record;
+            status = NewBackupRecord(&record);
+            if (!NT_SUCCESS(status))
+            {
+                LOG_ERROR(TraceCopy, "HandleFile: cannot draw the nonce (0x%08x)", status);
+                break;
+            }
+
+            // the target is reused in place or reserved, then copied and its end of file set
+            // the pre-backup scan copies on its own thread, in the background
+            KernelFileIo io = { hSourceFile, hTargetFile };
+            KernelParallelIo parallel = { Instance };
+            auto referenced = Helpers && NT_SUCCESS(parallel.Reference(hSourceFile, hTargetFile));
+            status = CopyFileData(&record, Helpers, Tuning, io, referenced ? &parallel : nullptr, &source, &target);
+            parallel.Dereference();
+            if (!NT_SUCCESS(status))
+                break;
+
+            // a backup without its record cannot be restored, and without the stamp below it is not current either
+            status = WriteBackupRecord(hTargetFile, &record);
+            if (!NT_SUCCESS(status))
+            {
+                LOG_ERROR(TraceCopy, "HandleFile: cannot write the backup record (0x%08x)", status);
+                break;
+            }
+
+            // the backup is current as long as the source keeps this last write time (zero fields are left unchanged)
+            FILE_BASIC_INFORMATION basic;
+            RtlZeroMemory(&basic, sizeof(basic));
+            basic.LastWriteTime = source.LastWriteTime;
+            NT_VERIFY(NT_SUCCESS(ZwSetInformationFile(hTargetFile, &ioStatus, &basic, sizeof(basic), FileBasicInformation)));
+            if (Copied)
+                *Copied = (ULONGLONG)fileSize.QuadPart;
+        }
+
+        if (Prebackup)
+            break;
+
+        // delete source file
+        FILE_DISPOSITION_INFORMATION delete_info;
+        delete_info.DeleteFile = TRUE;
+        NT_VERIFY(NT_SUCCESS(ZwSetInformationFile(hSourceFile, &ioStatus, &delete_info, sizeof(delete_info), FileDispositionInformation)));
+    } while(false);
+
+    if (hSourceFile)
+        FltClose(hSourceFile);
+
+    if (hTargetFile)
+        FltClose(hTargetFile);
+
+    return status;
+}
+
+// A directory open for the pre-backup scan
+struct KernelDirectory
+{
+    HANDLE Handle;
+    PFILE_DIRECTORY_INFORMATION Next;   // next entry of Buffer, null when it must be refilled
+    BOOLEAN Restart;
+    UCHAR Buffer[4096];
+};
+
+// Fs policy of the pre-backup walker (DirectoryWalker.h)
+struct KernelDirectoryFs
+{
+    using Directory = KernelDirectory*;
+
+    PFLT_FILTER Filter;
+    PFLT_INSTANCE Instance;
+
+    NTSTATUS Open(_In_ PCUNICODE_STRING Path, _Out_ Directory* Result)
+    {
+        auto directory = (KernelDirectory*)g_pool.Allocate(PoolSubsystem::Prebackup, PagedPool, sizeof(KernelDirectory), PREBACKUP_DIRECTORY_TAG);
+        if (!directory)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        OBJECT_ATTRIBUTES attributes;
+        InitializeObjectAttributes(&attributes, const_cast<PUNICODE_STRING>(Path), OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+        IO_STATUS_BLOCK ioStatus;
+        auto status = FltCreateFile(Filter, Instance, &directory->Handle, FILE_LIST_DIRECTORY | SYNCHRONIZE, &attributes, &ioStatus,
+            nullptr, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_OPEN,
+            FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT, nullptr, 0, 0);
+        if (!NT_SUCCESS(status))
+        {
+            g_pool.Free(directory, PREBACKUP_DIRECTORY_TAG);
+            return status;
+        }
+
+        SetLowIoPriority(directory->Handle);
+        directory->Next = nullptr;
+        directory->Restart = TRUE;
+        *Result = directory;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Read(_In_ Directory directory, _Out_ DirectoryEntry* Entry)
+    {
+        for (;;)
+        {
+            if (!directory->Next)
+            {
+                // STATUS_NO_MORE_FILES at the end
+                IO_STATUS_BLOCK ioStatus;
+                auto status = ZwQueryDirectoryFile(directory->Handle, nullptr, nullptr, nullptr, &ioStatus, directory->Buffer, sizeof(directory->Buffer),
+                    FileDirectoryInformation, FALSE, nullptr, directory->Restart);
+                directory->Restart = FALSE;
+                if (!NT_SUCCESS(status))
+                    return status;
+
+                directory->Next = (PFILE_DIRECTORY_INFORMATION)directory->Buffer;
+            }
+
+            auto info = directory->Next;
+            directory->Next = info->NextEntryOffset ? (PFILE_DIRECTORY_INFORMATION)((PUCHAR)info + info->NextEntryOffset) : nullptr;
+            // junctions and symbolic links could make the walk loop or leave the root
+            if (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                continue;
+
+            Entry->Name.Buffer = info->FileName;
+            Entry->Name.Length = (USHORT)info->FileNameLength;
+            Entry->Name.MaximumLength = Entry->Name.Length;
+            Entry->Directory = (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            Entry->Size = (ULONGLONG)info->EndOfFile.QuadPart;
+            Entry->LastWriteTime = info->LastWriteTime.QuadPart;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    void Close(_In_ Directory directory)
+    {
+        FltClose(directory->Handle);
+        g_pool.Free(directory, PREBACKUP_DIRECTORY_TAG);
+    }
+};
+
+// The file the pre-backup scan of a volume is backing up. The scan publishes it before it checks the file for a
+// writer: a writer the check missed opened the file later, and its first write finds the file here and waits,
+// without a deadline, for the scan to close the source and the backup.
+struct PrebackupFile
+{
+    kl::PushLock Lock;          // the name is paged
+    PCUNICODE_STRING Name;      // null between two files
+    KEVENT Idle;                // notification event, set while there is no file
+
+    void Init()
+    {
+        Lock.Init();
+        Name = nullptr;
+        KeInitializeEvent(&Idle, NotificationEvent, TRUE);
+    }
+
+    void Begin(_In_ PCUNICODE_STRING Path)
+    {
+        kl::ExclusiveGuard guard(Lock);
+        Name = Path;
+        KeClearEvent(&Idle);
+    }
+
+    void End()
+    {
+        kl::ExclusiveGuard guard(Lock);
+        Name = nullptr;
+        KeSetEvent(&Idle, IO_NO_INCREMENT, FALSE);
+    }
+
+    void Wait(_In_ PCUNICODE_STRING FileName)
+    {
+        for (;;)
+        {
+            {
+                kl::SharedGuard guard(Lock);
+                if (!Name || !RtlEqualUnicodeString(Name, FileName, TRUE))
+                    return;
+            }
+
+            LOG_INFO(TraceWrite, "PrebackupFile: %wZ waits for the pre-backup scan", FileName);
+            KeWaitForSingleObject(&Idle, Executive, KernelMode, FALSE, nullptr);
+        }
+    }
+};
+
+// Backup policy of the pre-backup scan (Prebackup.h)
+struct KernelBackup
+{
+    PFLT_FILTER Filter;
+    PFLT_INSTANCE Instance;
+    VolumeTuning Tuning;
+    PrebackupFile Current;
+
+    NTSTATUS Refresh(_In_ PCUNICODE_STRING Path, const DirectoryEntry& Entry, _Out_ PULONGLONG Copied)
+    {
+        UNREFERENCED_PARAMETER(Entry);
+        Current.Begin(Path);
+        auto status = HandleFile(const_cast<PUNICODE_STRING>(Path), Filter, Instance, &Tuning, nullptr, TRUE, Copied);
+        Current.End();
+        return status;
+    }
+};
+
+VOID PrebackupWait(_In_ PrebackupWorker* Worker, _In_ PCUNICODE_STRING FileName);
+
+// The first write of a file waits for a backup slot of its volume, then makes the backup
+NTSTATUS BackupFile(_In_ PUNICODE_STRING FileName, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ InstanceContext* Volume)
+{
+    if (!Volume)
+    {
+        // as before the volumes were tuned, serially: the copy helpers are threads of the instance
+        auto tuning = TuneVolume(VolumeDevice{}, g_copyWorkers);
+        tuning.BlockSize = COPY_BUFFER_SIZE;
+        tuning.CopyWorkers = g_copyWorkers;
+        return HandleFile(FileName, FltObjects->Filter, FltObjects->Instance, &tuning, nullptr, FALSE, nullptr);
+    }
+
+    // the pre-backup scan may be copying the file, its backup would miss this write
+    if (Volume->Prebackup)
+        PrebackupWait(Volume->Prebackup, FileName);
+
+    BackupQueue::Waiter waiter;
+    Volume->Queue.Enter(waiter);
+    ULONGLONG copied = 0;
+    auto status = HandleFile(FileName, FltObjects->Filter, FltObjects->Instance, &Volume->Tuning, Volume->Helpers, FALSE, &copied);
+    Volume->Queue.Leave(NT_SUCCESS(status), copied);
+    return status;
+}
+
+FLT_PREOP_CALLBACK_STATUS PreWriteOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext)
+{
+    UNREFERENCED_PARAMETER(Data);               // Pointer to the callback data structure for the I/O operation
+    //UNREFERENCED_PARAMETER(FltObjects);       // Pointer to an FLT_RELATED_OBJECTS strcture that contains opaque pointers for the objects related to the current I/O request
+    UNREFERENCED_PARAMETER(CompletionContext);  // Pointer to an optional context in case this callacks returns FLT_PREOP_SUCCESS_WITH_CALLBACK or FLT_PREOP_SYNCHRONIZE
+    FileContext* context = nullptr;
+    LOG_VERBOSE(TraceWrite, "Get context on FltObjects %p", FltObjects);
+    auto status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
+    if (!NT_SUCCESS(status) || context == nullptr)
+    {
+        LOG_VERBOSE(TraceWrite, "PreWriteOperation: cannot get file context (0x%08x)", status);
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    // no instance context when its allocation failed at attach time
+    InstanceContext* volume = nullptr;
+    if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&volume)))
+        volume = nullptr;
+
+    {
+        kl::ExclusiveGuard guard(context->Lock);
+        ResolveFileContext(Data, context);
+        LOG_INFO(TraceWrite, "context filename %wZ", &context->FileName);
+        if (context->Pending)
+        {
+            // no name to back up: as after a failed backup the write goes through, the next one queries again
+            LOG_WARNING(TraceWrite, "PreWriteOperation: the file is not resolved, the write goes through unbacked");
+        }
+        else if (!context->Written)
+        {
+            status = BackupFile(&context->FileName, FltObjects, volume);
+            if (!NT_SUCCESS(status))
+            {
+                LOG_ERROR(TraceWrite, "PreWriteOperation: failed to handle file, the next write retries (0x%08x)", status);
+            }
+
+            // only a backup made ends the first write
+            context->BackedUp = NT_SUCCESS(status);
+            context->Written = NT_SUCCESS(status);
+        }
+    }
+
+    if (volume)
+        FltReleaseContext(volume);
+    FltReleaseContext(context);
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    //return FLT_PREOP_COMPLETE;
+}
+
+FLT_POSTOP_CALLBACK_STATUS PostCleanupOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _In_opt_ PVOID CompletionContext, _In_ FLT_POST_OPERATION_FLAGS Flags)
+{
+    UNREFERENCED_PARAMETER(Data);               // Pointer to the callback data structure for the I/O operation
+    UNREFERENCED_PARAMETER(FltObjects);         // Pointer to an FLT_RELATED_OBJECTS strcture that contains opaque pointers for the objects related to the current I/O request
+    UNREFERENCED_PARAMETER(CompletionContext);  // A pointer that was returned by the minifilter pre-operation callback.
+    UNREFERENCED_PARAMETER(Flags);              // A bitmask of flags that specifies how the post-operation callback is to be performed
+    FileContext* context = nullptr;
+    auto status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
+    if (!NT_SUCCESS(status) || context == nullptr)
+    {
+        LOG_VERBOSE(TraceContext, "PostCleanupOperation: cannot get file context (0x%08x)", status);
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
+
+    // the backup outlives the context for the session window
+    if (g_sessions && context->BackedUp && context->FileName.Buffer)
+    {
+        if (!NT_SUCCESS(g_sessions->Touch(&context->FileName, KeQueryInterruptTime())))
+            LOG_WARNING(TraceSession, "PostCleanupOperation: cannot keep the session of %wZ", &context->FileName);
+    }
+
+    // FileContextCleanup frees the name once the last reference is gone
+    FltReleaseContext(context);
+    FltDeleteContext(context);
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+FLT_PREOP_CALLBACK_STATUS PreAcquireForSectionOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext)
+{
+    /*
+        A writable section lets its process write the file with paging writes only, which are not filtered: a pending
+        context, lazy or left by a failed name query, gets its name before the section exists. The sections of the
+        kernel, HandleFile among them, are left alone.
+    */
+    UNREFERENCED_PARAMETER(CompletionContext);
+    const auto& params = Data->Iopb->Parameters.AcquireForSectionSynchronization;
+    if (Data->RequestorMode == KernelMode || params.SyncType != SyncTypeCreateSection
+        || (params.PageProtection & (PAGE_READWRITE | PAGE_EXECUTE_READWRITE)) == 0)
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    FileContext* context = nullptr;
+    auto status = FltGetFileContext(FltObjects->Instance, FltObjects->FileObject, (PFLT_CONTEXT*)&context);
+    if (!NT_SUCCESS(status) || context == nullptr)
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    // a context is never pending again once resolved
+    if (context->Pending)
+    {
+        kl::ExclusiveGuard guard(context->Lock);
+        ResolveFileContext(Data, context);
+    }
+
+    FltReleaseContext(context);
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
+
+FLT_PREOP_CALLBACK_STATUS PreSetInformationOperation(_Inout_ PFLT_CALLBACK_DATA Data, _In_ PCFLT_RELATED_OBJECTS FltObjects, _Flt_CompletionContext_Outptr_ PVOID* CompletionContext)
+{
+    UNREFERENCED_PARAMETER(CompletionContext);
+    if (!g_sessions || g_sessions->Count() == 0)
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    const auto& params = Data->Iopb->Parameters.SetFileInformation;
+    auto rename = params.FileInformationClass == FileRenameInformation || params.FileInformationClass == FileRenameInformationEx;
+    auto dispose = params.FileInformationClass == FileDispositionInformation || params.FileInformationClass == FileDispositionInformationEx;
+    if (!rename && !dispose)
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+
+    // The session ends before the operation: if it fails, the next write only makes a new backup
+    auto fileNameInfo = kl::FilterFileNameInformation(Data);
+    if (fileNameInfo && g_sessions->Remove(&fileNameInfo->Name))
+        LOG_INFO(TraceSession, "PreSetInformationOperation: session of %wZ ended", &fileNameInfo->Name);
+
+    if (rename)
+    {
+        // a file replaced by the rename has a different content than its backup
+        auto info = (PFILE_RENAME_INFORMATION)params.InfoBuffer;
+        PFLT_FILE_NAME_INFORMATION target = nullptr;
+        auto status = FltGetDestinationFileNameInformation(FltObjects->Instance, FltObjects->FileObject, info->RootDirectory,
+            info->FileName, info->FileNameLength, FLT_FILE_NAME_NORMALIZED | FLT_FILE_NAME_QUERY_DEFAULT, &target);
+        if (NT_SUCCESS(status))
+        {
+            if (g_sessions->Remove(&target->Name))
+                LOG_INFO(TraceSession, "PreSetInformationOperation: session of %wZ ended", &target->Name);
+            FltReleaseFileNameInformation(target);
+        }
+    }
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
+
+VOID SessionTimerDpc(_In_ PKDPC Dpc, _In_opt_ PVOID DeferredContext, _In_opt_ PVOID SystemArgument1, _In_opt_ PVOID SystemArgument2)
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+    g_sessions->Expire(KeQueryInterruptTime());
+}
+
+NTSTATUS SessionsStart()
+{
+    if (g_sessionWindowMs == 0)
+        return STATUS_SUCCESS;
+
+    // Sessions are freed by the timer DPC, at DISPATCH_LEVEL
+    auto sessions = (SessionTable*)g_pool.Allocate(PoolSubsystem::Session, NonPagedPoolNx, sizeof(SessionTable), SESSION_TABLE_TAG);
+    if (!sessions)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    sessions->Init(KeQueryInterruptTime(), g_sessionWindowMs * 10000ull, SESSION_TICK_MS * 10000ull);
+    g_sessions = sessions;
+
+    KeInitializeDpc(&g_sessionDpc, SessionTimerDpc, nullptr);
+    KeInitializeTimerEx(&g_sessionTimer, NotificationTimer);
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)SESSION_TICK_MS * 10000;
+    KeSetTimerEx(&g_sessionTimer, due, SESSION_TICK_MS, &g_sessionDpc);
+    return STATUS_SUCCESS;
+}
+
+VOID SessionsStop()
+{
+    if (!g_sessions)
+        return;
+
+    KeCancelTimer(&g_sessionTimer);
+    KeFlushQueuedDpcs();
+    g_sessions->Clear();
+    g_pool.Free(g_sessions, SESSION_TABLE_TAG);
+    g_sessions = nullptr;
+}
+
+VOID ProcessNotify(_Inout_ PEPROCESS Process, _In_ HANDLE ProcessId, _Inout_opt_ PPS_CREATE_NOTIFY_INFO CreateInfo)
+{
+    UNREFERENCED_PARAMETER(Process);
+    if (!CreateInfo)
+    {
+        if (g_processes->Remove(ProcessId))
+            LOG_VERBOSE(TraceProcess, "ProcessNotify: excluded process %p exited", ProcessId);
+        return;
+    }
+
+    // processes started before the driver loaded are not classified, they are monitored
+    if (!CreateInfo->ImageFileName || !g_exclusions.Match(CreateInfo->ImageFileName))
+        return;
+
+    auto status = g_processes->Set(ProcessId, ProcessPolicy::Exclude);
+    if (NT_SUCCESS(status))
+        LOG_INFO(TraceProcess, "ProcessNotify: %wZ (%p) excluded", CreateInfo->ImageFileName, ProcessId);
+    else
+        LOG_WARNING(TraceProcess, "ProcessNotify: cannot exclude %wZ (0x%08x)", CreateInfo->ImageFileName, status);
+}
+
+// Exclusions are an optimization: without them every process is monitored
+VOID ProcessesStart()
+{
+    if (g_exclusions.Empty())
+        return;
+
+    // PreCreateOperation reads the table at APC_LEVEL, writers hold a spin lock
+    auto processes = (ProcessTable*)g_pool.Allocate(PoolSubsystem::Process, NonPagedPoolNx, sizeof(ProcessTable), PROCESS_TABLE_TAG);
+    if (!processes)
+    {
+        g_exclusions.Clear();
+        return;
+    }
+
+    processes->Init();
+    g_processes = processes;
+    auto status = PsSetCreateProcessNotifyRoutineEx(ProcessNotify, FALSE);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_ERROR(TraceProcess, "ProcessesStart: cannot register the process notify routine (0x%08x)", status);
+        g_processes = nullptr;
+        g_pool.Free(processes, PROCESS_TABLE_TAG);
+        g_exclusions.Clear();
+    }
+}
+
+VOID ProcessesStop()
+{
+    if (g_processes)
+    {
+        // waits for the notify routines in progress
+        NT_VERIFY(NT_SUCCESS(PsSetCreateProcessNotifyRoutineEx(ProcessNotify, TRUE)));
+        g_pool.Free(g_processes, PROCESS_TABLE_TAG);
+        g_processes = nullptr;
+    }
+
+    g_exclusions.Clear();
+}
+
+// Background scan of the PrebackupRoots of a volume, by a system thread of the instance
+struct PrebackupWorker
+{
+    KEVENT Stop;
+    PKTHREAD Thread;
+    WCHAR VolumeBuffer[64];
+    UNICODE_STRING Volume;
+    KernelDirectoryFs Fs;
+    KernelBackup Backup;
+    PrebackupScan<KernelDirectoryFs, KernelBackup> Scan;
+    WCHAR RootBuffer[DirectoryWalker<KernelDirectoryFs>::MaxPath];
+    WCHAR BookmarkBuffer[DirectoryWalker<KernelDirectoryFs>::MaxPath];
+};
+
+VOID PrebackupWait(_In_ PrebackupWorker* Worker, _In_ PCUNICODE_STRING FileName)
+{
+    Worker->Backup.Current.Wait(FileName);
+}
+
+// Bookmarks of the cancelled scans: the Prebackup subkey of the service key, one REG_SZ per root
+NTSTATUS OpenBookmarks(_Out_ PHANDLE Key)
+{
+    HANDLE service = nullptr;
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, &g_serviceKey, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+    auto status = ZwOpenKey(&service, KEY_CREATE_SUB_KEY, &attributes);
+    if (!NT_SUCCESS(status))
+        return status;
+
+    UNICODE_STRING name = RTL_CONSTANT_STRING(L"Prebackup");
+    InitializeObjectAttributes(&attributes, &name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, service, nullptr);
+    status = ZwCreateKey(Key, KEY_QUERY_VALUE | KEY_SET_VALUE, &attributes, 0, nullptr, REG_OPTION_NON_VOLATILE, nullptr);
+    ZwClose(service);
+    return status;
+}
+
+VOID LoadBookmark(_In_ PCUNICODE_STRING Root, _Inout_ PUNICODE_STRING Bookmark)
+{
+    Bookmark->Length = 0;
+    HANDLE key = nullptr;
+    if (!NT_SUCCESS(OpenBookmarks(&key)))
+        return;
+
+    ULONG length = 0;
+    ULONG size = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data) + Bookmark->MaximumLength;
+    auto info = (PKEY_VALUE_PARTIAL_INFORMATION)g_pool.Allocate(PoolSubsystem::Prebackup, PagedPool, size, PREBACKUP_VALUE_TAG);
+    if (info)
+    {
+        auto status = ZwQueryValueKey(key, const_cast<PUNICODE_STRING>(Root), KeyValuePartialInformation, info, size, &length);
+        if (NT_SUCCESS(status) && info->Type == REG_SZ && info->DataLength <= Bookmark->MaximumLength)
+        {
+            RtlCopyMemory(Bookmark->Buffer, info->Data, info->DataLength);
+            Bookmark->Length = (USHORT)(info->DataLength & ~1ul);
+            // REG_SZ data usually counts the terminator
+            while (Bookmark->Length > 0 && Bookmark->Buffer[Bookmark->Length / sizeof(WCHAR) - 1] == L'\0')
+                Bookmark->Length -= sizeof(WCHAR);
+        }
+
+        g_pool.Free(info, PREBACKUP_VALUE_TAG);
+    }
+
+    ZwClose(key);
+}
+
+// Saves the bookmark of a cancelled scan, or deletes it (null) once the scan is over
+VOID SaveBookmark(_In_ PCUNICODE_STRING Root, _In_opt_ PCUNICODE_STRING Bookmark)
+{
+    // a scan in shadow mode made no backup, the next one must not resume after it
+    if (g_shadow.Mode() != ShadowMode::Off)
+        return;
+
+    HANDLE key = nullptr;
+    auto status = OpenBookmarks(&key);
+    if (NT_SUCCESS(status))
+    {
+        if (Bookmark)
+            status = ZwSetValueKey(key, const_cast<PUNICODE_STRING>(Root), 0, REG_SZ, Bookmark->Buffer, Bookmark->Length);
+        else
+            (void)ZwDeleteValueKey(key, const_cast<PUNICODE_STRING>(Root));
+        ZwClose(key);
+    }
+
+    if (!NT_SUCCESS(status))
+        LOG_WARNING(TracePrebackup, "SaveBookmark: cannot save the bookmark of %wZ (0x%08x)", Root, status);
+}
+
+// Scans one root, FALSE when the worker has been stopped
+BOOLEAN PrebackupRoot(_In_ PrebackupWorker* Worker, _In_ PCUNICODE_STRING Root)
+{
+    UNICODE_STRING bookmark;
+    bookmark.Buffer = Worker->BookmarkBuffer;
+    bookmark.Length = 0;
+    bookmark.MaximumLength = sizeof(Worker->BookmarkBuffer);
+    LoadBookmark(Root, &bookmark);
+
+    auto& scan = Worker->Scan;
+    auto status = scan.Start(&Worker->Fs, &Worker->Backup, Root, bookmark.Length > 0 ? &bookmark : nullptr, g_prebackupRate, KeQueryInterruptTime());
+    if (!NT_SUCCESS(status))
+    {
+        LOG_WARNING(TracePrebackup, "PrebackupRoot: cannot scan %wZ (0x%08x)", Root, status);
+        return TRUE;
+    }
+
+    LOG_INFO(TracePrebackup, "PrebackupRoot: scanning %wZ, resuming after '%wZ'", Root, &bookmark);
+    for (;;)
+    {
+        ULONGLONG wait = 0;
+        status = scan.Run(KeQueryInterruptTime(), &wait);
+        if (status != STATUS_PENDING)
+            break;
+
+        // the rate limit, or a cancellation point between slices
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = -(LONGLONG)wait;
+        if (KeWaitForSingleObject(&Worker->Stop, Executive, KernelMode, FALSE, &timeout) == STATUS_SUCCESS)
+        {
+            // a scan stopped before its first file keeps the previous bookmark
+            if (scan.Bookmark()->Length > 0)
+                SaveBookmark(Root, scan.Bookmark());
+            scan.Stop();
+            LOG_INFO(TracePrebackup, "PrebackupRoot: scan of %wZ cancelled after %u files", Root, scan.Statistics().Files);
+            return FALSE;
+        }
+    }
+
+    SaveBookmark(Root, nullptr);
+    const auto& statistics = scan.Statistics();
+    LOG_INFO(TracePrebackup, "PrebackupRoot: %wZ scanned, %u files, %u protected, %u current, %u backed up (%llu bytes), %u busy, %u failed, %u skipped directories",
+        Root, statistics.Files, statistics.Protected, statistics.Current, statistics.BackedUp, statistics.BytesCopied, statistics.Busy, statistics.Failed, scan.Skipped());
+    return TRUE;
+}
+
+VOID PrebackupThread(_In_ PVOID Context)
+{
+    auto worker = (PrebackupWorker*)Context;
+    KeSetPriorityThread(KeGetCurrentThread(), LOW_PRIORITY + 1);
+
+    // let the boot, or the mount, settle first
+    LARGE_INTEGER delay;
+    delay.QuadPart = -(LONGLONG)PREBACKUP_DELAY_MS * 10000;
+    auto running = KeWaitForSingleObject(&worker->Stop, Executive, KernelMode, FALSE, &delay) != STATUS_SUCCESS;
+
+    // volume relative roots
+    for (ULONG start = 0; running && start < g_prebackupRootsLength;)
+    {
+        auto end = start;
+        while (end < g_prebackupRootsLength && g_prebackupRoots[end] != L'\0')
+            ++end;
+
+        UNICODE_STRING entry;
+        entry.Buffer = g_prebackupRoots + start;
+        entry.Length = (USHORT)((end - start) * sizeof(WCHAR));
+        entry.MaximumLength = entry.Length;
+        start = end + 1;
+
+        UNICODE_STRING root;
+        root.Buffer = worker->RootBuffer;
+        root.Length = 0;
+        root.MaximumLength = sizeof(worker->RootBuffer);
+        if (entry.Length == 0 || !NT_SUCCESS(RtlAppendUnicodeStringToString(&root, &worker->Volume)) || !NT_SUCCESS(RtlAppendUnicodeStringToString(&root, &entry)))
+            continue;
+
+        running = PrebackupRoot(worker, &root);
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+// Starts the pre-backup scan of the volume of Context, which InstanceSetupCallback then sets
+VOID PrebackupStart(_In_ PCFLT_RELATED_OBJECTS FltObjects, _Inout_ InstanceContext* Context)
+{
+    if (!g_prebackupRoots)
+        return;
+
+    // the stop event is waited on
+    auto worker = (PrebackupWorker*)g_pool.Allocate(PoolSubsystem::Prebackup, NonPagedPoolNx, sizeof(PrebackupWorker), PREBACKUP_TAG);
+    if (!worker)
+        return;
+
+    worker->Volume.Buffer = worker->VolumeBuffer;
+    worker->Volume.Length = 0;
+    worker->Volume.MaximumLength = sizeof(worker->VolumeBuffer);
+    auto status = FltGetVolumeName(FltObjects->Volume, &worker->Volume, nullptr);
+    if (NT_SUCCESS(status))
+    {
+        KeInitializeEvent(&worker->Stop, NotificationEvent, FALSE);
+        worker->Fs.Filter = worker->Backup.Filter = FltObjects->Filter;
+        worker->Fs.Instance = worker->Backup.Instance = FltObjects->Instance;
+        worker->Backup.Tuning = Context->Tuning;
+        worker->Backup.Current.Init();
+
+        HANDLE thread = nullptr;
+        status = PsCreateSystemThread(&thread, THREAD_ALL_ACCESS, nullptr, nullptr, nullptr, PrebackupThread, worker);
+        if (NT_SUCCESS(status))
+        {
+            NT_VERIFY(NT_SUCCESS(ObReferenceObjectByHandle(thread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID*)&worker->Thread, nullptr)));
+            ZwClose(thread);
+            Context->Prebackup = worker;
+            worker = nullptr;
+        }
+    }
+
+    if (worker)
+    {
+        LOG_WARNING(TracePrebackup, "PrebackupStart: no pre-backup on %wZ (0x%08x)", &worker->Volume, status);
+        g_pool.Free(worker, PREBACKUP_TAG);
+    }
+}
+
+VOID PrebackupClear()
+{
+    if (g_prebackupRoots)
+        g_pool.Free(g_prebackupRoots, PREBACKUP_ROOTS_TAG);
+    g_prebackupRoots = nullptr;
+    g_prebackupRootsLength = 0;
+    if (g_serviceKey.Buffer)
+        g_pool.Free(g_serviceKey.Buffer, PREBACKUP_ROOTS_TAG);
+    RtlZeroMemory(&g_serviceKey, sizeof(g_serviceKey));
+}
+
+NTSTATUS FilterUnloadCallback(_In_ FLT_FILTER_UNLOAD_FLAGS Flags)
+{
+    /*
+        The filter manager calls the FilterUnloadCallback routine to notify the minifilter driver that the filter manager is about to unload the minifilter driver.
+    */
+    UNREFERENCED_PARAMETER(Flags);              // A bitmask of flags describing the unload request
+    PAGED_CODE();
+    PortClose();
+    FltUnregisterFilter(FilterHandle);
+    SessionsStop();
+    ProcessesStop();
+    PrebackupClear();
+    g_shadow.Clear();
+    // the filter is unregistered: its contexts are gone, every block should be back
+    LOG_INFO(TraceDriver, "FilterUnloadCallback: %lld name queries, %lld deferred, %lld avoided", ReadNoFence64(&g_creates.NameQueries),
+        ReadNoFence64(&g_creates.Deferred), ReadNoFence64(&g_creates.Avoided));
+    if (auto outstanding = g_pool.Outstanding())
+        LOG_WARNING(TraceDriver, "FilterUnloadCallback: %lld pool blocks were not freed", outstanding);
+    LOG_INFO(TraceDriver, "Driver unloaded");
+    kl::trace::Default().Stop();
+    return STATUS_SUCCESS;
+}
+
+// Sector size, seek penalty and removable media of the disk under the volume, the defaults stay for what cannot be asked
+VOID QueryVolumeDevice(_In_ PFLT_VOLUME Volume, _Out_ VolumeDevice* Device)
+{
+    *Device = VolumeDevice{};
+
+    UCHAR buffer[sizeof(FLT_VOLUME_PROPERTIES) + 512];
+    auto properties = (PFLT_VOLUME_PROPERTIES)buffer;
+    ULONG length = 0;
+    auto status = FltGetVolumeProperties(Volume, properties, sizeof(buffer), &length);
+    if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW)
+    {
+        Device->SectorSize = properties->SectorSize;
+        Device->Removable = (properties->DeviceCharacteristics & FILE_REMOVABLE_MEDIA) != 0;
+    }
+
+    PDEVICE_OBJECT disk = nullptr;
+    if (!NT_SUCCESS(FltGetDiskDeviceObject(Volume, &disk)))
+        return;
+
+    STORAGE_PROPERTY_QUERY query = {};
+    query.PropertyId = StorageDeviceSeekPenaltyProperty;
+    query.QueryType = PropertyStandardQuery;
+    DEVICE_SEEK_PENALTY_DESCRIPTOR descriptor = {};
+    KEVENT event;
+    KeInitializeEvent(&event, NotificationEvent, FALSE);
+    IO_STATUS_BLOCK iosb = {};
+    auto irp = IoBuildDeviceIoControlRequest(IOCTL_STORAGE_QUERY_PROPERTY, disk, &query, sizeof(query), &descriptor, sizeof(descriptor), FALSE, &event, &iosb);
+    if (irp)
+    {
+        status = IoCallDriver(disk, irp);
+        if (status == STATUS_PENDING)
+        {
+            KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, nullptr);
+            status = iosb.Status;
+        }
+
+        if (NT_SUCCESS(status) && iosb.Information >= sizeof(descriptor))
+            Device->SeekPenalty = descriptor.IncursSeekPenalty != FALSE;
+    }
+
+    ObDereferenceObject(disk);
+}
+
+NTSTATUS InstanceSetupCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_SETUP_FLAGS Flags, _In_ DEVICE_TYPE VolumeDeviceType, _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType)
+{
+    /*
+        The filter manager calls this routine on the first operation after a new volume is mounted.
+        The filter manager calls this routine to allow the minifilter driver to respond to an automatic or manual attachment request.
+        If this routine returns an error or warning NTSTATUS code, the minifilter driver instance is not attached to the given volume.
+        Otherwise, the minifilter driver instance is attached to the given volume.
+    */
+    UNREFERENCED_PARAMETER(FltObjects);             // Pointer to an FLT_RELATED_OBJECTS structure that contains opaque pointers for the objects related to the current operation.
+    UNREFERENCED_PARAMETER(Flags);                  // Bitmask of flags that indicate why the instance is being attached
+    UNREFERENCED_PARAMETER(VolumeDeviceType);       // Device type of the file system volume (FILE_DEVICE_CD_ROM_FILE_SYSTEM, FILE_DEVICE_DISK_FILE_SYSTEM, FILE_DEVICE_NETWORK_FILE_SYSTEM)
+    // UNREFERENCED_PARAMETER(VolumeFilesystemType);   // File system type of the volume (FLT_FILESYSTEM_TYPE enum)
+    PAGED_CODE();
+
+    LOG_VERBOSE(TraceInstance, "VolumeFilesystemType %d. Want %d.", VolumeFilesystemType, FLT_FSTYPE_NTFS);
+    if (VolumeFilesystemType != FLT_FSTYPE_NTFS || VolumeDeviceType != FILE_DEVICE_DISK_FILE_SYSTEM)
+    {
+        LOG_INFO(TraceInstance, "Not attaching to non-NTFS volume (%d)", VolumeFilesystemType); // (13) and (5)
+        return STATUS_FLT_DO_NOT_ATTACH;
+    }
+
+    VolumeDevice device;
+    QueryVolumeDevice(FltObjects->Volume, &device);
+
+    // without a context the volume is backed up with the defaults, the writers do not queue
+    InstanceContext* context = nullptr;
+    auto status = FltAllocateContext(FltObjects->Filter, FLT_INSTANCE_CONTEXT, sizeof(InstanceContext), NonPagedPoolNx, (PFLT_CONTEXT*)&context);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_WARNING(TraceInstance, "InstanceSetupCallback: cannot allocate the instance context (0x%08x)", status);
+        return STATUS_SUCCESS;
+    }
+
+    g_pool.Charge(PoolSubsystem::Volume, sizeof(InstanceContext));
+    context->Tuning = TuneVolume(device, g_copyWorkers);
+    context->Queue.Init(context->Tuning.Budget);
+    context->Prebackup = nullptr;
+    context->Helpers = nullptr;
+    LOG_INFO(TraceInstance, "Volume: sector %u, seek penalty %d, removable %d: blocks of %u, %u backups, %u copy workers",
+        device.SectorSize, device.SeekPenalty, device.Removable, context->Tuning.BlockSize, context->Tuning.Budget, context->Tuning.CopyWorkers);
+
+    CopyPoolStart(context);
+    PrebackupStart(FltObjects, context);
+    status = FltSetInstanceContext(FltObjects->Instance, FLT_SET_CONTEXT_KEEP_IF_EXISTS, context, nullptr);
+    if (!NT_SUCCESS(status) && context->Prebackup)
+    {
+        // no teardown would stop it
+        KeSetEvent(&context->Prebackup->Stop, IO_NO_INCREMENT, FALSE);
+        KeWaitForSingleObject(context->Prebackup->Thread, Executive, KernelMode, FALSE, nullptr);
+        ObDereferenceObject(context->Prebackup->Thread);
+        g_pool.Free(context->Prebackup, PREBACKUP_TAG);
+        context->Prebackup = nullptr;
+    }
+
+    if (!NT_SUCCESS(status) && context->Helpers)
+    {
+        CopyPoolStop(context->Helpers);
+        context->Helpers = nullptr;
+    }
+
+    FltReleaseContext(context);
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS InstanceQueryTeardownCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags)
+{
+    /*
+        The filter manager calls this routine to allow the minifilter driver to respond to a manual detach request.
+        Such a request is received when a user-mode application calls FilterDetach or a kernel-mode component calls FltDetachVolume.
+        This routine is not called for automatic or mandatory detach requests, for example, when the minifilter driver is unloaded or a volume is dismounted.
+    */
+    UNREFERENCED_PARAMETER(FltObjects);             // Pointer to an FLT_RELATED_OBJECTS structure that contains opaque pointers for the objects related to the current operation.
+    UNREFERENCED_PARAMETER(Flags);                  // Bitmask of flags that describe why the given isntance query teardown callback routine was called (no flags currently defined)
+    PAGED_CODE();
+    return STATUS_SUCCESS;
+}
+
+VOID InstanceTeardownStartCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags)
+{
+    /*
+        The filter manager calls this routine when the instance is about to be detached: the writers waiting for a backup
+        slot are released and the pre-backup scan is cancelled, it keeps its bookmark to resume on the next attachment.
+    */
+    UNREFERENCED_PARAMETER(Flags);
+    PAGED_CODE();
+
+    InstanceContext* context = nullptr;
+    if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&context)))
+        return;
+
+    context->Queue.Close();
+    if (context->Prebackup)
+        KeSetEvent(&context->Prebackup->Stop, IO_NO_INCREMENT, FALSE);
+    FltReleaseContext(context);
+}
+
+VOID InstanceTeardownCompleteCallback(_In_ PCFLT_RELATED_OBJECTS FltObjects, _In_ FLT_INSTANCE_QUERY_TEARDOWN_FLAGS Flags)
+{
+    /*
+        The filter manager calls this routine once the I/O of the instance has completed: the pre-backup thread has been
+        told to stop by InstanceTeardownStartCallback and is waited for, the copy helpers have nothing left to help.
+    */
+    UNREFERENCED_PARAMETER(Flags);
+    PAGED_CODE();
+
+    InstanceContext* context = nullptr;
+    if (!NT_SUCCESS(FltGetInstanceContext(FltObjects->Instance, (PFLT_CONTEXT*)&context)))
+        return;
+
+    auto worker = context->Prebackup;
+    if (worker)
+    {
+        KeWaitForSingleObject(worker->Thread, Executive, KernelMode, FALSE, nullptr);
+        ObDereferenceObject(worker->Thread);
+        g_pool.Free(worker, PREBACKUP_TAG);
+        context->Prebackup = nullptr;
+    }
+
+    if (context->Helpers)
+    {
+        CopyPoolStop(context->Helpers);
+        context->Helpers = nullptr;
+    }
+
+    auto statistics = context->Queue.Statistics();
+    LOG_INFO(TraceInstance, "Volume: %llu backups, %llu failed, %llu bytes, %llu queued, wait %llu ms (max %llu ms), %u waiters at most",
+        statistics.Backups, statistics.Failed, statistics.Bytes, statistics.Queued,
+        statistics.WaitTime / 10000, statistics.WaitMax / 10000, statistics.DepthMax);
+    FltReleaseContext(context);
+}
+
+const FLT_REGISTRATION FilterRegistration = {                               // A driver uses FLT_REGISTRATION to register itself with the filter manager
+    sizeof(FLT_REGISTRATION),                                               // Size
+    FLT_REGISTRATION_VERSION,                                               // Version
     (FLT_REGISTRATION_FLAGS)0,                                              // Flags
     (PFLT_CONTEXT_REGISTRATION)Contexts,                                    // Pointer to contexts where each represents a context that the driver may use in its work. Context refers to some driver-defined data that can be attached to file system entries, such as files and volumes
     (PFLT_OPERATION_REGISTRATION)Callbacks,                                 // Operation callbacks, each specifying and operation of interest and associated pre/post callbacks
     (PFLT_FILTER_UNLOAD_CALLBACK)FilterUnloadCallback,                      // Function to be called when the driver is about to be unloaded
     (PFLT_INSTANCE_SETUP_CALLBACK)InstanceSetupCallback,                    // Allows the driver to be notified when an instance is about to be attached to a new volume
     (PFLT_INSTANCE_QUERY_TEARDOWN_CALLBACK)InstanceQueryTeardownCallback,   // InstanceQueryTeardown
-    nullptr, // (opt) InstanceTeardownStart
-    nullptr, // (opt) InstanceTeardownComplete
+    (PFLT_INSTANCE_TEARDOWN_CALLBACK)InstanceTeardownStartCallback,         // Cancels the pre-backup scan of the instance
+    (PFLT_INSTANCE_TEARDOWN_CALLBACK)InstanceTeardownCompleteCallback,      // Waits for it
     nullptr, // GenerateFileName
     nullptr, // GenerateDestinationFileName
     nullptr, // NormalizeNameComponent
@@ -453,27 +1833,254 @@ VOID GenerateKey() {
     ULONG seed = currentSystemTime.HighPart;
     auto randomKey = RtlRandomEx(&seed);
     RtlCopyMemory(g_key, &randomKey, sizeof(g_key));
-    DBGPRINT("randomKey %08x\n", randomKey);
+    // the backups of earlier loads were made with another key, the id tells them apart
+    if (!NT_SUCCESS(BCryptGenRandom(nullptr, (PUCHAR)&g_keyId, sizeof(g_keyId), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+        g_keyId = (ULONGLONG)currentSystemTime.QuadPart;
+    LOG_VERBOSE(TraceDriver, "GenerateKey: key generated");
+}
+
+NTSTATUS QueryValue(_In_ HANDLE Key, _In_ PCWSTR Name, ULONG Type, _Out_writes_bytes_(Size) PVOID Data, ULONG Size, _Out_ PULONG Length)
+{
+    UCHAR buffer[sizeof(KEY_VALUE_PARTIAL_INFORMATION) + 32];
+    auto info = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    UNICODE_STRING name;
+    RtlInitUnicodeString(&name, Name);
+    auto status = ZwQueryValueKey(Key, &name, KeyValuePartialInformation, info, sizeof(buffer), Length);
+    if (NT_SUCCESS(status) && (info->Type != Type || info->DataLength > Size))
+        status = STATUS_OBJECT_TYPE_MISMATCH;
+
+    *Length = 0;
+    if (NT_SUCCESS(status))
+    {
+        RtlCopyMemory(Data, info->Data, info->DataLength);
+        *Length = info->DataLength;
+    }
+
+    // the value may be the cipher key
+    RtlSecureZeroMemory(buffer, sizeof(buffer));
+    return status;
+}
+
+// REG_MULTI_SZ value, sized by a first query. The caller frees the result with g_pool.Free and Tag.
+NTSTATUS QueryMultiSz(_In_ HANDLE Key, _In_ PCWSTR Name, PoolSubsystem Subsystem, ULONG Tag, _Outptr_ PKEY_VALUE_PARTIAL_INFORMATION* Info)
+{
+    *Info = nullptr;
+    UNICODE_STRING name;
+    RtlInitUnicodeString(&name, Name);
+    ULONG length = 0;
+    auto status = ZwQueryValueKey(Key, &name, KeyValuePartialInformation, nullptr, 0, &length);
+    if (status != STATUS_BUFFER_TOO_SMALL && status != STATUS_BUFFER_OVERFLOW)
+        return NT_SUCCESS(status) ? STATUS_OBJECT_TYPE_MISMATCH : status;
+
+    auto info = (PKEY_VALUE_PARTIAL_INFORMATION)g_pool.Allocate(Subsystem, PagedPool, length, Tag);
+    if (!info)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    status = ZwQueryValueKey(Key, &name, KeyValuePartialInformation, info, length, &length);
+    if (NT_SUCCESS(status) && info->Type != REG_MULTI_SZ)
+        status = STATUS_OBJECT_TYPE_MISMATCH;
+    if (!NT_SUCCESS(status))
+    {
+        g_pool.Free(info, Tag);
+        return status;
+    }
+
+    *Info = info;
+    return STATUS_SUCCESS;
+}
+
+VOID ReadExclusions(_In_ HANDLE Key)
+{
+    // REG_MULTI_SZ of full image paths
+    PKEY_VALUE_PARTIAL_INFORMATION info = nullptr;
+    auto status = QueryMultiSz(Key, L"ExcludedProcesses", PoolSubsystem::Process, PROCESS_VALUE_TAG, &info);
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND)
+        return;
+
+    if (NT_SUCCESS(status))
+    {
+        status = g_exclusions.Init((const WCHAR*)info->Data, info->DataLength);
+        g_pool.Free(info, PROCESS_VALUE_TAG);
+    }
+
+    if (!NT_SUCCESS(status))
+        LOG_WARNING(TraceDriver, "ReadExclusions: ignoring ExcludedProcesses (0x%08x)", status);
+    else if (g_exclusions.Rejected() > 0)
+        LOG_WARNING(TraceDriver, "ReadExclusions: ignoring %u entries of ExcludedProcesses that are not full image paths", g_exclusions.Rejected());
+}
+
+// The pre-backup scan is an optimization: without it the first write makes the backup
+VOID ReadPrebackup(_In_ HANDLE Key, _In_ PUNICODE_STRING RegistryPath)
+{
+    ULONG rate = PREBACKUP_RATE_KBPS;
+    ULONG length = 0;
+    if (!NT_SUCCESS(QueryValue(Key, L"PrebackupRateKBps", REG_DWORD, &rate, sizeof(rate), &length)))
+        rate = PREBACKUP_RATE_KBPS;
+    g_prebackupRate = rate * 1024ull;
+
+    // REG_MULTI_SZ of volume relative directories, `\Users\alice\Documents`
+    PKEY_VALUE_PARTIAL_INFORMATION info = nullptr;
+    auto status = QueryMultiSz(Key, L"PrebackupRoots", PoolSubsystem::Prebackup, PREBACKUP_VALUE_TAG, &info);
+    if (!NT_SUCCESS(status))
+        return;
+
+    auto characters = info->DataLength / sizeof(WCHAR);
+    auto data = (const WCHAR*)info->Data;
+    while (characters > 0 && data[characters - 1] == L'\0')
+        --characters;
+
+    if (characters > 0)
+    {
+        g_prebackupRoots = (WCHAR*)g_pool.Allocate(PoolSubsystem::Prebackup, PagedPool, (characters + 1) * sizeof(WCHAR), PREBACKUP_ROOTS_TAG);
+        g_serviceKey.MaximumLength = RegistryPath->Length;
+        g_serviceKey.Buffer = (WCHAR*)g_pool.Allocate(PoolSubsystem::Prebackup, PagedPool, g_serviceKey.MaximumLength, PREBACKUP_ROOTS_TAG);
+        if (g_prebackupRoots && g_serviceKey.Buffer)
+        {
+            RtlCopyMemory(g_prebackupRoots, data, characters * sizeof(WCHAR));
+            g_prebackupRoots[characters] = L'\0';
+            g_prebackupRootsLength = (ULONG)characters;
+            RtlCopyUnicodeString(&g_serviceKey, RegistryPath);
+        }
+        else
+        {
+            LOG_WARNING(TraceDriver, "ReadPrebackup: ignoring PrebackupRoots");
+            PrebackupClear();
+        }
+    }
+
+    g_pool.Free(info, PREBACKUP_VALUE_TAG);
+}
+
+NTSTATUS ReadParameters(_In_ PUNICODE_STRING RegistryPath)
+{
+    // Optional values of the service key, see kapp.inf
+    OBJECT_ATTRIBUTES attributes;
+    InitializeObjectAttributes(&attributes, RegistryPath, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+    HANDLE key = nullptr;
+    auto status = ZwOpenKey(&key, KEY_READ, &attributes);
+    if (!NT_SUCCESS(status))
+    {
+        LOG_WARNING(TraceDriver, "ReadParameters: cannot open the service key (0x%08x)", status);
+        return STATUS_SUCCESS;
+    }
+
+    ULONG transformMode = (ULONG)TransformMode::Xor;
+    ULONG length = 0;
+    if (!NT_SUCCESS(QueryValue(key, L"TransformMode", REG_DWORD, &transformMode, sizeof(transformMode), &length))
+        || transformMode > (ULONG)TransformMode::Aes256Ctr)
+        transformMode = (ULONG)TransformMode::Xor;
+
+    g_transformMode = (TransformMode)transformMode;
+    if (!NT_SUCCESS(QueryValue(key, L"SessionWindowMs", REG_DWORD, &g_sessionWindowMs, sizeof(g_sessionWindowMs), &length)))
+        g_sessionWindowMs = SESSION_WINDOW_MS;
+
+    if (!NT_SUCCESS(QueryValue(key, L"CopyWorkers", REG_DWORD, &g_copyWorkers, sizeof(g_copyWorkers), &length))
+        || g_copyWorkers == 0 || g_copyWorkers > PARALLEL_COPY_WORKERS_MAX)
+        g_copyWorkers = PARALLEL_COPY_WORKERS;
+
+    ULONG lazyCreate = 0;
+    if (NT_SUCCESS(QueryValue(key, L"LazyCreate", REG_DWORD, &lazyCreate, sizeof(lazyCreate), &length)))
+        g_lazyCreate = lazyCreate != 0;
+
+    ULONG shadowMode = (ULONG)ShadowMode::Off;
+    if (!NT_SUCCESS(QueryValue(key, L"ShadowMode", REG_DWORD, &shadowMode, sizeof(shadowMode), &length))
+        || shadowMode > (ULONG)ShadowMode::Read)
+        shadowMode = (ULONG)ShadowMode::Off;
+
+    g_shadow.SetMode((ShadowMode)shadowMode);
+    if (shadowMode != (ULONG)ShadowMode::Off)
+        LOG_INFO(TraceDriver, "ReadParameters: shadow mode %u, no backup is made", shadowMode);
+
+    ReadExclusions(key);
+    ReadPrebackup(key, RegistryPath);
+
+    if (g_transformMode != TransformMode::Xor)
+    {
+        // The AES key is provisioned by the administrator, who needs it to restore the backups
+        UCHAR cipherKey[32];
+        auto keySize = g_transformMode == TransformMode::Aes256Ctr ? 32ul : 16ul;
+        status = QueryValue(key, L"TransformKey", REG_BINARY, cipherKey, sizeof(cipherKey), &length);
+        if (NT_SUCCESS(status))
+            status = length == keySize ? g_cipher.Init(cipherKey, keySize) : STATUS_INVALID_PARAMETER;
+
+        RtlSecureZeroMemory(cipherKey, sizeof(cipherKey));
+        if (NT_SUCCESS(status))
+        {
+            // key check value: the same provisioned key keeps its backups current across loads
+            UCHAR zero[kl::Aes::BlockSize] = {};
+            UCHAR check[kl::Aes::BlockSize];
+            g_cipher.EncryptBlock(zero, check);
+            RtlCopyMemory(&g_keyId, check, sizeof(g_keyId));
+        }
+
+        LOG_INFO(TraceDriver, "ReadParameters: AES-%u, AES-NI %d (0x%08x)", keySize * 8, g_cipher.Hardware(), status);
+    }
+
+    ZwClose(key);
+    return status;
 }
 
 NTSTATUS DriverEntry(_In_ PDRIVER_OBJECT DriverObject, _In_ PUNICODE_STRING RegistryPath)
 {
-    DBGPRINT("Driver loading\n");
-    UNREFERENCED_PARAMETER(RegistryPath);
+#if KL_TRACE_LEVEL > 0
+    // tracing is best effort, the driver works without it
+    NT_VERIFY(NT_SUCCESS(kl::trace::Default().Start(TRACE_BUFFER_SIZE)));
+#endif
+    LOG_INFO(TraceDriver, "Driver loading");
     GenerateKey();
-    auto status = FltRegisterFilter(    // Registers a minifilter driver
+    auto status = ReadParameters(RegistryPath);
+    if (!NT_SUCCESS(status))
+    {
+        // an AES mode without a usable key would write backups nobody can restore
+        g_exclusions.Clear();
+        PrebackupClear();
+        kl::trace::Default().Stop();
+        return status;
+    }
+
+    status = SessionsStart();
+    if (!NT_SUCCESS(status))
+    {
+        g_exclusions.Clear();
+        PrebackupClear();
+        kl::trace::Default().Stop();
+        return status;
+    }
+
+    ProcessesStart();
+
+    status = FltRegisterFilter(         // Registers a minifilter driver
         DriverObject,                   // Pointer to the driver object for the minifilter driver
         &FilterRegistration,            // Pointer to a minifilter driver registration structure
         &FilterHandle                   // Pointer to a variable that receives an opaque filter pointer for the caller
     );
     FLT_ASSERT(NT_SUCCESS(status));
     if (!NT_SUCCESS(status))
+    {
+        ProcessesStop();
+        SessionsStop();
+        PrebackupClear();
+        kl::trace::Default().Stop();
         return status;
+    }
+
+    // uapp drains the trace buffers through the communication port
+    status = PortCreate(FilterHandle);
+    if (NT_SUCCESS(status))
+    {
+        status = FltStartFiltering(FilterHandle);
+        if (!NT_SUCCESS(status))
+            PortClose();
+    }
 
-    // FltCreateCommunicationPort to extract key and enhance scenario/challenge?
-    status = FltStartFiltering(FilterHandle);
     if (!NT_SUCCESS(status))
+    {
         FltUnregisterFilter(FilterHandle);
+        ProcessesStop();
+        SessionsStop();
+        PrebackupClear();
+        kl::trace::Default().Stop();
+    }
 
     return status;
 }
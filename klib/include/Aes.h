@@ -0,0 +1,47 @@
+#pragma once
+
+#include "main.h"
+
+namespace kl
+{
+    // AES block cipher (FIPS-197) and counter mode (SP 800-38A), encryption direction only:
+    // CTR decrypts with the same keystream. Uses AES-NI when the processor supports it.
+    class Aes final
+    {
+    public:
+        static constexpr ULONG BlockSize = 16;
+
+        enum class Implementation
+        {
+            Auto,       // AES-NI when available
+            Portable,   // table based, any processor
+        };
+
+        // constexpr so that a global cipher is statically initialized
+        constexpr Aes() : roundKeys{}, rounds(0), hardware(false)
+        {}
+
+        // keySize is 16 (AES-128) or 32 (AES-256)
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        [[nodiscard]] auto Init(_In_reads_bytes_(keySize) const UCHAR* key, ULONG keySize, Implementation implementation = Implementation::Auto) -> NTSTATUS;
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void EncryptBlock(_In_reads_bytes_(BlockSize) const UCHAR* in, _Out_writes_bytes_(BlockSize) UCHAR* out) const;
+
+        // XORs buffer with the keystream bytes [offset, offset + size). The counter block of the
+        // keystream block at `offset` is iv + offset / BlockSize (128 bits big endian), so any
+        // range of a stream can be processed on its own and in any order.
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void Ctr(_Inout_updates_bytes_(size) UCHAR* buffer, SIZE_T size, _In_reads_bytes_(BlockSize) const UCHAR* iv, ULONGLONG offset) const;
+
+        [[nodiscard]] auto Hardware() const -> bool
+        {
+            return hardware;
+        }
+
+    private:
+        alignas(16) UCHAR roundKeys[15 * BlockSize];
+        ULONG rounds;
+        bool hardware;
+    };
+}
@@ -24,11 +24,14 @@ namespace kl
     class FilterFileNameInformation
     {
         PFLT_FILE_NAME_INFORMATION info;
+        NTSTATUS status;
 
     public:
         FilterFileNameInformation(PFLT_CALLBACK_DATA data, FileNameOptions options = FileNameOptions::QueryDefault | FileNameOptions::Normalized);
         ~FilterFileNameInformation();
         [[nodiscard]] operator bool();
+        // Of the name query, the reason there is no information
+        [[nodiscard]] auto Status() const -> NTSTATUS;
         [[nodiscard]] auto operator->() -> PFLT_FILE_NAME_INFORMATION const;
         [[nodiscard]] auto Parse() -> NTSTATUS;
         
@@ -4,108 +4,305 @@
 
 namespace kl
 {
-    class ILock
+    // A lock is a BasicLock over a policy naming the kernel object and the routines that work on it.
+    // The policy is known at compile time: Lock, Unlock and the guards below are direct calls to the
+    // Ke/Ex routines, inlined at the call site, and a lock is only its kernel object, without a vtable.
+    //
+    // A policy has:
+    //  - Object, the kernel object, and State, what an acquisition saves for its release
+    //    (the previous IRQL of a spin lock, the handle of a queued spin lock), or NoState
+    //  - Init(Object*), Acquire(Object*, State*) and Release(Object*, State*)
+    //  - optionally TryAcquire, AcquireShared and ReleaseShared, AcquireAtDpc and ReleaseFromDpc
+    //    (and their shared variants), Reinitialize, and Destroy for the objects that must be deleted
+    //  - Queued, when State is the entry of an acquisition in the queue of the lock: each acquisition
+    //    needs its own, so only the guards, which keep it on their stack, take the lock
+    // A method of BasicLock only compiles when its policy has the routine behind it.
+    struct NoState
+    {};
+
+    template <typename Policy>
+    concept SharedLockPolicy = requires(typename Policy::Object* object, typename Policy::State* state)
     {
+        Policy::AcquireShared(object, state);
+        Policy::ReleaseShared(object, state);
+    };
+
+    template <typename Policy>
+    concept QueuedLockPolicy = requires
+    {
+        requires Policy::Queued;
+    };
+
+    template <typename Policy>
+    concept DestroyedLockPolicy = requires(typename Policy::Object* object)
+    {
+        Policy::Destroy(object);
+    };
+
+    template <typename Lock>
+    class ExclusiveGuard;
+
+    template <typename Lock>
+    class SharedGuard;
+
+    template <typename LockPolicy>
+    class BasicLock final
+    {
+    public:
+        using Policy = LockPolicy;
+        using Object = typename Policy::Object;
+        using State = typename Policy::State;
+
+    private:
+        ALIGN Object object;
+        // saved by Lock for Unlock, the guards keep theirs on the stack; unused by a queued lock
+        [[no_unique_address]] State state;
+
+        template <typename Lock>
+        friend class ExclusiveGuard;
+
+        template <typename Lock>
+        friend class SharedGuard;
+
     public:
-        virtual void Init() = 0;
-        virtual void Lock() = 0;
-        virtual void Unlock() = 0;
+        constexpr BasicLock() : object{}, state{}
+        {}
+
+        BasicLock(BasicLock const&) = delete;
+        BasicLock(BasicLock&&) = delete;
+        BasicLock& operator = (BasicLock const&) = delete;
+        BasicLock& operator = (BasicLock&&) = delete;
+
+        ~BasicLock() requires DestroyedLockPolicy<Policy>
+        {
+            Policy::Destroy(&object);
+        }
+
+        ~BasicLock() = default;
+
+        void Init()
+        {
+            Policy::Init(&object);
+        }
+
+        auto Reinitialize() -> NTSTATUS
+        {
+            return Policy::Reinitialize(&object);
+        }
+
+        void Lock() requires (!QueuedLockPolicy<Policy>)
+        {
+            Policy::Acquire(&object, &state);
+        }
+
+        _Success_(return == true)
+        [[nodiscard]] auto TryLock() -> bool
+        {
+            return Policy::TryAcquire(&object, &state);
+        }
+
+        void Unlock() requires (!QueuedLockPolicy<Policy>)
+        {
+            Policy::Release(&object, &state);
+        }
+
+        void LockShared() requires SharedLockPolicy<Policy>
+        {
+            Policy::AcquireShared(&object, &state);
+        }
+
+        void UnlockShared() requires SharedLockPolicy<Policy>
+        {
+            Policy::ReleaseShared(&object, &state);
+        }
+
+        void LockAtDpc() requires (!QueuedLockPolicy<Policy>)
+        {
+            Policy::AcquireAtDpc(&object, &state);
+        }
+
+        void UnlockFromDpc() requires (!QueuedLockPolicy<Policy>)
+        {
+            Policy::ReleaseFromDpc(&object, &state);
+        }
+
+        void LockSharedAtDpc()
+        {
+            Policy::AcquireSharedAtDpc(&object, &state);
+        }
+
+        void UnlockSharedFromDpc()
+        {
+            Policy::ReleaseSharedFromDpc(&object, &state);
+        }
     };
 
-    /*class AutoLock final
+    // Owns the lock exclusively until the end of the scope:
+    //
+    //     kl::ExclusiveGuard guard(context->Lock);
+    template <typename Lock>
+    class [[nodiscard]] ExclusiveGuard final
     {
-        ILock& lock;
+        using Policy = typename Lock::Policy;
+
+        Lock& lock;
+        typename Lock::State state;
 
     public:
-        AutoLock(ILock& lock) : lock(lock)
+        [[nodiscard]] explicit ExclusiveGuard(Lock& lock) : lock(lock), state{}
         {
-            lock.Lock();
+            Policy::Acquire(&lock.object, &state);
         }
 
-        ~AutoLock()
+        ExclusiveGuard(ExclusiveGuard const&) = delete;
+        ExclusiveGuard(ExclusiveGuard&&) = delete;
+        ExclusiveGuard& operator = (ExclusiveGuard const&) = delete;
+        ExclusiveGuard& operator = (ExclusiveGuard&&) = delete;
+
+        ~ExclusiveGuard()
         {
-            lock.Unlock();
+            Policy::Release(&lock.object, &state);
         }
-    };*/
+    };
 
-    // For better performance, use fast mutexes or guarded mutexes.
-    class Mutex final : public ILock
+    // Owns the lock shared until the end of the scope, for the locks that have a shared mode
+    template <typename Lock>
+    class [[nodiscard]] SharedGuard final
     {
-        ALIGN KMUTEX mutex;
+        using Policy = typename Lock::Policy;
+        static_assert(SharedLockPolicy<Policy>, "the lock has no shared mode");
+
+        Lock& lock;
+        typename Lock::State state;
 
     public:
-        Mutex();
-        Mutex(Mutex const&) = delete;
-        Mutex(Mutex&&) = delete;
-        Mutex& operator = (Mutex const&) = delete;
-        Mutex& operator = (Mutex&&) = delete;
-        ~Mutex() = default;
-
-        void Init();
-        void Lock();
-        void Unlock();
+        [[nodiscard]] explicit SharedGuard(Lock& lock) : lock(lock), state{}
+        {
+            Policy::AcquireShared(&lock.object, &state);
+        }
+
+        SharedGuard(SharedGuard const&) = delete;
+        SharedGuard(SharedGuard&&) = delete;
+        SharedGuard& operator = (SharedGuard const&) = delete;
+        SharedGuard& operator = (SharedGuard&&) = delete;
+
+        ~SharedGuard()
+        {
+            Policy::ReleaseShared(&lock.object, &state);
+        }
+    };
+
+    // For better performance, use fast mutexes or guarded mutexes.
+    struct MutexPolicy
+    {
+        using Object = KMUTEX;
+        using State = NoState;
+
+        static void Init(Object* mutex)
+        {
+            // Initializes a mutex object, setting it to a signaled state.
+            KeInitializeMutex(mutex, 0);
+        }
+
+        static void Acquire(Object* mutex, State*)
+        {
+            // Puts the current thread into a wait state until the given dispatcher object is set to a signaled state
+            KeWaitForSingleObject(mutex, Executive, KernelMode, FALSE, nullptr);
+        }
+
+        static void Release(Object* mutex, State*)
+        {
+            // Releases a mutex object
+            KeReleaseMutex(mutex, FALSE);
+        }
     };
 
     // Starting with Windows 2000, drivers can use fast mutexes
     // if they require a low-overhead form of mutual exclusion for code that runs at IRQL <= APC_LEVEL.
     // https://docs.microsoft.com/windows-hardware/drivers/kernel/fast-mutexes-and-guarded-mutexes#fast-mutexes
-    class FastMutex final : public ILock
+    struct FastMutexPolicy
     {
-        ALIGN FAST_MUTEX mutex;
-
-    public:
-        FastMutex();
-        FastMutex(FastMutex const&) = delete;
-        FastMutex(FastMutex&&) = delete;
-        FastMutex& operator = (FastMutex const&) = delete;
-        FastMutex& operator = (FastMutex&&) = delete;
-        ~FastMutex() = default;
+        using Object = FAST_MUTEX;
+        using State = NoState;
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void Init();
+        static void Init(Object* mutex)
+        {
+            // Initializes a fast mutex variable, used to synchronize mutually exclusive access by a set of threads to a shared resource.
+            ExInitializeFastMutex(mutex);
+        }
 
         _IRQL_raises_(APC_LEVEL)
         _IRQL_saves_global_(OldIrql, mutex)
-        void Lock();
+        static void Acquire(Object* mutex, State*)
+        {
+            // ExAcquireFastMutex puts the caller into a wait state if the given fast mutex cannot be acquired immediately.
+            // Otherwise, the caller is given ownership of the fast mutex with APCs to the current thread disabled until it releases the fast mutex.
+            // Use TryLock/ExTryToAcquireFastMutex if the current thread can do other work before it waits on the acquisition of the given mutex.
+            ExAcquireFastMutex(mutex);
+        }
 
         _IRQL_raises_(APC_LEVEL)
         _IRQL_saves_global_(OldIrql, mutex)
         _Success_(return == true)
-        [[nodiscard]] auto TryLock() -> bool;
+        [[nodiscard]] static auto TryAcquire(Object* mutex, State*) -> bool
+        {
+            // ExTryToAcquireFastMutex acquires the fast mutex, if possible, with APCs to the current thread disabled.
+            // ExTryToAcquireFastMutex returns TRUE if the current thread is given ownership of the fast mutex.
+            return ExTryToAcquireFastMutex(mutex);
+        }
 
         _IRQL_requires_(APC_LEVEL)
         _IRQL_restores_global_(OldIrql, mutex)
-        void Unlock();
+        static void Release(Object* mutex, State*)
+        {
+            // ExReleaseFastMutex releases ownership of the given fast mutex and sets the IRQL to the value that the caller was running at before it called ExAcquireFastMutex.
+            // If the previous IRQL was less than APC_LEVEL, the delivery of APCs to the current thread is reenabled.
+            ExReleaseFastMutex(mutex);
+        }
     };
 
     // Guarded mutexes, which are available starting with Windows Server 2003,
     // perform the same function as fast mutexes but with higher performance.
     // https://docs.microsoft.com/windows-hardware/drivers/kernel/fast-mutexes-and-guarded-mutexes#guarded-mutexes
-    class GuardedMutex final : public ILock
+    struct GuardedMutexPolicy
     {
-        ALIGN KGUARDED_MUTEX mutex;
-
-    public:
-        GuardedMutex();
-        GuardedMutex(GuardedMutex const&) = delete;
-        GuardedMutex(GuardedMutex&&) = delete;
-        GuardedMutex& operator = (GuardedMutex const&) = delete;
-        GuardedMutex& operator = (GuardedMutex&&) = delete;
-        ~GuardedMutex() = default;
+        using Object = KGUARDED_MUTEX;
+        using State = NoState;
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void Init();
+        static void Init(Object* mutex)
+        {
+            // Initializes a guarded mutex variable, used to synchronize mutually exclusive access by a set of threads to a shared resource.
+            KeInitializeGuardedMutex(mutex);
+        }
 
         _IRQL_requires_max_(APC_LEVEL)
-        void Lock();
+        static void Acquire(Object* mutex, State*)
+        {
+            // KeAcquireGuardedMutex puts the caller into a wait state if the given guarded mutex cannot be acquired immediately.
+            // Otherwise, the caller is given ownership of the guarded mutex with APCs to the current thread disabled until it releases the guarded mutex.
+            // Use TryLock/ExTryToAcquireGuardedMutex if the current thread can do other work before it waits on the acquisition of the given mutex.
+            KeAcquireGuardedMutex(mutex);
+        }
 
         _IRQL_raises_(APC_LEVEL)
         _IRQL_saves_global_(OldIrql, mutex)
         _Success_(return == true)
-        [[nodiscard]] auto TryLock() -> bool;
+        [[nodiscard]] static auto TryAcquire(Object* mutex, State*) -> bool
+        {
+            // KeTryToAcquireGuardedMutex acquires the guarded mutex, if possible, with APCs to the current thread disabled.
+            // KeTryToAcquireGuardedMutex returns TRUE if the current thread is given ownership of the guarded mutex.
+            return KeTryToAcquireGuardedMutex(mutex);
+        }
 
         _IRQL_requires_max_(APC_LEVEL)
-        void Unlock();
+        static void Release(Object* mutex, State*)
+        {
+            // KeReleaseGuardedMutex releases ownership of the given guarded mutex and sets the IRQL to the value that the caller was running at before it called ExAcquireGuardedMutex.
+            // If the previous IRQL was less than APC_LEVEL, the delivery of APCs to the current thread is reenabled.
+            KeReleaseGuardedMutex(mutex);
+        }
     };
 
     // Spin locks are kernel-defined, kernel-mode-only synchronization mechanisms,
@@ -113,94 +310,290 @@ namespace kl
     // A spin lock can be used to protect shared data or resources from simultaneous access
     // by routines that can execute concurrently and at IRQL >= DISPATCH_LEVEL in SMP machines.
     // https://docs.microsoft.com/windows-hardware/drivers/kernel/spin-locks
-    class SpinLock final : public ILock
+    struct SpinLockPolicy
     {
-        ALIGN KSPIN_LOCK lock;
-        KIRQL old_irql;
+        using Object = KSPIN_LOCK;
+        using State = KIRQL;
 
-    public:
-        SpinLock();
-        SpinLock(SpinLock const&) = delete;
-        SpinLock(SpinLock&&) = delete;
-        SpinLock& operator = (SpinLock const&) = delete;
-        SpinLock& operator = (SpinLock&&) = delete;
-        ~SpinLock() = default;
-
-        void Init();
-        
-        _IRQL_saves_global_(SpinLock, old_irql)
+        static void Init(Object* lock)
+        {
+            // Initializes the KSPIN_LOCK lock.
+            // Callers of this routine can be running at any IRQL.
+            KeInitializeSpinLock(lock);
+        }
+
+        _IRQL_saves_global_(SpinLock, oldIrql)
         _IRQL_raises_(DISPATCH_LEVEL)
-        void Lock();
+        static void Acquire(Object* lock, State* oldIrql)
+        {
+            // KeAcquireSpinLock first resets the IRQL to DISPATCH_LEVEL and then acquires the lock
+            // The previous IRQL is written to OldIrql after the lock is acquired.
+            KeAcquireSpinLock(lock, oldIrql);
+        }
 
         _IRQL_requires_(DISPATCH_LEVEL)
-        _IRQL_restores_global_(SpinLock, old_irql)
-        void Unlock();
+        _IRQL_restores_global_(SpinLock, oldIrql)
+        static void Release(Object* lock, State* oldIrql)
+        {
+            // KeReleaseSpinLock releases a spin lock and restores the original IRQL at which the caller was running.
+            // This routine raises the IRQL level to DISPATCH_LEVEL when acquiring the spin lock.
+            // If the caller is guaranteed to already be running at DISPATCH_LEVEL, it is more efficient to call LockAtDpc/KeAcquireSpinLockAtDpcLevel.
+            KeReleaseSpinLock(lock, *oldIrql);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void AcquireAtDpc(Object* lock, State*)
+        {
+            KeAcquireSpinLockAtDpcLevel(lock);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void ReleaseFromDpc(Object* lock, State*)
+        {
+            KeReleaseSpinLockFromDpcLevel(lock);
+        }
     };
 
     // Queued spin locks are a variant of spin locks that are more efficient for high contention locks on multiprocessor machines.
     // On multiprocessor machines, using queued spin locks guarantees that processors acquire the spin lock on a first - come first - served basis.
     // Drivers for Windows XP and later versions of Windows should use queued spin locks instead of ordinary spin locks.
     // https://docs.microsoft.com/windows-hardware/drivers/kernel/queued-spin-locks
-    class QueuedSpinLock final : public ILock
+    //
+    // The handle is the entry of the waiter in the queue: each acquisition needs its own, on its stack.
+    // Only ExclusiveGuard takes the lock, Lock and Unlock do not compile.
+    struct QueuedSpinLockPolicy
     {
-        ALIGN KSPIN_LOCK lock;
-        KLOCK_QUEUE_HANDLE handle;
+        using Object = KSPIN_LOCK;
+        using State = KLOCK_QUEUE_HANDLE;
+        static constexpr bool Queued = true;
 
-    public:
-        QueuedSpinLock();
-        QueuedSpinLock(QueuedSpinLock const&) = delete;
-        QueuedSpinLock(QueuedSpinLock&&) = delete;
-        QueuedSpinLock& operator = (QueuedSpinLock const&) = delete;
-        QueuedSpinLock& operator = (QueuedSpinLock&&) = delete;
-        ~QueuedSpinLock() = default;
-
-        void Init();
+        static void Init(Object* lock)
+        {
+            // Initializes the KSPIN_LOCK lock.
+            // Callers of this routine can be running at any IRQL.
+            KeInitializeSpinLock(lock);
+        }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
         _IRQL_saves_global_(QueuedSpinLock, handle)
         _IRQL_raises_(DISPATCH_LEVEL)
-        void Lock();
+        static void Acquire(Object* lock, State* handle)
+        {
+            // KeAcquireInStackQueuedSpinLock acquires a spin lock as a queued spin lock.
+            // If the caller is guaranteed to already be running at DISPATCH_LEVEL, it is more efficient to call LockAtDpc/KeAcquireInStackQueuedSpinLockAtDpcLevel.
+            KeAcquireInStackQueuedSpinLock(lock, handle);
+        }
 
         _IRQL_requires_(DISPATCH_LEVEL)
         _IRQL_restores_global_(QueuedSpinLock, handle)
-        void Unlock();
+        static void Release(Object*, State* handle)
+        {
+            // KeReleaseInStackQueuedSpinLock restores the original IRQL that
+            // the operating system saved at the beginning of the KeAcquireInStackQueuedSpinLock call.
+            KeReleaseInStackQueuedSpinLock(handle);
+        }
 
         _IRQL_requires_(DISPATCH_LEVEL)
-        void LockAtDpc();
+        static void AcquireAtDpc(Object* lock, State* handle)
+        {
+            // KeAcquireInStackQueuedSpinLockAtDpcLevel acquires a queued spin lock
+            // when the caller is already running at IRQL >= DISPATCH_LEVEL.
+            KeAcquireInStackQueuedSpinLockAtDpcLevel(lock, handle);
+        }
 
         _IRQL_requires_(DISPATCH_LEVEL)
-        void UnlockFromDpc();
+        static void ReleaseFromDpc(Object*, State* handle)
+        {
+            // KeReleaseInStackQueuedSpinLockFromDpcLevel releases a queued spin lock acquired by KeAcquireInStackQueuedSpinLockAtDpcLevel.
+            KeReleaseInStackQueuedSpinLockFromDpcLevel(handle);
+        }
     };
 
     // The resource variable can be used for synchrosization by a set of threads
     // The ERESOURCE structure is opaque.
-    class ExecutiveResource : public ILock 
+    struct ExecutiveResourcePolicy
     {
-        ERESOURCE resource;
+        using Object = ERESOURCE;
+        using State = NoState;
 
-    public:
-        ExecutiveResource();
-        ExecutiveResource(const ExecutiveResource&) = delete;
-        ExecutiveResource(ExecutiveResource&&) = delete;
-        ExecutiveResource& operator=(const ExecutiveResource&) = delete;
-        ExecutiveResource& operator=(ExecutiveResource&&) = delete;
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        static void Init(Object* resource)
+        {
+            // Initializes the resource variable
+            ExInitializeResourceLite(resource);
+        }
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        static auto Reinitialize(Object* resource) -> NTSTATUS
+        {
+            // Reinitializes the resource. Replaces the three following calls:
+            // 1. ExDeleteResourceLite
+            // 2. ExAllocatePool
+            // 3. ExInitializeResourceLite
+            return ExReinitializeResourceLite(resource);
+        }
 
         _IRQL_requires_max_(APC_LEVEL)
-         ~ExecutiveResource();
+        static void Destroy(Object* resource)
+        {
+            ExDeleteResourceLite(resource);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        static void Acquire(Object* resource, State*)
+        {
+            // Disables the execution of normal kernel-mode APCs (but does not prevent special kernel APCs from running)
+            KeEnterCriticalRegion();
+            // Acquires the resource for exclusive access by the calling thread
+            static_cast<void>(ExAcquireResourceExclusiveLite(resource, TRUE));
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        static void AcquireShared(Object* resource, State*)
+        {
+            // Disables the execution of normal kernel-mode APCs (but does not prevent special kernel APCs from running)
+            KeEnterCriticalRegion();
+            // Waits until the shared access is granted, FALSE is only returned when Wait is FALSE
+            static_cast<void>(ExAcquireResourceSharedLite(resource, TRUE));
+        }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void Init() override;
+        static void Release(Object* resource, State*)
+        {
+            // Releases the resource owned by the current thread
+            ExReleaseResourceLite(resource);
+            // Reenables the delivery of normal kernel-mode APCs
+            KeLeaveCriticalRegion();
+        }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        auto Reinitialize() -> NTSTATUS;
-        
+        static void ReleaseShared(Object* resource, State* state)
+        {
+            Release(resource, state);
+        }
+    };
+
+    // Push locks are reader/writer locks the size of a pointer, acquired shared or exclusive at IRQL <= APC_LEVEL.
+    // Uncontended acquisitions are a single interlocked operation on the lock, without the owner table of an ERESOURCE.
+    // A push lock is not recursive and cannot be converted from shared to exclusive.
+    // https://docs.microsoft.com/windows-hardware/drivers/kernel/introduction-to-push-locks
+    struct PushLockPolicy
+    {
+        using Object = EX_PUSH_LOCK;
+        using State = NoState;
+
+        static void Init(Object* lock)
+        {
+            // Initializes a push lock variable, the lock is not owned.
+            ExInitializePushLock(lock);
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        static void Acquire(Object* lock, State*)
+        {
+            // Push locks are acquired in a critical region, so that a suspended thread cannot hold one
+            KeEnterCriticalRegion();
+            ExAcquirePushLockExclusiveEx(lock, EX_DEFAULT_PUSH_LOCK_FLAGS);
+        }
+
         _IRQL_requires_max_(APC_LEVEL)
-        void Lock() override;
+        static void Release(Object* lock, State*)
+        {
+            ExReleasePushLockExclusiveEx(lock, EX_DEFAULT_PUSH_LOCK_FLAGS);
+            KeLeaveCriticalRegion();
+        }
+
+        _IRQL_requires_max_(APC_LEVEL)
+        static void AcquireShared(Object* lock, State*)
+        {
+            KeEnterCriticalRegion();
+            ExAcquirePushLockSharedEx(lock, EX_DEFAULT_PUSH_LOCK_FLAGS);
+        }
 
         _IRQL_requires_max_(APC_LEVEL)
-        auto LockShared() -> BOOLEAN;
+        static void ReleaseShared(Object* lock, State*)
+        {
+            ExReleasePushLockSharedEx(lock, EX_DEFAULT_PUSH_LOCK_FLAGS);
+            KeLeaveCriticalRegion();
+        }
+    };
+
+    // Reader/writer spin locks, available starting with Windows Vista SP1, raise to DISPATCH_LEVEL as spin locks do.
+    // Readers only increment the share count of the lock, an exclusive acquirer blocks new readers and waits for the others to leave.
+    // https://docs.microsoft.com/windows-hardware/drivers/kernel/reader-writer-spin-locks
+    struct SharedSpinLockPolicy
+    {
+        using Object = EX_SPIN_LOCK;
+        using State = KIRQL;
+
+        static void Init(Object* lock)
+        {
+            // EX_SPIN_LOCK is a plain LONG, zero when not owned
+            *lock = 0;
+        }
+
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        _IRQL_saves_global_(OldIrql, oldIrql)
+        _IRQL_raises_(DISPATCH_LEVEL)
+        static void Acquire(Object* lock, State* oldIrql)
+        {
+            // ExAcquireSpinLockExclusive raises the IRQL to DISPATCH_LEVEL and returns the previous one.
+            *oldIrql = ExAcquireSpinLockExclusive(lock);
+        }
+
+        _IRQL_requires_(DISPATCH_LEVEL)
+        _IRQL_restores_global_(OldIrql, oldIrql)
+        static void Release(Object* lock, State* oldIrql)
+        {
+            ExReleaseSpinLockExclusive(lock, *oldIrql);
+        }
 
         _IRQL_requires_max_(DISPATCH_LEVEL)
-        void Unlock() override;
+        _IRQL_saves_global_(OldIrql, oldIrql)
+        _IRQL_raises_(DISPATCH_LEVEL)
+        static void AcquireShared(Object* lock, State* oldIrql)
+        {
+            *oldIrql = ExAcquireSpinLockShared(lock);
+        }
+
+        _IRQL_requires_(DISPATCH_LEVEL)
+        _IRQL_restores_global_(OldIrql, oldIrql)
+        static void ReleaseShared(Object* lock, State* oldIrql)
+        {
+            ExReleaseSpinLockShared(lock, *oldIrql);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void AcquireAtDpc(Object* lock, State*)
+        {
+            ExAcquireSpinLockExclusiveAtDpcLevel(lock);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void ReleaseFromDpc(Object* lock, State*)
+        {
+            ExReleaseSpinLockExclusiveFromDpcLevel(lock);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void AcquireSharedAtDpc(Object* lock, State*)
+        {
+            ExAcquireSpinLockSharedAtDpcLevel(lock);
+        }
+
+        _IRQL_requires_min_(DISPATCH_LEVEL)
+        static void ReleaseSharedFromDpc(Object* lock, State*)
+        {
+            ExReleaseSpinLockSharedFromDpcLevel(lock);
+        }
     };
+
+    using Mutex = BasicLock<MutexPolicy>;
+    using FastMutex = BasicLock<FastMutexPolicy>;
+    using GuardedMutex = BasicLock<GuardedMutexPolicy>;
+    using SpinLock = BasicLock<SpinLockPolicy>;
+    using QueuedSpinLock = BasicLock<QueuedSpinLockPolicy>;
+    using ExecutiveResource = BasicLock<ExecutiveResourcePolicy>;
+    using PushLock = BasicLock<PushLockPolicy>;
+    using SharedSpinLock = BasicLock<SharedSpinLockPolicy>;
 }
\ No newline at end of file
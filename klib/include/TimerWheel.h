@@ -0,0 +1,139 @@
+#pragma once
+
+#include "main.h"
+
+namespace kl
+{
+    // Intrusive timer: embed it in the object to expire, the wheel never allocates
+    struct TimerEntry
+    {
+        TimerEntry* Next;
+        TimerEntry* Prev;
+        ULONGLONG DueTick;
+    };
+
+    // Hashed timer wheel. An entry due at tick T sits in slot T % Slots; Advance only visits
+    // the slots of the ticks elapsed since the previous call, and leaves the entries due in a
+    // later revolution of the wheel where they are. Times are in the caller's unit (e.g. the
+    // 100ns of KeQueryInterruptTime), which makes the wheel easy to drive with a simulated clock.
+    // The wheel is not synchronized, callers serialize.
+    template <ULONG Slots>
+    class TimerWheel final
+    {
+        static_assert(Slots > 0 && (Slots & (Slots - 1)) == 0, "Slots must be a power of two");
+
+        TimerEntry slots[Slots];    // list heads
+        ULONGLONG tickLength;
+        ULONGLONG currentTick;      // first tick not processed yet
+        ULONG count;
+
+        static void Unlink(TimerEntry* entry)
+        {
+            entry->Prev->Next = entry->Next;
+            entry->Next->Prev = entry->Prev;
+            entry->Next = nullptr;
+            entry->Prev = nullptr;
+        }
+
+    public:
+        constexpr TimerWheel() : slots{}, tickLength(1), currentTick(0), count(0)
+        {}
+
+        TimerWheel(TimerWheel const&) = delete;
+        TimerWheel(TimerWheel&&) = delete;
+        TimerWheel& operator = (TimerWheel const&) = delete;
+        TimerWheel& operator = (TimerWheel&&) = delete;
+        ~TimerWheel() = default;
+
+        void Init(ULONGLONG now, ULONGLONG tick)
+        {
+            tickLength = tick ? tick : 1;
+            currentTick = now / tickLength;
+            count = 0;
+            for (auto& slot : slots)
+            {
+                slot.Next = &slot;
+                slot.Prev = &slot;
+            }
+        }
+
+        // Schedules the entry to expire at the first tick boundary at or after `due`
+        void Schedule(_Inout_ TimerEntry* entry, ULONGLONG due)
+        {
+            auto tick = (due + tickLength - 1) / tickLength;
+            if (tick < currentTick)
+                tick = currentTick;
+
+            auto& slot = slots[tick & (Slots - 1)];
+            entry->DueTick = tick;
+            entry->Next = &slot;
+            entry->Prev = slot.Prev;
+            slot.Prev->Next = entry;
+            slot.Prev = entry;
+            ++count;
+        }
+
+        void Cancel(_Inout_ TimerEntry* entry)
+        {
+            if (!Scheduled(entry))
+                return;
+
+            Unlink(entry);
+            --count;
+        }
+
+        // Moves a scheduled entry, or schedules it
+        void Reschedule(_Inout_ TimerEntry* entry, ULONGLONG due)
+        {
+            Cancel(entry);
+            Schedule(entry, due);
+        }
+
+        [[nodiscard]] static auto Scheduled(const TimerEntry* entry) -> bool
+        {
+            return entry->Next != nullptr;
+        }
+
+        // Unlinks every entry due at or before `now` and passes it to expired(TimerEntry*),
+        // which may free it. Returns the number of expired entries.
+        template <typename Callback>
+        auto Advance(ULONGLONG now, Callback&& expired) -> ULONG
+        {
+            auto target = now / tickLength;
+            if (target < currentTick)
+                return 0;
+
+            // after a full revolution every slot has been visited once
+            auto steps = target - currentTick + 1;
+            if (steps > Slots)
+                steps = Slots;
+
+            ULONG fired = 0;
+            for (ULONGLONG step = 0; step < steps; ++step)
+            {
+                auto& slot = slots[(currentTick + step) & (Slots - 1)];
+                for (auto entry = slot.Next; entry != &slot;)
+                {
+                    auto next = entry->Next;
+                    if (entry->DueTick <= target)
+                    {
+                        Unlink(entry);
+                        --count;
+                        ++fired;
+                        expired(entry);
+                    }
+
+                    entry = next;
+                }
+            }
+
+            currentTick = target + 1;
+            return fired;
+        }
+
+        [[nodiscard]] auto Count() const -> ULONG
+        {
+            return count;
+        }
+    };
+}
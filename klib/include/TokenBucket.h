@@ -0,0 +1,82 @@
+#pragma once
+
+#include "main.h"
+
+namespace kl
+{
+    // Token bucket rate limiter. Tokens accumulate at `rate` per second up to `burst`; an operation
+    // takes its cost once it has run and may leave the bucket in debt, the caller then waits for
+    // Delay before the next one. Times are in 100ns units (KeQueryInterruptTime), passed by the
+    // caller so that the bucket can be driven by a simulated clock. Not synchronized.
+    class TokenBucket final
+    {
+        static constexpr ULONGLONG Second = 10000000;
+
+        ULONGLONG rate;     // tokens per second, 0 for no limit
+        LONGLONG burst;
+        LONGLONG tokens;
+        ULONGLONG last;     // time of the last refill, not counting the fraction of a token left over
+
+        void Refill(ULONGLONG now)
+        {
+            if (now <= last)
+                return;
+
+            // a long idle period fills the bucket, and would overflow the product below
+            auto elapsed = now - last;
+            if (elapsed >= 1000 * Second)
+            {
+                tokens = burst;
+                last = now;
+                return;
+            }
+
+            auto added = elapsed * rate / Second;
+            if (added == 0)
+                return;
+
+            tokens += (LONGLONG)added;
+            last += added * Second / rate;
+            if (tokens >= burst)
+            {
+                tokens = burst;
+                last = now;
+            }
+        }
+
+    public:
+        constexpr TokenBucket() : rate(0), burst(0), tokens(0), last(0)
+        {}
+
+        void Init(ULONGLONG ratePerSecond, ULONGLONG burstTokens, ULONGLONG now)
+        {
+            rate = ratePerSecond;
+            burst = (LONGLONG)burstTokens;
+            tokens = burst;
+            last = now;
+        }
+
+        void Consume(ULONGLONG cost, ULONGLONG now)
+        {
+            if (rate == 0)
+                return;
+
+            Refill(now);
+            tokens -= (LONGLONG)cost;
+        }
+
+        // Time to wait before the next operation, 0 when the bucket is not in debt
+        [[nodiscard]] auto Delay(ULONGLONG now) -> ULONGLONG
+        {
+            if (rate == 0)
+                return 0;
+
+            Refill(now);
+            if (tokens >= 0)
+                return 0;
+
+            // rounded up, waking up early would only find the bucket still in debt
+            return ((ULONGLONG)-tokens * Second + rate - 1) / rate;
+        }
+    };
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "main.h"
+#include "TraceFormat.h"
+
+#include <type_traits>
+
+// Binary trace logging.
+//
+// Trace sites are filtered at compile time: a site whose level is above KL_TRACE_LEVEL,
+// or whose category is not in KL_TRACE_CATEGORIES, is discarded by `if constexpr` and
+// generates no code. Enabled sites append a compact record (format id, timestamp and
+// raw arguments) to the buffer of the current processor. Formatting happens offline,
+// in `uapp trace decode`.
+
+#ifndef KL_TRACE_LEVEL
+#define KL_TRACE_LEVEL 0            // kl::trace::Level, 0 compiles every site out
+#endif
+
+#ifndef KL_TRACE_CATEGORIES
+#define KL_TRACE_CATEGORIES 0xffffffff
+#endif
+
+namespace kl::trace
+{
+    constexpr auto Enabled(uint8_t level, uint8_t category) -> bool
+    {
+        return level != LevelNone && level <= KL_TRACE_LEVEL && category < 32 && ((KL_TRACE_CATEGORIES >> category) & 1);
+    }
+
+    class Session final
+    {
+        // Each processor owns two halves: writers append to the active one while
+        // Drain flips them and copies the other out once its writers are gone.
+        struct Half
+        {
+            UCHAR* Data;
+            volatile LONG Offset;
+            volatile LONG Writers;
+            volatile LONG Dropped;
+        };
+
+        struct alignas(64) CpuBuffer
+        {
+            Half Halves[2];
+            volatile LONG Active;
+        };
+
+        CpuBuffer* buffers;
+        ULONG cpuCount;
+        ULONG halfSize;
+        volatile LONG active;
+        EX_RUNDOWN_REF rundown;     // held by each Write, Stop waits for it before freeing the buffers
+
+        [[nodiscard]] auto Reserve(ULONG size, Half*& half) -> UCHAR*;
+        static void Commit(Half* half, RecordHeader* header, ULONG size);
+        static auto CountRecords(const UCHAR* data, ULONG size) -> ULONG;
+
+        template <typename T>
+        static constexpr auto IsString() -> bool
+        {
+            return std::is_same_v<T, const char*> || std::is_same_v<T, char*>
+                || std::is_same_v<T, const WCHAR*> || std::is_same_v<T, WCHAR*>
+                || std::is_same_v<T, PUNICODE_STRING> || std::is_same_v<T, PCUNICODE_STRING>;
+        }
+
+        template <typename T>
+        static auto ArgSize(T value) -> ULONG
+        {
+            static_assert((std::is_integral_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>), "trace arguments are integers, pointers or strings");
+            if constexpr (IsString<T>())
+                return 1 + sizeof(uint16_t) + StringLength(value) * (std::is_same_v<T, const char*> || std::is_same_v<T, char*> ? 1 : sizeof(uint16_t));
+            else if constexpr (sizeof(T) > sizeof(uint32_t) || std::is_pointer_v<T>)
+                return 1 + sizeof(uint64_t);
+            else
+                return 1 + sizeof(uint32_t);
+        }
+
+        static auto StringLength(const char* value) -> ULONG;
+        static auto StringLength(const WCHAR* value) -> ULONG;
+        static auto StringLength(PCUNICODE_STRING value) -> ULONG;
+
+        static void EncodeString(UCHAR*& cursor, const char* value);
+        static void EncodeString(UCHAR*& cursor, const WCHAR* value, ULONG length);
+
+        template <typename T>
+        static void Encode(UCHAR*& cursor, T value)
+        {
+            if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+                EncodeString(cursor, value);
+            else if constexpr (std::is_same_v<T, const WCHAR*> || std::is_same_v<T, WCHAR*>)
+                EncodeString(cursor, value, StringLength(value));
+            else if constexpr (std::is_same_v<T, PUNICODE_STRING> || std::is_same_v<T, PCUNICODE_STRING>)
+                EncodeString(cursor, value ? value->Buffer : nullptr, StringLength(value));
+            else if constexpr (std::is_pointer_v<T>)
+                EncodeValue(cursor, ArgType::Pointer, (uint64_t)(ULONG_PTR)value);
+            else if constexpr (sizeof(T) > sizeof(uint32_t))
+                EncodeValue(cursor, std::is_signed_v<T> ? ArgType::Int64 : ArgType::UInt64, (uint64_t)value);
+            else
+                EncodeValue(cursor, std::is_signed_v<T> ? ArgType::Int32 : ArgType::UInt32, (uint32_t)value);
+        }
+
+        template <typename T>
+        static void EncodeValue(UCHAR*& cursor, ArgType type, T value)
+        {
+            *cursor++ = (UCHAR)type;
+            RtlCopyMemory(cursor, &value, sizeof(value));
+            cursor += sizeof(value);
+        }
+
+    public:
+        // constexpr so that the default session is statically initialized, drivers run no global constructors
+        constexpr Session() : buffers(nullptr), cpuCount(0), halfSize(0), active(0), rundown{}
+        {}
+
+        Session(Session const&) = delete;
+        Session(Session&&) = delete;
+        Session& operator = (Session const&) = delete;
+        Session& operator = (Session&&) = delete;
+        ~Session() = default;
+
+        // Allocates bytesPerCpu of non paged pool per processor and starts accepting records
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]] auto Start(ULONG bytesPerCpu) -> NTSTATUS;
+
+        _IRQL_requires_max_(APC_LEVEL)
+        void Stop();
+
+        // Moves the records written so far to `output` as a sequence of ChunkHeader + records.
+        // Records that do not fit in `output` are lost and reported as dropped.
+        // Calls must be serialized by the caller.
+        _IRQL_requires_max_(APC_LEVEL)
+        [[nodiscard]] auto Drain(_Out_ void* output, ULONG size, _Out_ ULONG* written) -> NTSTATUS;
+
+        template <typename... Args>
+        _IRQL_requires_max_(DISPATCH_LEVEL)
+        void Write(uint8_t level, uint8_t category, uint32_t formatId, Args... args)
+        {
+            if (!ReadNoFence(&active))
+                return;
+
+            ULONG size = (sizeof(RecordHeader) + (0 + ... + ArgSize(args)) + RecordAlignment - 1) & ~(RecordAlignment - 1);
+            if (size > MaxRecordSize)
+                return;
+
+            // the session can be stopped since active was read, the buffers are only used under the rundown
+            if (!ExAcquireRundownProtection(&rundown))
+                return;
+
+            Half* half = nullptr;
+            auto record = Reserve(size, half);
+            if (!record)
+            {
+                ExReleaseRundownProtection(&rundown);
+                return;
+            }
+
+            auto header = (RecordHeader*)record;
+            header->FormatId = formatId;
+            header->Level = level;
+            header->Category = category;
+            header->Timestamp = KeQueryInterruptTime();
+            auto cursor = record + sizeof(RecordHeader);
+            (Encode(cursor, args), ...);
+            // the decoder stops at the first byte that is not an ArgType
+            RtlZeroMemory(cursor, record + size - cursor);
+            Commit(half, header, size);
+            ExReleaseRundownProtection(&rundown);
+        }
+    };
+
+    // The session every trace site writes to
+    auto Default() -> Session&;
+}
+
+#define KL_TRACE(Level, Category, Format, ...) \
+    do { \
+        if constexpr (kl::trace::Enabled(Level, Category)) \
+        { \
+            constexpr auto formatId = kl::trace::FormatId(Format); \
+            kl::trace::Default().Write(Level, Category, formatId, ##__VA_ARGS__); \
+        } \
+    } while (false)
+
+#define LOG_ERROR(Category, Format, ...) KL_TRACE(kl::trace::LevelError, Category, Format, ##__VA_ARGS__)
+#define LOG_WARNING(Category, Format, ...) KL_TRACE(kl::trace::LevelWarning, Category, Format, ##__VA_ARGS__)
+#define LOG_INFO(Category, Format, ...) KL_TRACE(kl::trace::LevelInfo, Category, Format, ##__VA_ARGS__)
+#define LOG_VERBOSE(Category, Format, ...) KL_TRACE(kl::trace::LevelVerbose, Category, Format, ##__VA_ARGS__)
@@ -0,0 +1,85 @@
+#pragma once
+
+// Binary trace format shared by the kernel writer (Trace.h) and the user-mode decoder.
+// This header must stay free of kernel includes.
+
+#include <stdint.h>
+
+namespace kl::trace
+{
+    enum Level : uint8_t
+    {
+        LevelNone = 0,
+        LevelError = 1,
+        LevelWarning = 2,
+        LevelInfo = 3,
+        LevelVerbose = 4,
+    };
+
+    enum class ArgType : uint8_t
+    {
+        Int32 = 1,
+        UInt32 = 2,
+        Int64 = 3,
+        UInt64 = 4,
+        Pointer = 5,
+        AnsiString = 6,     // uint16_t byte count, then the characters
+        WideString = 7,     // uint16_t code unit count, then UTF-16LE code units
+    };
+
+    constexpr uint32_t FileMagic = 'RTLK';     // "KLTR"
+    constexpr uint32_t ChunkMagic = 'HCLK';    // "KLCH"
+    constexpr uint16_t FormatVersion = 1;
+    constexpr uint32_t RecordAlignment = 8;
+    constexpr uint32_t MaxRecordSize = 1024;
+    constexpr uint16_t MaxStringLength = 128;  // longer string arguments are truncated
+
+#pragma pack(push, 1)
+    // Start of a trace file written by `uapp trace dump`
+    struct FileHeader
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t Reserved;
+        uint64_t TimestampFrequency;   // timestamp ticks per second
+    };
+
+    // Records drained from one processor buffer, as returned by the driver
+    struct ChunkHeader
+    {
+        uint32_t Magic;
+        uint16_t Cpu;
+        uint16_t Reserved;
+        uint32_t Bytes;     // size of the records following this header
+        uint32_t Dropped;   // records lost because the buffer was full
+    };
+
+    // Records are RecordAlignment aligned, Size includes the header, the arguments and the padding.
+    // Each argument is an ArgType byte followed by its payload.
+    struct RecordHeader
+    {
+        uint32_t FormatId;
+        uint16_t Size;
+        uint8_t Level;
+        uint8_t Category;   // category bit index
+        uint64_t Timestamp;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(RecordHeader) == 16);
+    static_assert(sizeof(ChunkHeader) == 16);
+
+    // Records carry a hash of their format string instead of the string itself.
+    // The decoder rebuilds the table by hashing the format strings found in the sources.
+    constexpr auto FormatId(const char* format) -> uint32_t
+    {
+        uint32_t hash = 2166136261u;  // FNV-1a
+        for (; *format; ++format)
+        {
+            hash ^= (uint8_t)*format;
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+}
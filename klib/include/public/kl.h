@@ -3,4 +3,8 @@
 #include "../main.h"
 #include "../version.h"
 #include "../Lock.h"
-#include "../FilterFileNameInformation.h"
\ No newline at end of file
+#include "../FilterFileNameInformation.h"
+#include "../Trace.h"
+#include "../Aes.h"
+#include "../TimerWheel.h"
+#include "../TokenBucket.h"
\ No newline at end of file
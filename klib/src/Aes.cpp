@@ -0,0 +1,338 @@
+#include "Aes.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define KL_AES_NI 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define KL_TARGET_AES
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define KL_TARGET_AES __attribute__((target("aes,sse2")))
+#endif
+#else
+#define KL_AES_NI 0
+#endif
+
+namespace
+{
+    constexpr UCHAR SBox[256] = {
+        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+    };
+
+    constexpr auto XTime(ULONG x) -> ULONG
+    {
+        return ((x << 1) ^ ((x & 0x80) ? 0x1b : 0)) & 0xff;
+    }
+
+    // SubBytes and MixColumns of one byte, as a big endian column (2s, s, s, 3s).
+    // The other three positions are byte rotations of it.
+    struct Tables
+    {
+        ULONG Te[256];
+
+        constexpr Tables() : Te{}
+        {
+            for (ULONG i = 0; i < 256; ++i)
+            {
+                ULONG s = SBox[i];
+                Te[i] = (XTime(s) << 24) | (s << 16) | (s << 8) | (XTime(s) ^ s);
+            }
+        }
+    };
+
+    constexpr Tables tables;
+
+    inline auto RotateRight(ULONG x, int n) -> ULONG
+    {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    inline auto LoadBigEndian32(const UCHAR* p) -> ULONG
+    {
+        return ((ULONG)p[0] << 24) | ((ULONG)p[1] << 16) | ((ULONG)p[2] << 8) | p[3];
+    }
+
+    inline void StoreBigEndian32(UCHAR* p, ULONG x)
+    {
+        p[0] = (UCHAR)(x >> 24);
+        p[1] = (UCHAR)(x >> 16);
+        p[2] = (UCHAR)(x >> 8);
+        p[3] = (UCHAR)x;
+    }
+
+    inline auto ByteSwap64(ULONGLONG x) -> ULONGLONG
+    {
+#if defined(_MSC_VER)
+        return _byteswap_uint64(x);
+#else
+        return __builtin_bswap64(x);
+#endif
+    }
+
+    inline auto LoadBigEndian64(const UCHAR* p) -> ULONGLONG
+    {
+        return ((ULONGLONG)LoadBigEndian32(p) << 32) | LoadBigEndian32(p + 4);
+    }
+
+    inline void StoreBigEndian64(UCHAR* p, ULONGLONG x)
+    {
+        StoreBigEndian32(p, (ULONG)(x >> 32));
+        StoreBigEndian32(p + 4, (ULONG)x);
+    }
+
+    inline auto SubWord(ULONG x) -> ULONG
+    {
+        return ((ULONG)SBox[x >> 24] << 24) | ((ULONG)SBox[(x >> 16) & 0xff] << 16) | ((ULONG)SBox[(x >> 8) & 0xff] << 8) | SBox[x & 0xff];
+    }
+
+    // 128 bits big endian counter block
+    struct Counter
+    {
+        ULONGLONG High;
+        ULONGLONG Low;
+
+        Counter(const UCHAR* iv, ULONGLONG block) : High(LoadBigEndian64(iv)), Low(LoadBigEndian64(iv + 8))
+        {
+            Low += block;
+            if (Low < block)
+                ++High;
+        }
+
+        void Increment()
+        {
+            if (++Low == 0)
+                ++High;
+        }
+
+        void Store(UCHAR* block) const
+        {
+            StoreBigEndian64(block, High);
+            StoreBigEndian64(block + 8, Low);
+        }
+    };
+
+    void PortableEncrypt(const UCHAR* roundKeys, ULONG rounds, const UCHAR* in, UCHAR* out)
+    {
+        const auto& Te = tables.Te;
+        auto s0 = LoadBigEndian32(in) ^ LoadBigEndian32(roundKeys);
+        auto s1 = LoadBigEndian32(in + 4) ^ LoadBigEndian32(roundKeys + 4);
+        auto s2 = LoadBigEndian32(in + 8) ^ LoadBigEndian32(roundKeys + 8);
+        auto s3 = LoadBigEndian32(in + 12) ^ LoadBigEndian32(roundKeys + 12);
+        for (ULONG round = 1; round < rounds; ++round)
+        {
+            auto key = roundKeys + round * kl::Aes::BlockSize;
+            auto t0 = Te[s0 >> 24] ^ RotateRight(Te[(s1 >> 16) & 0xff], 8) ^ RotateRight(Te[(s2 >> 8) & 0xff], 16) ^ RotateRight(Te[s3 & 0xff], 24) ^ LoadBigEndian32(key);
+            auto t1 = Te[s1 >> 24] ^ RotateRight(Te[(s2 >> 16) & 0xff], 8) ^ RotateRight(Te[(s3 >> 8) & 0xff], 16) ^ RotateRight(Te[s0 & 0xff], 24) ^ LoadBigEndian32(key + 4);
+            auto t2 = Te[s2 >> 24] ^ RotateRight(Te[(s3 >> 16) & 0xff], 8) ^ RotateRight(Te[(s0 >> 8) & 0xff], 16) ^ RotateRight(Te[s1 & 0xff], 24) ^ LoadBigEndian32(key + 8);
+            auto t3 = Te[s3 >> 24] ^ RotateRight(Te[(s0 >> 16) & 0xff], 8) ^ RotateRight(Te[(s1 >> 8) & 0xff], 16) ^ RotateRight(Te[s2 & 0xff], 24) ^ LoadBigEndian32(key + 12);
+            s0 = t0;
+            s1 = t1;
+            s2 = t2;
+            s3 = t3;
+        }
+
+        // the last round has no MixColumns
+        auto key = roundKeys + rounds * kl::Aes::BlockSize;
+        auto last = [](ULONG a, ULONG b, ULONG c, ULONG d) -> ULONG {
+            return ((ULONG)SBox[a >> 24] << 24) | ((ULONG)SBox[(b >> 16) & 0xff] << 16) | ((ULONG)SBox[(c >> 8) & 0xff] << 8) | SBox[d & 0xff];
+        };
+        StoreBigEndian32(out, last(s0, s1, s2, s3) ^ LoadBigEndian32(key));
+        StoreBigEndian32(out + 4, last(s1, s2, s3, s0) ^ LoadBigEndian32(key + 4));
+        StoreBigEndian32(out + 8, last(s2, s3, s0, s1) ^ LoadBigEndian32(key + 8));
+        StoreBigEndian32(out + 12, last(s3, s0, s1, s2) ^ LoadBigEndian32(key + 12));
+    }
+
+    void PortableCtrBlocks(const UCHAR* roundKeys, ULONG rounds, UCHAR* buffer, SIZE_T blocks, Counter& counter)
+    {
+        UCHAR block[kl::Aes::BlockSize];
+        UCHAR keystream[kl::Aes::BlockSize];
+        for (; blocks > 0; --blocks, buffer += kl::Aes::BlockSize)
+        {
+            counter.Store(block);
+            counter.Increment();
+            PortableEncrypt(roundKeys, rounds, block, keystream);
+            for (ULONG i = 0; i < kl::Aes::BlockSize; ++i)
+                buffer[i] ^= keystream[i];
+        }
+    }
+
+#if KL_AES_NI
+    auto HasAesNi() -> bool
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 25)) != 0;
+#else
+        unsigned int eax, ebx, ecx, edx;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) != 0;
+#endif
+    }
+
+    // The x64 kernel preserves the XMM registers used here, no KeSaveExtendedProcessorState needed
+    KL_TARGET_AES inline auto CounterBlock(Counter& counter) -> __m128i
+    {
+        // bytes 0-7 are High and bytes 8-15 are Low, both big endian
+        auto block = _mm_set_epi64x((LONGLONG)ByteSwap64(counter.Low), (LONGLONG)ByteSwap64(counter.High));
+        counter.Increment();
+        return block;
+    }
+
+    KL_TARGET_AES void AesNiEncrypt(const UCHAR* roundKeys, ULONG rounds, const UCHAR* in, UCHAR* out)
+    {
+        auto keys = (const __m128i*)roundKeys;
+        auto state = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_load_si128(keys));
+        for (ULONG round = 1; round < rounds; ++round)
+            state = _mm_aesenc_si128(state, _mm_load_si128(keys + round));
+
+        _mm_storeu_si128((__m128i*)out, _mm_aesenclast_si128(state, _mm_load_si128(keys + rounds)));
+    }
+
+    KL_TARGET_AES void AesNiCtrBlocks(const UCHAR* roundKeys, ULONG rounds, UCHAR* buffer, SIZE_T blocks, Counter& counter)
+    {
+        constexpr ULONG Lanes = 8;  // enough independent blocks to hide the aesenc latency
+        auto keys = (const __m128i*)roundKeys;
+        for (; blocks >= Lanes; blocks -= Lanes, buffer += Lanes * kl::Aes::BlockSize)
+        {
+            __m128i state[Lanes];
+            for (ULONG lane = 0; lane < Lanes; ++lane)
+                state[lane] = _mm_xor_si128(CounterBlock(counter), _mm_load_si128(keys));
+
+            for (ULONG round = 1; round < rounds; ++round)
+            {
+                auto key = _mm_load_si128(keys + round);
+                for (ULONG lane = 0; lane < Lanes; ++lane)
+                    state[lane] = _mm_aesenc_si128(state[lane], key);
+            }
+
+            auto key = _mm_load_si128(keys + rounds);
+            for (ULONG lane = 0; lane < Lanes; ++lane)
+            {
+                auto data = (__m128i*)(buffer + lane * kl::Aes::BlockSize);
+                _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), _mm_aesenclast_si128(state[lane], key)));
+            }
+        }
+
+        for (; blocks > 0; --blocks, buffer += kl::Aes::BlockSize)
+        {
+            auto state = _mm_xor_si128(CounterBlock(counter), _mm_load_si128(keys));
+            for (ULONG round = 1; round < rounds; ++round)
+                state = _mm_aesenc_si128(state, _mm_load_si128(keys + round));
+
+            auto data = (__m128i*)buffer;
+            _mm_storeu_si128(data, _mm_xor_si128(_mm_loadu_si128(data), _mm_aesenclast_si128(state, _mm_load_si128(keys + rounds))));
+        }
+    }
+#endif
+}
+
+namespace kl
+{
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    [[nodiscard]] auto Aes::Init(_In_reads_bytes_(keySize) const UCHAR* key, ULONG keySize, Implementation implementation) -> NTSTATUS
+    {
+        if (keySize != 16 && keySize != 32)
+            return STATUS_INVALID_PARAMETER;
+
+        // FIPS-197 key expansion, the round keys are kept in byte order as AES-NI wants them
+        ULONG words = keySize / 4;
+        rounds = words + 6;
+        ULONG total = (rounds + 1) * 4;
+        ULONG w[15 * 4];
+        for (ULONG i = 0; i < words; ++i)
+            w[i] = LoadBigEndian32(key + 4 * i);
+
+        ULONG rcon = 1;
+        for (ULONG i = words; i < total; ++i)
+        {
+            auto temp = w[i - 1];
+            if (i % words == 0)
+            {
+                temp = SubWord((temp << 8) | (temp >> 24)) ^ (rcon << 24);
+                rcon = XTime(rcon);
+            }
+            else if (words > 6 && i % words == 4)
+            {
+                temp = SubWord(temp);
+            }
+
+            w[i] = w[i - words] ^ temp;
+        }
+
+        for (ULONG i = 0; i < total; ++i)
+            StoreBigEndian32(roundKeys + 4 * i, w[i]);
+        RtlSecureZeroMemory(w, sizeof(w));
+
+#if KL_AES_NI
+        hardware = implementation == Implementation::Auto && HasAesNi();
+#else
+        UNREFERENCED_PARAMETER(implementation);
+        hardware = false;
+#endif
+        return STATUS_SUCCESS;
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void Aes::EncryptBlock(_In_reads_bytes_(BlockSize) const UCHAR* in, _Out_writes_bytes_(BlockSize) UCHAR* out) const
+    {
+#if KL_AES_NI
+        if (hardware)
+            return AesNiEncrypt(roundKeys, rounds, in, out);
+#endif
+        PortableEncrypt(roundKeys, rounds, in, out);
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    void Aes::Ctr(_Inout_updates_bytes_(size) UCHAR* buffer, SIZE_T size, _In_reads_bytes_(BlockSize) const UCHAR* iv, ULONGLONG offset) const
+    {
+        Counter counter(iv, offset / BlockSize);
+        UCHAR block[BlockSize];
+        UCHAR keystream[BlockSize];
+
+        // leading partial block
+        auto skip = (ULONG)(offset % BlockSize);
+        if (skip && size)
+        {
+            counter.Store(block);
+            counter.Increment();
+            EncryptBlock(block, keystream);
+            for (; skip < BlockSize && size; ++skip, --size)
+                *buffer++ ^= keystream[skip];
+        }
+
+        auto blocks = size / BlockSize;
+#if KL_AES_NI
+        if (hardware)
+            AesNiCtrBlocks(roundKeys, rounds, buffer, blocks, counter);
+        else
+#endif
+            PortableCtrBlocks(roundKeys, rounds, buffer, blocks, counter);
+        buffer += blocks * BlockSize;
+        size -= blocks * BlockSize;
+
+        // trailing partial block
+        if (size)
+        {
+            counter.Store(block);
+            EncryptBlock(block, keystream);
+            for (ULONG i = 0; i < size; ++i)
+                buffer[i] ^= keystream[i];
+        }
+    }
+}
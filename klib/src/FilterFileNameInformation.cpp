@@ -4,7 +4,7 @@ namespace kl
 {
     FilterFileNameInformation::FilterFileNameInformation(PFLT_CALLBACK_DATA data, FileNameOptions options)
     {
-        auto status = FltGetFileNameInformation(data, (FLT_FILE_NAME_OPTIONS)options, &info);
+        status = FltGetFileNameInformation(data, (FLT_FILE_NAME_OPTIONS)options, &info);
         if (!NT_SUCCESS(status))
             info = nullptr;
     }
@@ -20,6 +20,11 @@ namespace kl
         return info != nullptr;
     }
 
+    [[nodiscard]] auto FilterFileNameInformation::Status() const -> NTSTATUS
+    {
+        return status;
+    }
+
     [[nodiscard]] auto FilterFileNameInformation::operator->() -> PFLT_FILE_NAME_INFORMATION const
     {
         return info;
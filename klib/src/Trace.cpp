@@ -0,0 +1,206 @@
+#include "Trace.h"
+
+namespace kl::trace
+{
+    auto Default() -> Session&
+    {
+        static Session session;
+        return session;
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    [[nodiscard]] auto Session::Start(ULONG bytesPerCpu) -> NTSTATUS
+    {
+        if (buffers)
+            return STATUS_SUCCESS;
+
+        halfSize = (bytesPerCpu / 2) & ~(RecordAlignment - 1);
+        if (halfSize < MaxRecordSize)
+            return STATUS_INVALID_PARAMETER;
+
+        // Records are written at any IRQL <= DISPATCH_LEVEL, the buffers must be resident
+        cpuCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        auto cpus = (CpuBuffer*)ExAllocatePoolWithTag(NonPagedPoolNx, cpuCount * sizeof(CpuBuffer), KERNEL_LIB_TAG);
+        if (!cpus)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        RtlZeroMemory(cpus, cpuCount * sizeof(CpuBuffer));
+        auto data = (UCHAR*)ExAllocatePoolWithTag(NonPagedPoolNx, (SIZE_T)cpuCount * 2 * halfSize, KERNEL_LIB_TAG);
+        if (!data)
+        {
+            ExFreePoolWithTag(cpus, KERNEL_LIB_TAG);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        for (ULONG cpu = 0; cpu < cpuCount; ++cpu)
+        {
+            cpus[cpu].Halves[0].Data = data + (SIZE_T)cpu * 2 * halfSize;
+            cpus[cpu].Halves[1].Data = cpus[cpu].Halves[0].Data + halfSize;
+        }
+
+        buffers = cpus;
+        ExReInitializeRundownProtection(&rundown);
+        WriteRelease(&active, TRUE);
+        return STATUS_SUCCESS;
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    void Session::Stop()
+    {
+        if (!buffers)
+            return;
+
+        // A writer can read active just before it is cleared: the rundown refuses the writers that come
+        // after, and waits for the ones holding it, which have committed or dropped their record
+        InterlockedExchange(&active, FALSE);
+        ExWaitForRundownProtectionRelease(&rundown);
+
+        ExFreePoolWithTag(buffers[0].Halves[0].Data, KERNEL_LIB_TAG);
+        ExFreePoolWithTag(buffers, KERNEL_LIB_TAG);
+        buffers = nullptr;
+        cpuCount = 0;
+    }
+
+    [[nodiscard]] auto Session::Reserve(ULONG size, Half*& half) -> UCHAR*
+    {
+        // The processor can change under a passive level caller, the reservation is atomic anyway
+        auto& cpu = buffers[KeGetCurrentProcessorNumberEx(nullptr) % cpuCount];
+        for (;;)
+        {
+            auto index = ReadAcquire(&cpu.Active);
+            half = &cpu.Halves[index];
+            InterlockedIncrement(&half->Writers);
+            if (ReadAcquire(&cpu.Active) != index)
+            {
+                // raced with Drain, retry on the new active half
+                InterlockedDecrement(&half->Writers);
+                continue;
+            }
+
+            for (;;)
+            {
+                auto offset = ReadNoFence(&half->Offset);
+                if (offset + size > halfSize)
+                {
+                    InterlockedIncrement(&half->Dropped);
+                    InterlockedDecrement(&half->Writers);
+                    return nullptr;
+                }
+
+                if (InterlockedCompareExchange(&half->Offset, offset + size, offset) == offset)
+                    return half->Data + offset;
+            }
+        }
+    }
+
+    void Session::Commit(Half* half, RecordHeader* header, ULONG size)
+    {
+        // Size is published last, Drain only reads a half once all its writers have committed
+        WriteRelease16((volatile SHORT*)&header->Size, (SHORT)size);
+        InterlockedDecrement(&half->Writers);
+    }
+
+    _IRQL_requires_max_(APC_LEVEL)
+    [[nodiscard]] auto Session::Drain(_Out_ void* output, ULONG size, _Out_ ULONG* written) -> NTSTATUS
+    {
+        *written = 0;
+        if (!buffers)
+            return STATUS_UNSUCCESSFUL;
+
+        auto out = (UCHAR*)output;
+        for (ULONG cpu = 0; cpu < cpuCount; ++cpu)
+        {
+            auto& buffer = buffers[cpu];
+            auto index = InterlockedExchange(&buffer.Active, buffer.Active ^ 1);
+            auto& half = buffer.Halves[index];
+            while (ReadAcquire(&half.Writers) != 0)
+                YieldProcessor();
+
+            auto used = (ULONG)ReadAcquire(&half.Offset);
+            auto dropped = (ULONG)InterlockedExchange(&half.Dropped, 0);
+            if (used == 0 && dropped == 0)
+                continue;
+
+            // copy whole records, as many as the output can take
+            if (*written + sizeof(ChunkHeader) <= size)
+            {
+                auto room = size - *written - (ULONG)sizeof(ChunkHeader);
+                ULONG copied = 0;
+                while (copied < used)
+                {
+                    auto record = (RecordHeader*)(half.Data + copied);
+                    if (copied + record->Size > room)
+                        break;
+
+                    copied += record->Size;
+                }
+
+                ChunkHeader chunk;
+                chunk.Magic = ChunkMagic;
+                chunk.Cpu = (uint16_t)cpu;
+                chunk.Reserved = 0;
+                chunk.Bytes = copied;
+                chunk.Dropped = dropped + CountRecords(half.Data + copied, used - copied);
+                RtlCopyMemory(out + *written, &chunk, sizeof(chunk));
+                RtlCopyMemory(out + *written + sizeof(chunk), half.Data, copied);
+                *written += (ULONG)sizeof(chunk) + copied;
+            }
+
+            WriteRelease(&half.Offset, 0);
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    auto Session::CountRecords(const UCHAR* data, ULONG size) -> ULONG
+    {
+        ULONG count = 0;
+        for (ULONG offset = 0; offset < size; offset += ((const RecordHeader*)(data + offset))->Size)
+            ++count;
+
+        return count;
+    }
+
+    auto Session::StringLength(const char* value) -> ULONG
+    {
+        auto length = value ? strlen(value) : 0;
+        return (ULONG)(length < MaxStringLength ? length : MaxStringLength);
+    }
+
+    auto Session::StringLength(const WCHAR* value) -> ULONG
+    {
+        auto length = value ? wcslen(value) : 0;
+        return (ULONG)(length < MaxStringLength ? length : MaxStringLength);
+    }
+
+    auto Session::StringLength(PCUNICODE_STRING value) -> ULONG
+    {
+        auto length = value && value->Buffer ? value->Length / sizeof(WCHAR) : 0;
+        return (ULONG)(length < MaxStringLength ? length : MaxStringLength);
+    }
+
+    void Session::EncodeString(UCHAR*& cursor, const char* value)
+    {
+        auto length = (uint16_t)StringLength(value);
+        *cursor++ = (UCHAR)ArgType::AnsiString;
+        RtlCopyMemory(cursor, &length, sizeof(length));
+        cursor += sizeof(length);
+        RtlCopyMemory(cursor, value, length);
+        cursor += length;
+    }
+
+    void Session::EncodeString(UCHAR*& cursor, const WCHAR* value, ULONG length)
+    {
+        auto count = (uint16_t)length;
+        *cursor++ = (UCHAR)ArgType::WideString;
+        RtlCopyMemory(cursor, &count, sizeof(count));
+        cursor += sizeof(count);
+        for (ULONG i = 0; i < length; ++i)
+        {
+            // always UTF-16, whatever the size of WCHAR in this build
+            auto unit = (uint16_t)value[i];
+            RtlCopyMemory(cursor, &unit, sizeof(unit));
+            cursor += sizeof(unit);
+        }
+    }
+}
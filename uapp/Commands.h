@@ -0,0 +1,9 @@
+#pragma once
+
+// uapp sub commands, each gets the arguments following its name
+int TraceMain(int argc, char** argv);
+int KeyMain(int argc, char** argv);
+int ShadowMain(int argc, char** argv);
+int LoadMain(int argc, char** argv);
+int PoolMain(int argc, char** argv);
+int CreateMain(int argc, char** argv);
@@ -0,0 +1,55 @@
+#include "Commands.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fltUser.h>
+#include "Protocol.h"
+
+static int Query()
+{
+    HANDLE port = nullptr;
+    auto hr = FilterConnectCommunicationPort(KAPP_PORT_NAME, 0, nullptr, 0, nullptr, &port);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "cannot connect to the driver (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    KappMessage message = { KappCommandCreateQuery, 0 };
+    KappCreateReport report = {};
+    DWORD returned = 0;
+    hr = FilterSendMessage(port, &message, sizeof(message), &report, sizeof(report), &returned);
+    CloseHandle(port);
+    if (FAILED(hr) || returned < sizeof(report))
+    {
+        fprintf(stderr, "cannot query the create counters (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    printf("opens for writing  %llu\n", (unsigned long long)report.Opens);
+    printf("name queries       %llu\n", (unsigned long long)report.NameQueries);
+    printf("deferred           %llu\n", (unsigned long long)report.Deferred);
+    printf("resolved           %llu\n", (unsigned long long)report.Resolved);
+    printf("avoided            %llu\n", (unsigned long long)report.Avoided);
+    return 0;
+}
+#endif
+
+int CreateMain(int argc, char** argv)
+{
+    (void)argv;
+    if (argc != 0)
+    {
+        fprintf(stderr, "usage: uapp create\n");
+        return 2;
+    }
+
+#ifdef _WIN32
+    return Query();
+#else
+    fprintf(stderr, "uapp create talks to the driver, it runs on Windows\n");
+    return 1;
+#endif
+}
@@ -0,0 +1,178 @@
+#include "Commands.h"
+#include "KeySearch.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// GenerateKey draws the key with RtlRandomEx, whose results are below MAXLONG: the high bit of the
+// key is clear. The seed (the high part of the system time) does not narrow it further, RtlRandomEx
+// also mixes in a table shared by every caller of the system.
+static constexpr uint64_t RtlRandomExKeys = 0x7fffffff;
+
+static int Recover(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr,
+            "usage: uapp key recover <file.lock> [options]\n"
+            "  --signature <name>[,<name>...]  zip, ooxml, pdf, pe, utf16, utf8 (default: all)\n"
+            "  --range <full|rtl|first-last>   keys to try: all of them (default), the RtlRandomEx results, or hex bounds\n"
+            "  --threads <count>               default: one per processor\n"
+            "  --engine <avx2|sse2|scalar>     default: the widest the processor has\n"
+            "  --all                           every matching key instead of the first one\n"
+            "  --out <file>                    write the backup decoded with the key found\n");
+        return 2;
+    }
+
+    std::ifstream stream(argv[0], std::ios::binary);
+    if (!stream)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> backup((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    KeySearchOptions options;
+    std::vector<const Signature*> signatures;
+    const char* out = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (option == "--all")
+        {
+            options.All = true;
+            continue;
+        }
+
+        if (!value)
+        {
+            fprintf(stderr, "%s needs a value\n", option.c_str());
+            return 2;
+        }
+
+        ++i;
+        if (option == "--signature")
+        {
+            std::string names = value;
+            for (size_t start = 0; start <= names.size();)
+            {
+                auto end = std::min(names.find(',', start), names.size());
+                auto name = names.substr(start, end - start);
+                auto found = false;
+                for (const auto& signature : BuiltinSignatures())
+                {
+                    if (signature.Name == name)
+                    {
+                        signatures.push_back(&signature);
+                        found = true;
+                    }
+                }
+
+                if (!found)
+                {
+                    fprintf(stderr, "unknown signature %s\n", name.c_str());
+                    return 2;
+                }
+
+                start = end + 1;
+            }
+        }
+        else if (option == "--range")
+        {
+            std::string range = value;
+            auto dash = range.find('-');
+            if (range == "rtl")
+            {
+                options.Last = RtlRandomExKeys;
+            }
+            else if (dash != std::string::npos)
+            {
+                options.First = strtoull(range.substr(0, dash).c_str(), nullptr, 16);
+                options.Last = strtoull(range.substr(dash + 1).c_str(), nullptr, 16) + 1;
+            }
+            else if (range != "full")
+            {
+                fprintf(stderr, "unknown range %s\n", value);
+                return 2;
+            }
+        }
+        else if (option == "--threads")
+        {
+            options.Threads = (unsigned)atoi(value);
+        }
+        else if (option == "--engine")
+        {
+            options.Vector = !strcmp(value, "avx2") ? KeySearchOptions::Engine::Avx2
+                : !strcmp(value, "sse2") ? KeySearchOptions::Engine::Sse2 : KeySearchOptions::Engine::Scalar;
+        }
+        else if (option == "--out")
+        {
+            out = value;
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", option.c_str());
+            return 2;
+        }
+    }
+
+    if (signatures.empty())
+    {
+        for (const auto& signature : BuiltinSignatures())
+            signatures.push_back(&signature);
+    }
+
+    KeySearch search(backup.data(), backup.size(), signatures);
+    if (!search.Possible())
+    {
+        fprintf(stderr, "%s cannot start with any of the signatures\n", argv[0]);
+        return 1;
+    }
+
+    auto result = search.Run(options);
+    for (const auto& match : result.Matches)
+    {
+        printf("key %02x %02x %02x %02x (0x%08x), signature %s\n", match.Key & 0xff, match.Key >> 8 & 0xff, match.Key >> 16 & 0xff,
+            match.Key >> 24, match.Key, match.Format->Name.c_str());
+    }
+
+    fprintf(stderr, "%llu keys in %.2f s, %.1f Mkeys/s, %u threads, %s\n", (unsigned long long)result.Tested, result.Seconds,
+        result.Seconds > 0 ? result.Tested / result.Seconds / 1e6 : 0.0, result.Threads, result.Engine);
+    if (result.Matches.empty())
+    {
+        fprintf(stderr, "no key found\n");
+        return 1;
+    }
+
+    if (out)
+    {
+        auto plain = DecodeBackup(backup.data(), backup.size(), result.Matches.front().Key);
+        auto file = fopen(out, "wb");
+        if (!file || fwrite(plain.data(), 1, plain.size(), file) != plain.size())
+        {
+            perror(out);
+            if (file)
+                fclose(file);
+            return 1;
+        }
+
+        fclose(file);
+    }
+
+    return 0;
+}
+
+int KeyMain(int argc, char** argv)
+{
+    if (argc >= 1 && !strcmp(argv[0], "recover"))
+        return Recover(argc - 1, argv + 1);
+
+    fprintf(stderr, "usage: uapp key recover ...\n");
+    return 2;
+}
@@ -0,0 +1,382 @@
+#include "KeySearch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define KEY_SEARCH_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define KEY_SEARCH_TARGET_AVX2
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define KEY_SEARCH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define KEY_SEARCH_X64 0
+#endif
+
+namespace
+{
+    using Compiled = KeySearch::Compiled;
+    using Match = KeySearchResult::Match;
+
+    // Keys per work item, a multiple of the block size: the granularity of the early exit
+    constexpr uint64_t ChunkKeys = 1ull << 24;
+
+    // Text probes, the first characters of a file
+    constexpr uint32_t TextBytes = 64;
+
+    auto Bytes(uint32_t offset, const std::string& bytes) -> std::vector<Signature::Probe>
+    {
+        std::vector<Signature::Probe> probes;
+        for (size_t i = 0; i < bytes.size(); ++i)
+            probes.push_back({ offset + (uint32_t)i, (uint8_t)bytes[i], (uint8_t)bytes[i] });
+        return probes;
+    }
+
+    auto Append(std::vector<Signature::Probe> probes, const std::vector<Signature::Probe>& more) -> std::vector<Signature::Probe>
+    {
+        probes.insert(probes.end(), more.begin(), more.end());
+        return probes;
+    }
+
+    auto MakeSignatures() -> std::vector<Signature>
+    {
+        using namespace std::string_literals;
+        // local file header: version needed to extract 1.0 to 6.3
+        auto zip = Append(Bytes(0, "PK\x03\x04"s), { { 4, 0x0a, 0x3f }, { 5, 0, 0 } });
+        // OOXML packages store [Content_Types].xml first
+        auto ooxml = Append(Append(zip, Bytes(26, "\x13\x00"s)), Bytes(30, "[Content_Types].xml"));
+        auto pdf = Append(Bytes(0, "%PDF-1."), { { 7, '0', '9' } });
+        // the DOS header of the linkers: 0x90 bytes on the last page, 3 pages
+        auto pe = Bytes(0, "MZ\x90\x00\x03\x00\x00\x00"s);
+
+        // BOM, then ASCII characters (tab to tilde) with zero high bytes, what scripts/decode.py assumes
+        auto utf16 = Bytes(0, "\xff\xfe");
+        for (uint32_t offset = 2; offset < TextBytes; offset += 2)
+        {
+            utf16.push_back({ offset, 0x09, 0x7e });
+            utf16.push_back({ offset + 1, 0, 0 });
+        }
+
+        std::vector<Signature::Probe> utf8;
+        for (uint32_t offset = 0; offset < TextBytes; ++offset)
+            utf8.push_back({ offset, 0x09, 0x7e });
+
+        return {
+            { "zip", zip },
+            { "ooxml", ooxml },
+            { "pdf", pdf },
+            { "pe", pe },
+            { "utf16", utf16 },
+            { "utf8", utf8 },
+        };
+    }
+
+    auto Compile(const Signature& signature, const uint8_t* backup, size_t size, Compiled& result) -> bool
+    {
+        result = { &signature, 0, 0, {}, {} };
+        uint32_t mask = 0;
+        uint32_t value = 0;
+        std::vector<Compiled::Range> ranges;
+        for (const auto& probe : signature.Probes)
+        {
+            if (probe.Offset >= size)
+                continue;
+
+            // plaintext = key byte ^ backup byte ^ chunk index
+            auto shift = (uint8_t)(8 * (probe.Offset % 7 % 4));
+            auto x = (uint8_t)(backup[probe.Offset] ^ (uint8_t)(probe.Offset / 7 + 1));
+            if (probe.Low != probe.High)
+            {
+                ranges.push_back({ shift, x, probe.Low, (uint8_t)(probe.High - probe.Low) });
+                continue;
+            }
+
+            auto keyByte = (uint32_t)(uint8_t)(x ^ probe.Low) << shift;
+            if ((mask >> shift & 0xff) && (value & 0xffu << shift) != keyByte)
+                return false;
+
+            mask |= 0xffu << shift;
+            value |= keyByte;
+        }
+
+        if (mask == 0 && ranges.empty())
+            return false;
+
+        std::vector<Compiled::Range> low;
+        for (const auto& range : ranges)
+        {
+            // a probe on a pinned key byte is decided once and for all
+            if (mask >> range.Shift & 0xff)
+            {
+                if ((uint8_t)((uint8_t)(value >> range.Shift ^ range.Xor) - range.Low) > range.Span)
+                    return false;
+            }
+            else
+            {
+                (range.Shift == 0 ? low : result.Ranges).push_back(range);
+            }
+        }
+
+        auto any = false;
+        for (uint32_t key = 0; key < 256; ++key)
+        {
+            auto inside = (key & mask & 0xff) == (value & 0xff);
+            for (size_t i = 0; inside && i < low.size(); ++i)
+                inside = (uint8_t)((uint8_t)(key ^ low[i].Xor) - low[i].Low) <= low[i].Span;
+
+            result.LowKeys[key / 64] |= (uint64_t)inside << key % 64;
+            any |= inside;
+        }
+
+        result.Mask = mask & ~0xffu;
+        result.Value = value & ~0xffu;
+        return any;
+    }
+
+    // The probes on the high key bytes of a block, `high` is its first key
+    auto HighMatches(const Compiled& signature, uint32_t high) -> bool
+    {
+        if ((high & signature.Mask) != signature.Value)
+            return false;
+
+        for (const auto& range : signature.Ranges)
+        {
+            if ((uint8_t)((uint8_t)(high >> range.Shift ^ range.Xor) - range.Low) > range.Span)
+                return false;
+        }
+
+        return true;
+    }
+
+    // The keys of a block that passes the high byte probes, within [first, last)
+    void Emit(const Compiled& signature, uint64_t block, uint64_t first, uint64_t last, std::vector<Match>& found)
+    {
+        for (uint32_t low = 0; low < 256; ++low)
+        {
+            auto key = block << 8 | low;
+            if ((signature.LowKeys[low / 64] >> low % 64 & 1) && first <= key && key < last)
+                found.push_back({ (uint32_t)key, signature.Format });
+        }
+    }
+
+    // Each engine tests the keys of [first, last) and appends the matches to `found`
+    using Engine = void (*)(const std::vector<Compiled>&, uint64_t, uint64_t, std::vector<Match>&);
+
+    void SearchScalar(const std::vector<Compiled>& signatures, uint64_t first, uint64_t last, std::vector<Match>& found)
+    {
+        for (auto block = first >> 8; block < (last + 255) >> 8; ++block)
+        {
+            for (const auto& signature : signatures)
+            {
+                if (HighMatches(signature, (uint32_t)(block << 8)))
+                    Emit(signature, block, first, last, found);
+            }
+        }
+    }
+
+#if KEY_SEARCH_X64
+    // 4 blocks per vector, each lane holds the first key of a block. A key byte is at most 255 and the
+    // plaintext minus Low is in [-255, 255], so the 32 bits signed compares do the unsigned byte
+    // compare of HighMatches.
+    void SearchSse2(const std::vector<Compiled>& signatures, uint64_t first, uint64_t last, std::vector<Match>& found)
+    {
+        const auto lanes = _mm_set_epi32(3 << 8, 2 << 8, 1 << 8, 0);
+        const auto byte = _mm_set1_epi32(0xff);
+        const auto negative = _mm_set1_epi32(-1);
+        auto block = first >> 8;
+        auto blocks = (last + 255) >> 8;
+        for (; block + 4 <= blocks; block += 4)
+        {
+            auto keys = _mm_add_epi32(_mm_set1_epi32((int)(uint32_t)(block << 8)), lanes);
+            for (const auto& signature : signatures)
+            {
+                auto alive = _mm_cmpeq_epi32(_mm_and_si128(keys, _mm_set1_epi32((int)signature.Mask)), _mm_set1_epi32((int)signature.Value));
+                for (size_t i = 0; i < signature.Ranges.size() && _mm_movemask_epi8(alive); ++i)
+                {
+                    const auto& range = signature.Ranges[i];
+                    auto plain = _mm_xor_si128(_mm_and_si128(_mm_srl_epi32(keys, _mm_cvtsi32_si128(range.Shift)), byte), _mm_set1_epi32(range.Xor));
+                    auto delta = _mm_sub_epi32(plain, _mm_set1_epi32(range.Low));
+                    auto inside = _mm_andnot_si128(_mm_cmpgt_epi32(delta, _mm_set1_epi32(range.Span)), _mm_cmpgt_epi32(delta, negative));
+                    alive = _mm_and_si128(alive, inside);
+                }
+
+                auto mask = _mm_movemask_ps(_mm_castsi128_ps(alive));
+                for (int lane = 0; mask; ++lane, mask >>= 1)
+                {
+                    if (mask & 1)
+                        Emit(signature, block + lane, first, last, found);
+                }
+            }
+        }
+
+        if (block < blocks)
+            SearchScalar(signatures, std::max(first, block << 8), last, found);
+    }
+
+    // SearchSse2 on 8 blocks per vector
+    KEY_SEARCH_TARGET_AVX2 void SearchAvx2(const std::vector<Compiled>& signatures, uint64_t first, uint64_t last, std::vector<Match>& found)
+    {
+        const auto lanes = _mm256_set_epi32(7 << 8, 6 << 8, 5 << 8, 4 << 8, 3 << 8, 2 << 8, 1 << 8, 0);
+        const auto byte = _mm256_set1_epi32(0xff);
+        const auto negative = _mm256_set1_epi32(-1);
+        auto block = first >> 8;
+        auto blocks = (last + 255) >> 8;
+        for (; block + 8 <= blocks; block += 8)
+        {
+            auto keys = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)(block << 8)), lanes);
+            for (const auto& signature : signatures)
+            {
+                auto alive = _mm256_cmpeq_epi32(_mm256_and_si256(keys, _mm256_set1_epi32((int)signature.Mask)), _mm256_set1_epi32((int)signature.Value));
+                for (size_t i = 0; i < signature.Ranges.size() && _mm256_movemask_epi8(alive); ++i)
+                {
+                    const auto& range = signature.Ranges[i];
+                    auto plain = _mm256_xor_si256(_mm256_and_si256(_mm256_srl_epi32(keys, _mm_cvtsi32_si128(range.Shift)), byte), _mm256_set1_epi32(range.Xor));
+                    auto delta = _mm256_sub_epi32(plain, _mm256_set1_epi32(range.Low));
+                    auto inside = _mm256_andnot_si256(_mm256_cmpgt_epi32(delta, _mm256_set1_epi32(range.Span)), _mm256_cmpgt_epi32(delta, negative));
+                    alive = _mm256_and_si256(alive, inside);
+                }
+
+                auto mask = _mm256_movemask_ps(_mm256_castsi256_ps(alive));
+                for (int lane = 0; mask; ++lane, mask >>= 1)
+                {
+                    if (mask & 1)
+                        Emit(signature, block + lane, first, last, found);
+                }
+            }
+        }
+
+        if (block < blocks)
+            SearchScalar(signatures, std::max(first, block << 8), last, found);
+    }
+
+    auto HasAvx2() -> bool
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        // the OS saves the YMM registers
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    auto SelectEngine(KeySearchOptions::Engine requested, const char** name) -> Engine
+    {
+#if KEY_SEARCH_X64
+        // an engine the processor does not have falls back to SSE2, part of x64
+        if ((requested == KeySearchOptions::Engine::Avx2 || requested == KeySearchOptions::Engine::Auto) && HasAvx2())
+        {
+            *name = "avx2";
+            return SearchAvx2;
+        }
+
+        if (requested != KeySearchOptions::Engine::Scalar)
+        {
+            *name = "sse2";
+            return SearchSse2;
+        }
+#else
+        (void)requested;
+#endif
+        *name = "scalar";
+        return SearchScalar;
+    }
+}
+
+auto BuiltinSignatures() -> const std::vector<Signature>&
+{
+    static const auto signatures = MakeSignatures();
+    return signatures;
+}
+
+KeySearch::KeySearch(const uint8_t* backup, size_t size, const std::vector<const Signature*>& signatures)
+{
+    for (auto signature : signatures)
+    {
+        Compiled signatureProbes;
+        if (Compile(*signature, backup, size, signatureProbes))
+            compiled.push_back(std::move(signatureProbes));
+    }
+}
+
+auto KeySearch::Possible() const -> size_t
+{
+    return compiled.size();
+}
+
+auto KeySearch::Test(uint32_t key) const -> const Signature*
+{
+    for (const auto& signature : compiled)
+    {
+        if (HighMatches(signature, key & ~0xffu) && (signature.LowKeys[(key & 0xff) / 64] >> key % 64 & 1))
+            return signature.Format;
+    }
+
+    return nullptr;
+}
+
+auto KeySearch::Run(const KeySearchOptions& options) const -> KeySearchResult
+{
+    KeySearchResult result;
+    auto engine = SelectEngine(options.Vector, &result.Engine);
+    result.Threads = options.Threads ? options.Threads : std::max(1u, std::thread::hardware_concurrency());
+    auto last = std::min<uint64_t>(options.Last, 1ull << 32);
+    if (compiled.empty() || options.First >= last)
+        return result;
+
+    std::atomic<uint64_t> next{ options.First };
+    std::atomic<uint64_t> tested{ 0 };
+    std::atomic<bool> done{ false };
+    std::mutex lock;
+    auto worker = [&] {
+        std::vector<Match> found;
+        while (!done.load(std::memory_order_relaxed))
+        {
+            auto first = next.fetch_add(ChunkKeys);
+            if (first >= last)
+                break;
+
+            auto end = std::min(first + ChunkKeys, last);
+            engine(compiled, first, end, found);
+            tested += end - first;
+            if (!found.empty() && !options.All)
+                done = true;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        result.Matches.insert(result.Matches.end(), found.begin(), found.end());
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < result.Threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+
+    result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.Tested = tested;
+    std::sort(result.Matches.begin(), result.Matches.end(), [](const Match& a, const Match& b) { return a.Key < b.Key; });
+    return result;
+}
+
+auto DecodeBackup(const uint8_t* backup, size_t size, uint32_t key) -> std::vector<uint8_t>
+{
+    std::vector<uint8_t> plain(backup, backup + size);
+    for (size_t offset = 0; offset < size; ++offset)
+        plain[offset] ^= KeystreamByte(key, offset);
+    return plain;
+}
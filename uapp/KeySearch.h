@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Known plaintext recovery of the 4 bytes key of the XOR backups (XorTransform, kapp/include/Transform.h).
+//
+// A signature lists plaintext bytes a file format starts with, each as a range of values: `PK\3\4`
+// for a ZIP file, ASCII characters with zero high bytes for UTF-16 text. The search tries every key
+// of a range against the signatures on every core, 4 or 8 blocks of 256 keys per instruction (SSE2,
+// AVX2), and stops at the first key that decrypts the probes of a signature to values of their ranges.
+
+// Keystream byte of the backup byte at `offset`, `key` is g_key as a little endian ULONG
+constexpr auto KeystreamByte(uint32_t key, uint64_t offset) -> uint8_t
+{
+    return (uint8_t)(key >> 8 * (offset % 7 % 4)) ^ (uint8_t)(offset / 7 + 1);
+}
+
+struct Signature
+{
+    struct Probe
+    {
+        uint32_t Offset;
+        uint8_t Low;        // the plaintext byte is in [Low, High]
+        uint8_t High;
+    };
+
+    std::string Name;
+    std::vector<Probe> Probes;
+};
+
+// zip, ooxml, pdf, pe, utf16 and utf8 (ASCII compatible text)
+[[nodiscard]] auto BuiltinSignatures() -> const std::vector<Signature>&;
+
+struct KeySearchOptions
+{
+    enum class Engine { Auto, Scalar, Sse2, Avx2 };
+
+    uint64_t First = 0;
+    uint64_t Last = 1ull << 32;     // excluded
+    unsigned Threads = 0;           // 0 for one per processor
+    bool All = false;               // every matching key instead of the first one
+    Engine Vector = Engine::Auto;
+};
+
+struct KeySearchResult
+{
+    struct Match
+    {
+        uint32_t Key;
+        const Signature* Format;
+    };
+
+    std::vector<Match> Matches;     // by key
+    uint64_t Tested = 0;
+    double Seconds = 0;
+    unsigned Threads = 0;
+    const char* Engine = "";
+};
+
+class KeySearch
+{
+public:
+    // The signature probes past the end of the backup are ignored
+    KeySearch(const uint8_t* backup, size_t size, const std::vector<const Signature*>& signatures);
+
+    [[nodiscard]] auto Run(const KeySearchOptions& options) const -> KeySearchResult;
+
+    // Scalar reference of the vector engines
+    [[nodiscard]] auto Test(uint32_t key) const -> const Signature*;
+
+    // Whether a signature can match at all: probes that pin the same key byte may disagree
+    [[nodiscard]] auto Possible() const -> size_t;
+
+    // Probes of a signature, compiled against the backup. Keys are tried by blocks of 256 that share
+    // their high bytes: the low key bytes that pass the probes on it are a set computed once, the
+    // engines only test the high bytes, the key bytes pinned by equal probes (Mask, Value) first.
+    struct Compiled
+    {
+        struct Range
+        {
+            uint8_t Shift;      // of the key byte
+            uint8_t Xor;        // backup byte ^ chunk index
+            uint8_t Low;
+            uint8_t Span;       // High - Low
+        };
+
+        const Signature* Format;
+        uint32_t Mask;          // high bytes only
+        uint32_t Value;
+        std::vector<Range> Ranges;
+        uint64_t LowKeys[4];    // bit set of the low key bytes
+    };
+
+private:
+    std::vector<Compiled> compiled;
+};
+
+// Backup to plaintext, the transform is its own inverse
+[[nodiscard]] auto DecodeBackup(const uint8_t* backup, size_t size, uint32_t key) -> std::vector<uint8_t>;
@@ -0,0 +1,166 @@
+#include "Commands.h"
+#include "Workload.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#ifdef _WIN32
+static const char* const Platform = "windows";
+#else
+static const char* const Platform = "linux";
+#endif
+
+// Paths in JSON strings, Windows ones have backslashes
+static auto Escape(const std::string& text) -> std::string
+{
+    std::string escaped;
+    for (auto c : text)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+static void PrintLatency(const char* name, const LatencyHistogram& histogram)
+{
+    printf("%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long long)histogram.Count(), histogram.Mean() / 1000,
+        histogram.Percentile(0.50) / 1000.0, histogram.Percentile(0.99) / 1000.0, histogram.Percentile(0.999) / 1000.0, histogram.Max() / 1000.0);
+}
+
+static void WriteLatency(FILE* out, const char* name, const LatencyHistogram& histogram, bool last)
+{
+    fprintf(out, "    \"%s\": {\"count\": %llu, \"mean_ns\": %.1f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+        name, (unsigned long long)histogram.Count(), histogram.Mean(), (unsigned long long)histogram.Percentile(0.50),
+        (unsigned long long)histogram.Percentile(0.99), (unsigned long long)histogram.Percentile(0.999),
+        (unsigned long long)histogram.Max(), last ? "" : ",");
+}
+
+// Same layout on both platforms, so that a Linux baseline and a run against the filter compare field by field
+static auto WriteJson(const char* path, const char* specName, const std::string& root, const WorkloadSpec& spec, const WorkloadResult& result) -> bool
+{
+    auto out = fopen(path, "w");
+    if (!out)
+        return false;
+
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"platform\": \"%s\",\n", Platform);
+    fprintf(out, "    \"spec\": \"%s\",\n", Escape(specName).c_str());
+    fprintf(out, "    \"root\": \"%s\",\n", Escape(root).c_str());
+    fprintf(out, "    \"threads\": %u,\n    \"files\": %u,\n    \"directories\": %u,\n", spec.Threads, spec.Files, spec.Directories);
+    fprintf(out, "    \"writes_per_session\": %u,\n    \"write_size\": %u,\n    \"think_ms\": %.3f\n", spec.Writes, spec.WriteSize, spec.ThinkMs);
+    fprintf(out, "  },\n  \"results\": {\n");
+    fprintf(out, "    \"seconds\": %.3f,\n    \"sessions\": %llu,\n", result.Seconds, (unsigned long long)result.Sessions);
+    for (unsigned kind = 0; kind < WorkloadSpec::Kinds; ++kind)
+        fprintf(out, "    \"sessions_%s\": %llu,\n", KindName(kind), (unsigned long long)result.SessionsByKind[kind]);
+    fprintf(out, "    \"writes\": %llu,\n    \"bytes\": %llu,\n    \"created\": %llu,\n    \"errors\": %llu,\n",
+        (unsigned long long)result.Writes, (unsigned long long)result.Bytes, (unsigned long long)result.Created, (unsigned long long)result.Errors);
+    fprintf(out, "    \"sessions_per_second\": %.1f,\n    \"writes_per_second\": %.1f,\n    \"bytes_per_second\": %.1f,\n",
+        result.Sessions / result.Seconds, result.Writes / result.Seconds, result.Bytes / result.Seconds);
+    WriteLatency(out, "open", result.Open, false);
+    WriteLatency(out, "first_write", result.FirstWrite, false);
+    WriteLatency(out, "write", result.Write, false);
+    WriteLatency(out, "close", result.Close, true);
+    fprintf(out, "  }\n}\n");
+    return fclose(out) == 0;
+}
+
+int LoadMain(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr,
+            "usage: uapp load <spec> [options]\n"
+            "  --root <directory>    where the files are created (default: loadgen)\n"
+            "  --threads <count>     overrides the spec\n"
+            "  --duration <seconds>  overrides the spec\n"
+            "  --json <file>         write the results as JSON\n"
+            "  --keep                leave the files in place\n"
+            "the spec format is described in uapp/Workload.h, examples are in scripts/load/\n");
+        return 2;
+    }
+
+    std::ifstream stream(argv[0]);
+    if (!stream)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[0]);
+        return 1;
+    }
+
+    WorkloadSpec spec;
+    std::string error;
+    if (!ParseWorkload(std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>()), spec, error))
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+        return 2;
+    }
+
+    std::string root = "loadgen";
+    const char* json = nullptr;
+    auto keep = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (option == "--keep")
+        {
+            keep = true;
+            continue;
+        }
+
+        if (!value)
+        {
+            fprintf(stderr, "%s needs a value\n", option.c_str());
+            return 2;
+        }
+
+        ++i;
+        if (option == "--root")
+            root = value;
+        else if (option == "--threads")
+            spec.Threads = (unsigned)std::max(1, atoi(value));
+        else if (option == "--duration")
+            spec.Duration = atof(value);
+        else if (option == "--json")
+            json = value;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", option.c_str());
+            return 2;
+        }
+    }
+
+    fprintf(stderr, "%s: %u threads, %u files in %u directories under %s, %.0f seconds\n",
+        argv[0], spec.Threads, spec.Files, spec.Directories, root.c_str(), spec.Duration);
+    WorkloadResult result;
+    if (!RunWorkload(spec, root, keep, result, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    printf("%s, %.1f s: %llu sessions (%.0f/s), %llu writes (%.0f/s), %.1f MiB/s, %llu files recreated, %llu errors\n",
+        Platform, result.Seconds, (unsigned long long)result.Sessions, result.Sessions / result.Seconds,
+        (unsigned long long)result.Writes, result.Writes / result.Seconds, result.Bytes / result.Seconds / (1 << 20),
+        (unsigned long long)result.Created, (unsigned long long)result.Errors);
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "us", "count", "mean", "p50", "p99", "p999", "max");
+    PrintLatency("open", result.Open);
+    PrintLatency("first_write", result.FirstWrite);
+    PrintLatency("write", result.Write);
+    PrintLatency("close", result.Close);
+
+    if (json && !WriteJson(json, argv[0], root, spec, result))
+    {
+        fprintf(stderr, "cannot write %s\n", json);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "Commands.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fltUser.h>
+#include "Protocol.h"
+
+static int Query(bool resetPeaks)
+{
+    HANDLE port = nullptr;
+    auto hr = FilterConnectCommunicationPort(KAPP_PORT_NAME, 0, nullptr, 0, nullptr, &port);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "cannot connect to the driver (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    KappPoolQueryMessage message = { { KappCommandPoolQuery, 0 }, resetPeaks ? 1u : 0u, 0 };
+    KappPoolReport report = {};
+    DWORD returned = 0;
+    hr = FilterSendMessage(port, &message, sizeof(message), &report, sizeof(report), &returned);
+    CloseHandle(port);
+    if (FAILED(hr) || returned < sizeof(report))
+    {
+        fprintf(stderr, "cannot query the pool usage (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    // in the order of KappPoolSubsystem
+    static const char* const names[KappPoolSubsystems] = { "create", "copy", "session", "process", "prebackup", "shadow", "port", "volume" };
+    printf("%-10s %12s %12s %14s %10s %10s %12s\n", "subsystem", "bytes", "peak", "total", "blocks", "peak", "total");
+    KappPoolCounters sum = {};
+    for (uint32_t i = 0; i < KappPoolSubsystems && i < report.Subsystems; ++i)
+    {
+        const auto& counters = report.Counters[i];
+        printf("%-10s %12llu %12llu %14llu %10llu %10llu %12llu\n", names[i], (unsigned long long)counters.Bytes,
+            (unsigned long long)counters.PeakBytes, (unsigned long long)counters.TotalBytes, (unsigned long long)counters.Blocks,
+            (unsigned long long)counters.PeakBlocks, (unsigned long long)counters.TotalBlocks);
+        sum.Bytes += counters.Bytes;
+        sum.Blocks += counters.Blocks;
+    }
+
+    // the peaks of the subsystems are not reached at the same time, they do not add up
+    printf("%-10s %12llu %12s %14s %10llu\n", "all", (unsigned long long)sum.Bytes, "", "", (unsigned long long)sum.Blocks);
+    return 0;
+}
+#endif
+
+int PoolMain(int argc, char** argv)
+{
+    auto resetPeaks = argc >= 1 && !strcmp(argv[0], "--reset-peaks");
+    if (argc > 1 || (argc == 1 && !resetPeaks))
+    {
+        fprintf(stderr, "usage: uapp pool [--reset-peaks]\n");
+        return 2;
+    }
+
+#ifdef _WIN32
+    return Query(resetPeaks);
+#else
+    fprintf(stderr, "uapp pool talks to the driver, it runs on Windows\n");
+    return 1;
+#endif
+}
@@ -0,0 +1,106 @@
+#include "Commands.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fltUser.h>
+#include "Protocol.h"
+
+static auto Connect(HANDLE* port) -> bool
+{
+    auto hr = FilterConnectCommunicationPort(KAPP_PORT_NAME, 0, nullptr, 0, nullptr, port);
+    if (FAILED(hr))
+        fprintf(stderr, "cannot connect to the driver (0x%08lx)\n", hr);
+    return SUCCEEDED(hr);
+}
+
+static int Set(uint32_t mode, bool reset)
+{
+    HANDLE port = nullptr;
+    if (!Connect(&port))
+        return 1;
+
+    KappShadowSetMessage message = { { KappCommandShadowSet, 0 }, mode, reset ? 1u : 0u };
+    DWORD returned = 0;
+    auto hr = FilterSendMessage(port, &message, sizeof(message), nullptr, 0, &returned);
+    CloseHandle(port);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "cannot set the shadow mode (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int Stats()
+{
+    HANDLE port = nullptr;
+    if (!Connect(&port))
+        return 1;
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    KappMessage message = { KappCommandShadowQuery, 0 };
+    DWORD returned = 0;
+    auto hr = FilterSendMessage(port, &message, sizeof(message), buffer.data(), (DWORD)buffer.size(), &returned);
+    CloseHandle(port);
+    if (FAILED(hr) || returned < sizeof(KappShadowReport))
+    {
+        fprintf(stderr, "cannot query the shadow statistics (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    static const char* const modes[] = { "off", "estimate", "read" };
+    auto report = (const KappShadowReport*)buffer.data();
+    printf("mode %s, %u directories, %llu files dropped\n", report->Mode < 3 ? modes[report->Mode] : "?",
+        report->Directories, (unsigned long long)report->Dropped);
+    printf("%12s %12s %16s %12s %12s  %s\n", "files", "current", "bytes", "mean_us", "max_us", "directory");
+
+    size_t offset = sizeof(KappShadowReport);
+    for (uint32_t i = 0; i < report->Records && offset + sizeof(KappShadowDirectory) <= returned; ++i)
+    {
+        auto record = (const KappShadowDirectory*)(buffer.data() + offset);
+        if (record->Size < sizeof(KappShadowDirectory) + record->NameLength || offset + record->Size > returned)
+            break;
+
+        auto decided = record->Files + record->Current;
+        printf("%12llu %12llu %16llu %12.1f %12.1f  %.*ls\n", (unsigned long long)record->Files, (unsigned long long)record->Current,
+            (unsigned long long)record->Bytes, decided ? record->Latency / 10.0 / decided : 0.0, record->LatencyMax / 10.0,
+            (int)(record->NameLength / sizeof(wchar_t)), (const wchar_t*)(record + 1));
+        offset += record->Size;
+    }
+
+    if (report->Records < report->Directories)
+        fprintf(stderr, "%u directories did not fit\n", report->Directories - report->Records);
+    return 0;
+}
+#endif
+
+int ShadowMain(int argc, char** argv)
+{
+#ifdef _WIN32
+    if (argc >= 1 && !strcmp(argv[0], "stats"))
+        return Stats();
+
+    static const char* const modes[] = { "off", "estimate", "read" };
+    for (uint32_t mode = 0; argc >= 1 && mode < 3; ++mode)
+    {
+        if (!strcmp(argv[0], modes[mode]))
+            return Set(mode, argc > 1 && !strcmp(argv[1], "--reset"));
+    }
+#else
+    (void)argv;
+    if (argc >= 1)
+    {
+        fprintf(stderr, "uapp shadow talks to the driver, it runs on Windows\n");
+        return 1;
+    }
+#endif
+
+    fprintf(stderr, "usage: uapp shadow <off|estimate|read> [--reset]\n"
+        "       uapp shadow stats\n");
+    return 2;
+}
@@ -0,0 +1,118 @@
+#include "Commands.h"
+#include "TraceDecoder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fltUser.h>
+#include "Protocol.h"
+#endif
+
+static int Decode(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: uapp trace decode <file> <source>...\n");
+        return 2;
+    }
+
+    std::ifstream stream(argv[0], std::ios::binary);
+    if (!stream)
+    {
+        fprintf(stderr, "cannot open %s\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    TraceDecoder decoder;
+    for (int i = 1; i < argc; ++i)
+        decoder.LoadSources(argv[i]);
+
+    std::vector<TraceDecoder::Event> events;
+    std::string error;
+    if (!decoder.Parse(data.data(), data.size(), events, error))
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+        return 1;
+    }
+
+    auto origin = events.empty() ? 0 : events.front().Header->Timestamp;
+    for (const auto& event : events)
+        puts(decoder.FormatLine(event, origin).c_str());
+
+    fprintf(stderr, "%zu records, %llu dropped, %zu known formats\n", events.size(), (unsigned long long)decoder.Dropped(), decoder.Formats());
+    return 0;
+}
+
+#ifdef _WIN32
+static int Dump(int argc, char** argv)
+{
+    if (argc < 1)
+    {
+        fprintf(stderr, "usage: uapp trace dump <file> [seconds]\n");
+        return 2;
+    }
+
+    auto seconds = argc > 1 ? atoi(argv[1]) : 10;
+    HANDLE port = nullptr;
+    auto hr = FilterConnectCommunicationPort(KAPP_PORT_NAME, 0, nullptr, 0, nullptr, &port);
+    if (FAILED(hr))
+    {
+        fprintf(stderr, "cannot connect to the driver (0x%08lx)\n", hr);
+        return 1;
+    }
+
+    auto file = fopen(argv[0], "wb");
+    if (!file)
+    {
+        CloseHandle(port);
+        perror(argv[0]);
+        return 1;
+    }
+
+    kl::trace::FileHeader header = { kl::trace::FileMagic, kl::trace::FormatVersion, 0, 10000000 };
+    fwrite(&header, sizeof(header), 1, file);
+
+    std::vector<uint8_t> buffer(1024 * 1024);
+    KappMessage message = { KappCommandTraceDrain, 0 };
+    unsigned long long total = 0;
+    for (int tick = 0; tick <= seconds * 4; ++tick)
+    {
+        DWORD returned = 0;
+        hr = FilterSendMessage(port, &message, sizeof(message), buffer.data(), (DWORD)buffer.size(), &returned);
+        if (FAILED(hr))
+        {
+            fprintf(stderr, "drain failed (0x%08lx)\n", hr);
+            break;
+        }
+
+        fwrite(buffer.data(), 1, returned, file);
+        total += returned;
+        Sleep(250);
+    }
+
+    fclose(file);
+    CloseHandle(port);
+    fprintf(stderr, "%llu bytes written to %s\n", total, argv[0]);
+    return 0;
+}
+#endif
+
+int TraceMain(int argc, char** argv)
+{
+    if (argc >= 1 && !strcmp(argv[0], "decode"))
+        return Decode(argc - 1, argv + 1);
+
+#ifdef _WIN32
+    if (argc >= 1 && !strcmp(argv[0], "dump"))
+        return Dump(argc - 1, argv + 1);
+#endif
+
+    fprintf(stderr, "usage: uapp trace <dump|decode> ...\n");
+    return 2;
+}
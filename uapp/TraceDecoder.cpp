@@ -0,0 +1,433 @@
+#include "TraceDecoder.h"
+#include "TraceCategories.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <regex>
+
+using namespace kl::trace;
+
+namespace
+{
+    template <typename T>
+    auto Read(const uint8_t* p) -> T
+    {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void AppendUtf8(std::string& out, uint32_t code)
+    {
+        if (code < 0x80)
+            out += (char)code;
+        else if (code < 0x800)
+        {
+            out += (char)(0xc0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000)
+        {
+            out += (char)(0xe0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+        else
+        {
+            out += (char)(0xf0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3f));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+    }
+
+    struct Arg
+    {
+        ArgType Type;
+        uint64_t Value;
+        std::string Text;   // strings, converted to UTF-8
+    };
+
+    auto DecodeArgs(const RecordHeader* header, std::vector<Arg>& args) -> bool
+    {
+        auto p = (const uint8_t*)(header + 1);
+        auto end = (const uint8_t*)header + header->Size;
+        while (p < end)
+        {
+            Arg arg = { (ArgType)*p++, 0, {} };
+            switch (arg.Type)
+            {
+            case ArgType::Int32:
+                if (end - p < 4) return false;
+                arg.Value = (uint64_t)(int64_t)Read<int32_t>(p);
+                p += 4;
+                break;
+            case ArgType::UInt32:
+                if (end - p < 4) return false;
+                arg.Value = Read<uint32_t>(p);
+                p += 4;
+                break;
+            case ArgType::Int64:
+            case ArgType::UInt64:
+            case ArgType::Pointer:
+                if (end - p < 8) return false;
+                arg.Value = Read<uint64_t>(p);
+                p += 8;
+                break;
+            case ArgType::AnsiString:
+            {
+                if (end - p < 2) return false;
+                auto length = Read<uint16_t>(p);
+                p += 2;
+                if (end - p < length) return false;
+                arg.Text.assign((const char*)p, length);
+                p += length;
+                break;
+            }
+            case ArgType::WideString:
+            {
+                if (end - p < 2) return false;
+                auto count = Read<uint16_t>(p);
+                p += 2;
+                if (end - p < count * 2) return false;
+                for (uint16_t i = 0; i < count; ++i)
+                {
+                    uint32_t unit = Read<uint16_t>(p + 2 * i);
+                    if (unit >= 0xd800 && unit < 0xdc00 && i + 1 < count)
+                    {
+                        uint32_t low = Read<uint16_t>(p + 2 * (i + 1));
+                        if (low >= 0xdc00 && low < 0xe000)
+                        {
+                            unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                            ++i;
+                        }
+                    }
+
+                    AppendUtf8(arg.Text, unit);
+                }
+                p += count * 2;
+                break;
+            }
+            default:
+                // padding up to the record alignment
+                return true;
+            }
+
+            args.push_back(std::move(arg));
+        }
+
+        return true;
+    }
+
+    auto IsSigned(ArgType type) -> bool
+    {
+        return type == ArgType::Int32 || type == ArgType::Int64;
+    }
+
+    auto IsString(ArgType type) -> bool
+    {
+        return type == ArgType::AnsiString || type == ArgType::WideString;
+    }
+
+    auto RawArg(const Arg& arg) -> std::string
+    {
+        if (IsString(arg.Type))
+            return "\"" + arg.Text + "\"";
+
+        char text[32];
+        if (IsSigned(arg.Type))
+            snprintf(text, sizeof(text), "%lld", (long long)arg.Value);
+        else
+            snprintf(text, sizeof(text), "0x%llx", (unsigned long long)arg.Value);
+        return text;
+    }
+
+    // printf as the driver would have printed it, with the DbgPrint extensions (%wZ, %ws, %S)
+    auto Render(const std::string& format, const std::vector<Arg>& args) -> std::string
+    {
+        std::string out;
+        size_t next = 0;
+        for (size_t i = 0; i < format.size(); ++i)
+        {
+            if (format[i] != '%')
+            {
+                out += format[i];
+                continue;
+            }
+
+            if (i + 1 < format.size() && format[i + 1] == '%')
+            {
+                out += '%';
+                ++i;
+                continue;
+            }
+
+            // %[flags][width][.precision][length]conversion
+            auto start = i++;
+            std::string spec = "%";
+            while (i < format.size() && strchr("-+ #0", format[i]))
+                spec += format[i++];
+            while (i < format.size() && (isdigit((unsigned char)format[i]) || format[i] == '.'))
+                spec += format[i++];
+
+            // length modifiers do not matter, the record carries the argument size
+            while (i < format.size() && strchr("hlwzjtIL6432", format[i]))
+                ++i;
+
+            if (i >= format.size())
+            {
+                out += format.substr(start);
+                break;
+            }
+
+            auto conversion = format[i];
+            if (next >= args.size())
+            {
+                out += "<missing>";
+                continue;
+            }
+
+            const auto& arg = args[next++];
+            char text[64];
+            switch (conversion)
+            {
+            case 'd':
+            case 'i':
+                if (IsString(arg.Type))
+                    out += RawArg(arg);
+                else
+                {
+                    // 32 bits values are printed as the int they were
+                    auto value = arg.Type == ArgType::UInt32 ? (long long)(int32_t)arg.Value : (long long)arg.Value;
+                    snprintf(text, sizeof(text), (spec + "lld").c_str(), value);
+                    out += text;
+                }
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            {
+                if (IsString(arg.Type))
+                {
+                    out += RawArg(arg);
+                    break;
+                }
+
+                auto value = arg.Value;
+                if (arg.Type == ArgType::Int32)
+                    value = (uint32_t)value;
+                snprintf(text, sizeof(text), (spec + "ll" + conversion).c_str(), (unsigned long long)value);
+                out += text;
+                break;
+            }
+            case 'c':
+                out += (char)arg.Value;
+                break;
+            case 'p':
+                snprintf(text, sizeof(text), "%016llX", (unsigned long long)arg.Value);
+                out += text;
+                break;
+            case 's':
+            case 'S':
+            case 'Z':
+                out += IsString(arg.Type) ? arg.Text : RawArg(arg);
+                break;
+            default:
+                out += format.substr(start, i - start + 1);
+                break;
+            }
+        }
+
+        return out;
+    }
+
+    auto Unescape(const std::string& literal) -> std::string
+    {
+        std::string out;
+        for (size_t i = 0; i < literal.size(); ++i)
+        {
+            if (literal[i] != '\\' || i + 1 == literal.size())
+            {
+                out += literal[i];
+                continue;
+            }
+
+            switch (literal[++i])
+            {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case '0': out += '\0'; break;
+            default: out += literal[i]; break;
+            }
+        }
+
+        return out;
+    }
+}
+
+void TraceDecoder::AddFormat(const std::string& format)
+{
+    formats[FormatId(format.c_str())] = format;
+}
+
+auto TraceDecoder::ScanSource(const std::string& text) -> size_t
+{
+    static const std::regex site(R"(\b(LOG_ERROR|LOG_WARNING|LOG_INFO|LOG_VERBOSE|KL_TRACE)\s*\()");
+    size_t found = 0;
+    for (auto it = std::sregex_iterator(text.begin(), text.end(), site); it != std::sregex_iterator(); ++it)
+    {
+        // the format is the first string literal among the macro arguments
+        auto i = (size_t)(it->position() + it->length());
+        int depth = 1;
+        std::string format;
+        bool inFormat = false;
+        for (; i < text.size() && depth > 0; ++i)
+        {
+            auto c = text[i];
+            if (c == '"')
+            {
+                auto end = i + 1;
+                while (end < text.size() && text[end] != '"')
+                    end += text[end] == '\\' ? 2 : 1;
+
+                if (depth == 1 && (format.empty() || inFormat))
+                {
+                    format += Unescape(text.substr(i + 1, end - i - 1));
+                    inFormat = true;
+                }
+
+                i = end;
+                continue;
+            }
+
+            if (c == '(')
+                ++depth;
+            else if (c == ')')
+                --depth;
+            else if (!isspace((unsigned char)c) && inFormat)
+                break;   // adjacent literals are concatenated, anything else ends the format
+        }
+
+        if (inFormat)
+        {
+            AddFormat(format);
+            ++found;
+        }
+    }
+
+    return found;
+}
+
+auto TraceDecoder::LoadSources(const std::filesystem::path& path) -> size_t
+{
+    auto load = [this](const std::filesystem::path& file) -> size_t {
+        std::ifstream stream(file, std::ios::binary);
+        std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        return ScanSource(text);
+    };
+
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error))
+        return load(path);
+
+    size_t found = 0;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(path, error))
+    {
+        auto extension = entry.path().extension();
+        if (entry.is_regular_file() && (extension == ".cpp" || extension == ".c" || extension == ".h"))
+            found += load(entry.path());
+    }
+
+    return found;
+}
+
+[[nodiscard]] auto TraceDecoder::Parse(const uint8_t* data, size_t size, std::vector<Event>& events, std::string& error) -> bool
+{
+    size_t offset = 0;
+    if (size >= sizeof(FileHeader) && Read<uint32_t>(data) == FileMagic)
+    {
+        auto header = Read<FileHeader>(data);
+        if (header.Version != FormatVersion)
+        {
+            error = "unsupported trace version " + std::to_string(header.Version);
+            return false;
+        }
+
+        if (header.TimestampFrequency)
+            frequency = header.TimestampFrequency;
+        offset = sizeof(FileHeader);
+    }
+
+    while (offset < size)
+    {
+        if (size - offset < sizeof(ChunkHeader))
+        {
+            error = "truncated chunk header at offset " + std::to_string(offset);
+            return false;
+        }
+
+        auto chunk = Read<ChunkHeader>(data + offset);
+        offset += sizeof(ChunkHeader);
+        if (chunk.Magic != ChunkMagic || chunk.Bytes > size - offset)
+        {
+            error = "invalid chunk at offset " + std::to_string(offset - sizeof(ChunkHeader));
+            return false;
+        }
+
+        dropped += chunk.Dropped;
+        for (size_t position = 0; position < chunk.Bytes;)
+        {
+            auto header = (const RecordHeader*)(data + offset + position);
+            if (chunk.Bytes - position < sizeof(RecordHeader) || header->Size < sizeof(RecordHeader) || header->Size > chunk.Bytes - position)
+            {
+                error = "invalid record at offset " + std::to_string(offset + position);
+                return false;
+            }
+
+            events.push_back({ chunk.Cpu, header });
+            position += header->Size;
+        }
+
+        offset += chunk.Bytes;
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.Header->Timestamp < b.Header->Timestamp; });
+    return true;
+}
+
+[[nodiscard]] auto TraceDecoder::Format(const Event& event) const -> std::string
+{
+    std::vector<Arg> args;
+    if (!DecodeArgs(event.Header, args))
+        return "<corrupted record>";
+
+    auto format = formats.find(event.Header->FormatId);
+    if (format != formats.end())
+        return Render(format->second, args);
+
+    char text[48];
+    snprintf(text, sizeof(text), "<unknown format %08x>", event.Header->FormatId);
+    std::string out = text;
+    for (const auto& arg : args)
+        out += " " + RawArg(arg);
+    return out;
+}
+
+[[nodiscard]] auto TraceDecoder::FormatLine(const Event& event, uint64_t origin) const -> std::string
+{
+    static const char* levels[] = { "NONE", "ERROR", "WARN", "INFO", "VERBOSE" };
+    auto level = event.Header->Level < std::size(levels) ? levels[event.Header->Level] : "?";
+    auto category = event.Header->Category < std::size(TraceCategoryNames) ? TraceCategoryNames[event.Header->Category] : "?";
+    auto ticks = event.Header->Timestamp - origin;
+
+    char prefix[96];
+    snprintf(prefix, sizeof(prefix), "[%6llu.%06llu] cpu%-3u %-7s %-8s ",
+        (unsigned long long)(ticks / frequency), (unsigned long long)(ticks % frequency * 1000000 / frequency),
+        event.Cpu, level, category);
+    return prefix + Format(event);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "TraceFormat.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Offline decoder for the binary traces written by kl::trace::Session.
+// Records only carry a hash of their format string: the format table is rebuilt
+// by scanning the driver sources for trace sites (LOG_ERROR, LOG_INFO, ...).
+class TraceDecoder
+{
+public:
+    struct Event
+    {
+        uint16_t Cpu;
+        const kl::trace::RecordHeader* Header;   // points into the buffer given to Parse
+    };
+
+    // Registers the format strings of the trace sites in a source file, or in every
+    // .c/.cpp/.h file below a directory. Returns the number of formats found.
+    auto LoadSources(const std::filesystem::path& path) -> size_t;
+    void AddFormat(const std::string& format);
+
+    // Splits a trace (an optional FileHeader followed by chunks) into events sorted by timestamp.
+    // The events point into `data`, which must outlive them.
+    [[nodiscard]] auto Parse(const uint8_t* data, size_t size, std::vector<Event>& events, std::string& error) -> bool;
+
+    // Renders the record with its format string, or its raw arguments when the format is unknown
+    [[nodiscard]] auto Format(const Event& event) const -> std::string;
+
+    // Renders a whole event line: relative time, processor, level, category and message
+    [[nodiscard]] auto FormatLine(const Event& event, uint64_t origin) const -> std::string;
+
+    [[nodiscard]] auto Dropped() const -> uint64_t
+    {
+        return dropped;
+    }
+
+    [[nodiscard]] auto Formats() const -> size_t
+    {
+        return formats.size();
+    }
+
+private:
+    auto ScanSource(const std::string& text) -> size_t;
+
+    std::unordered_map<uint32_t, std::string> formats;
+    uint64_t frequency = 10000000;  // 100ns interrupt time ticks
+    uint64_t dropped = 0;
+};
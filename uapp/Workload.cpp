@@ -0,0 +1,562 @@
+#include "Workload.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+    const char* const KindNames[WorkloadSpec::Kinds] = { "append", "overwrite", "rewrite", "truncate" };
+
+#ifdef _WIN32
+    // Win32 handles: the filter sees the creates and writes of an application
+    class File
+    {
+        HANDLE handle = INVALID_HANDLE_VALUE;
+
+    public:
+        ~File()
+        {
+            Close();
+        }
+
+        // A new file is created with CREATE_NEW, which the filter lets through (FILE_CREATE)
+        auto Open(const std::string& path, bool create, bool* created) -> bool
+        {
+            handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                create ? CREATE_NEW : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            *created = create || GetLastError() != ERROR_ALREADY_EXISTS;
+            return handle != INVALID_HANDLE_VALUE;
+        }
+
+        auto Write(uint64_t offset, const uint8_t* data, uint32_t size) -> bool
+        {
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)offset;
+            overlapped.OffsetHigh = (DWORD)(offset >> 32);
+            DWORD written = 0;
+            return WriteFile(handle, data, size, &written, &overlapped) && written == size;
+        }
+
+        auto Size(uint64_t* size) -> bool
+        {
+            LARGE_INTEGER value;
+            if (!GetFileSizeEx(handle, &value))
+                return false;
+            *size = (uint64_t)value.QuadPart;
+            return true;
+        }
+
+        auto Truncate(uint64_t size) -> bool
+        {
+            FILE_END_OF_FILE_INFO info;
+            info.EndOfFile.QuadPart = (LONGLONG)size;
+            return SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info));
+        }
+
+        void Close()
+        {
+            if (handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+        }
+    };
+
+    auto MakeDirectory(const std::string& path) -> bool
+    {
+        return CreateDirectoryA(path.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+    }
+
+    // the .lock stream of a backup goes with its file
+    void RemoveFile(const std::string& path)
+    {
+        DeleteFileA(path.c_str());
+    }
+
+    void RemoveEmptyDirectory(const std::string& path)
+    {
+        RemoveDirectoryA(path.c_str());
+    }
+
+    constexpr char Separator = '\\';
+#else
+    class File
+    {
+        int fd = -1;
+
+    public:
+        ~File()
+        {
+            Close();
+        }
+
+        auto Open(const std::string& path, bool create, bool* created) -> bool
+        {
+            *created = create;
+            fd = open(path.c_str(), create ? O_WRONLY | O_CREAT | O_EXCL : O_WRONLY);
+            if (fd < 0 && !create && errno == ENOENT)
+            {
+                *created = true;
+                fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+            }
+
+            return fd >= 0;
+        }
+
+        auto Write(uint64_t offset, const uint8_t* data, uint32_t size) -> bool
+        {
+            return pwrite(fd, data, size, (off_t)offset) == (ssize_t)size;
+        }
+
+        auto Size(uint64_t* size) -> bool
+        {
+            struct stat info;
+            if (fstat(fd, &info) != 0)
+                return false;
+            *size = (uint64_t)info.st_size;
+            return true;
+        }
+
+        auto Truncate(uint64_t size) -> bool
+        {
+            return ftruncate(fd, (off_t)size) == 0;
+        }
+
+        void Close()
+        {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+    };
+
+    auto MakeDirectory(const std::string& path) -> bool
+    {
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    void RemoveFile(const std::string& path)
+    {
+        unlink(path.c_str());
+    }
+
+    void RemoveEmptyDirectory(const std::string& path)
+    {
+        rmdir(path.c_str());
+    }
+
+    constexpr char Separator = '/';
+#endif
+
+    auto Trim(const std::string& text) -> std::string
+    {
+        auto first = text.find_first_not_of(" \t\r");
+        auto last = text.find_last_not_of(" \t\r");
+        return first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+    }
+
+    // 4096, 4K, 1M, 2G
+    auto ParseSize(const std::string& text, uint64_t* value) -> bool
+    {
+        char* end = nullptr;
+        auto number = strtoull(text.c_str(), &end, 10);
+        if (end == text.c_str())
+            return false;
+
+        std::string suffix = end;
+        uint64_t unit = suffix.empty() ? 1 : suffix == "K" || suffix == "k" ? 1024 : suffix == "M" || suffix == "m" ? 1 << 20
+            : suffix == "G" || suffix == "g" ? 1 << 30 : 0;
+        *value = number * unit;
+        return unit != 0;
+    }
+
+    auto ParseNumber(const std::string& text, double* value) -> bool
+    {
+        char* end = nullptr;
+        *value = strtod(text.c_str(), &end);
+        return end != text.c_str() && *end == '\0' && *value >= 0;
+    }
+
+    // value:weight pairs, values parsed by `parse`
+    template <typename Parse>
+    auto ParseWeights(const std::string& text, std::vector<WorkloadSpec::Weighted>& list, Parse parse) -> bool
+    {
+        list.clear();
+        std::istringstream stream(text);
+        std::string item;
+        while (stream >> item)
+        {
+            auto colon = item.find(':');
+            WorkloadSpec::Weighted weighted;
+            if (colon == std::string::npos || !parse(item.substr(0, colon), &weighted.Value)
+                || !ParseNumber(item.substr(colon + 1), &weighted.Weight))
+                return false;
+            list.push_back(weighted);
+        }
+
+        double total = 0;
+        for (const auto& weighted : list)
+            total += weighted.Weight;
+        return total > 0;
+    }
+
+    auto Draw(std::discrete_distribution<size_t>& distribution, std::mt19937_64& random, const std::vector<WorkloadSpec::Weighted>& list) -> uint64_t
+    {
+        return list[distribution(random)].Value;
+    }
+
+    auto Weights(const std::vector<WorkloadSpec::Weighted>& list) -> std::discrete_distribution<size_t>
+    {
+        std::vector<double> weights;
+        for (const auto& weighted : list)
+            weights.push_back(weighted.Weight);
+        return std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    }
+
+    // <root>/<N>/secret: the filter protects the files of directories named secret
+    auto Parent(const std::string& root, unsigned file, const WorkloadSpec& spec) -> std::string
+    {
+        return root + Separator + std::to_string(file % spec.Directories);
+    }
+
+    auto Directory(const std::string& root, unsigned file, const WorkloadSpec& spec) -> std::string
+    {
+        return Parent(root, file, spec) + Separator + "secret";
+    }
+
+    auto FilePath(const std::string& root, unsigned file, const WorkloadSpec& spec) -> std::string
+    {
+        return Directory(root, file, spec) + Separator + "file" + std::to_string(file) + ".dat";
+    }
+
+    auto Elapsed(Clock::time_point start) -> uint64_t
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    // Files of the initial sizes, created before the clock starts
+    auto Populate(const WorkloadSpec& spec, const std::string& root, std::string& error) -> bool
+    {
+        if (!MakeDirectory(root))
+        {
+            error = "cannot create " + root;
+            return false;
+        }
+
+        for (unsigned i = 0; i < spec.Directories; ++i)
+        {
+            if (!MakeDirectory(Parent(root, i, spec)) || !MakeDirectory(Directory(root, i, spec)))
+            {
+                error = "cannot create " + Directory(root, i, spec);
+                return false;
+            }
+        }
+
+        std::mt19937_64 random(spec.Seed);
+        auto sizes = Weights(spec.Sizes);
+        std::vector<uint8_t> data(64 * 1024);
+        for (auto& byte : data)
+            byte = (uint8_t)random();
+
+        for (unsigned i = 0; i < spec.Files; ++i)
+        {
+            auto path = FilePath(root, i, spec);
+            RemoveFile(path);
+            File file;
+            bool created = false;
+            if (!file.Open(path, true, &created))
+            {
+                error = "cannot create " + path;
+                return false;
+            }
+
+            auto size = Draw(sizes, random, spec.Sizes);
+            for (uint64_t offset = 0; offset < size; offset += data.size())
+            {
+                if (!file.Write(offset, data.data(), (uint32_t)std::min<uint64_t>(data.size(), size - offset)))
+                {
+                    error = "cannot write " + path;
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    void Remove(const WorkloadSpec& spec, const std::string& root)
+    {
+        for (unsigned i = 0; i < spec.Files; ++i)
+            RemoveFile(FilePath(root, i, spec));
+        for (unsigned i = 0; i < spec.Directories; ++i)
+        {
+            RemoveEmptyDirectory(Directory(root, i, spec));
+            RemoveEmptyDirectory(Parent(root, i, spec));
+        }
+        RemoveEmptyDirectory(root);
+    }
+
+    // One writer thread, its results are merged after the run
+    void Writer(const WorkloadSpec& spec, const std::string& root, unsigned index, Clock::time_point deadline,
+        std::atomic<uint64_t>& started, WorkloadResult& result)
+    {
+        std::mt19937_64 random(spec.Seed * 0x9e3779b97f4a7c15ull + index + 1);
+        auto mix = Weights(spec.Mix);
+        std::uniform_int_distribution<unsigned> files(0, spec.Files - 1);
+        std::exponential_distribution<double> think(spec.ThinkMs > 0 ? 1.0 / spec.ThinkMs : 1.0);
+        std::vector<uint8_t> data(spec.WriteSize);
+        for (auto& byte : data)
+            byte = (uint8_t)random();
+
+        while (Clock::now() < deadline && (spec.Sessions == 0 || started.fetch_add(1) < spec.Sessions))
+        {
+            auto path = FilePath(root, files(random), spec);
+            auto kind = (unsigned)Draw(mix, random, spec.Mix);
+            File file;
+            bool created = false;
+            auto start = Clock::now();
+            if (!file.Open(path, false, &created))
+            {
+                ++result.Errors;
+                continue;
+            }
+
+            result.Open.Record(Elapsed(start));
+            result.Created += created;
+
+            // the size and the truncation are part of the session, they are not timed
+            uint64_t size = 0;
+            auto ok = file.Size(&size);
+            if (ok && kind == WorkloadSpec::Rewrite)
+            {
+                ok = file.Truncate(0);
+                size = 0;
+            }
+            else if (ok && kind == WorkloadSpec::Truncate)
+            {
+                size = size ? random() % (size + 1) : 0;
+                ok = file.Truncate(size);
+            }
+
+            for (unsigned i = 0; ok && i < spec.Writes; ++i)
+            {
+                auto offset = size + (uint64_t)i * spec.WriteSize;
+                if (kind == WorkloadSpec::Overwrite)
+                    offset = size > spec.WriteSize ? random() % (size - spec.WriteSize + 1) : 0;
+
+                start = Clock::now();
+                ok = file.Write(offset, data.data(), spec.WriteSize);
+                auto ns = Elapsed(start);
+                if (!ok)
+                    break;
+
+                if (i == 0)
+                    result.FirstWrite.Record(ns);
+                result.Write.Record(ns);
+                ++result.Writes;
+                result.Bytes += spec.WriteSize;
+            }
+
+            start = Clock::now();
+            file.Close();
+            result.Close.Record(Elapsed(start));
+            ++result.Sessions;
+            ++result.SessionsByKind[kind];
+            result.Errors += !ok;
+
+            if (spec.ThinkMs > 0)
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(think(random)));
+        }
+    }
+}
+
+[[nodiscard]] auto KindName(unsigned kind) -> const char*
+{
+    return kind < WorkloadSpec::Kinds ? KindNames[kind] : "?";
+}
+
+[[nodiscard]] auto ParseWorkload(const std::string& text, WorkloadSpec& spec, std::string& error) -> bool
+{
+    std::istringstream stream(text);
+    std::string line;
+    for (unsigned lineNumber = 1; std::getline(stream, line); ++lineNumber)
+    {
+        line = Trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        auto equal = line.find('=');
+        auto key = Trim(line.substr(0, equal));
+        auto value = equal == std::string::npos ? std::string() : Trim(line.substr(equal + 1));
+        double number = 0;
+        uint64_t size = 0;
+        auto ok = true;
+        if (key == "threads" || key == "files" || key == "directories" || key == "writes")
+        {
+            ok = ParseNumber(value, &number) && number >= 1 && number <= 100000;
+            auto& field = key == "threads" ? spec.Threads : key == "files" ? spec.Files : key == "directories" ? spec.Directories : spec.Writes;
+            field = (unsigned)number;
+        }
+        else if (key == "duration")
+        {
+            ok = ParseNumber(value, &spec.Duration);
+        }
+        else if (key == "sessions")
+        {
+            ok = ParseNumber(value, &number);
+            spec.Sessions = (uint64_t)number;
+        }
+        else if (key == "sizes")
+        {
+            ok = ParseWeights(value, spec.Sizes, ParseSize);
+        }
+        else if (key == "mix")
+        {
+            ok = ParseWeights(value, spec.Mix, [](const std::string& name, uint64_t* kind) {
+                *kind = (uint64_t)(std::find(KindNames, KindNames + WorkloadSpec::Kinds, name) - KindNames);
+                return *kind < WorkloadSpec::Kinds;
+            });
+        }
+        else if (key == "write_size")
+        {
+            ok = ParseSize(value, &size) && size > 0 && size <= 64u << 20;
+            spec.WriteSize = (uint32_t)size;
+        }
+        else if (key == "think_ms")
+        {
+            ok = ParseNumber(value, &spec.ThinkMs);
+        }
+        else if (key == "seed")
+        {
+            ok = ParseNumber(value, &number);
+            spec.Seed = (uint64_t)number;
+        }
+        else
+        {
+            error = "line " + std::to_string(lineNumber) + ": unknown key " + key;
+            return false;
+        }
+
+        if (!ok)
+        {
+            error = "line " + std::to_string(lineNumber) + ": bad value for " + key;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+auto LatencyHistogram::Bucket(uint64_t ns) -> size_t
+{
+    if (ns < 1u << SubBits)
+        return (size_t)ns;
+
+    auto exponent = (unsigned)std::bit_width(ns) - 1;
+    auto sub = (ns >> (exponent - SubBits)) & ((1u << SubBits) - 1);
+    return ((size_t)(exponent - SubBits + 1) << SubBits) + sub;
+}
+
+auto LatencyHistogram::Upper(size_t bucket) -> uint64_t
+{
+    auto group = (unsigned)(bucket >> SubBits);
+    auto sub = (uint64_t)(bucket & ((1u << SubBits) - 1));
+    if (group == 0)
+        return sub;
+
+    auto exponent = group + SubBits - 1;
+    auto width = 1ull << (exponent - SubBits);
+    return (1ull << exponent) + sub * width + (width - 1);
+}
+
+void LatencyHistogram::Record(uint64_t ns)
+{
+    ++buckets[Bucket(ns)];
+    ++count;
+    total += ns;
+    max = std::max(max, ns);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < buckets.size(); ++i)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+[[nodiscard]] auto LatencyHistogram::Percentile(double q) const -> uint64_t
+{
+    if (count == 0)
+        return 0;
+
+    auto rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * (double)count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(Upper(i), max);
+    }
+
+    return max;
+}
+
+[[nodiscard]] auto RunWorkload(const WorkloadSpec& spec, const std::string& root, bool keep, WorkloadResult& result, std::string& error) -> bool
+{
+    result = WorkloadResult();
+    if (!Populate(spec, root, error))
+    {
+        Remove(spec, root);
+        return false;
+    }
+
+    std::vector<WorkloadResult> results(spec.Threads);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> started = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(spec.Duration));
+    for (unsigned i = 0; i < spec.Threads; ++i)
+        threads.emplace_back(Writer, std::cref(spec), std::cref(root), i, deadline, std::ref(started), std::ref(results[i]));
+    for (auto& thread : threads)
+        thread.join();
+    result.Seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (const auto& thread : results)
+    {
+        result.Open.Merge(thread.Open);
+        result.FirstWrite.Merge(thread.FirstWrite);
+        result.Write.Merge(thread.Write);
+        result.Close.Merge(thread.Close);
+        result.Sessions += thread.Sessions;
+        for (unsigned kind = 0; kind < WorkloadSpec::Kinds; ++kind)
+            result.SessionsByKind[kind] += thread.SessionsByKind[kind];
+        result.Writes += thread.Writes;
+        result.Bytes += thread.Bytes;
+        result.Created += thread.Created;
+        result.Errors += thread.Errors;
+    }
+
+    if (!keep)
+        Remove(spec, root);
+    return true;
+}
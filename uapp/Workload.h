@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic write load on protected directories (uapp load).
+//
+// A workload spec is a text file of `key = value` lines, `#` starts a comment:
+//
+//   threads = 200                              # concurrent writers
+//   files = 1000                               # spread over the directories
+//   directories = 8                            # <root>/<N>/secret, protected by the filter
+//   duration = 30                              # seconds
+//   sessions = 0                               # sessions in all threads, 0 for no limit
+//   sizes = 4K:50 64K:30 1M:15 16M:5           # initial file sizes, size:weight
+//   mix = append:40 overwrite:30 rewrite:20 truncate:10    # session kinds, kind:weight
+//   writes = 4                                 # writes per session
+//   write_size = 4K
+//   think_ms = 2                               # mean pause between the sessions of a thread
+//   seed = 1
+//
+// A session opens a file for write, as an application does, and appends its writes (append),
+// writes them at random offsets below the end of file (overwrite), truncates the file and
+// writes it again from the start (rewrite), or cuts it to a random size and appends
+// (truncate), then closes it. The filter backs a file up on the first write after the open:
+// open, first write and later write latencies are kept apart. Pauses are exponential.
+
+struct WorkloadSpec
+{
+    enum Kind { Append, Overwrite, Rewrite, Truncate, Kinds };
+
+    struct Weighted
+    {
+        uint64_t Value;     // size in bytes, or Kind
+        double Weight;
+    };
+
+    unsigned Threads = 16;
+    unsigned Files = 256;
+    unsigned Directories = 4;
+    double Duration = 10;
+    uint64_t Sessions = 0;
+    std::vector<Weighted> Sizes = { { 4096, 60 }, { 64 * 1024, 30 }, { 1024 * 1024, 10 } };
+    std::vector<Weighted> Mix = { { Append, 40 }, { Overwrite, 30 }, { Rewrite, 20 }, { Truncate, 10 } };
+    unsigned Writes = 4;
+    uint32_t WriteSize = 4096;
+    double ThinkMs = 1;
+    uint64_t Seed = 1;
+};
+
+// Reads a spec, the keys it does not set keep their defaults
+[[nodiscard]] auto ParseWorkload(const std::string& text, WorkloadSpec& spec, std::string& error) -> bool;
+
+[[nodiscard]] auto KindName(unsigned kind) -> const char*;
+
+// Log-linear latency histogram: 32 buckets per power of two of nanoseconds, a percentile is
+// the upper bound of its bucket, within 3% of the sample. Merged across threads after a run.
+class LatencyHistogram
+{
+    static constexpr unsigned SubBits = 5;
+    std::vector<uint64_t> buckets = std::vector<uint64_t>((64 - SubBits + 1) << SubBits);
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    static auto Bucket(uint64_t ns) -> size_t;
+    static auto Upper(size_t bucket) -> uint64_t;
+
+public:
+    void Record(uint64_t ns);
+    void Merge(const LatencyHistogram& other);
+
+    [[nodiscard]] auto Count() const -> uint64_t
+    {
+        return count;
+    }
+
+    [[nodiscard]] auto Mean() const -> double
+    {
+        return count ? (double)total / (double)count : 0.0;
+    }
+
+    [[nodiscard]] auto Max() const -> uint64_t
+    {
+        return max;
+    }
+
+    // q in [0, 1], 0 for an empty histogram
+    [[nodiscard]] auto Percentile(double q) const -> uint64_t;
+};
+
+struct WorkloadResult
+{
+    LatencyHistogram Open;
+    LatencyHistogram FirstWrite;    // the write the filter waits on
+    LatencyHistogram Write;         // every write, the first ones included
+    LatencyHistogram Close;
+    uint64_t Sessions = 0;
+    uint64_t SessionsByKind[WorkloadSpec::Kinds] = {};
+    uint64_t Writes = 0;
+    uint64_t Bytes = 0;
+    uint64_t Created = 0;           // files found missing at open, the filter deletes the source after its backup
+    uint64_t Errors = 0;
+    double Seconds = 0;             // of the run, the set up excluded
+};
+
+// Creates the directories and files under root, runs the spec, and removes them unless keep is set
+[[nodiscard]] auto RunWorkload(const WorkloadSpec& spec, const std::string& root, bool keep, WorkloadResult& result, std::string& error) -> bool;
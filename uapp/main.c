@@ -1,6 +0,0 @@
-#include <stdio.h>
-
-int main()
-{
-    puts("Hello world!");
-}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "Commands.h"
+
+#include <cstdio>
+#include <cstring>
+
+static int Usage()
+{
+    fprintf(stderr,
+        "usage: uapp <command> [arguments]\n"
+        "\n"
+        "commands:\n"
+        "  trace dump <file> [seconds]        drain the driver trace buffers to a file (Windows)\n"
+        "  trace decode <file> <source>...    print a trace, formats are read from the driver sources\n"
+        "  key recover <file.lock> [options]  find the key of a backup from the format it starts with\n"
+        "  shadow <off|estimate|read> [--reset]  measure the backups instead of making them (Windows)\n"
+        "  shadow stats                       print the shadow statistics per directory (Windows)\n"
+        "  load <spec> [options]              write load on protected directories, latency percentiles\n"
+        "  pool [--reset-peaks]               print the pool usage of the driver per subsystem (Windows)\n"
+        "  create                             print the name queries of the creates, made and avoided (Windows)\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+        return Usage();
+
+    if (!strcmp(argv[1], "trace"))
+        return TraceMain(argc - 2, argv + 2);
+
+    if (!strcmp(argv[1], "key"))
+        return KeyMain(argc - 2, argv + 2);
+
+    if (!strcmp(argv[1], "shadow"))
+        return ShadowMain(argc - 2, argv + 2);
+
+    if (!strcmp(argv[1], "load"))
+        return LoadMain(argc - 2, argv + 2);
+
+    if (!strcmp(argv[1], "pool"))
+        return PoolMain(argc - 2, argv + 2);
+
+    if (!strcmp(argv[1], "create"))
+        return CreateMain(argc - 2, argv + 2);
+
+    return Usage();
+}